@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+
+#include "../src_generator/parse.h"
+#include "../src_generator/generator.h"
+
+// Benchmarks the whole generator -> solver pipeline over a family of systems instantiated from a template.
+// Every run regenerates the sources in generated/, rebuilds the solver target and runs it with --stats, so the
+// numbers include everything a model change costs. The original generated sources are restored afterwards, also
+// when a run fails or the benchmark is interrupted with Ctrl-C.
+
+struct BenchSettings
+{
+    std::string template_filename = std::string(SOURCE_DIR) + "/system2.txt";
+    std::string output_filename = "bench.json";
+    std::string scale_name = "MAX_CLUSTER_SIZE";
+    std::vector<std::string> scale_values = { "100", "1000", "10000", "100000" };
+    std::vector<std::pair<std::string, std::string>> overrides;
+    std::vector<std::string> precisions = { "double" }; // Values for @PRECISION, every scale runs with each of them
+    double max_precision_error = 1e-2; // Largest relative error of a reduced precision run before the bench fails
+    bool iterative = false;
+    // Larger scale values drop @DIRECT_LINEAR_SOLVER, the dense matrix grows with the square of the state
+    double direct_solver_limit = 1000;
+};
+
+struct BenchRun
+{
+    std::string scale_value;
+    std::string precision;
+    bool iterative = false;
+    double generator_seconds = 0.0;
+    size_t generated_bytes = 0;
+    double compile_seconds = 0.0;
+    int compile_exit_code = 0;
+    double solve_seconds = 0.0;
+    int solve_exit_code = 0;
+    double rhs_evals_per_second = 0.0;
+    double jacobian_seconds = 0.0;
+    double preconditioner_seconds = 0.0;
+    std::string solver_stats = "null";
+    std::vector<double> final_row; // Last csv line of the solution, compared across precisions
+    double max_relative_error = 0.0;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+void interrupt(int)
+{
+    interrupted = 1;
+}
+
+// std::system ignores Ctrl-C while the command runs, the command itself dies of it instead
+double time_command(const std::string& command, int& exit_code)
+{
+    auto start = std::chrono::steady_clock::now();
+    exit_code = std::system(command.c_str());
+    if (exit_code != -1 && WIFSIGNALED(exit_code) && WTERMSIG(exit_code) == SIGINT)
+        interrupted = 1;
+    return seconds_since(start);
+}
+
+std::string read_file(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::in);
+    std::stringstream str;
+    str << file.rdbuf();
+    return str.str();
+}
+
+void write_file(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename, std::ios::out);
+    file << contents;
+}
+
+// Replaces the declaration of `name` (a symbol or an @TAG) with `name value`, or `name = value` for symbols
+std::string set_declaration(std::string system_src, const std::string& name, const std::string& value)
+{
+    std::string replacement = name[0] == '@' ? name + " " + value : name + " = " + value;
+    std::regex declaration("^" + name + "([ \\t=].*)?$", std::regex::multiline);
+    if (!std::regex_search(system_src, declaration))
+    {
+        std::cerr << "Warning: Template has no declaration of " << name << ", appending it.\n";
+        return system_src + "\n" + replacement + "\n";
+    }
+    return std::regex_replace(system_src, declaration, replacement);
+}
+
+bool use_iterative_solver(const BenchSettings& settings, const std::string& scale_value)
+{
+    return settings.iterative || std::atof(scale_value.c_str()) > settings.direct_solver_limit;
+}
+
+std::string instantiate_template(const BenchSettings& settings, const std::string& template_src, const std::string& scale_value,
+                                 const std::string& precision)
+{
+    std::string system_src = set_declaration(template_src, settings.scale_name, scale_value);
+    for (auto& override : settings.overrides)
+    {
+        system_src = set_declaration(system_src, override.first, override.second);
+    }
+    if (use_iterative_solver(settings, scale_value))
+    {
+        system_src = std::regex_replace(system_src, std::regex("^@DIRECT_LINEAR_SOLVER.*$", std::regex::multiline), "");
+    }
+    system_src = std::regex_replace(system_src, std::regex("^@PRECISION.*$", std::regex::multiline), "");
+    return "@PRECISION " + precision + "\n" + system_src;
+}
+
+// Pulls the "totals" object out of the solver's --stats report, it's embedded as-is in the results
+std::string read_solver_totals(const std::string& stats_filename)
+{
+    std::string stats = read_file(stats_filename);
+    std::smatch matches;
+    if (!std::regex_search(stats, matches, std::regex("\"totals\": (\\{.*\\}),\\n")))
+    {
+        return "null";
+    }
+    return matches[1];
+}
+
+bool read_timer(const std::string& totals, const std::string& name, double& calls, double& seconds)
+{
+    std::smatch matches;
+    if (!std::regex_search(totals, matches, std::regex("\"" + name + "\": \\{\"calls\": ([0-9]+), \"seconds\": ([^}]+)\\}")))
+    {
+        return false;
+    }
+    calls = std::atof(matches[1].str().c_str());
+    seconds = std::atof(matches[2].str().c_str());
+    return true;
+}
+
+std::vector<double> read_last_csv_row(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::in);
+    std::string line, last_line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty()) last_line = line;
+    }
+
+    std::vector<double> row;
+    std::stringstream str(last_line);
+    std::string item;
+    while (std::getline(str, item, ','))
+    {
+        row.push_back(std::atof(item.c_str()));
+    }
+    return row;
+}
+
+// Largest error over the final state and outputs, relative to the reference. Entries below 1e-10 of the largest
+// reference value are compared against that floor instead, so values which decayed to ~0 don't dominate
+double max_relative_error(const std::vector<double>& row, const std::vector<double>& reference)
+{
+    if (row.size() != reference.size() || reference.empty())
+        return -1.0;
+
+    double scale = 0.0;
+    for (size_t i = 1; i < reference.size(); ++i)
+    {
+        scale = std::max(scale, std::fabs(reference[i]));
+    }
+
+    double max_error = 0.0;
+    for (size_t i = 1; i < reference.size(); ++i) // Column 0 is the time
+    {
+        double error = std::fabs(row[i] - reference[i]) / std::max(std::fabs(reference[i]), 1e-10 * scale);
+        max_error = std::max(max_error, std::isnan(error) ? INFINITY : error);
+    }
+    return max_error;
+}
+
+BenchRun run_bench(const BenchSettings& settings, const std::string& template_src, const std::string& scale_value,
+                   const std::string& precision)
+{
+    BenchRun run;
+    run.scale_value = scale_value;
+    run.precision = precision;
+    run.iterative = use_iterative_solver(settings, scale_value);
+
+    std::string run_name = scale_value + "_" + precision;
+    std::string system_filename = "bench_system_" + run_name + ".txt";
+    write_file(system_filename, instantiate_template(settings, template_src, scale_value, precision));
+
+    auto generator_start = std::chrono::steady_clock::now();
+    std::ifstream system_src_file(system_filename, std::ios::in);
+    SystemDeclarations system;
+    read_system(system, system_src_file);
+    auto files = generate_sources(system);
+    run.generator_seconds = seconds_since(generator_start);
+    for (auto& file : files)
+    {
+        run.generated_bytes += file.contents.size();
+    }
+    if (!write_sources(std::string(SOURCE_DIR) + "/generated", files))
+    {
+        run.compile_exit_code = -1;
+        return run;
+    }
+
+    std::string build_command = std::string("\"") + CMAKE_COMMAND + "\" --build \"" + BUILD_DIR + "\" --target solver > bench_build.log 2>&1";
+    run.compile_seconds = time_command(build_command, run.compile_exit_code);
+    if (run.compile_exit_code != 0)
+    {
+        std::cerr << "Error: Failed to build the solver for " << settings.scale_name << " = " << scale_value << ", see bench_build.log\n";
+        return run;
+    }
+
+    std::string stats_filename = "bench_stats_" + run_name + ".json";
+    std::string solution_filename = "bench_solution_" + run_name + ".csv";
+    std::string solve_command = std::string("\"") + BUILD_DIR + "/solver\" --stats=" + stats_filename + " > " + solution_filename;
+    run.solve_seconds = time_command(solve_command, run.solve_exit_code);
+    run.solver_stats = read_solver_totals(stats_filename);
+    run.final_row = read_last_csv_row(solution_filename);
+
+    // The dense solver builds its Jacobian by difference quotients inside the linear setup,
+    // so the setup timer is the Jacobian cost for direct runs.
+    double calls, seconds;
+    if (read_timer(run.solver_stats, "derivative", calls, seconds) && seconds > 0.0)
+        run.rhs_evals_per_second = calls / seconds;
+    if (read_timer(run.solver_stats, "linear_setup", calls, seconds))
+        run.jacobian_seconds = seconds;
+    if (read_timer(run.solver_stats, "preconditioner", calls, seconds))
+        run.preconditioner_seconds = seconds;
+
+    return run;
+}
+
+void write_results(const BenchSettings& settings, const std::vector<BenchRun>& runs)
+{
+    std::ofstream out(settings.output_filename, std::ios::out);
+
+    out << "{\n  \"template\": \"" << settings.template_filename << "\","
+        << "\n  \"scale\": \"" << settings.scale_name << "\","
+        << "\n  \"direct_solver_limit\": " << (settings.iterative ? 0.0 : settings.direct_solver_limit) << ","
+        << "\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        auto& run = runs[i];
+        out << (i != 0 ? "," : "")
+            << "\n    {\"" << settings.scale_name << "\": \"" << run.scale_value << "\""
+            << ", \"precision\": \"" << run.precision << "\""
+            << ", \"iterative\": " << (run.iterative ? "true" : "false")
+            << ", \"max_relative_error\": " << run.max_relative_error
+            << ", \"generator_seconds\": " << run.generator_seconds
+            << ", \"generated_bytes\": " << run.generated_bytes
+            << ", \"compile_seconds\": " << run.compile_seconds
+            << ", \"compile_exit_code\": " << run.compile_exit_code
+            << ", \"solve_seconds\": " << run.solve_seconds
+            << ", \"solve_exit_code\": " << run.solve_exit_code
+            << ", \"rhs_evals_per_second\": " << run.rhs_evals_per_second
+            << ", \"jacobian_seconds\": " << run.jacobian_seconds
+            << ", \"preconditioner_seconds\": " << run.preconditioner_seconds
+            << ", \"solver\": " << run.solver_stats
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Puts back the checked-in generated sources when it goes out of scope, however the benchmark ends
+struct GeneratedSourcesGuard
+{
+    std::string directory;
+    std::vector<GeneratedFile> original_files;
+
+    GeneratedSourcesGuard(const std::string& directory)
+        : directory(directory)
+    {
+        for (auto& entry : std::filesystem::directory_iterator(directory))
+        {
+            auto filename = entry.path().filename().string();
+            if (filename.rfind("system", 0) == 0)
+                original_files.push_back({ filename, read_file(entry.path().string()) });
+        }
+    }
+
+    ~GeneratedSourcesGuard()
+    {
+        write_sources(directory, original_files);
+    }
+};
+
+std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream str(list);
+    std::string item;
+    while (std::getline(str, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char **argv)
+{
+    BenchSettings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto equals = arg.find('=');
+        if (arg == "--iterative")
+        {
+            settings.iterative = true;
+        }
+        else if (arg.rfind("--direct-limit=", 0) == 0)
+        {
+            settings.direct_solver_limit = std::atof(arg.substr(equals + 1).c_str());
+        }
+        else if (arg.rfind("--template=", 0) == 0)
+        {
+            settings.template_filename = arg.substr(equals + 1);
+        }
+        else if (arg.rfind("--precision=", 0) == 0)
+        {
+            settings.precisions = split_list(arg.substr(equals + 1));
+        }
+        else if (arg.rfind("--max-error=", 0) == 0)
+        {
+            settings.max_precision_error = std::atof(arg.substr(equals + 1).c_str());
+        }
+        else if (arg.rfind("--output=", 0) == 0)
+        {
+            settings.output_filename = arg.substr(equals + 1);
+        }
+        else if (arg.rfind("--scale=", 0) == 0 && arg.find('=', equals + 1) != std::string::npos)
+        {
+            auto values_start = arg.find('=', equals + 1);
+            settings.scale_name = arg.substr(equals + 1, values_start - equals - 1);
+            settings.scale_values = split_list(arg.substr(values_start + 1));
+        }
+        else if (arg.rfind("--set=", 0) == 0 && arg.find('=', equals + 1) != std::string::npos)
+        {
+            auto value_start = arg.find('=', equals + 1);
+            settings.overrides.push_back({ arg.substr(equals + 1, value_start - equals - 1), arg.substr(value_start + 1) });
+        }
+        else
+        {
+            std::cerr << "Usage: bench [--template=<file>] [--scale=<NAME>=<v1>,<v2>,...] [--set=<NAME>=<value>]... "
+                      << "[--precision=double,mixed,single] [--max-error=<value>] [--iterative] [--direct-limit=<value>] [--output=<file>]\n";
+            return 1;
+        }
+    }
+
+    std::string template_src = read_file(settings.template_filename);
+    if (template_src.empty())
+    {
+        std::cerr << "Error: Failed to read template " << settings.template_filename << "\n";
+        return 1;
+    }
+
+    GeneratedSourcesGuard generated_sources(std::string(SOURCE_DIR) + "/generated");
+    std::signal(SIGINT, interrupt);
+
+    // Errors are relative to the double run of the same scale, or the first precision listed if double isn't
+    std::vector<BenchRun> runs;
+    bool inaccurate = false;
+    for (auto& scale_value : settings.scale_values)
+    {
+        size_t first_run = runs.size(), reference = runs.size();
+        for (auto& precision : settings.precisions)
+        {
+            if (interrupted)
+                break;
+            std::cerr << "Benchmarking " << settings.scale_name << " = " << scale_value << " in " << precision << " precision\n";
+            runs.push_back(run_bench(settings, template_src, scale_value, precision));
+            if (precision == "double") reference = runs.size() - 1;
+        }
+        for (size_t i = first_run; i < runs.size(); ++i)
+        {
+            runs[i].max_relative_error = max_relative_error(runs[i].final_row, runs[reference].final_row);
+            if (runs[i].max_relative_error > settings.max_precision_error)
+            {
+                std::cerr << "Error: " << settings.scale_name << " = " << scale_value << " in " << runs[i].precision
+                          << " precision is off by a relative " << runs[i].max_relative_error << " from "
+                          << runs[reference].precision << ", more than --max-error=" << settings.max_precision_error << "\n";
+                inaccurate = true;
+            }
+        }
+        write_results(settings, runs);
+        if (interrupted)
+        {
+            std::cerr << "Interrupted, restoring generated/\n";
+            break;
+        }
+    }
+
+    std::cerr << "Results written to " << settings.output_filename << "\n";
+
+    return inaccurate ? 1 : 0;
+}
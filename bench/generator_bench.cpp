@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src_generator/parse.h"
+#include "../src_generator/generator.h"
+#include "../src_generator/bytecode.h"
+
+// Times every phase of the generator on synthetic reaction networks of increasing size. With --check the
+// run fails when any phase grows clearly faster than linearly, so complexity blowups are caught early.
+
+struct PhaseTiming
+{
+    std::string name;
+    double seconds;
+};
+
+struct GeneratorRun
+{
+    size_t num_lines;
+    std::vector<PhaseTiming> phases;
+};
+
+// Each group of lines declares a rate constant, an indexed coefficient, a scalar species coupled to its
+// neighbour, a list species and a summation over it, roughly mirroring an automatically produced network.
+// The tags switch on optional parts of the generator.
+std::string synthesize_system(size_t num_lines, const std::string& tags = "")
+{
+    std::stringstream str;
+    str << tags
+        << "@END_TIME 10^2\n"
+        << "@SAMPLE_INTERVAL 10^0\n"
+        << "n = 1 .. 10\n";
+
+    for (size_t k = 0; 8 * k + 3 < num_lines; ++k)
+    {
+        size_t previous = k == 0 ? 0 : k - 1;
+        str << "rate_" << k << " = 0.5 + " << k << " * 10^-3\n"
+            << "g_" << k << "(n) = rate_" << k << " * n + rate_" << previous << "\n"
+            << "g_" << k << "(1) = rate_" << k << "\n"
+            << "d/dt X_" << k << " = g_" << k << "(2) * X_" << previous << " - rate_" << k << " * X_" << k << " + total_" << k << "\n"
+            << "INITIAL X_" << k << " = 1.0\n"
+            << "d/dt L_" << k << "[n] = g_" << k << "(n) * L_" << k << "[n] - X_" << k << "\n"
+            << "INITIAL L_" << k << "[n] = 10^-1\n"
+            << "total_" << k << " = SUM(i = 1 .. 10, L_" << k << "[i])\n";
+    }
+
+    return str.str();
+}
+
+double time_phase(const std::function<void()>& phase)
+{
+    auto start = std::chrono::steady_clock::now();
+    phase();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Features which exclude each other (the Jacobian product and pattern, scaling and sensitivities, IMEX and @FAST)
+// are spread over several networks, so every emitter of generate_sources runs in one of them
+struct Variant
+{
+    std::string name;
+    std::string tags;
+};
+
+const std::vector<Variant> VARIANTS = {
+    { "iterative", "@SCALE auto\n@ABSOLUTE_TOLERANCE L_0[n] = 10^-10\n@STOP_WHEN X_0 - 10^-3\n@EVENT X_0 - 0.5\n@FAST X_0\n@PARALLEL\n" },
+    { "direct", "@DIRECT_LINEAR_SOLVER\n@SENSITIVITY rate_0\n@ADJOINT final\nOUTPUT final X_0\n" },
+    { "imex", "@INTEGRATOR arkode-imex\n" },
+};
+
+std::vector<std::string> split_lines(const std::string& text)
+{
+    std::vector<std::string> lines;
+    std::stringstream str(text);
+    std::string line;
+    while (std::getline(str, line))
+        lines.push_back(line);
+    return lines;
+}
+
+// Times generate_sources end to end, and through its phase hook every check and emitter it runs
+void time_sources(GeneratorRun& run, const std::string& variant, const std::string& system_src)
+{
+    SystemDeclarations system;
+    for (auto& line : split_lines(system_src))
+        parse_declaration(system, line);
+
+    auto time_hooked_phase = [&](const std::string& name, const std::function<void()>& phase) {
+        run.phases.push_back({ variant + "/" + name, time_phase(phase) });
+    };
+    double total = time_phase([&]() { generate_sources(system, DEFAULT_SHARD_SIZE, time_hooked_phase); });
+    run.phases.push_back({ variant + "/generate_sources", total });
+}
+
+GeneratorRun run_generator(size_t num_lines)
+{
+    GeneratorRun run;
+    run.num_lines = num_lines;
+
+    std::string filename = "generator_bench_" + std::to_string(num_lines) + ".txt";
+    {
+        std::ofstream system_file(filename, std::ios::out);
+        system_file << synthesize_system(num_lines);
+    }
+
+    std::ifstream system_src_file(filename, std::ios::in);
+    std::vector<std::string> lines;
+    run.phases.push_back({ "collect_lines", time_phase([&]() { lines = collect_lines(system_src_file); }) });
+
+    std::vector<std::vector<Token>> tokenized_lines;
+    run.phases.push_back({ "tokenize", time_phase([&]() {
+        for (auto& line : lines)
+            tokenized_lines.push_back(tokenize(line));
+    }) });
+
+    SystemDeclarations system;
+    run.phases.push_back({ "parse_declaration", time_phase([&]() {
+        for (auto& tokens : tokenized_lines)
+            parse_declaration(system, tokens);
+    }) });
+
+    run.phases.push_back({ "lower_system", time_phase([&]() { lower_system(system); }) });
+
+    for (auto& variant : VARIANTS)
+    {
+        time_sources(run, variant.name, synthesize_system(num_lines, variant.tags));
+    }
+
+    return run;
+}
+
+void write_results(std::ostream& out, const std::vector<GeneratorRun>& runs)
+{
+    out << "{\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        out << (i != 0 ? "," : "") << "\n    {\"lines\": " << runs[i].num_lines;
+        for (auto& phase : runs[i].phases)
+        {
+            out << ", \"" << phase.name << "\": " << phase.seconds;
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Fits t ~ lines^k between the two largest runs for every phase that takes long enough to measure
+bool check_scaling(const std::vector<GeneratorRun>& runs, double max_exponent, double min_seconds)
+{
+    if (runs.size() < 2)
+        return true;
+
+    auto& small = runs[runs.size() - 2];
+    auto& large = runs[runs.size() - 1];
+    double size_ratio = (double)large.num_lines / small.num_lines;
+
+    bool passed = true;
+    for (size_t i = 0; i < large.phases.size(); ++i)
+    {
+        double small_seconds = small.phases[i].seconds;
+        double large_seconds = large.phases[i].seconds;
+        if (large_seconds < min_seconds || small_seconds <= 0.0)
+            continue;
+
+        double exponent = std::log(large_seconds / small_seconds) / std::log(size_ratio);
+        std::cerr << large.phases[i].name << ": O(n^" << exponent << ")\n";
+        if (exponent > max_exponent)
+        {
+            std::cerr << "Error: " << large.phases[i].name << " scales as O(n^" << exponent << "), expected at most O(n^" << max_exponent << ")\n";
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes = { 1000, 4000, 16000 };
+    std::string output_filename = "";
+    bool check = false;
+    double max_exponent = 1.35;
+    size_t repeats = 3;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--check")
+        {
+            check = true;
+        }
+        else if (arg.rfind("--repeats=", 0) == 0)
+        {
+            repeats = std::max<size_t>(1, std::stoul(arg.substr(10)));
+        }
+        else if (arg.rfind("--max-exponent=", 0) == 0)
+        {
+            max_exponent = std::atof(arg.substr(15).c_str());
+        }
+        else if (arg.rfind("--output=", 0) == 0)
+        {
+            output_filename = arg.substr(9);
+        }
+        else if (arg.rfind("--sizes=", 0) == 0)
+        {
+            sizes.clear();
+            std::stringstream list(arg.substr(8));
+            std::string item;
+            while (std::getline(list, item, ','))
+                sizes.push_back(std::stoul(item));
+        }
+        else
+        {
+            std::cerr << "Usage: generator_bench [--sizes=<n1>,<n2>,...] [--output=<file>] [--check] [--max-exponent=<k>] [--repeats=<n>]\n";
+            return 1;
+        }
+    }
+
+    // The fastest of a few repeats, the short phases are easily thrown off by the rest of the machine. The sizes
+    // take turns so a busy stretch doesn't only slow down one of them
+    std::vector<GeneratorRun> runs;
+    for (size_t i = 0; i < repeats; ++i)
+    {
+        for (size_t j = 0; j < sizes.size(); ++j)
+        {
+            std::cerr << "Generating " << sizes[j] << " lines\n";
+            auto run = run_generator(sizes[j]);
+            if (i == 0)
+            {
+                runs.push_back(run);
+                continue;
+            }
+            for (size_t k = 0; k < run.phases.size(); ++k)
+                runs[j].phases[k].seconds = std::min(runs[j].phases[k].seconds, run.phases[k].seconds);
+        }
+    }
+
+    if (output_filename.empty())
+    {
+        write_results(std::cout, runs);
+    }
+    else
+    {
+        std::ofstream out(output_filename, std::ios::out);
+        write_results(out, runs);
+    }
+
+    if (check && !check_scaling(runs, max_exponent, 0.01))
+        return 1;
+
+    return 0;
+}
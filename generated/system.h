@@ -1,59 +1,67 @@
+#pragma once
+
 #include <cmath>
-#include <nvector/nvector_serial.h>
 #include <sstream>
+#include <string>
+#include <vector>
 
-const double end_time = std::pow(10, 1);
-const double sample_interval = 1;
-const double absolute_tolerance = std::pow(10, -(1));
-const double relative_tolerance = std::pow(10, -(6));
-const size_t initial_step_size = 1e-10;
-const double maximum_step_size = std::pow(10, 5);
-const double minimum_step_size = std::pow(10, -(30));
-const double maximum_num_steps = 500;
-const bool use_direct_solver = 0;
-
-
-const size_t INDEX_C_START = 0;
-const size_t INDEX_C_SIZE = (3 - 1 + 1);
-const size_t STATE_SIZE =INDEX_C_START + INDEX_C_SIZE;
-
-
-std::string get_state_csv_label() {
-	std::stringstream str; 
-	str << "t (seconds)";
-	for (size_t n = 1; n <= 3; ++n)
-	{
-		str << ", C[" << n << "]";
-	}
-	return str.str();
+inline double pow_tangent(double base, double exp, double base_tangent, double exp_tangent)
+{
+	double tangent = base_tangent != 0.0 ? exp * std::pow(base, exp - 1) * base_tangent : 0.0;
+	if (exp_tangent != 0.0) tangent += std::pow(base, exp) * std::log(base) * exp_tangent;
+	return tangent;
 }
 
-std::string get_csv_line(N_Vector state) {
-	std::stringstream str;
-	double* values = N_VGetArrayPointer(state);
-	for (size_t i = 0; i < STATE_SIZE; ++i) {
-		str << ", " << values[i];
-	}
-	return str.str();
-}
 
-void get_initial_state(N_Vector state) {
-    double* values = N_VGetArrayPointer(state);
+extern const double end_time;
+extern const double sample_interval;
+extern const double absolute_tolerance;
+extern const double relative_tolerance;
+extern const size_t initial_step_size;
+extern const double maximum_step_size;
+extern const double minimum_step_size;
+extern const double maximum_num_steps;
+extern const bool use_direct_solver;
+extern const double steady_state_tolerance;
+extern const bool use_steady_state_solver;
+extern const double slow_step_size;
+extern const double jacobian_reuse;
+extern const double linear_setup_frequency;
+extern const double delta_gamma_max;
+extern const double maximum_nonlinear_iterations;
+extern const double maximum_order;
+extern const bool use_adaptive_reuse;
+
+
+constexpr size_t RANGE_n_START = 1;
+constexpr size_t RANGE_n_END = 3;
+constexpr size_t RANGE_n_SIZE = RANGE_n_END - RANGE_n_START + 1;
+
+constexpr size_t INDEX_C_START = 0;
+constexpr size_t INDEX_C_SIZE = RANGE_n_SIZE;
+constexpr size_t STATE_SIZE =INDEX_C_START + INDEX_C_SIZE;
+
+
+// Named access to a state vector, or to its derivative, with the layout above. Only wraps the pointer
+template <typename Real>
+struct StateView
+{
+	Real* values;
+
+	explicit StateView(Real* values) : values(values) {}
+
+	Real& C(size_t n) const { return values[INDEX_C_START + ((n) - 1)]; }
+	Real* C_data() const { return values + INDEX_C_START; }
+};
 
-	for (size_t n = 1; n <= 3; ++n)
-	{
-		values[INDEX_C_START + ((n) - 1)] = n;
-	}
-}
 
-int derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data) {
-    double* values = N_VGetArrayPointer(y);
-    double* derivatives = N_VGetArrayPointer(ydot);
 
-	for (size_t n = 1; n <= 3; ++n)
-	{
-		derivatives[INDEX_C_START + ((n) - 1)] = ((3) * (n));
-	}
+std::string get_state_csv_label();
+std::string get_csv_line(double* values);
+const size_t* get_state_csv_order();
+void get_initial_state(double* values);
+void derivative(double t, double* values, double* derivatives);
 
-    return 0;
-}
\ No newline at end of file
+void jacobian_times(double* values, double* tangents, double* tangent_derivatives);
+void derivative_chunk_0(double* values, double* derivatives);
+void jacobian_times_chunk_0(double* values, double* tangents, double* tangent_derivatives);
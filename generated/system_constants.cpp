@@ -0,0 +1,22 @@
+#include "system.h"
+
+
+
+const double end_time = std::pow(10, 1);
+const double sample_interval = 1;
+const double absolute_tolerance = std::pow(10, -(1));
+const double relative_tolerance = std::pow(10, -(6));
+const size_t initial_step_size = 1e-10;
+const double maximum_step_size = std::pow(10, 5);
+const double minimum_step_size = std::pow(10, -(30));
+const double maximum_num_steps = 500;
+const bool use_direct_solver = 0;
+const double steady_state_tolerance = 0;
+const bool use_steady_state_solver = 0;
+const double slow_step_size = 0;
+const double jacobian_reuse = 0;
+const double linear_setup_frequency = 0;
+const double delta_gamma_max = 0;
+const double maximum_nonlinear_iterations = 0;
+const double maximum_order = 0;
+const bool use_adaptive_reuse = 0;
@@ -0,0 +1,5 @@
+#include "system.h"
+
+void derivative(double t, double* values, double* derivatives) {
+    derivative_chunk_0(values, derivatives);
+}
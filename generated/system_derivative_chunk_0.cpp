@@ -0,0 +1,10 @@
+#include "system.h"
+
+void derivative_chunk_0(double* values, double* derivatives) {
+
+	for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)
+	{
+		derivatives[INDEX_C_START + ((n) - 1)] = ((3) * (n));
+	}
+
+}
@@ -0,0 +1,5 @@
+#include "system.h"
+
+void jacobian_times(double* values, double* tangents, double* tangent_derivatives) {
+    jacobian_times_chunk_0(values, tangents, tangent_derivatives);
+}
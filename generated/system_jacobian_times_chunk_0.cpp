@@ -0,0 +1,10 @@
+#include "system.h"
+
+void jacobian_times_chunk_0(double* values, double* tangents, double* tangent_derivatives) {
+
+	for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)
+	{
+		tangent_derivatives[INDEX_C_START + ((n) - 1)] = 0;
+	}
+
+}
@@ -0,0 +1,71 @@
+#include "system.h"
+#include "model.h"
+
+static void model_derivative(double t, double* values, double* derivatives) { derivative(t, values, derivatives); }
+static void model_get_initial_state(double* values) { get_initial_state(values); }
+
+static const char* model_get_state_csv_label() {
+	static std::string label = get_state_csv_label();
+	return label.c_str();
+}
+
+static const char* model_get_csv_line(double* values) {
+	thread_local std::string line;
+	line = get_csv_line(values);
+	return line.c_str();
+}
+
+static void model_jacobian_times(double t, double* values, double* v, double* Jv) { jacobian_times(values, v, Jv); }
+
+extern "C" MODEL_EXPORT const Model* get_model() {
+	static Model model = {
+		MODEL_ABI_VERSION,
+		STATE_SIZE,
+		end_time,
+		sample_interval,
+		absolute_tolerance,
+		relative_tolerance,
+		(double)initial_step_size,
+		maximum_step_size,
+		minimum_step_size,
+		maximum_num_steps,
+		use_direct_solver,
+		model_get_initial_state,
+		nullptr,
+		model_derivative,
+		model_get_state_csv_label,
+		model_get_csv_line,
+		get_state_csv_order,
+		model_jacobian_times,
+		nullptr,
+		0,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		0,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		0,
+		0,
+		nullptr,
+		nullptr,
+		steady_state_tolerance,
+		use_steady_state_solver,
+		nullptr,
+		nullptr,
+		nullptr,
+		nullptr,
+		slow_step_size,
+		jacobian_reuse,
+		linear_setup_frequency,
+		delta_gamma_max,
+		maximum_nonlinear_iterations,
+		maximum_order,
+		use_adaptive_reuse,
+	};
+	return &model;
+}
@@ -0,0 +1,41 @@
+#include "system.h"
+
+
+std::string get_state_csv_label() {
+	std::stringstream str; 
+	str << "t (seconds)";
+	for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)
+	{
+		str << ", C[" << n << "]";
+	}
+	return str.str();
+}
+
+const size_t* get_state_csv_order() {
+	static const std::vector<size_t> order = [] {
+		std::vector<size_t> order;
+		for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)
+		{
+			order.push_back(INDEX_C_START + ((n) - 1));
+		}
+		return order;
+	}();
+	return order.data();
+}
+
+std::string get_csv_line(double* values) {
+	const size_t* order = get_state_csv_order();
+	std::stringstream str;
+	for (size_t i = 0; i < STATE_SIZE; ++i) {
+		str << ", " << values[order[i]];
+	}
+	return str.str();
+}
+
+void get_initial_state(double* values) {
+
+	for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)
+	{
+		values[INDEX_C_START + ((n) - 1)] = n;
+	}
+}
@@ -0,0 +1,376 @@
+#include "adjoint.h"
+
+#include <sstream>
+
+#include "layout.h"
+
+ExpressionOutput* find_objective(SystemDeclarations &system)
+{
+    for (auto& output : system.additional_outputs)
+    {
+        if (output.label.to_string() == system.adjoint_objective)
+            return &output;
+    }
+    return nullptr;
+}
+
+bool has_adjoint(SystemDeclarations &system)
+{
+    return !system.adjoint_objective.empty() && system.precision == Precision::DOUBLE && find_objective(system) != nullptr;
+}
+
+bool check_adjoint(SystemDeclarations &system)
+{
+    if (system.adjoint_objective.empty())
+        return false;
+
+    if (system.precision != Precision::DOUBLE)
+    {
+        std::cerr << "Error: @ADJOINT needs @PRECISION double.\n";
+        return false;
+    }
+
+    if (!find_objective(system))
+    {
+        std::cerr << "Error: @ADJOINT names " << system.adjoint_objective << ", which isn't an OUTPUT.\n";
+        return false;
+    }
+    return true;
+}
+
+std::string indent_statements(std::string statements, std::string indentation)
+{
+    std::stringstream str;
+    std::istringstream lines(statements);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        str << indentation << line << "\n";
+    }
+    return str.str();
+}
+
+std::string adjoint_temporary(SystemDeclarations& system)
+{
+    return "adjoint_" + std::to_string(system.adjoint_temporaries++);
+}
+
+// Binds the seed to a local so the statements don't repeat it. An operand which depends on neither the state nor a
+// constant generates no statements, so the scope is left out altogether when all of them are empty
+std::string adjoint_scope(std::string name, std::string seed, std::string statements)
+{
+    if (statements.empty())
+        return "";
+
+    return "{\n\tconst double " + name + " = " + seed + ";\n" + indent_statements(statements, "\t") + "}\n";
+}
+
+std::string generate_parameter_adjoint(SystemDeclarations& system, Parameter& parameter, std::string seed)
+{
+    switch (parameter.type)
+    {
+        case ParameterType::VARIABLE:
+            {
+            auto bound = system.bound_parameters.find(parameter.symbol.value_or(""));
+            if (bound == system.bound_parameters.end() || bound->second)
+                return "";
+            return "d_" + parameter.symbol.value() + " += " + seed + ";\n";
+            }
+        case ParameterType::EXPRESSION:
+            return parameter.expression->generate_adjoint(system, seed);
+    }
+    return "";
+}
+
+std::string ConstantExpression::generate_adjoint(SystemDeclarations&, std::string)
+{
+    return "";
+}
+
+std::string SymbolExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    std::stringstream str;
+
+    SymbolType type = system.resolve_symbol_type(symbol);
+    switch (type)
+    {
+        case SymbolType::STATE:
+            if (symbol.parameters.size() > 0)
+                return "state_adjoint[" + generate_state_index(system, symbol) + "] += " + seed + ";\n";
+            return "state_adjoint[INDEX_" + symbol.to_string() + "] += " + seed + ";\n";
+        case SymbolType::PARAMETER:
+            if (system.bound_parameters.count(symbol.name) && !system.bound_parameters[symbol.name])
+                return "d_" + symbol.to_string() + " += " + seed + ";\n";
+            return "";
+        case SymbolType::FUNCTION:
+            if (auto function = system.find_function_definition(symbol))
+            {
+                if (function->is_constant(system))
+                    return "constant_adjoint[ADJOINT_" + symbol.to_string() + "] += " + seed + ";\n";
+
+                // The function hands the adjoints of its arguments back, which then flow into the argument expressions
+                auto name = adjoint_temporary(system);
+                std::stringstream call;
+                if (symbol.parameters.size() > 0)
+                {
+                    call << "double ";
+                    for (size_t i = 0; i < symbol.parameters.size(); ++i)
+                    {
+                        call << (i != 0 ? ", " : "") << name << "_" << i << " = 0.0";
+                    }
+                    call << ";\n";
+                }
+                call << symbol.to_string() << "_adjoint(";
+                for (auto& parameter : symbol.parameters)
+                {
+                    call << generate_parameter_value(system, parameter) << ", ";
+                }
+                call << name;
+                for (size_t i = 0; i < symbol.parameters.size(); ++i)
+                {
+                    call << ", " << name << "_" << i;
+                }
+                call << ", values, state_adjoint, constant_adjoint);\n";
+                for (size_t i = 0; i < symbol.parameters.size(); ++i)
+                {
+                    call << generate_parameter_adjoint(system, symbol.parameters[i], name + "_" + std::to_string(i));
+                }
+                return adjoint_scope(name, seed, call.str());
+            }
+            return "";
+        case SymbolType::SUMMATION:
+            return symbol.to_string() + "_adjoint(" + seed + ", values, state_adjoint, constant_adjoint);\n";
+        default:
+            break;
+    }
+
+    return "";
+}
+
+std::string NegateExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    return negated_expression->generate_adjoint(system, "-(" + seed + ")");
+}
+
+std::string AddExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    auto name = adjoint_temporary(system);
+    return adjoint_scope(name, seed, lhs->generate_adjoint(system, name) + rhs->generate_adjoint(system, name));
+}
+
+std::string SubtractExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    auto name = adjoint_temporary(system);
+    return adjoint_scope(name, seed, lhs->generate_adjoint(system, name) + rhs->generate_adjoint(system, "-" + name));
+}
+
+std::string MultiplyExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    auto name = adjoint_temporary(system);
+    return adjoint_scope(name, seed, lhs->generate_adjoint(system, name + " * (" + rhs->generate(system) + ")")
+                                     + rhs->generate_adjoint(system, name + " * (" + lhs->generate(system) + ")"));
+}
+
+std::string DivideExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    auto name = adjoint_temporary(system);
+    auto numerator = lhs->generate(system);
+    auto denominator = rhs->generate(system);
+    return adjoint_scope(name, seed, lhs->generate_adjoint(system, name + " / (" + denominator + ")")
+                                     + rhs->generate_adjoint(system, "-" + name + " * (" + numerator + ") / ((" + denominator + ") * (" + denominator + "))"));
+}
+
+std::string ExponentExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    auto name = adjoint_temporary(system);
+    auto base_value = base->generate(system);
+    auto exp_value = exp->generate(system);
+    return adjoint_scope(name, seed, base->generate_adjoint(system, name + " * (" + exp_value + ") * std::pow(" + base_value + ", (" + exp_value + ") - 1)")
+                                     + exp->generate_adjoint(system, name + " * std::pow(" + base_value + ", " + exp_value + ") * std::log(" + base_value + ")"));
+}
+
+std::string SqrtExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    return base->generate_adjoint(system, "(" + seed + ") / (2 * std::sqrt(" + base->generate(system) + "))");
+}
+
+std::string ExpExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    return exp->generate_adjoint(system, "(" + seed + ") * std::exp(" + exp->generate(system) + ")");
+}
+
+std::string ExplicitExpression::generate_adjoint(SystemDeclarations& system, std::string seed)
+{
+    return term->generate_adjoint(system, seed);
+}
+
+std::string RangeExpression::generate_adjoint(SystemDeclarations&, std::string)
+{
+    std::cerr << "Error: Range expression must be either standalone or used for a summation.\n";
+    return "";
+}
+
+std::string generate_adjoint_signature(Function &f)
+{
+    std::stringstream str;
+
+    auto parameters = f.get_catchall_definition().parameters;
+    str << "void " << f.symbol.to_string() << "_adjoint(";
+    for (auto& p : parameters)
+    {
+        str << "double " << p.symbol.value_or("ERROR") << ", ";
+    }
+    str << "double seed, ";
+    for (auto& p : parameters)
+    {
+        str << "double& d_" << p.symbol.value_or("ERROR") << ", ";
+    }
+    str << "double* values, double* state_adjoint, double* constant_adjoint)";
+
+    return str.str();
+}
+
+std::string generate_adjoint_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n"
+        << "\nextern const size_t NUM_ADJOINT_CONSTANTS;"
+        << "\nextern const char* const ADJOINT_CONSTANT_NAMES[];"
+        << "\nextern const char* const ADJOINT_OBJECTIVE;";
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_constant(system))
+            str << "\nextern const size_t ADJOINT_" << f.symbol.to_string() << ";";
+        else if (f.definitions.size() > 0)
+            str << "\n" << generate_adjoint_signature(f) << ";";
+    }
+    for (auto& summation : system.summation_definitions)
+    {
+        str << "\nvoid " << summation.symbol.to_string() << "_adjoint(double seed, double* values, double* state_adjoint, double* constant_adjoint);";
+    }
+    str << "\nvoid objective_adjoint(double* values, double* state_adjoint, double* constant_adjoint);"
+        << "\nvoid initial_state_adjoint(double* lambda, double* values, double* state_adjoint, double* constant_adjoint);"
+        << "\nvoid adjoint_derivative(double* values, double* lambda, double* state_adjoint, double* constant_adjoint);"
+        << "\nvoid propagate_constant_adjoint(double* constant_adjoint);";
+
+    return str.str();
+}
+
+// Every constant gets a slot in constant_adjoint, in declaration order
+std::string generate_adjoint_constants(SystemDeclarations &system)
+{
+    std::stringstream str;
+    std::vector<std::string> names;
+
+    str << "\n";
+    for (auto &f : system.function_definitions)
+    {
+        if (!f.is_constant(system))
+            continue;
+
+        str << "\nconst size_t ADJOINT_" << f.symbol.to_string() << " = " << names.size() << ";";
+        names.push_back(f.symbol.to_string());
+    }
+    str << "\nconst size_t NUM_ADJOINT_CONSTANTS = " << names.size() << ";";
+    str << "\nconst char* const ADJOINT_CONSTANT_NAMES[] = {";
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        str << (i != 0 ? ", " : " ") << "\"" << names[i] << "\"";
+    }
+    str << " };";
+    str << "\nconst char* const ADJOINT_OBJECTIVE = \"" << system.adjoint_objective << "\";\n";
+
+    return str.str();
+}
+
+std::string generate_function_adjoint(SystemDeclarations &system, Function &f)
+{
+    std::stringstream str;
+
+    if (f.definitions.size() == 0)
+        return "";
+
+    auto main_definition = f.get_catchall_definition();
+
+    system.bound_parameters.clear();
+    for (auto& p : main_definition.parameters)
+    {
+        if (p.type == ParameterType::VARIABLE)
+            system.bound_parameters[p.symbol.value()] = false;
+    }
+
+    str << "\n\n" << generate_adjoint_signature(f) << "\n{\n";
+    for (auto definition : f.definitions)
+    {
+        if (definition.is_catchall())
+            continue;
+
+        system.adjoint_temporaries = 0;
+        str << "\tif (" << definition.get_parameter_constraints(system, main_definition) << ") {\n"
+            << indent_statements(definition.expression->generate_adjoint(system, "seed"), "\t\t")
+            << "\t\treturn;\n"
+            << "\t}\n";
+    }
+    system.adjoint_temporaries = 0;
+    str << indent_statements(main_definition.expression->generate_adjoint(system, "seed"), "\t")
+        << "}";
+
+    return str.str();
+}
+
+std::string generate_summation_adjoint(SystemDeclarations &system, Summation &summation)
+{
+    std::stringstream str;
+
+    system.bound_parameters[summation.index.name] = true;
+    system.adjoint_temporaries = 0;
+    str << "\n\nvoid " << summation.symbol.to_string() << "_adjoint(double seed, double* values, double* state_adjoint, double* constant_adjoint) {"
+        << "\n\tfor (size_t " << summation.index.to_string() << " = " << summation.range.start->generate(system) << "; "
+        << summation.index.to_string() << " < " << summation.range.end->generate(system) << "; "
+        << summation.index.to_string() << "++) {\n"
+        << indent_statements(summation.summand->generate_adjoint(system, "seed"), "\t\t")
+        << "\t}"
+        << "\n}";
+    system.bound_parameters.erase(summation.index.name);
+
+    return str.str();
+}
+
+// The objective's derivative seeds lambda at the end time, its explicit dependence on constants goes straight
+// into the gradient
+std::string generate_objective_adjoint(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    system.bound_parameters.clear();
+    system.adjoint_temporaries = 0;
+    str << "\n\nvoid objective_adjoint(double* values, double* state_adjoint, double* constant_adjoint) {\n"
+        << indent_statements(find_objective(system)->rhs->generate_adjoint(system, "1.0"), "\t")
+        << "}";
+
+    return str.str();
+}
+
+// Constants are defined in terms of earlier ones, walking them backwards turns the adjoint of each constant taken
+// on its own into the total derivative through everything defined from it
+std::string generate_constant_propagation(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    system.bound_parameters.clear();
+    str << "\n\nvoid propagate_constant_adjoint(double* constant_adjoint) {"
+        << "\n\tdouble* values = nullptr;"
+        << "\n\tdouble* state_adjoint = nullptr;\n";
+    for (auto f = system.function_definitions.rbegin(); f != system.function_definitions.rend(); ++f)
+    {
+        if (!f->is_constant(system) || f->definitions.size() != 1)
+            continue;
+
+        system.adjoint_temporaries = 0;
+        str << indent_statements(f->definitions[0].expression->generate_adjoint(system, "constant_adjoint[ADJOINT_" + f->symbol.to_string() + "]"), "\t");
+    }
+    str << "}";
+
+    return str.str();
+}
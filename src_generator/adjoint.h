@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "expression.h"
+#include "parse.h"
+
+// Adjoint gradients of the OUTPUT named by @ADJOINT, taken at the end time, with respect to every constant.
+// Every expression generates its adjoint: statements which add `seed` times its derivative to state_adjoint
+// (per state entry) and constant_adjoint (per constant, indexed by ADJOINT_<name>). Seeding each equation with
+// lambda gives the transposed Jacobian product and the parameter quadrature CVODES integrates backwards.
+// Functions and summations get `f_adjoint` counterparts, which hand the adjoints of their arguments back through
+// references. Locals of the generated code are named from system.adjoint_temporaries.
+
+bool has_adjoint(SystemDeclarations &system);
+// Prints an error when @ADJOINT can't be honoured
+bool check_adjoint(SystemDeclarations &system);
+
+std::string indent_statements(std::string statements, std::string indentation);
+
+std::string generate_adjoint_declarations(SystemDeclarations &system);
+std::string generate_adjoint_constants(SystemDeclarations &system);
+std::string generate_function_adjoint(SystemDeclarations &system, Function &f);
+std::string generate_summation_adjoint(SystemDeclarations &system, Summation &summation);
+std::string generate_objective_adjoint(SystemDeclarations &system);
+std::string generate_constant_propagation(SystemDeclarations &system);
@@ -0,0 +1,564 @@
+#include "bytecode.h"
+
+#include <algorithm>
+
+int BytecodeBuilder::emit(Opcode opcode, int a, int b, int c, double immediate)
+{
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.dst = (int)varying.size();
+    instruction.a = a;
+    instruction.b = b;
+    instruction.c = c;
+    instruction.immediate = immediate;
+
+    // Jump operands are instruction numbers and slot operands index the constants, neither are registers
+    bool a_is_register = opcode != Opcode::LOAD_CONSTANT && opcode != Opcode::LANE_INDEX;
+    if (a >= 0 && a_is_register && varying[a]) instruction.flags |= VARYING_A;
+    if (b >= 0 && varying[b]) instruction.flags |= VARYING_B;
+    if (c >= 0 && opcode == Opcode::SELECT && varying[c]) instruction.flags |= VARYING_C;
+    if (instruction.flags != 0 || opcode == Opcode::LANE_INDEX) instruction.flags |= VARYING_DST;
+
+    varying.push_back(instruction.flags & VARYING_DST);
+    types.push_back(opcode == Opcode::LANE_INDEX ? ValueType::SIZE : ValueType::DOUBLE);
+    program.num_registers = std::max(program.num_registers, varying.size());
+    program.instructions.push_back(instruction);
+    return instruction.dst;
+}
+
+// Follows the usual arithmetic conversions of the compiled code: double wins, then size_t, then int
+int BytecodeBuilder::emit_arithmetic(Opcode opcode, int a, int b)
+{
+    ValueType type = types[a];
+    if (b >= 0 && (type == ValueType::DOUBLE || types[b] == ValueType::DOUBLE)) type = ValueType::DOUBLE;
+    else if (b >= 0 && (type == ValueType::SIZE || types[b] == ValueType::SIZE)) type = ValueType::SIZE;
+
+    if (opcode == Opcode::DIVIDE && type != ValueType::DOUBLE)
+    {
+        if (type == ValueType::SIZE)
+        {
+            a = emit(Opcode::WRAP_UNSIGNED, a);
+            b = emit(Opcode::WRAP_UNSIGNED, b);
+        }
+        opcode = Opcode::INTEGER_DIVIDE;
+    }
+
+    int result = emit(opcode, a, b);
+    if (type == ValueType::SIZE && opcode != Opcode::INTEGER_DIVIDE)
+    {
+        result = emit(Opcode::WRAP_UNSIGNED, result);
+    }
+    types[result] = type;
+    return result;
+}
+
+// Overwrites an existing uniform register, used for loop counters and accumulators
+void BytecodeBuilder::emit_into(int dst, Opcode opcode, int a, int b)
+{
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.dst = dst;
+    instruction.a = a;
+    instruction.b = b;
+    if ((a >= 0 && varying[a]) || (b >= 0 && varying[b]))
+    {
+        std::cerr << "Error: Bytecode accumulator fed from a per-lane value.\n";
+    }
+    program.instructions.push_back(instruction);
+}
+
+void BytecodeBuilder::emit_store(Opcode opcode, int dst, int a, int b)
+{
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.dst = dst;
+    instruction.a = a;
+    instruction.b = b;
+    if (a >= 0 && varying[a]) instruction.flags |= VARYING_A;
+    if (b >= 0 && varying[b]) instruction.flags |= VARYING_B;
+    if (instruction.flags != 0) instruction.flags |= VARYING_DST;
+    program.instructions.push_back(instruction);
+}
+
+size_t BytecodeBuilder::emit_jump(Opcode opcode, int a, int b)
+{
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.a = a;
+    instruction.b = b;
+    program.instructions.push_back(instruction);
+    return program.instructions.size() - 1;
+}
+
+void BytecodeBuilder::patch_jump(size_t jump)
+{
+    program.instructions[jump].c = (int)program.instructions.size();
+}
+
+int BytecodeBuilder::constant(double value)
+{
+    return emit(Opcode::CONSTANT, -1, -1, -1, value);
+}
+
+int BytecodeBuilder::new_slot()
+{
+    return (int)program.num_constants++;
+}
+
+// Registers are only live within a block, so every block starts allocating from 0 again
+void BytecodeBuilder::begin_block(std::vector<BytecodeBlock>& blocks, std::vector<int> dimensions)
+{
+    blocks.push_back({ program.instructions.size(), dimensions });
+    varying.clear();
+    types.clear();
+    bound_parameters.clear();
+}
+
+void BytecodeBuilder::end_block()
+{
+    Instruction instruction;
+    instruction.opcode = Opcode::END;
+    program.instructions.push_back(instruction);
+}
+
+int BytecodeBuilder::lower_parameter(Parameter& parameter)
+{
+    if (parameter.type == ParameterType::EXPRESSION)
+    {
+        return parameter.expression->lower(*this);
+    }
+
+    auto bound = bound_parameters.find(parameter.symbol.value_or(""));
+    if (bound == bound_parameters.end())
+    {
+        std::cerr << "Error: Tried to use unbound index variable " << parameter.symbol.value_or("ERROR") << " in definition.\n";
+        return constant(0.0);
+    }
+    return bound->second;
+}
+
+// Same layout as generate_parameters_index without @LAYOUT, the first index varies fastest
+int BytecodeBuilder::lower_state_index(Symbol& symbol)
+{
+    auto state_variable = system.find_state_variable(symbol);
+    auto offset = state_offset_slots.find(symbol.name);
+    if (state_variable == nullptr || offset == state_offset_slots.end())
+    {
+        std::cerr << "Error: State " << symbol.to_string() << " has no index.\n";
+        return constant(0.0);
+    }
+
+    int index = emit(Opcode::LOAD_CONSTANT, offset->second);
+    if (symbol.parameters.size() != state_variable->symbol.parameters.size())
+    {
+        std::cerr << "Error: Used wrong number of indices for accessing " << symbol.to_string() << "\n";
+        return index;
+    }
+
+    int stride = -1;
+    for (size_t i = 0; i < symbol.parameters.size(); ++i)
+    {
+        int offset_in_list = emit(Opcode::SUBTRACT, lower_parameter(symbol.parameters[i]), constant(1.0));
+        index = emit(Opcode::ADD, index, stride < 0 ? offset_in_list : emit(Opcode::MULTIPLY, stride, offset_in_list));
+
+        auto& range = program.ranges[range_indices[state_variable->symbol.parameters[i].symbol.value()]];
+        int size = emit(Opcode::LOAD_CONSTANT, range.size_slot);
+        stride = stride < 0 ? size : emit(Opcode::MULTIPLY, stride, size);
+    }
+    return index;
+}
+
+// Functions are inlined. Constrained definitions become selects, evaluated in reverse so the first match wins.
+// Both sides of a select are lowered, so a recursive function would be inlined forever whatever its base cases
+int BytecodeBuilder::lower_function_call(Function& f, Symbol& symbol)
+{
+    if (f.definitions.size() == 0)
+    {
+        std::cerr << "Error: " << f.symbol.to_string() << " is missing definition.\n";
+        return constant(0.0);
+    }
+    if (std::find(inlining.begin(), inlining.end(), f.symbol.name) != inlining.end())
+    {
+        auto& recursive = program.recursive_functions;
+        if (std::find(recursive.begin(), recursive.end(), f.symbol.name) == recursive.end())
+            recursive.push_back(f.symbol.name);
+        return constant(0.0);
+    }
+
+    auto main_definition = f.get_catchall_definition();
+    if (main_definition.parameters.size() != symbol.parameters.size())
+    {
+        std::cerr << "Error: Called " << f.symbol.to_string() << " with the wrong number of parameters.\n";
+        return constant(0.0);
+    }
+
+    std::unordered_map<std::string, int> scope;
+    for (size_t i = 0; i < symbol.parameters.size(); ++i)
+    {
+        // Parameters and return values of the compiled functions are doubles, whatever the arguments were
+        int argument = lower_parameter(symbol.parameters[i]);
+        scope[main_definition.parameters[i].symbol.value_or("")] = types[argument] == ValueType::DOUBLE ? argument : emit(Opcode::COPY, argument);
+    }
+
+    auto caller_scope = bound_parameters;
+    bound_parameters = scope;
+    inlining.push_back(f.symbol.name);
+
+    int result = main_definition.expression->lower(*this);
+    for (auto definition = f.definitions.rbegin(); definition != f.definitions.rend(); ++definition)
+    {
+        if (definition->is_catchall() || definition->parameters.size() != main_definition.parameters.size())
+            continue;
+
+        int condition = -1;
+        for (size_t i = 0; i < definition->parameters.size(); ++i)
+        {
+            if (definition->parameters[i].type != ParameterType::EXPRESSION)
+                continue;
+
+            int matches = emit(Opcode::EQUAL, scope[main_definition.parameters[i].symbol.value_or("")], definition->parameters[i].expression->lower(*this));
+            condition = condition < 0 ? matches : emit(Opcode::MULTIPLY, condition, matches);
+        }
+        result = emit(Opcode::SELECT, condition, definition->expression->lower(*this), result);
+    }
+
+    inlining.pop_back();
+    bound_parameters = caller_scope;
+    return types[result] == ValueType::DOUBLE ? result : emit(Opcode::COPY, result);
+}
+
+// Summations only see their own index, so they're the same for every lane and run once per tile
+int BytecodeBuilder::lower_summation(Summation& summation)
+{
+    auto caller_scope = bound_parameters;
+    bound_parameters.clear();
+
+    int end = summation.range.end->lower(*this);
+    int counter = emit(Opcode::COPY, summation.range.start->lower(*this));
+    types[counter] = ValueType::SIZE;
+    int sum = constant(0.0);
+    int one = constant(1.0);
+
+    size_t loop_start = program.instructions.size();
+    size_t exit_jump = emit_jump(Opcode::JUMP_IF_GREATER_EQUAL, counter, end);
+    bound_parameters[summation.index.name] = counter;
+    emit_into(sum, Opcode::ADD, sum, summation.summand->lower(*this));
+    emit_into(counter, Opcode::ADD, counter, one);
+    size_t back_jump = emit_jump(Opcode::JUMP);
+    program.instructions[back_jump].c = (int)loop_start;
+    patch_jump(exit_jump);
+
+    bound_parameters = caller_scope;
+    return sum;
+}
+
+int ConstantExpression::lower(BytecodeBuilder& builder)
+{
+    // Goes through the same text as the C++ backend so both round the literal identically
+    std::string literal = generate(builder.system);
+    int result = builder.constant(std::stod(literal));
+    if (literal.find_first_not_of("0123456789") == std::string::npos)
+    {
+        builder.types[result] = ValueType::INT;
+    }
+    return result;
+}
+
+int SymbolExpression::lower(BytecodeBuilder& builder)
+{
+    auto bound = builder.bound_parameters.find(symbol.name);
+    if (bound != builder.bound_parameters.end())
+    {
+        return bound->second;
+    }
+
+    auto& system = builder.system;
+    switch (system.resolve_symbol_type(symbol))
+    {
+        case SymbolType::STATE:
+            return builder.emit(Opcode::LOAD_STATE, builder.lower_state_index(symbol));
+        case SymbolType::FUNCTION:
+            {
+            auto constant_slot = builder.constant_slots.find(symbol.name);
+            if (constant_slot != builder.constant_slots.end())
+            {
+                return builder.emit(Opcode::LOAD_CONSTANT, constant_slot->second);
+            }
+            return builder.lower_function_call(*system.find_function_definition(symbol), symbol);
+            }
+        case SymbolType::SUMMATION:
+            return builder.lower_summation(*system.find_summation(symbol));
+        default:
+            break;
+    }
+
+    std::cerr << "Error: Used an unbound parameter " << symbol.to_string() << ".\n";
+    return builder.constant(0.0);
+}
+
+int NegateExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit_arithmetic(Opcode::NEGATE, negated_expression->lower(builder));
+}
+
+int AddExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit_arithmetic(Opcode::ADD, lhs->lower(builder), rhs->lower(builder));
+}
+
+int SubtractExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit_arithmetic(Opcode::SUBTRACT, lhs->lower(builder), rhs->lower(builder));
+}
+
+int MultiplyExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit_arithmetic(Opcode::MULTIPLY, lhs->lower(builder), rhs->lower(builder));
+}
+
+int DivideExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit_arithmetic(Opcode::DIVIDE, lhs->lower(builder), rhs->lower(builder));
+}
+
+int ExponentExpression::lower(BytecodeBuilder& builder)
+{
+    if (!base || !exp) {
+        std::cerr << "Error: Exponent expression is missing an operand." << std::endl;
+        return builder.constant(0.0);
+    }
+
+    return builder.emit(Opcode::POW, base->lower(builder), exp->lower(builder));
+}
+
+int SqrtExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit(Opcode::SQRT, base->lower(builder));
+}
+
+int ExpExpression::lower(BytecodeBuilder& builder)
+{
+    return builder.emit(Opcode::EXP, exp->lower(builder));
+}
+
+int ExplicitExpression::lower(BytecodeBuilder& builder)
+{
+    return term->lower(builder);
+}
+
+int RangeExpression::lower(BytecodeBuilder& builder)
+{
+    std::cerr << "Error: Range expression must be either standalone or used for a summation.\n";
+    return builder.constant(0.0);
+}
+
+bool is_catchall_list(SystemDeclarations& system, Symbol& symbol)
+{
+    for (auto& p : symbol.parameters)
+    {
+        if (p.type != ParameterType::VARIABLE || !system.ranges.count(p.symbol.value()))
+            return false;
+    }
+    return true;
+}
+
+int lower_meta(BytecodeBuilder& builder, TokenType tag, std::string default_value)
+{
+    auto& program = builder.program;
+    builder.begin_block(program.setup);
+    int slot = builder.new_slot();
+    auto expression = builder.system.tag_expressions.find(tag);
+    int value = expression != builder.system.tag_expressions.end() ? expression->second->lower(builder) : builder.constant(std::stod(default_value));
+    builder.emit_store(Opcode::STORE_CONSTANT, slot, value);
+    builder.end_block();
+    return slot;
+}
+
+// Runs the loops of a list (or a single statement for scalars and overrides) storing rhs into the given state
+void lower_assignment(BytecodeBuilder& builder, std::vector<BytecodeBlock>& blocks, Symbol& symbol, Expression& rhs)
+{
+    std::vector<int> dimensions;
+    bool is_list = symbol.parameters.size() > 0 && is_catchall_list(builder.system, symbol);
+    if (is_list)
+    {
+        for (auto& p : symbol.parameters)
+        {
+            dimensions.push_back(builder.range_indices[p.symbol.value()]);
+        }
+    }
+
+    builder.begin_block(blocks, dimensions);
+    if (is_list)
+    {
+        for (size_t i = 0; i < symbol.parameters.size(); ++i)
+        {
+            builder.bound_parameters[symbol.parameters[i].symbol.value()] = builder.emit(Opcode::LANE_INDEX, (int)i);
+        }
+    }
+    int index = builder.lower_state_index(symbol);
+    builder.emit_store(Opcode::STORE, -1, index, rhs.lower(builder));
+    builder.end_block();
+}
+
+// Lists first and their overrides afterwards, like the C++ backend
+static void lower_state_assignments(BytecodeBuilder& builder, std::vector<BytecodeBlock>& blocks, std::vector<InitialState>& assignments)
+{
+    for (auto& assignment : assignments)
+    {
+        if (assignment.rhs && (assignment.symbol.parameters.size() == 0 || is_catchall_list(builder.system, assignment.symbol)))
+            lower_assignment(builder, blocks, assignment.symbol, *assignment.rhs);
+    }
+    for (auto& assignment : assignments)
+    {
+        if (assignment.rhs && assignment.symbol.parameters.size() > 0 && !is_catchall_list(builder.system, assignment.symbol))
+            lower_assignment(builder, blocks, assignment.symbol, *assignment.rhs);
+    }
+}
+
+BytecodeProgram lower_system(SystemDeclarations& system)
+{
+    BytecodeProgram program;
+    BytecodeBuilder builder(system, program);
+    system.bound_parameters.clear();
+
+    for (auto& f : system.function_definitions)
+    {
+        if (!f.is_constant(system))
+            continue;
+
+        if (f.definitions.size() != 1)
+        {
+            std::cerr << "Error: Constant " << f.symbol.to_string() << " must have 1 and only 1 definition.\n";
+            continue;
+        }
+        builder.constant_slots[f.symbol.name] = builder.new_slot();
+    }
+    for (auto& f : system.function_definitions)
+    {
+        if (!builder.constant_slots.count(f.symbol.name))
+            continue;
+
+        builder.begin_block(program.setup);
+        builder.emit_store(Opcode::STORE_CONSTANT, builder.constant_slots[f.symbol.name], f.definitions[0].expression->lower(builder));
+        builder.end_block();
+    }
+
+    program.end_time_slot = lower_meta(builder, TokenType::TAG_END_TIME, system.end_time);
+    program.sample_interval_slot = lower_meta(builder, TokenType::TAG_SAMPLE_INTERVAL, system.sample_interval);
+    program.absolute_tolerance_slot = lower_meta(builder, TokenType::TAG_ABSTOL, system.abstol);
+    program.relative_tolerance_slot = lower_meta(builder, TokenType::TAG_RELTOL, system.reltol);
+    program.initial_step_size_slot = lower_meta(builder, TokenType::TAG_INIT_STEP, system.init_step_size);
+    program.maximum_step_size_slot = lower_meta(builder, TokenType::TAG_MAX_STEP_SIZE, system.max_step_size);
+    program.minimum_step_size_slot = lower_meta(builder, TokenType::TAG_MIN_STEP_SIZE, system.min_step_size);
+    program.maximum_num_steps_slot = lower_meta(builder, TokenType::TAG_MAX_NUM_STEPS, system.max_num_steps);
+    program.steady_state_tolerance_slot = lower_meta(builder, TokenType::TAG_STOP_AT_STEADY_STATE, system.steady_state_tolerance);
+    program.jacobian_reuse_slot = lower_meta(builder, TokenType::TAG_JAC_REUSE, system.jacobian_reuse);
+    program.linear_setup_frequency_slot = lower_meta(builder, TokenType::TAG_LSETUP_FREQ, system.linear_setup_frequency);
+    program.delta_gamma_max_slot = lower_meta(builder, TokenType::TAG_DELTA_GAMMA_MAX, system.delta_gamma_max);
+    program.maximum_nonlinear_iterations_slot = lower_meta(builder, TokenType::TAG_MAX_NONLINEAR_ITERS, system.max_nonlinear_iterations);
+    program.maximum_order_slot = lower_meta(builder, TokenType::TAG_MAX_ORDER, system.max_order);
+    program.use_direct_solver = system.use_direct_solver;
+    program.use_adaptive_reuse = system.use_adaptive_reuse;
+    program.use_steady_state_solver = system.use_steady_state_solver;
+
+    // Sorted so the slot numbering doesn't depend on hash order
+    std::vector<std::string> range_names;
+    for (auto& range : system.ranges)
+    {
+        range_names.push_back(range.first);
+    }
+    std::sort(range_names.begin(), range_names.end());
+    for (auto& name : range_names)
+    {
+        auto& range = system.ranges[name];
+        builder.begin_block(program.setup);
+        int start = range.start->lower(builder);
+        int size = builder.emit(Opcode::ADD, builder.emit(Opcode::SUBTRACT, range.end->lower(builder), start), builder.constant(1.0));
+        BytecodeRange bytecode_range = { name, builder.new_slot(), builder.new_slot() };
+        builder.emit_store(Opcode::STORE_CONSTANT, bytecode_range.start_slot, start);
+        builder.emit_store(Opcode::STORE_CONSTANT, bytecode_range.size_slot, size);
+        builder.end_block();
+
+        builder.range_indices[name] = (int)program.ranges.size();
+        program.ranges.push_back(bytecode_range);
+    }
+
+    // State layout, in the same order as generate_state_indices
+    int next_index = -1;
+    for (auto& state_variable : system.state_variables)
+    {
+        auto& symbol = state_variable.symbol;
+        if (symbol.is_list() && !is_catchall_list(system, symbol))
+            continue;
+
+        builder.begin_block(program.setup);
+        int offset_slot = builder.new_slot();
+        int offset = next_index < 0 ? builder.constant(0.0) : builder.emit(Opcode::LOAD_CONSTANT, next_index);
+        builder.emit_store(Opcode::STORE_CONSTANT, offset_slot, offset);
+
+        int size = builder.constant(1.0);
+        BytecodeLabel label = { symbol.name, {}, offset_slot };
+        for (auto& p : symbol.parameters)
+        {
+            int range = builder.range_indices[p.symbol.value()];
+            size = builder.emit(Opcode::MULTIPLY, size, builder.emit(Opcode::LOAD_CONSTANT, program.ranges[range].size_slot));
+            label.dimensions.push_back(range);
+        }
+        next_index = builder.new_slot();
+        builder.emit_store(Opcode::STORE_CONSTANT, next_index, builder.emit(Opcode::ADD, offset, size));
+        builder.end_block();
+
+        builder.state_offset_slots[symbol.name] = offset_slot;
+        program.labels.push_back(label);
+    }
+    if (next_index < 0)
+    {
+        builder.begin_block(program.setup);
+        next_index = builder.new_slot();
+        builder.emit_store(Opcode::STORE_CONSTANT, next_index, builder.constant(0.0));
+        builder.end_block();
+    }
+    program.state_size_slot = next_index;
+
+    for (auto& initial_state : system.initial_states)
+    {
+        if (!initial_state.rhs)
+            std::cerr << "Error: Initial state of " << initial_state.symbol.name << " is missing definition.\n";
+    }
+    lower_state_assignments(builder, program.initial_state, system.initial_states);
+    lower_state_assignments(builder, program.absolute_tolerances, system.absolute_tolerances);
+    lower_state_assignments(builder, program.state_scales, system.state_scales);
+    program.use_auto_scale = system.use_auto_scale;
+
+    for (auto& state_variable : system.state_variables)
+    {
+        if (state_variable.symbol.parameters.size() == 0 || is_catchall_list(system, state_variable.symbol))
+            lower_assignment(builder, program.derivative, state_variable.symbol, *state_variable.rhs);
+    }
+    for (auto& state_variable : system.state_variables)
+    {
+        if (state_variable.symbol.parameters.size() > 0 && !is_catchall_list(system, state_variable.symbol))
+            lower_assignment(builder, program.derivative, state_variable.symbol, *state_variable.rhs);
+    }
+
+    for (auto& output : system.additional_outputs)
+    {
+        builder.begin_block(program.outputs);
+        builder.emit_store(Opcode::STORE_OUTPUT, (int)program.output_labels.size(), output.rhs->lower(builder));
+        builder.end_block();
+        program.output_labels.push_back(output.label.to_string());
+    }
+
+    std::vector<ExpressionOutput> conditions = system.stop_conditions;
+    conditions.insert(conditions.end(), system.event_conditions.begin(), system.event_conditions.end());
+    for (auto& condition : conditions)
+    {
+        builder.begin_block(program.roots);
+        builder.emit_store(Opcode::STORE_OUTPUT, (int)(program.output_labels.size() + program.root_labels.size()), condition.rhs->lower(builder));
+        builder.end_block();
+        program.root_labels.push_back(condition.label.to_string());
+    }
+    program.num_stop_roots = system.stop_conditions.size();
+
+    return program;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.h"
+#include "parse.h"
+
+// Bytecode backend, an alternative to the C++ emitters in generator.h which needs no compiler. Equations are
+// lowered to blocks of register based instructions. A block either computes one scalar statement or a whole list
+// of equations, in which case every instruction works on a tile of list elements (lanes) at once, so dispatch
+// cost is paid per tile rather than per element.
+
+#define BYTECODE_OPCODES(X) \
+    X(END)                  /* Ends a block */ \
+    X(CONSTANT)             /* dst = immediate */ \
+    X(LOAD_CONSTANT)        /* dst = constants[a] */ \
+    X(STORE_CONSTANT)       /* constants[dst] = a */ \
+    X(LANE_INDEX)           /* dst = value of the block's list parameter a for every lane */ \
+    X(LOAD_STATE)           /* dst = in[a], 0 outside of the state */ \
+    X(STORE)                /* out[a] = b */ \
+    X(STORE_OUTPUT)         /* outputs[dst] = a */ \
+    X(COPY)                 /* dst = a */ \
+    X(NEGATE)               /* dst = -a */ \
+    X(ADD)                  /* dst = a + b */ \
+    X(SUBTRACT)             /* dst = a - b */ \
+    X(MULTIPLY)             /* dst = a * b */ \
+    X(DIVIDE)               /* dst = a / b */ \
+    X(POW)                  /* dst = pow(a, b) */ \
+    X(SQRT)                 /* dst = sqrt(a) */ \
+    X(EXP)                  /* dst = exp(a) */ \
+    X(INTEGER_DIVIDE)       /* dst = trunc(a / b) */ \
+    X(WRAP_UNSIGNED)        /* dst = a mod 2^64, for results the compiled code computes as size_t */ \
+    X(EQUAL)                /* dst = a == b ? 1 : 0 */ \
+    X(SELECT)               /* dst = a != 0 ? b : c */ \
+    X(JUMP)                 /* Continue at instruction c */ \
+    X(JUMP_IF_GREATER_EQUAL) /* Continue at instruction c if a >= b, both uniform */
+
+enum class Opcode : uint8_t
+{
+#define BYTECODE_ENUM(name) name,
+    BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+};
+
+// Set for operands (and the result) which hold one value per lane, uniform ones only have lane 0
+const uint8_t VARYING_DST = 1;
+const uint8_t VARYING_A = 2;
+const uint8_t VARYING_B = 4;
+const uint8_t VARYING_C = 8;
+
+struct Instruction
+{
+    Opcode opcode;
+    uint8_t flags = 0;
+    int32_t dst = -1;
+    int32_t a = -1;
+    int32_t b = -1;
+    int32_t c = -1;
+    double immediate = 0.0;
+};
+
+struct BytecodeRange
+{
+    std::string name;
+    int start_slot;
+    int size_slot;
+};
+
+struct BytecodeBlock
+{
+    size_t begin; // First instruction, the block runs until its END
+    std::vector<int> dimensions; // Ranges the lanes iterate over, the first one varies fastest. Empty for scalar blocks
+};
+
+struct BytecodeLabel
+{
+    std::string name;
+    std::vector<int> dimensions; // Ranges of a list state, outermost first as in the compiled csv header
+    int offset_slot; // Index of the state's first entry
+};
+
+struct BytecodeProgram
+{
+    std::vector<Instruction> instructions;
+    std::vector<BytecodeBlock> setup; // Run once, fills the constant slots
+    std::vector<BytecodeBlock> initial_state;
+    std::vector<BytecodeBlock> absolute_tolerances; // @ABSOLUTE_TOLERANCE <state> = <value>, over the global tolerance
+    std::vector<BytecodeBlock> state_scales; // @SCALE <state> = <value>, over the automatic scale
+    std::vector<BytecodeBlock> derivative;
+    std::vector<BytecodeBlock> outputs;
+    std::vector<BytecodeBlock> roots; // Store after the outputs, stop conditions first
+
+    std::vector<BytecodeRange> ranges;
+    std::vector<BytecodeLabel> labels;
+    std::vector<std::string> output_labels;
+    std::vector<std::string> root_labels;
+    size_t num_stop_roots = 0;
+    size_t num_constants = 0;
+    size_t num_registers = 0;
+    // Functions calling themselves can't be inlined, the program is incomplete when any are listed
+    std::vector<std::string> recursive_functions;
+
+    int state_size_slot = -1;
+    int end_time_slot = -1;
+    int sample_interval_slot = -1;
+    int absolute_tolerance_slot = -1;
+    int relative_tolerance_slot = -1;
+    int initial_step_size_slot = -1;
+    int maximum_step_size_slot = -1;
+    int minimum_step_size_slot = -1;
+    int maximum_num_steps_slot = -1;
+    int steady_state_tolerance_slot = -1;
+    int jacobian_reuse_slot = -1;
+    int linear_setup_frequency_slot = -1;
+    int delta_gamma_max_slot = -1;
+    int maximum_nonlinear_iterations_slot = -1;
+    int maximum_order_slot = -1;
+    bool use_direct_solver = false;
+    bool use_steady_state_solver = false;
+    bool use_adaptive_reuse = false;
+    bool use_auto_scale = false;
+};
+
+// C++ type the compiled backend gives a value. Index variables are size_t and integer literals are int there,
+// so the interpreter tracks types to reproduce integer division and unsigned wraparound
+enum class ValueType
+{
+    DOUBLE,
+    INT,
+    SIZE
+};
+
+class BytecodeBuilder
+{
+public:
+    SystemDeclarations& system;
+    BytecodeProgram& program;
+
+    std::unordered_map<std::string, int> bound_parameters; // Index variables and function parameters in scope
+    std::unordered_map<std::string, int> constant_slots;
+    std::unordered_map<std::string, int> range_indices;
+    std::unordered_map<std::string, int> state_offset_slots;
+    std::vector<std::string> inlining; // Functions whose calls are being inlined, innermost last
+
+    BytecodeBuilder(SystemDeclarations& system, BytecodeProgram& program)
+        : system(system), program(program)
+    {}
+
+    int emit(Opcode opcode, int a = -1, int b = -1, int c = -1, double immediate = 0.0);
+    int emit_arithmetic(Opcode opcode, int a, int b = -1);
+    void emit_into(int dst, Opcode opcode, int a = -1, int b = -1);
+    void emit_store(Opcode opcode, int dst, int a = -1, int b = -1);
+    size_t emit_jump(Opcode opcode, int a = -1, int b = -1);
+    void patch_jump(size_t jump);
+    int constant(double value);
+    int new_slot();
+
+    void begin_block(std::vector<BytecodeBlock>& blocks, std::vector<int> dimensions = {});
+    void end_block();
+
+    int lower_parameter(Parameter& parameter);
+    int lower_state_index(Symbol& symbol);
+    int lower_function_call(Function& f, Symbol& symbol);
+    int lower_summation(Summation& summation);
+
+    std::vector<ValueType> types;
+
+private:
+    std::vector<bool> varying;
+};
+
+BytecodeProgram lower_system(SystemDeclarations& system);
@@ -1,5 +1,8 @@
+#include <cmath>
+
 #include "expression.h"
 #include "parse.h"
+#include "layout.h"
 
 
 std::string FunctionDefinition::get_parameter_constraints(SystemDeclarations& system, FunctionDefinition& catchall)
@@ -32,14 +35,34 @@ std::string FunctionDefinition::get_parameter_constraints(SystemDeclarations& sy
 
 bool Function::is_state_dependent(SystemDeclarations& system)
 {
-    for (auto definition : definitions)
+    if (visiting)
+    {
+        recursive = true; // A recursive call only depends on state through the other terms
+        return false;
+    }
+
+    visiting = true;
+    bool state_dependent = false;
+    for (auto& definition : definitions)
     {
         if (definition.expression->has_state_dependencies(system))
         {
-            return true;
+            state_dependent = true;
+            break;
         }
     }
-    return false;
+    visiting = false;
+    return state_dependent;
+}
+
+// State independent functions of one index are computed once over the list ranges and looked up afterwards.
+// Recursive ones are left alone, filling their table could recurse below the base case
+bool Function::is_tabulated(SystemDeclarations& system)
+{
+    if (symbol.parameters.size() != 1 || (system.ranges.empty() && system.summation_definitions.empty()))
+        return false;
+
+    return !is_state_dependent(system) && !recursive;
 }
 
 std::string generate_parameter_value(SystemDeclarations& system, Parameter& parameter)
@@ -72,18 +95,51 @@ std::string generate_parameter_value(SystemDeclarations& system, Parameter& para
     return str.str();
 }
 
-std::vector<Parameter> get_needed_parameter_list(SystemDeclarations& system, Symbol& symbol)
+static bool is_whole_constant(Expression* expression)
 {
-    for (auto d : system.state_variables)
+    auto constant = dynamic_cast<ConstantExpression*>(expression);
+    return constant != nullptr && constant->value == std::floor(constant->value) && constant->value < 1e6; // Printed as an int literal
+}
+
+static bool is_index_expression(SystemDeclarations& system, Expression* expression)
+{
+    if (auto symbol = dynamic_cast<SymbolExpression*>(expression))
     {
-        if (d.symbol != symbol) continue;
+        auto bound = system.bound_parameters.find(symbol->symbol.name);
+        return symbol->symbol.parameters.empty() && bound != system.bound_parameters.end() && bound->second;
+    }
 
-        for (auto p : d.symbol.parameters)
-        {
-            if (p.type != ParameterType::VARIABLE) continue;
-        }
+    if (auto add = dynamic_cast<AddExpression*>(expression))
+    {
+        return (is_index_expression(system, add->lhs.get()) && is_whole_constant(add->rhs.get()))
+            || (is_whole_constant(add->lhs.get()) && is_index_expression(system, add->rhs.get()));
+    }
 
-        return d.symbol.parameters;
+    if (auto subtract = dynamic_cast<SubtractExpression*>(expression))
+    {
+        return is_index_expression(system, subtract->lhs.get()) && is_whole_constant(subtract->rhs.get());
+    }
+
+    return false;
+}
+
+// True for an index variable shifted by a whole number, which the compiled code computes as a size_t
+bool is_index_parameter(SystemDeclarations& system, Parameter& parameter)
+{
+    if (parameter.type == ParameterType::VARIABLE)
+    {
+        auto bound = system.bound_parameters.find(parameter.symbol.value_or(""));
+        return bound != system.bound_parameters.end() && bound->second;
+    }
+
+    return parameter.type == ParameterType::EXPRESSION && is_index_expression(system, parameter.expression.get());
+}
+
+std::vector<Parameter> get_needed_parameter_list(SystemDeclarations& system, Symbol& symbol)
+{
+    if (auto state_variable = system.find_state_variable(symbol))
+    {
+        return state_variable->symbol.parameters;
     }
 
     std::cerr << "Failed to find catchall definition for " << symbol.to_string() << "\n";
@@ -102,29 +158,94 @@ std::string generate_parameters_index(SystemDeclarations& system, Symbol& symbol
         return "0";
     }
 
+    // Each index steps over every entry of the faster ones, the first index is the fastest unless @LAYOUT says row_major
+    auto layout = system.list_layouts.find(symbol.to_string());
+    bool row_major = layout != system.list_layouts.end() && layout->second.row_major;
     std::string index_jump = "";
-    for (int i = 0; i < symbol.parameters.size(); ++i)
+    for (size_t n = 0; n < symbol.parameters.size(); ++n)
     {
-        if (i != 0) 
+        size_t i = row_major ? symbol.parameters.size() - 1 - n : n;
+        if (n != 0) 
         {
             index_str << " + " << index_jump << " * (";
         }
         index_str << "("  << generate_parameter_value(system, symbol.parameters[i]) << " - 1)";
-        if (i != 0) index_str << ")";
-
-        auto range_symbol = original_parameters[i].symbol.value();
-        auto range = system.ranges[range_symbol];
+        if (n != 0) index_str << ")";
 
-        std::string range_size = "(" + range.end->generate(system) + " - " + range.start->generate(system) + " + 1)";
-        if (i != 0) index_jump += range_size;
-        index_jump += range_size;
+        index_jump += (n != 0 ? " * " : "") + generate_range_size(system, original_parameters[i].symbol.value());
     }
 
     return index_str.str();
 }
 
+bool is_constexpr_range(SystemDeclarations& system, std::string range_symbol)
+{
+    auto& range = system.ranges[range_symbol];
+    return range.start->is_constexpr(system) && range.end->is_constexpr(system);
+}
+
+std::string generate_range_start(SystemDeclarations& system, std::string range_symbol)
+{
+    return is_constexpr_range(system, range_symbol) ? "RANGE_" + range_symbol + "_START" : system.ranges[range_symbol].start->generate(system);
+}
+
+std::string generate_range_end(SystemDeclarations& system, std::string range_symbol)
+{
+    return is_constexpr_range(system, range_symbol) ? "RANGE_" + range_symbol + "_END" : system.ranges[range_symbol].end->generate(system);
+}
+
+std::string generate_range_size(SystemDeclarations& system, std::string range_symbol)
+{
+    if (is_constexpr_range(system, range_symbol))
+    {
+        return "RANGE_" + range_symbol + "_SIZE";
+    }
+    auto& range = system.ranges[range_symbol];
+    return "(" + range.end->generate(system) + " - " + range.start->generate(system) + " + 1)";
+}
+
+// Whole numbers stay int literals so index arithmetic keeps C++ integer semantics
+std::string ConstantExpression::generate(SystemDeclarations& system)
+{
+    std::stringstream str;
+    str << value;
+    if (system.precision != Precision::DOUBLE && str.str().find_first_of(".e") != std::string::npos)
+    {
+        str << "f";
+    }
+    return str.str();
+}
+
+// Float code reads the double state through a cast, otherwise the arithmetic would be promoted back to double
+std::string generate_state_read(SystemDeclarations& system, std::string access)
+{
+    if (system.precision == Precision::MIXED)
+    {
+        return "((float)" + access + ")";
+    }
+    return access;
+}
+
+// Math functions take float overloads only if every argument is a float, index variables would pick double
+std::string generate_real_argument(SystemDeclarations& system, std::string argument)
+{
+    if (system.precision == Precision::DOUBLE)
+    {
+        return argument;
+    }
+    return "(float)(" + argument + ")";
+}
+
 std::string SymbolExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
+    auto intermediate = system.intermediates.find(symbol.name);
+    if (intermediate != system.intermediates.end())
+        return intermediate->second;
+
     std::stringstream str;
 
     SymbolType type = system.resolve_symbol_type(symbol);
@@ -132,12 +253,12 @@ std::string SymbolExpression::generate(SystemDeclarations& system)
     {
         case SymbolType::STATE:
             if (symbol.parameters.size() > 0) {
-                str << "values[INDEX_" << symbol.to_string() << "_START + " << generate_parameters_index(system, symbol) << "]";
-                return str.str();
+                str << "values[" << generate_state_index(system, symbol) << "]";
+                return generate_state_read(system, str.str());
             }
 
             str << "values[INDEX_" << symbol.to_string() << "]";
-            return str.str();
+            return generate_state_read(system, str.str());
         case SymbolType::PARAMETER:
             if (!system.bound_parameters.count(symbol.to_string()))
             {
@@ -146,15 +267,23 @@ std::string SymbolExpression::generate(SystemDeclarations& system)
             }
             return symbol.to_string();
         case SymbolType::FUNCTION:
-            for (auto& f : system.function_definitions)
+            if (auto function = system.find_function_definition(symbol))
             {
-                if (f.symbol != symbol) continue;
-                
+                auto& f = *function;
                 if (f.is_constant(system))
                 {
                     return symbol.to_string();
                 }
 
+                if (f.is_tabulated(system))
+                {
+                    // Shifted index variables read the table like a slice of an array
+                    auto& parameter = symbol.parameters[0];
+                    bool by_index = is_index_parameter(system, parameter);
+                    str << symbol.to_string() << "_table" << (by_index ? "[" : "(") << generate_parameter_value(system, parameter) << (by_index ? "]" : ")");
+                    return str.str();
+                }
+
                 str << symbol.to_string() << "(";
                 for (auto i = 0; i < symbol.parameters.size(); ++i)
                 {
@@ -172,9 +301,8 @@ std::string SymbolExpression::generate(SystemDeclarations& system)
             std::cerr << "Error: Function " << symbol.name << " is undefined.\n";
             return "0";
         case SymbolType::SUMMATION:
-            for (auto& summation : system.summation_definitions)
+            if (system.find_summation(symbol) != nullptr)
             {
-                if (summation.symbol != symbol) continue;
                 return symbol.to_string() + "(values)";
             }
 
@@ -186,20 +314,81 @@ std::string SymbolExpression::generate(SystemDeclarations& system)
     return symbol.to_string();
 }
 
+bool SymbolExpression::is_constexpr(SystemDeclarations& system)
+{
+    return symbol.parameters.empty() && !system.bound_parameters.count(symbol.name) && system.constexpr_constants.count(symbol.name);
+}
+
+bool SymbolExpression::find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+{
+    if (symbol.parameters.empty())
+    {
+        auto bound = system.bound_parameters.find(symbol.name);
+        return bound != system.bound_parameters.end() && bound->second;
+    }
+
+    bool reads_index = false;
+    std::vector<Expression*> arguments;
+    for (auto& parameter : symbol.parameters)
+    {
+        if (parameter.type == ParameterType::EXPRESSION)
+            arguments.push_back(parameter.expression.get());
+        else if (system.bound_parameters.count(parameter.symbol.value()) && system.bound_parameters[parameter.symbol.value()])
+            reads_index = true;
+    }
+    return find_operand_invariants(system, arguments, invariants, reads_index);
+}
+
+void SymbolExpression::find_symbols(std::vector<Symbol*>& symbols)
+{
+    symbols.push_back(&symbol);
+    for (auto& parameter : symbol.parameters)
+    {
+        if (parameter.type == ParameterType::EXPRESSION)
+            parameter.expression->find_symbols(symbols);
+    }
+}
+
+bool find_operand_invariants(SystemDeclarations& system, std::vector<Expression*> operands, std::vector<Expression*>& invariants, bool reads_index)
+{
+    std::vector<Expression*> hoistable;
+    for (auto operand : operands)
+    {
+        if (operand->find_loop_invariants(system, invariants))
+            reads_index = true;
+        else if (operand->has_state_dependencies(system))
+            hoistable.push_back(operand);
+    }
+    if (reads_index)
+        invariants.insert(invariants.end(), hoistable.begin(), hoistable.end());
+    return reads_index;
+}
+
+bool read_loop_invariant(SystemDeclarations& system, const Expression* expression, std::string& local)
+{
+    auto hoisted = system.loop_invariants.find(expression);
+    if (hoisted == system.loop_invariants.end())
+        return false;
+    local = hoisted->second;
+    return true;
+}
+
 bool SymbolExpression::has_state_dependencies(SystemDeclarations& system)
 {
-    // Probably better as a map, having this ordered is nice for generation though
-    for (StateVariable& dep : system.state_variables)
+    for (auto& parameter : symbol.parameters)
     {
-        if (dep.symbol == symbol) return true;
+        if (parameter.type == ParameterType::EXPRESSION && parameter.expression->has_state_dependencies(system)) return true;
     }
 
-    if (symbol.type == SymbolType::SUMMATION)
+    if (system.find_state_variable(symbol) != nullptr) return true;
+
+    // Summations are always called with the state, whatever the summand reads
+    if (system.find_summation(symbol) != nullptr) return true;
+
+    // Dependencies are followed through calls, a function calling a state dependent one needs the state too
+    if (auto function = system.find_function_definition(symbol))
     {
-        for (auto& summation : system.summation_definitions)
-        {
-            if (summation.symbol == symbol && summation.summand->has_state_dependencies(system)) return true;
-        }
+        return function->is_state_dependent(system);
     }
 
     return false;
@@ -207,6 +396,10 @@ bool SymbolExpression::has_state_dependencies(SystemDeclarations& system)
 
 std::string AddExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
     code << "((" << lhs->generate(system) << ") + (" << rhs->generate(system) << "))";
     return code.str();
@@ -214,6 +407,10 @@ std::string AddExpression::generate(SystemDeclarations& system)
 
 std::string SubtractExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
     code << "((" << lhs->generate(system) << ") - (" << rhs->generate(system) << "))";
     return code.str();
@@ -221,6 +418,10 @@ std::string SubtractExpression::generate(SystemDeclarations& system)
 
 std::string MultiplyExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
     code << "((" << lhs->generate(system) << ") * (" << rhs->generate(system) << "))";
     return code.str();
@@ -228,6 +429,10 @@ std::string MultiplyExpression::generate(SystemDeclarations& system)
 
 std::string DivideExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
     code << "((" << lhs->generate(system) << ") / (" << rhs->generate(system) << "))";
     return code.str();
@@ -235,6 +440,10 @@ std::string DivideExpression::generate(SystemDeclarations& system)
 
 std::string ExponentExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     if (!base) {
         std::cerr << "Error: Exponent expression is missing base." << std::endl;
         return "";
@@ -246,20 +455,28 @@ std::string ExponentExpression::generate(SystemDeclarations& system)
     }
 
     std::stringstream code;
-    code << "std::pow(" << base->generate(system) << ", " << exp->generate(system) << ")";
+    code << "std::pow(" << generate_real_argument(system, base->generate(system)) << ", " << generate_real_argument(system, exp->generate(system)) << ")";
     return code.str();
 }
 
 std::string SqrtExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
-    code << "std::sqrt(" << base->generate(system) << ")";
+    code << "std::sqrt(" << generate_real_argument(system, base->generate(system)) << ")";
     return code.str();
 }
 
 std::string ExpExpression::generate(SystemDeclarations& system)
 {
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
     std::stringstream code;
-    code << "std::exp(" << exp->generate(system) << ")";
+    code << "std::exp(" << generate_real_argument(system, exp->generate(system)) << ")";
     return code.str();
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "tokenize.h"
 
 class SystemDeclarations;
+class BytecodeBuilder;
 
 struct FunctionDefinition
 {
@@ -30,6 +31,8 @@ struct Function
 {
     Symbol symbol;
     std::vector<FunctionDefinition> definitions;
+    bool visiting = false; // Set while is_state_dependent walks the definitions, catches recursion
+    bool recursive = false;
 
     Function()
         : symbol("error")
@@ -48,6 +51,7 @@ struct Function
     }
 
     bool is_state_dependent(SystemDeclarations& system);
+    bool is_tabulated(SystemDeclarations& system);
 
     FunctionDefinition get_catchall_definition()
     {
@@ -79,12 +83,39 @@ class Expression
 {
 public:
     virtual std::string generate(SystemDeclarations& system) = 0;
+    virtual int lower(BytecodeBuilder& builder) = 0; // Emits bytecode for the expression, returns its register
+    virtual std::string generate_tangent(SystemDeclarations& system) = 0; // Forward derivative, see sensitivity.h
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed) = 0; // Reverse derivative, see adjoint.h
+    virtual std::string generate_explicit(SystemDeclarations& system); // The EXPLICIT() terms alone, see imex.h
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return false;
     }
+    virtual bool has_explicit_terms()
+    {
+        return false;
+    }
+    virtual bool is_constexpr(SystemDeclarations& /*system*/) // Only literals, arithmetic and constexpr constants
+    {
+        return false;
+    }
+    // Whether the expression reads an index variable bound in bound_parameters. If it does, its operands which don't
+    // are added to invariants, to be evaluated once before the loop, see generate_loop_invariants in generator.h
+    virtual bool find_loop_invariants(SystemDeclarations& /*system*/, std::vector<Expression*>& /*invariants*/)
+    {
+        return true;
+    }
+    virtual void find_symbols(std::vector<Symbol*>& /*symbols*/) // Every symbol read, including those in arguments
+    {
+    }
 };
 
+// Loop invariant code motion over generated loops, see generate_loop_invariants in generator.h. Operands which don't
+// read a loop index are hoisted whole when another one does, if they read the state, call or sum
+bool find_operand_invariants(SystemDeclarations& system, std::vector<Expression*> operands, std::vector<Expression*>& invariants, bool reads_index = false);
+// The local holding the expression when it was hoisted out of the loop being generated
+bool read_loop_invariant(SystemDeclarations& system, const Expression* expression, std::string& local);
+
 class ConstantExpression : public Expression
 {
 public:
@@ -94,11 +125,19 @@ public:
         : value(value)
     {}
 
-    virtual std::string generate(SystemDeclarations& system)
+    virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+
+    virtual bool is_constexpr(SystemDeclarations& /*system*/)
+    {
+        return true;
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& /*system*/, std::vector<Expression*>& /*invariants*/)
     {
-        std::stringstream str;
-        str << value;
-        return str.str();
+        return false;
     }
 };
 
@@ -112,7 +151,13 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
     virtual bool has_state_dependencies(SystemDeclarations& system);
+    virtual bool is_constexpr(SystemDeclarations& system);
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants);
+    virtual void find_symbols(std::vector<Symbol*>& symbols);
 };
 
 class NegateExpression : public Expression
@@ -126,15 +171,44 @@ public:
 
     virtual std::string generate(SystemDeclarations& system)
     {
+        std::string hoisted;
+        if (read_loop_invariant(system, this, hoisted))
+            return hoisted;
+
         std::stringstream code;
         code << "-(" << negated_expression->generate(system) << ")";
         return code.str();
     }
 
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+    virtual std::string generate_explicit(SystemDeclarations& system);
+
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return negated_expression->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return negated_expression->has_explicit_terms();
+    }
+
+    virtual bool is_constexpr(SystemDeclarations& system)
+    {
+        return negated_expression->is_constexpr(system);
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {negated_expression.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        negated_expression->find_symbols(symbols);
+    }
 };
 
 class AddExpression : public Expression
@@ -148,11 +222,36 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+    virtual std::string generate_explicit(SystemDeclarations& system);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return lhs->has_state_dependencies(system) || rhs->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return lhs->has_explicit_terms() || rhs->has_explicit_terms();
+    }
+
+    virtual bool is_constexpr(SystemDeclarations& system)
+    {
+        return lhs->is_constexpr(system) && rhs->is_constexpr(system);
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {lhs.get(), rhs.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        lhs->find_symbols(symbols);
+        rhs->find_symbols(symbols);
+    }
 };
 
 class SubtractExpression : public Expression
@@ -166,11 +265,36 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+    virtual std::string generate_explicit(SystemDeclarations& system);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return lhs->has_state_dependencies(system) || rhs->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return lhs->has_explicit_terms() || rhs->has_explicit_terms();
+    }
+
+    virtual bool is_constexpr(SystemDeclarations& system)
+    {
+        return lhs->is_constexpr(system) && rhs->is_constexpr(system);
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {lhs.get(), rhs.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        lhs->find_symbols(symbols);
+        rhs->find_symbols(symbols);
+    }
 };
 
 class MultiplyExpression : public Expression
@@ -184,11 +308,35 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return lhs->has_state_dependencies(system) || rhs->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return lhs->has_explicit_terms() || rhs->has_explicit_terms();
+    }
+
+    virtual bool is_constexpr(SystemDeclarations& system)
+    {
+        return lhs->is_constexpr(system) && rhs->is_constexpr(system);
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {lhs.get(), rhs.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        lhs->find_symbols(symbols);
+        rhs->find_symbols(symbols);
+    }
 };
 
 class DivideExpression : public Expression
@@ -202,11 +350,35 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return lhs->has_state_dependencies(system) || rhs->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return lhs->has_explicit_terms() || rhs->has_explicit_terms();
+    }
+
+    virtual bool is_constexpr(SystemDeclarations& system)
+    {
+        return lhs->is_constexpr(system) && rhs->is_constexpr(system);
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {lhs.get(), rhs.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        lhs->find_symbols(symbols);
+        rhs->find_symbols(symbols);
+    }
 };
 
 class ExponentExpression : public Expression
@@ -220,11 +392,30 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return base->has_state_dependencies(system) || exp->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return base->has_explicit_terms() || exp->has_explicit_terms();
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {base.get(), exp.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        base->find_symbols(symbols);
+        exp->find_symbols(symbols);
+    }
 };
 
 class SqrtExpression : public Expression
@@ -237,11 +428,29 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return base->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return base->has_explicit_terms();
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {base.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        base->find_symbols(symbols);
+    }
 };
 
 class ExpExpression : public Expression
@@ -254,11 +463,66 @@ public:
     {}
 
     virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
 
     virtual bool has_state_dependencies(SystemDeclarations& system)
     {
         return exp->has_state_dependencies(system);
     }
+
+    virtual bool has_explicit_terms()
+    {
+        return exp->has_explicit_terms();
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {exp.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        exp->find_symbols(symbols);
+    }
+};
+
+// Marks a term for the explicit half of an IMEX split, see imex.h. Anywhere else it's the term's value
+class ExplicitExpression : public Expression
+{
+public:
+    std::shared_ptr<Expression> term;
+
+    ExplicitExpression(std::shared_ptr<Expression> term)
+        : term(term)
+    {}
+
+    virtual std::string generate(SystemDeclarations& system);
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+    virtual std::string generate_explicit(SystemDeclarations& system);
+
+    virtual bool has_state_dependencies(SystemDeclarations& system)
+    {
+        return term->has_state_dependencies(system);
+    }
+
+    virtual bool has_explicit_terms()
+    {
+        return true;
+    }
+
+    virtual bool find_loop_invariants(SystemDeclarations& system, std::vector<Expression*>& invariants)
+    {
+        return find_operand_invariants(system, {term.get()}, invariants);
+    }
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        term->find_symbols(symbols);
+    }
 };
 
 class RangeExpression : public Expression
@@ -275,7 +539,24 @@ public:
         std::cerr << "Error: Range expression must be either standalone or used for a summation.\n";
         return "";
     }
+
+    virtual int lower(BytecodeBuilder& builder);
+    virtual std::string generate_tangent(SystemDeclarations& system);
+    virtual std::string generate_adjoint(SystemDeclarations& system, std::string seed);
+
+    virtual void find_symbols(std::vector<Symbol*>& symbols)
+    {
+        range.start->find_symbols(symbols);
+        range.end->find_symbols(symbols);
+    }
 };
 
 std::string generate_parameter_value(SystemDeclarations& system, Parameter& parameter);
-std::string generate_parameters_index(SystemDeclarations& system, Symbol& symbol);
\ No newline at end of file
+bool is_index_parameter(SystemDeclarations& system, Parameter& parameter);
+std::string generate_parameters_index(SystemDeclarations& system, Symbol& symbol);
+
+// Bounds and size of a range, the RANGE_ constants when they're constexpr and the range's expressions otherwise
+bool is_constexpr_range(SystemDeclarations& system, std::string range_symbol);
+std::string generate_range_start(SystemDeclarations& system, std::string range_symbol);
+std::string generate_range_end(SystemDeclarations& system, std::string range_symbol);
+std::string generate_range_size(SystemDeclarations& system, std::string range_symbol);
\ No newline at end of file
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -8,6 +11,15 @@
 
 #include "expression.h"
 #include "parse.h"
+#include "generator.h"
+#include "sensitivity.h"
+#include "adjoint.h"
+#include "imex.h"
+#include "multirate.h"
+#include "layout.h"
+#include "schedule.h"
+#include "pattern.h"
+#include "scaling.h"
 
 std::string generate_index_range(SystemDeclarations &system, Symbol state_symbol)
 {
@@ -31,13 +43,15 @@ std::string generate_index_range(SystemDeclarations &system, Symbol state_symbol
     std::string size_str = "";
     for (size_t i = 0; i < state_symbol.parameters.size(); ++i)
     {
-        auto range = system.ranges[state_symbol.parameters[i].symbol.value()];
-
         if (i != 0) size_str += " * ";
-        size_str += "(" + range.end->generate(system) + " - " + range.start->generate(system) + " + 1)";
+        size_str += generate_range_size(system, state_symbol.parameters[i].symbol.value());
+    }
+    if (get_list_layout(system, state_symbol.to_string()).kind != LayoutKind::SEPARATE)
+    {
+        return generate_group_indices(system, state_symbol.to_string(), size_str);
     }
-    str << "\nconst size_t INDEX_" << state_symbol.to_string() << "_START = " << system.next_index << ";";
-    str << "\nconst size_t INDEX_" << state_symbol.to_string() << "_SIZE = " << size_str << ";";
+    str << "\n" << system.index_type() << " INDEX_" << state_symbol.to_string() << "_START = " << system.next_index << ";";
+    str << "\n" << system.index_type() << " INDEX_" << state_symbol.to_string() << "_SIZE = " << size_str << ";";
     system.next_index = "INDEX_" + state_symbol.to_string() + "_START + INDEX_" + state_symbol.to_string() + "_SIZE";
 
     return str.str();
@@ -49,42 +63,169 @@ void add_tabs(std::stringstream& str, size_t num_tabs)
         str << "\t";
 }
 
-std::string generate_setter_list(SystemDeclarations &system, InitialState &initial_state)
+std::string generate_profile_scope(SystemDeclarations &system, std::string label, size_t num_tabs)
 {
-    for (auto p : initial_state.symbol.parameters)
+    if (!system.use_profiler)
+        return "";
+
+    std::stringstream str;
+    str << "\n";
+    add_tabs(str, num_tabs);
+    str << "ProfileScope __profile(profile_table[" << system.profile_labels.size() << "]);";
+    system.profile_labels.push_back(label);
+
+    return str.str();
+}
+
+std::string generate_profiler_runtime(SystemDeclarations &system)
+{
+    if (!system.use_profiler)
+        return "";
+
+    std::stringstream str;
+
+    str << "\n#include <algorithm>"
+        << "\n#include <chrono>"
+        << "\n#include <cstdio>"
+        << "\n#include <vector>"
+        << "\n"
+        << "\n#if defined(__x86_64__) || defined(__i386__)"
+        << "\n#include <x86intrin.h>"
+        << "\n#define PROFILE_TICKS() __rdtsc()"
+        << "\n#define PROFILE_TICK_UNIT \"cycles\""
+        << "\n#else"
+        << "\n#define PROFILE_TICKS() (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>("
+        << "std::chrono::steady_clock::now().time_since_epoch()).count()"
+        << "\n#define PROFILE_TICK_UNIT \"ns\""
+        << "\n#endif"
+        << "\n"
+        << "\nstruct ProfileEntry"
+        << "\n{"
+        << "\n\tconst char* name;"
+        << "\n\tunsigned long long calls;"
+        << "\n\tunsigned long long ticks;"
+        << "\n};"
+        << "\n"
+        << "\nextern ProfileEntry profile_table[];"
+        << "\n"
+        << "\nstruct ProfileScope"
+        << "\n{"
+        << "\n\tProfileEntry& entry;"
+        << "\n\tunsigned long long start;"
+        << "\n"
+        << "\n\tProfileScope(ProfileEntry& entry) : entry(entry), start(PROFILE_TICKS()) {}"
+        << "\n\t~ProfileScope() { entry.calls += 1; entry.ticks += PROFILE_TICKS() - start; }"
+        << "\n};"
+        << "\n";
+
+    return str.str();
+}
+
+std::string generate_profiler_report(SystemDeclarations &system)
+{
+    if (!system.use_profiler)
+        return "";
+
+    std::stringstream str;
+
+    str << "\n\nProfileEntry profile_table[] = {";
+    for (size_t i = 0; i < system.profile_labels.size(); ++i)
     {
-        if (p.type != ParameterType::VARIABLE)
-        {
-            std::cerr << "Error: Trying to generate indices for a non variable list parameter." << std::endl;
-            return "";
-        }
+        str << "\n\t{\"" << system.profile_labels[i] << "\", 0, 0},";
+    }
+    str << "\n};";
+
+    // Ticks are inclusive, so a function called from a list loop is also counted in the loop
+    str << "\n\nstruct ProfileReport"
+        << "\n{"
+        << "\n\t~ProfileReport()"
+        << "\n\t{"
+        << "\n\t\tstd::vector<ProfileEntry> entries(profile_table, profile_table + " << system.profile_labels.size() << ");"
+        << "\n\t\tstd::sort(entries.begin(), entries.end(), [](const ProfileEntry& a, const ProfileEntry& b) { return a.ticks > b.ticks; });"
+        << "\n\t\tstd::fprintf(stderr, \"\\n%-40s %14s %20s %14s\\n\", \"region\", \"calls\", \"inclusive \" PROFILE_TICK_UNIT, \"per call\");"
+        << "\n\t\tfor (auto& entry : entries)"
+        << "\n\t\t{"
+        << "\n\t\t\tif (entry.calls == 0) continue;"
+        << "\n\t\t\tstd::fprintf(stderr, \"%-40s %14llu %20llu %14.1f\\n\", entry.name, entry.calls, entry.ticks, (double)entry.ticks / entry.calls);"
+        << "\n\t\t}"
+        << "\n\t}"
+        << "\n} profile_report;";
 
-        auto &range_symbol = p.symbol.value();
-        if (!system.ranges.count(range_symbol))
+    return str.str();
+}
+
+// The statements which set one entry of a derivative or initial state block. Adjoint blocks instead push the
+// entry's seed in seeds[] back through the right hand side, see adjoint.h
+std::string generate_entry(SystemDeclarations &system, DerivativeMode mode, std::string indentation, std::string array, std::string index, Expression &rhs)
+{
+    switch (mode)
+    {
+        case DerivativeMode::VALUE:
+        case DerivativeMode::FAST:
+        case DerivativeMode::SLOW:
+            return indentation + array + "[" + index + "] = " + rhs.generate(system) + ";\n";
+        case DerivativeMode::TANGENT:
+            return indentation + array + "[" + index + "] = " + rhs.generate_tangent(system) + ";\n";
+        case DerivativeMode::EXPLICIT:
+            return indentation + array + "[" + index + "] = " + rhs.generate_explicit(system) + ";\n";
+        case DerivativeMode::IMPLICIT:
+            {
+            system.omit_explicit_terms = true;
+            auto entry = indentation + array + "[" + index + "] = " + rhs.generate(system) + ";\n";
+            system.omit_explicit_terms = false;
+            return entry;
+            }
+        case DerivativeMode::ADJOINT:
+            {
+            // Entries an override replaced have a zero seed. Skipping them also skips the neighbours out of the
+            // list's range which the catch-all definition would read at its ends
+            system.adjoint_temporaries = 0;
+            auto statements = rhs.generate_adjoint(system, "seeds[" + index + "]");
+            if (statements.empty())
+                return "";
+            return indentation + "if (seeds[" + index + "] != 0.0)\n" + indentation + "{\n"
+                   + indent_statements(statements, indentation + "\t") + indentation + "}\n";
+            }
+    }
+    return "";
+}
+
+std::string generate_loop_invariants(SystemDeclarations &system, Expression &body, std::string indentation)
+{
+    std::vector<Expression*> invariants;
+    if (!body.find_loop_invariants(system, invariants) && body.has_state_dependencies(system))
+        invariants.push_back(&body);
+
+    std::stringstream str;
+    std::unordered_map<std::string, std::string> locals; // Repeated subexpressions share one local
+    for (auto invariant : invariants)
+    {
+        std::string value = invariant->generate(system);
+        auto local = locals.find(value);
+        if (local == locals.end())
         {
-            std::cerr << "Error: Tried to generate setters for a list which doesn't exist.\n";
-            return "";
+            local = locals.emplace(value, "invariant_" + std::to_string(system.loop_invariant_locals++)).first;
+            str << indentation << "const " << system.real_type() << " " << local->second << " = " << value << ";\n";
         }
+        system.loop_invariants[invariant] = local->second;
     }
+    return str.str();
+}
 
+// Emits the range loops around one list entry, the entry is generated with the loop indices bound
+std::string generate_list_loops(SystemDeclarations &system, Symbol &symbol, size_t nesting_level, std::function<std::string(std::string)> generate_body)
+{
     std::stringstream str;
-    std::string index_string;
-
-    str << "\n";
-    
-    system.bound_parameters.clear();
 
-    size_t nesting_level = 1;
-    for (size_t i = 0; i < initial_state.symbol.parameters.size(); ++i)
+    for (size_t i = 0; i < symbol.parameters.size(); ++i)
     {
-        auto p = initial_state.symbol.parameters[i];
+        auto p = symbol.parameters[i];
         auto range_symbol = p.symbol.value();
-        auto range = system.ranges[range_symbol];
         system.bound_parameters[range_symbol] = true;
 
         add_tabs(str, nesting_level);
-        str << "for (size_t " << range_symbol << " = " << range.start->generate(system) << "; "
-            << range_symbol << " <= " << range.end->generate(system) << "; "
+        str << "for (size_t " << range_symbol << " = " << generate_range_start(system, range_symbol) << "; "
+            << range_symbol << " <= " << generate_range_end(system, range_symbol) << "; "
             << "++" << range_symbol << ")\n";
         add_tabs(str, nesting_level);
         str << "{\n";
@@ -92,13 +233,12 @@ std::string generate_setter_list(SystemDeclarations &system, InitialState &initi
         nesting_level += 1;
     }
 
-    add_tabs(str, nesting_level);
-    str << "values[INDEX_" << initial_state.symbol.to_string() << "_START + " 
-        << generate_parameters_index(system, initial_state.symbol) << "] = "
-        << initial_state.rhs->generate(system) << ";\n";
+    std::stringstream indentation;
+    add_tabs(indentation, nesting_level);
+    str << generate_body(indentation.str());
     nesting_level -= 1;
 
-    for (; nesting_level > 0; --nesting_level)
+    for (size_t i = 0; i < symbol.parameters.size(); ++i, --nesting_level)
     {
         add_tabs(str, nesting_level);
         str << "}\n";
@@ -107,7 +247,40 @@ std::string generate_setter_list(SystemDeclarations &system, InitialState &initi
     return str.str();
 }
 
-std::string generate_derivative_list(SystemDeclarations &system, StateVariable &state_variable)
+std::string generate_setter_list(SystemDeclarations &system, InitialState &initial_state, DerivativeMode mode)
+{
+    for (auto p : initial_state.symbol.parameters)
+    {
+        if (p.type != ParameterType::VARIABLE)
+        {
+            std::cerr << "Error: Trying to generate indices for a non variable list parameter." << std::endl;
+            return "";
+        }
+
+        auto &range_symbol = p.symbol.value();
+        if (!system.ranges.count(range_symbol))
+        {
+            std::cerr << "Error: Tried to generate setters for a list which doesn't exist.\n";
+            return "";
+        }
+    }
+
+    std::stringstream str;
+
+    str << "\n";
+    
+    system.bound_parameters.clear();
+
+    std::string array = mode == DerivativeMode::TANGENT ? "tangents" : "values";
+    str << generate_list_loops(system, initial_state.symbol, 1, [&](std::string indentation) {
+        std::string index = generate_state_index(system, initial_state.symbol);
+        return generate_entry(system, mode, indentation, array, index, *initial_state.rhs);
+    });
+
+    return str.str();
+}
+
+std::string generate_derivative_list(SystemDeclarations &system, StateVariable &state_variable, DerivativeMode mode)
 {
     for (auto p : state_variable.symbol.parameters) // Skip constrained definitions - they're handled in a separate pass
     {
@@ -131,39 +304,49 @@ std::string generate_derivative_list(SystemDeclarations &system, StateVariable &
     }
 
     std::stringstream str;
-    std::string index_string;
 
     str << "\n";
 
     system.bound_parameters.clear();
 
     size_t nesting_level = 1;
-    for (size_t i = 0; i < state_variable.symbol.parameters.size(); ++i)
+    bool profiled = system.use_profiler && mode == DerivativeMode::VALUE;
+    if (profiled)
     {
-        auto p = state_variable.symbol.parameters[i];
-        auto range_symbol = p.symbol.value();
-        auto range = system.ranges[range_symbol];
-        system.bound_parameters[range_symbol] = true;
+        std::string label = "d/dt " + state_variable.symbol.to_string() + "[";
+        for (size_t i = 0; i < state_variable.symbol.parameters.size(); ++i)
+        {
+            label += (i != 0 ? ", " : "") + state_variable.symbol.parameters[i].symbol.value();
+        }
+        label += "]";
 
         add_tabs(str, nesting_level);
-        str << "for (size_t " << range_symbol << " = " << range.start->generate(system) << "; "
-            << range_symbol << " <= " << range.end->generate(system) << "; "
-            << "++" << range_symbol << ")\n";
-        add_tabs(str, nesting_level);
-        str << "{\n";
-
+        str << "{" << generate_profile_scope(system, label, nesting_level + 1) << "\n";
         nesting_level += 1;
     }
 
-    add_tabs(str, nesting_level);
-    str << "derivatives[INDEX_" << state_variable.symbol.to_string() << "_START + " 
-        << generate_parameters_index(system, state_variable.symbol) << "] = "
-        << state_variable.rhs->generate(system) << ";\n";
-    nesting_level -= 1;
+    // Tangent and adjoint entries differentiate the body and the imex halves each generate part of it, only values are hoisted
+    if (mode == DerivativeMode::VALUE || mode == DerivativeMode::FAST || mode == DerivativeMode::SLOW)
+    {
+        for (auto& p : state_variable.symbol.parameters)
+        {
+            system.bound_parameters[p.symbol.value()] = true;
+        }
+        std::stringstream indentation;
+        add_tabs(indentation, nesting_level);
+        str << generate_loop_invariants(system, *state_variable.rhs, indentation.str());
+    }
 
-    for (; nesting_level > 0; --nesting_level)
+    std::string array = mode == DerivativeMode::TANGENT ? "tangent_derivatives" : "derivatives";
+    str << generate_list_loops(system, state_variable.symbol, nesting_level, [&](std::string indentation) {
+        std::string index = generate_state_index(system, state_variable.symbol);
+        return generate_entry(system, mode, indentation, array, index, *state_variable.rhs);
+    });
+    system.loop_invariants.clear();
+
+    if (profiled)
     {
-        add_tabs(str, nesting_level);
+        add_tabs(str, 1);
         str << "}\n";
     }
 
@@ -188,11 +371,10 @@ std::string generate_csv_list(SystemDeclarations &system, Symbol state_symbol)
             return "";
         }
 
-        auto range = system.ranges[range_symbol];
         str << "\n";
         add_tabs(str, nesting_level);
-        str << "for (size_t " << range_symbol << " = " << range.start->generate(system) << "; "
-            << range_symbol << " <= " << range.end->generate(system)  << "; ++" << range_symbol << ")";
+        str << "for (size_t " << range_symbol << " = " << generate_range_start(system, range_symbol) << "; "
+            << range_symbol << " <= " << generate_range_end(system, range_symbol)  << "; ++" << range_symbol << ")";
         str << "\n";
         add_tabs(str, nesting_level);
         str << "{";
@@ -235,6 +417,66 @@ std::string generate_meta(SystemDeclarations& system)
     str << "\nconst double minimum_step_size = " << system.min_step_size << ";";
     str << "\nconst double maximum_num_steps = " << system.max_num_steps << ";";
     str << "\nconst bool use_direct_solver = " << system.use_direct_solver << ";";
+    str << "\nconst double steady_state_tolerance = " << system.steady_state_tolerance << ";";
+    str << "\nconst bool use_steady_state_solver = " << system.use_steady_state_solver << ";";
+    str << "\nconst double slow_step_size = " << system.slow_step_size << ";";
+    str << "\nconst double jacobian_reuse = " << system.jacobian_reuse << ";";
+    str << "\nconst double linear_setup_frequency = " << system.linear_setup_frequency << ";";
+    str << "\nconst double delta_gamma_max = " << system.delta_gamma_max << ";";
+    str << "\nconst double maximum_nonlinear_iterations = " << system.max_nonlinear_iterations << ";";
+    str << "\nconst double maximum_order = " << system.max_order << ";";
+    str << "\nconst bool use_adaptive_reuse = " << system.use_adaptive_reuse << ";";
+
+    return str.str();
+}
+
+// Constants made of literals and earlier constexpr constants are defined in the header, so every translation unit
+// can fold them. Ranges bounded by them get constexpr bounds, and when all list ranges do, so do the state indices
+void find_constexpr_constants(SystemDeclarations &system)
+{
+    system.constexpr_constants.clear();
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_constant(system) && f.definitions.size() == 1 && f.definitions[0].expression->is_constexpr(system))
+        {
+            system.constexpr_constants.insert(f.symbol.to_string());
+        }
+    }
+
+    system.constexpr_indices = true;
+    for (auto &state_variable : system.state_variables)
+    {
+        for (auto &p : state_variable.symbol.parameters)
+        {
+            if (p.type == ParameterType::VARIABLE && system.ranges.count(p.symbol.value()) && !is_constexpr_range(system, p.symbol.value()))
+            {
+                system.constexpr_indices = false;
+            }
+        }
+    }
+}
+
+std::string generate_range_constants(SystemDeclarations &system)
+{
+    std::vector<std::string> ranges;
+    for (auto &[name, range] : system.ranges)
+    {
+        if (is_constexpr_range(system, name))
+        {
+            ranges.push_back(name);
+        }
+    }
+    std::sort(ranges.begin(), ranges.end()); // Unordered map, keep the generated code stable
+
+    std::stringstream str;
+    str << "\n";
+    for (auto &name : ranges)
+    {
+        auto &range = system.ranges[name];
+        str << "\nconstexpr size_t RANGE_" << name << "_START = " << range.start->generate(system) << ";"
+            << "\nconstexpr size_t RANGE_" << name << "_END = " << range.end->generate(system) << ";"
+            << "\nconstexpr size_t RANGE_" << name << "_SIZE = RANGE_" << name << "_END - RANGE_" << name << "_START + 1;";
+    }
 
     return str.str();
 }
@@ -247,7 +489,7 @@ std::string generate_constant_definitions(SystemDeclarations &system)
 
     for (auto &f : system.function_definitions)
     {
-        if (!f.is_constant(system))
+        if (!f.is_constant(system) || system.constexpr_constants.count(f.symbol.to_string()))
             continue;
 
         if (f.definitions.size() != 1)
@@ -256,7 +498,7 @@ std::string generate_constant_definitions(SystemDeclarations &system)
             return "0";
         }
 
-        str << "\ndouble " << f.symbol.to_string() << " = " << f.definitions[0].expression->generate(system) << ";";
+        str << "\n" << system.real_type() << " " << f.symbol.to_string() << " = " << f.definitions[0].expression->generate(system) << ";";
     }
 
     return str.str();
@@ -277,7 +519,7 @@ std::string generate_function_declarations(SystemDeclarations &system)
 
         auto main_definition = f.get_catchall_definition();
 
-        str << "\ndouble " << f.symbol.to_string() << "(";
+        str << "\n" << system.real_type() << " " << f.symbol.to_string() << "(";
         for (auto i = 0; i < main_definition.parameters.size(); ++i)
         {
             auto &p = main_definition.parameters[i];
@@ -286,12 +528,12 @@ std::string generate_function_declarations(SystemDeclarations &system)
                 std::cerr << "Error: Main definition of a function must only have variable parameters.\n";
                 continue;
             }
-            str << (i != 0 ? ", " : "") << "double " << p.symbol.value();
+            str << (i != 0 ? ", " : "") << system.real_type() << " " << p.symbol.value();
         }
 
         if (f.is_state_dependent(system))
         {
-            str << (f.symbol.parameters.size() > 0 ? ", " : "") << "double* values";
+            str << (f.symbol.parameters.size() > 0 ? ", " : "") << system.state_type() << "* values";
         }
 
         str << ");";
@@ -300,6 +542,58 @@ std::string generate_function_declarations(SystemDeclarations &system)
     return str.str();
 }
 
+std::string generate_function_definition(SystemDeclarations &system, Function &f)
+{
+    std::stringstream str;
+
+    auto name = f.symbol.to_string();
+    if (f.definitions.size() == 0)
+    {
+        std::cerr << "Error: " << name << " is missing definition.\n";
+        return "";
+    }
+
+    auto main_definition = f.get_catchall_definition();
+
+    str << "\n\n" << system.real_type() << " " << name << "(";
+    system.bound_parameters.clear();
+    for (auto i = 0; i < main_definition.parameters.size(); ++i)
+    {
+        auto p = main_definition.parameters[i];
+        if (p.type != ParameterType::VARIABLE)
+        {
+            std::cerr << "Error: Main definition of a function must only have variable parameters.\n";
+            continue;
+        }
+        str << (i != 0 ? ", " : "") << system.real_type() << " " << p.symbol.value();
+        system.bound_parameters[p.symbol.value()] = false;
+    }
+
+    if (f.is_state_dependent(system))
+    {
+        str << (f.symbol.parameters.size() > 0 ? ", " : "") << system.state_type() << "* values";
+    }
+
+    str << ")"
+        << "\n{"
+        << generate_profile_scope(system, name, 1);
+
+    for (auto definition : f.definitions)
+    {
+        if (definition.is_catchall())
+            continue;
+
+        str << "\n\tif (" << definition.get_parameter_constraints(system, main_definition) << ") {"
+            << "\n\t\t return " << definition.expression->generate(system) << ";"
+            << "\n\t}";
+    }
+
+    str << "\n\treturn " << main_definition.expression->generate(system) << ";\n"
+        << "}";
+
+    return str.str();
+}
+
 std::string generate_function_definitions(SystemDeclarations &system)
 {
     std::stringstream str;
@@ -310,50 +604,128 @@ std::string generate_function_definitions(SystemDeclarations &system)
         if (f.is_constant(system))
             continue;
 
-        auto name = f.symbol.to_string();
-        if (f.definitions.size() == 0)
-        {
-            std::cerr << "Error: " << name << " is missing definition.\n";
-            continue;
-        }
+        str << generate_function_definition(system, f);
+    }
 
-        auto main_definition = f.get_catchall_definition();
+    return str.str();
+}
 
-        str << "\n\ndouble " << name << "(";
-        system.bound_parameters.clear();
-        for (auto i = 0; i < main_definition.parameters.size(); ++i)
-        {
-            auto p = main_definition.parameters[i];
-            if (p.type != ParameterType::VARIABLE)
-            {
-                std::cerr << "Error: Main definition of a function must only have variable parameters.\n";
-                continue;
-            }
-            str << (i != 0 ? ", " : "") << "double " << p.symbol.value();
-            system.bound_parameters[p.symbol.value()] = true;
-        }
+bool has_function_tables(SystemDeclarations &system)
+{
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_tabulated(system))
+            return true;
+    }
+    return false;
+}
 
-        if (f.is_state_dependent(system))
-        {
-            str << (f.symbol.parameters.size() > 0 ? ", " : "") << "double* values";
-        }
+std::string generate_function_table_runtime(SystemDeclarations &system)
+{
+    if (!has_function_tables(system))
+        return "";
 
-        str << ")"
-            << "\n{";
+    std::stringstream str;
+    std::string real = system.real_type();
+
+    // Index arguments take the [] lookup, which is a single unsigned compare in the list loops. The function is a
+    // template argument so a table which isn't constructed yet (still zeroed) computes values instead
+    str << "\n#include <algorithm>"
+        << "\n#include <vector>"
+        << "\n"
+        << "\ntemplate <" << real << " (*compute)(" << real << ")>"
+        << "\nstruct FunctionTable"
+        << "\n{"
+        << "\n\tstatic constexpr size_t MAX_SIZE = 1 << 24;"
+        << "\n"
+        << "\n\tsize_t first;"
+        << "\n\tstd::vector<" << real << "> values;"
+        << "\n"
+        << "\n\tFunctionTable(double first, double last)"
+        << "\n\t\t: first(first > 0.0 ? (size_t)first : 0)"
+        << "\n\t{"
+        << "\n\t\tif (!(last >= (double)this->first) || last - (double)this->first >= (double)MAX_SIZE) return;"
+        << "\n\t\tsize_t size = (size_t)last - this->first + 1;"
+        << "\n\t\tvalues.reserve(size);"
+        << "\n\t\tfor (size_t i = 0; i < size; ++i) values.push_back(compute((" << real << ")(this->first + i)));"
+        << "\n\t}"
+        << "\n"
+        << "\n\t" << real << " operator[](size_t x) const"
+        << "\n\t{"
+        << "\n\t\tsize_t i = x - first;"
+        << "\n\t\treturn i < values.size() ? values[i] : compute((" << real << ")x);"
+        << "\n\t}"
+        << "\n"
+        << "\n\t" << real << " operator()(" << real << " x) const"
+        << "\n\t{"
+        << "\n\t\tdouble i = (double)x - (double)first;"
+        << "\n\t\treturn (i >= 0.0 && i < (double)values.size() && i == std::floor(i)) ? values[(size_t)i] : compute(x);"
+        << "\n\t}"
+        << "\n};"
+        << "\n";
 
-        for (auto definition : f.definitions)
-        {
-            if (definition.is_catchall())
-                continue;
+    return str.str();
+}
 
-            str << "\n\tif (" << definition.get_parameter_constraints(system, main_definition) << ") {"
-                << "\n\t\t return " << definition.expression->generate(system) << ";"
-                << "\n\t}";
-        }
+std::string generate_function_table_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_tabulated(system))
+            str << "\nextern FunctionTable<" << f.symbol.to_string() << "> " << f.symbol.to_string() << "_table;";
+    }
+
+    return str.str();
+}
+
+// Tables cover every list and summation range plus one index past the end, for the usual n + 1 neighbour.
+// They're defined after the constants in the same translation unit so the functions see initialized constants
+std::string generate_function_tables(SystemDeclarations &system)
+{
+    if (!has_function_tables(system))
+        return "";
+
+    system.bound_parameters.clear();
 
-        str << "\n\treturn " << main_definition.expression->generate(system) << ";\n"
-            << "}";
+    std::vector<std::string> ranges;
+    for (auto &[name, range] : system.ranges)
+    {
+        ranges.push_back(name);
+    }
+    std::sort(ranges.begin(), ranges.end()); // Unordered map, keep the generated code stable
+
+    std::vector<std::string> bounds;
+    for (auto &name : ranges)
+    {
+        bounds.push_back("(double)(" + system.ranges[name].start->generate(system) + ")");
+        bounds.push_back("(double)(" + system.ranges[name].end->generate(system) + ")");
+    }
+    for (auto &summation : system.summation_definitions)
+    {
+        bounds.push_back("(double)(" + summation.range.start->generate(system) + ")");
+        bounds.push_back("(double)(" + summation.range.end->generate(system) + ")");
+    }
+
+    std::string bound_list;
+    for (size_t i = 0; i < bounds.size(); ++i)
+    {
+        bound_list += (i != 0 ? ", " : "") + bounds[i];
+    }
+
+    std::stringstream str;
+    str << "\nstatic const double FUNCTION_TABLE_FIRST = std::min({ " << bound_list << " });";
+    str << "\nstatic const double FUNCTION_TABLE_LAST = std::max({ " << bound_list << " }) + 1;";
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_tabulated(system))
+        {
+            str << "\nFunctionTable<" << f.symbol.to_string() << "> " << f.symbol.to_string()
+                << "_table(FUNCTION_TABLE_FIRST, FUNCTION_TABLE_LAST);";
+        }
     }
+    str << "\n";
 
     return str.str();
 }
@@ -372,7 +744,7 @@ std::string generate_state_indices(SystemDeclarations &system)
         }
         else
         {
-            str << "\nconst size_t INDEX_" << state_variables[i].symbol.to_string() << " = " << system.next_index << ";";
+            str << "\n" << system.index_type() << " INDEX_" << state_variables[i].symbol.to_string() << " = " << system.next_index << ";";
             system.next_index = "INDEX_" + state_variables[i].symbol.to_string() + " + 1";
         }
     }
@@ -380,36 +752,96 @@ std::string generate_state_indices(SystemDeclarations &system)
     return str.str();
 }
 
+std::string generate_summation_definition(SystemDeclarations& system, Summation &summation)
+{
+    std::stringstream str;
+
+    system.bound_parameters[summation.index.name] = true;
+    str << "\n\n" << system.real_type() << " " << summation.symbol.to_string() << "(" << system.state_type() << "* values) {"
+        << generate_profile_scope(system, summation.symbol.to_string(), 1);
+    std::string invariants = generate_loop_invariants(system, *summation.summand, "\t");
+    if (!invariants.empty())
+    {
+        invariants.pop_back();
+        str << "\n" << invariants;
+    }
+    str << "\n\t" << system.real_type() << " sum = 0.0;"
+        << "\n\tfor (size_t " << summation.index.to_string() << " = " << summation.range.start->generate(system) << "; "
+        << summation.index.to_string() << " < " << summation.range.end->generate(system) << "; "
+        << summation.index.to_string() << "++) {"
+        << "\n\t\tsum += " << summation.summand->generate(system) << ";"
+        << "\n\t}"
+        << "\n\treturn sum;"
+        << "\n}";
+    system.bound_parameters.erase(summation.index.name);
+    system.loop_invariants.clear();
+
+    return str.str();
+}
+
 std::string generate_summation_definitions(SystemDeclarations& system)
 {
     std::stringstream str;
 
-    for (auto summation : system.summation_definitions)
+    for (auto& summation : system.summation_definitions)
     {
-        system.bound_parameters[summation.index.name] = true;
-        str << "\n\ndouble " << summation.symbol.to_string() << "(double* values) {"
-            << "\n\tdouble sum = 0.0;"
-            << "\n\tfor (size_t " << summation.index.to_string() << " = " << summation.range.start->generate(system) << "; "
-            << summation.index.to_string() << " < " << summation.range.end->generate(system) << "; "
-            << summation.index.to_string() << "++) {"
-            << "\n\t\tsum += " << summation.summand->generate(system) << ";"
-            << "\n\t}"
-            << "\n\treturn sum;"
-            << "\n}";
-        system.bound_parameters.erase(summation.index.name);
+        str << generate_summation_definition(system, summation);
     }
 
     return str.str();
 }
 
-std::string generate_initial_state_setter(SystemDeclarations &system)
+// The tangent mode is get_initial_sensitivity, the derivative of the initial state along a parameter. The adjoint
+// mode is initial_state_adjoint, which adds lambda times the initial state's derivative to constant_adjoint
+std::string generate_initial_state_setter(SystemDeclarations &system, DerivativeMode mode)
 {
     auto &initial_states = system.initial_states;
 
     std::stringstream str;
 
-    str << "\n\nvoid get_initial_state(N_Vector state) {"
-        << "\n    double* values = N_VGetArrayPointer(state);\n";
+    bool single = system.precision == Precision::SINGLE;
+    std::string array = mode == DerivativeMode::TANGENT ? "tangents" : "values";
+    if (mode == DerivativeMode::TANGENT)
+    {
+        str << "\n\nvoid get_initial_sensitivity(int parameter, double* values, double* tangents) {\n";
+    }
+    else if (mode == DerivativeMode::ADJOINT)
+    {
+        str << "\n\nvoid initial_state_adjoint(double* lambda, double* values, double* state_adjoint, double* constant_adjoint) {\n"
+            << "\tstd::vector<double> seeds(lambda, lambda + STATE_SIZE);\n";
+    }
+    else
+    {
+        str << "\n\nvoid get_initial_state(double* " << (single ? "state" : "values") << ") {\n";
+    }
+    if (single && mode == DerivativeMode::VALUE)
+    {
+        str << "\tstd::vector<float> buffer(STATE_SIZE);\n"
+            << "\tfloat* values = buffer.data();\n";
+    }
+
+    // Manual overrides to a list land after the list, so their adjoints run first and take the seed from it
+    std::vector<std::string> overrides;
+    for (size_t i = 0; i < initial_states.size(); ++i)
+    {
+        if (initial_states[i].symbol.is_list() && initial_states[i].symbol.parameters[0].type == ParameterType::EXPRESSION)
+        {
+            system.bound_parameters.clear();
+            std::string index = generate_list_index(system, initial_states[i].symbol.to_string(),
+                                                    "(size_t)(" + initial_states[i].symbol.parameters[0].expression->generate(system) + " - 1)");
+            overrides.push_back(generate_entry(system, mode, "    ", array, index, *initial_states[i].rhs)
+                                + (mode == DerivativeMode::ADJOINT ? "    seeds[" + index + "] = 0.0;\n" : ""));
+        }
+    }
+    if (mode == DerivativeMode::ADJOINT)
+    {
+        std::reverse(overrides.begin(), overrides.end());
+        for (auto& override : overrides)
+        {
+            str << override;
+        }
+    }
+
     for (size_t i = 0; i < initial_states.size(); ++i)
     {
         if (initial_states[i].symbol.is_list())
@@ -417,7 +849,7 @@ std::string generate_initial_state_setter(SystemDeclarations &system)
             if (initial_states[i].symbol.parameters[0].type == ParameterType::EXPRESSION)
                 continue;
 
-            str << generate_setter_list(system, initial_states[i]);
+            str << generate_setter_list(system, initial_states[i], mode);
         }
         else
         {
@@ -428,33 +860,98 @@ std::string generate_initial_state_setter(SystemDeclarations &system)
             }
 
             system.bound_parameters.clear();
-            str << "    values[INDEX_" << initial_states[i].symbol.to_string() << "] = " << initial_states[i].rhs->generate(system) << ";\n";
+            str << generate_entry(system, mode, "    ", array, "INDEX_" + initial_states[i].symbol.to_string(), *initial_states[i].rhs);
         }
     }
 
     // Second pass to define manual overrides to the list
-    for (size_t i = 0; i < initial_states.size(); ++i)
+    if (mode != DerivativeMode::ADJOINT)
     {
-        if (initial_states[i].symbol.is_list() && initial_states[i].symbol.parameters[0].type == ParameterType::EXPRESSION)
+        for (auto& override : overrides)
         {
-            system.bound_parameters.clear();
-            str << "    values[INDEX_" << initial_states[i].symbol.to_string() << "_START + (size_t)"
-                << "(" << initial_states[i].symbol.parameters[0].expression->generate(system) << " - 1)" << "] = "
-                << initial_states[i].rhs->generate(system) << ";\n";
+            str << override;
         }
     }
 
+    if (single && mode == DerivativeMode::VALUE)
+    {
+        str << "\tstd::copy(values, values + STATE_SIZE, state);\n";
+    }
     str << "}";
 
     return str.str();
 }
 
-std::string generate_derivative_definitions(SystemDeclarations &system)
+bool has_absolute_tolerances(SystemDeclarations &system)
 {
-    auto &deps = system.state_variables;
+    return !system.absolute_tolerances.empty();
+}
 
+std::string generate_state_assignments(SystemDeclarations &system, std::vector<InitialState> &assignments, std::string tag)
+{
     std::stringstream str;
 
+    std::vector<std::string> overrides;
+    for (auto& assignment : assignments)
+    {
+        system.bound_parameters.clear();
+        if (system.resolve_symbol_type(assignment.symbol) != SymbolType::STATE)
+        {
+            std::cerr << "Error: " << tag << " is given for " << assignment.symbol.name << ", which isn't a state.\n";
+            continue;
+        }
+
+        if (!assignment.symbol.is_list())
+        {
+            str << generate_entry(system, DerivativeMode::VALUE, "    ", "values", "INDEX_" + assignment.symbol.to_string(), *assignment.rhs);
+        }
+        else if (assignment.symbol.parameters[0].type == ParameterType::EXPRESSION)
+        {
+            std::string index = generate_list_index(system, assignment.symbol.to_string(),
+                                                    "(size_t)(" + assignment.symbol.parameters[0].expression->generate(system) + " - 1)");
+            overrides.push_back(generate_entry(system, DerivativeMode::VALUE, "    ", "values", index, *assignment.rhs));
+        }
+        else
+        {
+            str << generate_setter_list(system, assignment);
+        }
+    }
+    for (auto& override : overrides)
+    {
+        str << override;
+    }
+    system.bound_parameters.clear();
+
+    return str.str();
+}
+
+// get_absolute_tolerances, the tolerance vector for CVodeSVtolerances. States without their own @ABSOLUTE_TOLERANCE
+// keep the global one
+std::string generate_absolute_tolerance_setter(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n\nvoid get_absolute_tolerances(double* values) {\n"
+        << "    for (size_t i = 0; i < STATE_SIZE; ++i) values[i] = absolute_tolerance;\n"
+        << generate_state_assignments(system, system.absolute_tolerances, "@ABSOLUTE_TOLERANCE")
+        << "}";
+
+    return str.str();
+}
+
+// Every block assigns one equation (or one list of equations), in the order they have to run in. The tangent
+// mode assigns tangent_derivatives, the sensitivity RHS along one parameter. The adjoint mode accumulates the
+// transposed Jacobian and the constants' Jacobian times seeds[], with list overrides first
+std::vector<std::string> generate_derivative_blocks(SystemDeclarations &system, DerivativeMode mode)
+{
+    if (mode == DerivativeMode::FAST)
+        return generate_fast_derivative_blocks(system);
+
+    auto &deps = system.state_variables;
+    std::string array = mode == DerivativeMode::TANGENT ? "tangent_derivatives" : "derivatives";
+
+    std::vector<std::string> blocks;
+
     for (size_t i = 0; i < deps.size(); ++i)
     {
         if (deps[i].symbol.is_list())
@@ -462,27 +959,55 @@ std::string generate_derivative_definitions(SystemDeclarations &system)
             if (deps[i].symbol.parameters[0].type == ParameterType::EXPRESSION)
                 continue;
 
-            str << generate_derivative_list(system, deps[i]);
+            blocks.push_back(generate_derivative_list(system, deps[i], mode));
         }
         else
         {
             system.bound_parameters.clear();
-            str << "    derivatives[INDEX_" << deps[i].symbol.to_string() << "] = " << deps[i].rhs->generate(system) << ";\n";
+            blocks.push_back(generate_entry(system, mode, "    ", array, "INDEX_" + deps[i].symbol.to_string(), *deps[i].rhs));
         }
     }
-    str << "\n";
 
     // Second pass to define manual overrides to the list
+    std::vector<std::string> overrides;
     for (size_t i = 0; i < deps.size(); ++i)
     {
         if (deps[i].symbol.is_list() && deps[i].symbol.parameters[0].type == ParameterType::EXPRESSION)
         {
             system.bound_parameters.clear();
-            str << "    derivatives[INDEX_" << deps[i].symbol.to_string() << "_START + (size_t)(" << deps[i].symbol.parameters[0].expression->generate(system)
-                << " - 1)] = " << deps[i].rhs->generate(system) << ";\n";
+            std::string index = generate_list_index(system, deps[i].symbol.to_string(), "(size_t)(" + deps[i].symbol.parameters[0].expression->generate(system) + " - 1)");
+            overrides.push_back(generate_entry(system, mode, "    ", array, index, *deps[i].rhs)
+                                + (mode == DerivativeMode::ADJOINT ? "    seeds[" + index + "] = 0.0;\n" : ""));
         }
     }
 
+    if (mode == DerivativeMode::ADJOINT)
+    {
+        std::reverse(overrides.begin(), overrides.end());
+        blocks.insert(blocks.begin(), overrides.begin(), overrides.end());
+        return blocks;
+    }
+
+    if (overrides.empty())
+        blocks.push_back("\n");
+    else
+        overrides.front() = "\n" + overrides.front();
+    blocks.insert(blocks.end(), overrides.begin(), overrides.end());
+    if (mode == DerivativeMode::SLOW)
+        blocks.push_back(generate_fast_state_mask(system));
+
+    return blocks;
+}
+
+std::string generate_derivative_definitions(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    for (auto& block : generate_derivative_blocks(system))
+    {
+        str << block;
+    }
+
     return str.str();
 }
 
@@ -515,11 +1040,45 @@ std::string generate_csv_getters(SystemDeclarations &system)
 
     str << "\n}\n\n";
 
-    str << "std::string get_csv_line(N_Vector state) {"
+    // Columns follow the labels, with a list's last index fastest, whatever the order of the state
+    str << "const size_t* get_state_csv_order() {"
+        << "\n\tstatic const std::vector<size_t> order = [] {"
+        << "\n\t\tstd::vector<size_t> order;";
+    for (auto& state_variable : deps)
+    {
+        system.bound_parameters.clear();
+        if (!state_variable.symbol.is_list())
+        {
+            str << "\n\t\torder.push_back(INDEX_" << state_variable.symbol.to_string() << ");";
+            continue;
+        }
+        if (state_variable.symbol.parameters[0].type != ParameterType::VARIABLE) // The catch-all covers the overrides
+            continue;
+
+        std::string loops = generate_list_loops(system, state_variable.symbol, 2, [&](std::string indentation) {
+            return indentation + "order.push_back(" + generate_state_index(system, state_variable.symbol) + ");\n";
+        });
+        loops.pop_back();
+        str << "\n" << loops;
+    }
+    str << "\n\t\treturn order;"
+        << "\n\t}();"
+        << "\n\treturn order.data();"
+        << "\n}\n\n";
+
+    // Single precision outputs are computed from a float copy, the state itself is printed as the solver has it
+    bool single = system.precision == Precision::SINGLE;
+    std::string state = single ? "state" : "values";
+    str << "std::string get_csv_line(double* " << state << ") {";
+    if (single)
+    {
+        str << "\n\tstd::vector<float> buffer(state, state + STATE_SIZE);"
+            << "\n\tfloat* values = buffer.data();";
+    }
+    str << "\n\tconst size_t* order = get_state_csv_order();"
         << "\n\tstd::stringstream str;"
-        << "\n\tdouble* values = N_VGetArrayPointer(state);"
         << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) {"
-        << "\n\t\tstr << \", \" << values[i];"
+        << "\n\t\tstr << \", \" << " << state << "[order[i]];"
         << "\n\t}";
         for (auto out : system.additional_outputs)
         {
@@ -531,18 +1090,790 @@ std::string generate_csv_getters(SystemDeclarations &system)
     return str.str();
 }
 
+bool has_roots(SystemDeclarations &system)
+{
+    return !system.stop_conditions.empty() || !system.event_conditions.empty();
+}
+
+// CVODES locates zero crossings of g during the solve, the stop conditions come first so the solver can tell
+// them apart by index
+std::string generate_root_function(SystemDeclarations &system)
+{
+    std::stringstream str;
+    std::vector<ExpressionOutput> conditions = system.stop_conditions;
+    conditions.insert(conditions.end(), system.event_conditions.begin(), system.event_conditions.end());
+
+    str << "\n\nconst size_t NUM_ROOTS = " << conditions.size() << ";"
+        << "\nconst size_t NUM_STOP_ROOTS = " << system.stop_conditions.size() << ";"
+        << "\nconst char* const ROOT_LABELS[] = {";
+    for (size_t i = 0; i < conditions.size(); ++i)
+    {
+        str << (i != 0 ? ", " : " ") << "\"" << conditions[i].label.to_string() << "\"";
+    }
+    str << " };";
+
+    bool single = system.precision == Precision::SINGLE;
+    str << "\n\nvoid roots(double t, double* " << (single ? "state" : "values") << ", double* g) {";
+    if (single)
+    {
+        str << "\n\tstd::vector<float> buffer(state, state + STATE_SIZE);"
+            << "\n\tfloat* values = buffer.data();";
+    }
+    for (size_t i = 0; i < conditions.size(); ++i)
+    {
+        str << "\n\tg[" << i << "] = " << conditions[i].rhs->generate(system) << ";";
+    }
+    str << "\n}";
+
+    return str.str();
+}
+
 std::string generate_derivative(SystemDeclarations &system)
 {
     std::stringstream str;
 
     auto &deps = system.state_variables;
 
-    str << "\n\nint derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data) {\n"
-        << "    double* values = N_VGetArrayPointer(y);\n"
-        << "    double* derivatives = N_VGetArrayPointer(ydot);\n"
+    str << "\n\nvoid derivative(double t, double* values, double* derivatives) {"
+        << generate_profile_scope(system, "derivative", 1) << "\n"
         << generate_derivative_definitions(system)
-        << "    return 0;\n"
         << "}";
 
     return str.str();
+}
+
+std::string generate_meta_declarations(SystemDeclarations& system)
+{
+    std::stringstream str;
+
+    str << "\n\nextern const double end_time;";
+    str << "\nextern const double sample_interval;";
+    str << "\nextern const double absolute_tolerance;";
+    str << "\nextern const double relative_tolerance;";
+    str << "\nextern const size_t initial_step_size;";
+    str << "\nextern const double maximum_step_size;";
+    str << "\nextern const double minimum_step_size;";
+    str << "\nextern const double maximum_num_steps;";
+    str << "\nextern const bool use_direct_solver;";
+    str << "\nextern const double steady_state_tolerance;";
+    str << "\nextern const bool use_steady_state_solver;";
+    str << "\nextern const double slow_step_size;";
+    str << "\nextern const double jacobian_reuse;";
+    str << "\nextern const double linear_setup_frequency;";
+    str << "\nextern const double delta_gamma_max;";
+    str << "\nextern const double maximum_nonlinear_iterations;";
+    str << "\nextern const double maximum_order;";
+    str << "\nextern const bool use_adaptive_reuse;";
+
+    return str.str();
+}
+
+std::string generate_constant_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n";
+
+    for (auto &f : system.function_definitions)
+    {
+        if (!f.is_constant(system))
+            continue;
+
+        if (system.constexpr_constants.count(f.symbol.to_string()))
+        {
+            str << "\nconstexpr " << system.real_type() << " " << f.symbol.to_string() << " = " << f.definitions[0].expression->generate(system) << ";";
+            continue;
+        }
+        str << "\nextern " << system.real_type() << " " << f.symbol.to_string() << ";";
+    }
+
+    return str.str();
+}
+
+std::string generate_state_index_declarations(SystemDeclarations &system)
+{
+    if (system.constexpr_indices) // Defined in the header
+        return "";
+
+    std::stringstream str;
+
+    str << "\n";
+    for (auto& state_variable : system.state_variables)
+    {
+        if (!state_variable.symbol.is_list())
+        {
+            str << "\nextern const size_t INDEX_" << state_variable.symbol.to_string() << ";";
+        }
+        else
+        {
+            bool is_catchall = true;
+            for (auto& p : state_variable.symbol.parameters)
+            {
+                if (p.type != ParameterType::VARIABLE || !system.ranges.count(p.symbol.value())) is_catchall = false;
+            }
+            if (!is_catchall)
+                continue;
+
+            str << "\nextern const size_t INDEX_" << state_variable.symbol.to_string() << "_START;";
+            str << "\nextern const size_t INDEX_" << state_variable.symbol.to_string() << "_SIZE;";
+        }
+    }
+    str << "\nextern const size_t STATE_SIZE;";
+
+    return str.str();
+}
+
+std::string generate_summation_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n";
+    for (auto& summation : system.summation_definitions)
+    {
+        str << "\n" << system.real_type() << " " << summation.symbol.to_string() << "(" << system.state_type() << "* values);";
+    }
+
+    return str.str();
+}
+
+// The solver only talks to a model through get_model(), whether it's linked in or loaded with dlopen
+std::string generate_model_interface(SystemDeclarations &system)
+{
+    std::stringstream str;
+    bool sensitivities = has_sensitivities(system);
+    bool jacobian_times = has_jacobian_times(system);
+    bool jacobian_pattern = has_jacobian_pattern(system);
+    bool adjoint = has_adjoint(system);
+    bool roots = has_roots(system);
+    bool scaling = has_state_scaling(system);
+    bool absolute_tolerances = has_absolute_tolerances(system);
+    // The Model's entries go through the scaling wrappers of scaling.h when the state is scaled
+    auto entry = [&](std::string name, std::string scaled) { return "\n\t\t" + (scaling ? scaled : name) + ","; };
+
+    str << "#include \"system.h\"\n"
+        << "#include \"model.h\"\n"
+        << "\nstatic void model_derivative(double t, double* values, double* derivatives) { derivative(t, values, derivatives); }"
+        << "\nstatic void model_get_initial_state(double* values) { get_initial_state(values); }"
+        << "\n"
+        << "\nstatic const char* model_get_state_csv_label() {"
+        << "\n\tstatic std::string label = get_state_csv_label();"
+        << "\n\treturn label.c_str();"
+        << "\n}"
+        << "\n"
+        << "\nstatic const char* model_get_csv_line(double* values) {"
+        << "\n\tthread_local std::string line;"
+        << "\n\tline = get_csv_line(values);"
+        << "\n\treturn line.c_str();"
+        << "\n}"
+        << "\n";
+    if (sensitivities)
+    {
+        str << "\nstatic void model_sensitivity_derivative(int parameter, double t, double* values, double* tangents, double* tangent_derivatives) {"
+            << "\n\tsensitivity_derivative(parameter, values, tangents, tangent_derivatives);"
+            << "\n}"
+            << "\n";
+    }
+    if (jacobian_times)
+    {
+        str << "\nstatic void model_jacobian_times(double t, double* values, double* v, double* Jv) { jacobian_times(values, v, Jv); }"
+            << "\n";
+    }
+    if (adjoint)
+    {
+        str << "\nstatic void model_adjoint_derivative(double t, double* values, double* lambda, double* state_adjoint, double* constant_adjoint) {"
+            << "\n\tadjoint_derivative(values, lambda, state_adjoint, constant_adjoint);"
+            << "\n}"
+            << "\n";
+    }
+    if (scaling)
+        str << generate_scaled_model_runtime(system);
+    str << "\nextern \"C\" MODEL_EXPORT const Model* get_model() {"
+        << (scaling ? "\n\tget_state_scale(state_scale);" : "")
+        << "\n\tstatic Model model = {"
+        << "\n\t\tMODEL_ABI_VERSION,"
+        << "\n\t\tSTATE_SIZE,"
+        << "\n\t\tend_time,"
+        << "\n\t\tsample_interval,"
+        << "\n\t\tabsolute_tolerance,"
+        << "\n\t\trelative_tolerance,"
+        << "\n\t\t(double)initial_step_size,"
+        << "\n\t\tmaximum_step_size,"
+        << "\n\t\tminimum_step_size,"
+        << "\n\t\tmaximum_num_steps,"
+        << "\n\t\tuse_direct_solver,"
+        << entry("model_get_initial_state", "scaled_get_initial_state")
+        << (absolute_tolerances || scaling ? entry("get_absolute_tolerances", "scaled_get_absolute_tolerances") : "\n\t\tnullptr,")
+        << entry("model_derivative", "scaled_derivative<model_derivative>")
+        << "\n\t\tmodel_get_state_csv_label,"
+        << entry("model_get_csv_line", "scaled_get_csv_line")
+        << "\n\t\tget_state_csv_order,"
+        << (jacobian_times ? entry("model_jacobian_times", "scaled_jacobian_times") : "\n\t\tnullptr,")
+        << (jacobian_pattern ? "\n\t\tjacobian_pattern," : "\n\t\tnullptr,");
+    if (sensitivities)
+    {
+        str << "\n\t\tNUM_SENSITIVITIES,"
+            << "\n\t\tSENSITIVITY_NAMES,"
+            << "\n\t\tget_initial_sensitivity,"
+            << "\n\t\tmodel_sensitivity_derivative,";
+    }
+    else
+    {
+        str << "\n\t\t0,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,";
+    }
+    if (adjoint)
+    {
+        str << "\n\t\tADJOINT_OBJECTIVE,"
+            << "\n\t\tNUM_ADJOINT_CONSTANTS,"
+            << "\n\t\tADJOINT_CONSTANT_NAMES,"
+            << "\n\t\tobjective_adjoint,"
+            << "\n\t\tinitial_state_adjoint,"
+            << "\n\t\tmodel_adjoint_derivative,"
+            << "\n\t\tpropagate_constant_adjoint,";
+    }
+    else
+    {
+        str << "\n\t\tnullptr,"
+            << "\n\t\t0,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,";
+    }
+    if (roots)
+    {
+        str << "\n\t\tNUM_ROOTS,"
+            << "\n\t\tNUM_STOP_ROOTS,"
+            << "\n\t\tROOT_LABELS,"
+            << entry("roots", "scaled_roots<roots>");
+    }
+    else
+    {
+        str << "\n\t\t0,"
+            << "\n\t\t0,"
+            << "\n\t\tnullptr,"
+            << "\n\t\tnullptr,";
+    }
+    str << "\n\t\tsteady_state_tolerance,"
+        << "\n\t\tuse_steady_state_solver,"
+        << (has_imex(system) ? entry("explicit_derivative", "scaled_derivative<explicit_derivative>")
+                               + entry("implicit_derivative", "scaled_derivative<implicit_derivative>") : "\n\t\tnullptr,\n\t\tnullptr,")
+        << (has_multirate(system) ? entry("fast_derivative", "scaled_derivative<fast_derivative>")
+                                  + entry("slow_derivative", "scaled_derivative<slow_derivative>") : "\n\t\tnullptr,\n\t\tnullptr,")
+        << "\n\t\tslow_step_size,"
+        << "\n\t\tjacobian_reuse,"
+        << "\n\t\tlinear_setup_frequency,"
+        << "\n\t\tdelta_gamma_max,"
+        << "\n\t\tmaximum_nonlinear_iterations,"
+        << "\n\t\tmaximum_order,"
+        << "\n\t\tuse_adaptive_reuse,"
+        << "\n\t};"
+        << "\n\treturn &model;"
+        << "\n}\n";
+
+    return str.str();
+}
+
+// Splits blocks of code into groups of roughly shard_size bytes, blocks are never split
+std::vector<std::string> shard_blocks(const std::vector<std::string>& blocks, size_t shard_size)
+{
+    std::vector<std::string> shards;
+    for (auto& block : blocks)
+    {
+        if (shards.empty() || (shards.back().size() > 0 && shards.back().size() + block.size() > shard_size))
+        {
+            shards.push_back("");
+        }
+        shards.back() += block;
+    }
+    return shards;
+}
+
+std::string shard_filename(std::string prefix, size_t shard, size_t num_shards)
+{
+    return num_shards == 1 ? prefix + ".cpp" : prefix + "_" + std::to_string(shard) + ".cpp";
+}
+
+// Derivative chunks run in order, so list overrides still land after the list loops. derivative() runs in the stages
+// of schedule.h, with @PARALLEL every block of a stage is an OpenMP task and a stage waits for the one before
+void generate_derivative_function(SystemDeclarations &system, std::string name, DerivativeMode mode, size_t shard_size,
+                                  std::string include, std::stringstream &header, std::vector<GeneratedFile> &files)
+{
+    std::vector<std::vector<std::string>> stages = { generate_derivative_blocks(system, mode) };
+    bool intermediates = false;
+    if (mode == DerivativeMode::VALUE)
+    {
+        stages = generate_derivative_stages(system);
+        intermediates = !find_intermediates(system).empty();
+    }
+    bool parallel = system.use_parallel && mode == DerivativeMode::VALUE;
+    if (!parallel) // Run in order, the stages only need to follow each other
+    {
+        std::vector<std::string> blocks;
+        for (auto& stage : stages)
+        {
+            blocks.insert(blocks.end(), stage.begin(), stage.end());
+        }
+        stages = { blocks };
+    }
+    else
+    {
+        for (auto& stage : stages)
+        {
+            for (auto& block : stage)
+            {
+                if (block.find_first_not_of(" \t\n") != std::string::npos)
+                    block = "    #pragma omp task\n    {\n" + indent_statements(block.substr(block.find_first_not_of('\n')), "    ") + "    }\n";
+            }
+        }
+    }
+
+    // In single precision the chunks work on float copies of the state and derivatives, reused between calls
+    bool single = system.precision == Precision::SINGLE;
+    std::string state_type = system.state_type();
+    std::string parameters = state_type + "* values, " + state_type + "* derivatives" + (intermediates ? ", " + system.real_type() + "* intermediates" : "");
+    std::string arguments = std::string("values, derivatives") + (intermediates ? ", intermediates" : "");
+    std::stringstream derivative;
+    derivative << include
+               << "\nvoid " << name << "(double t, double* " << (single ? "state, double* rates" : "values, double* derivatives") << ") {"
+               << (mode == DerivativeMode::VALUE ? generate_profile_scope(system, "derivative", 1) : "") << "\n";
+    if (single)
+    {
+        derivative << "    thread_local std::vector<float> values_buffer(STATE_SIZE), derivatives_buffer(STATE_SIZE);\n"
+                   << "    float* values = values_buffer.data();\n"
+                   << "    float* derivatives = derivatives_buffer.data();\n"
+                   << "    std::copy(state, state + STATE_SIZE, values);\n";
+    }
+    if (intermediates)
+    {
+        derivative << "    " << system.real_type() << " intermediates[NUM_INTERMEDIATES];\n";
+    }
+    if (parallel)
+    {
+        derivative << "    #pragma omp parallel\n"
+                   << "    #pragma omp single\n"
+                   << "    {\n";
+    }
+    size_t num_chunks = 0;
+    for (auto& stage : stages)
+    {
+        for (auto& shard : shard_blocks(stage, shard_size))
+        {
+            size_t i = num_chunks++;
+            header << "\nvoid " << name << "_chunk_" << i << "(" << parameters << ");";
+            derivative << (parallel ? "        " : "    ") << name << "_chunk_" << i << "(" << arguments << ");\n";
+
+            std::stringstream chunk;
+            chunk << include
+                  << "\nvoid " << name << "_chunk_" << i << "(" << parameters << ") {\n"
+                  << shard
+                  << "}\n";
+            files.push_back({ "system_" + name + "_chunk_" + std::to_string(i) + ".cpp", chunk.str() });
+        }
+        if (parallel)
+        {
+            derivative << "        #pragma omp taskwait\n";
+        }
+    }
+    if (parallel)
+    {
+        derivative << "    }\n";
+    }
+    if (single)
+    {
+        derivative << "    std::copy(derivatives, derivatives + STATE_SIZE, rates);\n";
+    }
+    derivative << "}\n";
+    files.push_back({ "system_" + name + ".cpp", derivative.str() });
+}
+
+std::vector<GeneratedFile> generate_sources(SystemDeclarations &system, size_t shard_size, const PhaseHook &phase_hook)
+{
+    auto phase = [&phase_hook](const std::string &name, const std::function<void()> &run) {
+        if (phase_hook)
+            phase_hook(name, run);
+        else
+            run();
+    };
+    auto emit = [&phase](const std::string &name, const std::function<std::string()> &emitter) {
+        std::string code;
+        phase(name, [&]() { code = emitter(); });
+        return code;
+    };
+
+    std::vector<GeneratedFile> files;
+    const std::string include = "#include \"system.h\"\n";
+    bool sensitivities = false, jacobian_times = false, jacobian_pattern = false, adjoint = false, roots = false;
+    bool imex = false, multirate = false, scaling = false;
+    phase("checks", [&]() {
+        sensitivities = check_sensitivities(system);
+        jacobian_times = has_jacobian_times(system);
+        jacobian_pattern = has_jacobian_pattern(system);
+        adjoint = check_adjoint(system);
+        roots = has_roots(system);
+        imex = check_imex(system);
+        multirate = check_multirate(system);
+        check_layouts(system);
+        check_parallel(system);
+        scaling = check_state_scaling(system);
+        find_constexpr_constants(system);
+    });
+
+    std::stringstream header;
+    header << "#pragma once"
+           << "\n"
+           << "\n#include <cmath>"
+           << "\n#include <sstream>"
+           << "\n#include <string>"
+           << "\n#include <vector>"
+           << (system.precision == Precision::SINGLE || adjoint || multirate ? "\n#include <algorithm>" : "")
+           << emit("generate_profiler_runtime", [&]() { return generate_profiler_runtime(system); })
+           << emit("generate_function_table_runtime", [&]() { return generate_function_table_runtime(system); })
+           << emit("generate_layout_runtime", [&]() { return generate_layout_runtime(system); })
+           << emit("generate_sensitivity_runtime", [&]() { return generate_sensitivity_runtime(system); })
+           << emit("generate_jacobian_pattern_runtime", [&]() { return generate_jacobian_pattern_runtime(system); })
+           << emit("generate_meta_declarations", [&]() { return generate_meta_declarations(system); })
+           << emit("generate_constant_declarations", [&]() { return generate_constant_declarations(system); })
+           << emit("generate_range_constants", [&]() { return generate_range_constants(system); });
+
+    std::string state_indices = emit("generate_state_indices", [&]() { return generate_state_indices(system); });
+    state_indices += "\n" + system.index_type() + " STATE_SIZE =" + system.next_index + ";\n";
+    if (system.constexpr_indices)
+    {
+        header << state_indices;
+    }
+
+    // Constants and indices share a translation unit so their dynamic initialization stays ordered
+    std::stringstream constants;
+    constants << include
+              << emit("generate_constant_definitions", [&]() { return generate_constant_definitions(system); })
+              << emit("generate_meta", [&]() { return generate_meta(system); })
+              << (system.constexpr_indices ? "\n" : state_indices)
+              << emit("generate_function_tables", [&]() { return generate_function_tables(system); })
+              << (sensitivities ? emit("generate_constant_tangents", [&]() { return generate_constant_tangents(system); }) : "")
+              << (adjoint ? emit("generate_adjoint_constants", [&]() { return generate_adjoint_constants(system); }) : "");
+    files.push_back({ "system_constants.cpp", constants.str() });
+
+    header << emit("generate_state_index_declarations", [&]() { return generate_state_index_declarations(system); })
+           << emit("generate_state_view", [&]() { return generate_state_view(system); })
+           << emit("generate_function_declarations", [&]() { return generate_function_declarations(system); })
+           << emit("generate_function_table_declarations", [&]() { return generate_function_table_declarations(system); })
+           << emit("generate_summation_declarations", [&]() { return generate_summation_declarations(system); })
+           << emit("generate_intermediate_indices", [&]() { return generate_intermediate_indices(system); })
+           << "\n"
+           << "\nstd::string get_state_csv_label();"
+           << "\nstd::string get_csv_line(double* values);"
+           << "\nconst size_t* get_state_csv_order();"
+           << "\nvoid get_initial_state(double* values);"
+           << (has_absolute_tolerances(system) ? "\nvoid get_absolute_tolerances(double* values);" : "")
+           << (scaling ? emit("generate_state_scale_declarations", [&]() { return generate_state_scale_declarations(); }) : "")
+           << "\nvoid derivative(double t, double* values, double* derivatives);"
+           << (sensitivities ? emit("generate_sensitivity_declarations", [&]() { return generate_sensitivity_declarations(system); }) : "")
+           << (jacobian_times ? emit("generate_jacobian_times_declarations", [&]() { return generate_jacobian_times_declarations(system); }) : "")
+           << (jacobian_pattern ? emit("generate_jacobian_pattern_declarations", [&]() { return generate_jacobian_pattern_declarations(system); }) : "")
+           << (adjoint ? emit("generate_adjoint_declarations", [&]() { return generate_adjoint_declarations(system); }) : "")
+           << (imex ? emit("generate_imex_declarations", [&]() { return generate_imex_declarations(); }) : "")
+           << (multirate ? emit("generate_multirate_declarations", [&]() { return generate_multirate_declarations(); }) : "")
+           << (roots ? "\n\nextern const size_t NUM_ROOTS;"
+                       "\nextern const size_t NUM_STOP_ROOTS;"
+                       "\nextern const char* const ROOT_LABELS[];"
+                       "\nvoid roots(double t, double* values, double* g);" : "");
+
+    std::vector<std::string> summation_blocks;
+    phase("generate_summation_definition", [&]() {
+        for (auto& summation : system.summation_definitions)
+        {
+            summation_blocks.push_back(generate_summation_definition(system, summation));
+        }
+    });
+    auto summation_shards = shard_blocks(summation_blocks, shard_size);
+    for (size_t i = 0; i < summation_shards.size(); ++i)
+    {
+        files.push_back({ shard_filename("system_summations", i, summation_shards.size()), include + summation_shards[i] + "\n" });
+    }
+
+    std::vector<std::string> function_blocks;
+    phase("generate_function_definition", [&]() {
+        for (auto& f : system.function_definitions)
+        {
+            if (f.is_constant(system))
+                continue;
+
+            function_blocks.push_back(generate_function_definition(system, f));
+        }
+    });
+    auto function_shards = shard_blocks(function_blocks, shard_size);
+    for (size_t i = 0; i < function_shards.size(); ++i)
+    {
+        files.push_back({ shard_filename("system_functions", i, function_shards.size()), include + function_shards[i] + "\n" });
+    }
+
+    if (sensitivities)
+    {
+        std::vector<std::string> tangent_blocks;
+        phase("generate_function_tangent", [&]() {
+            for (auto& f : system.function_definitions)
+            {
+                if (!f.is_constant(system))
+                    tangent_blocks.push_back(generate_function_tangent(system, f));
+            }
+        });
+        phase("generate_summation_tangent", [&]() {
+            for (auto& summation : system.summation_definitions)
+            {
+                tangent_blocks.push_back(generate_summation_tangent(system, summation));
+            }
+        });
+        auto tangent_shards = shard_blocks(tangent_blocks, shard_size);
+        for (size_t i = 0; i < tangent_shards.size(); ++i)
+        {
+            files.push_back({ shard_filename("system_tangents", i, tangent_shards.size()), include + tangent_shards[i] + "\n" });
+        }
+    }
+
+    if (jacobian_times)
+    {
+        system.state_tangents = true;
+        std::vector<std::string> state_tangent_blocks;
+        phase("generate_function_state_tangent", [&]() {
+            for (auto& f : system.function_definitions)
+            {
+                if (!f.is_constant(system))
+                    state_tangent_blocks.push_back(generate_function_tangent(system, f));
+            }
+        });
+        phase("generate_summation_state_tangent", [&]() {
+            for (auto& summation : system.summation_definitions)
+            {
+                state_tangent_blocks.push_back(generate_summation_tangent(system, summation));
+            }
+        });
+        system.state_tangents = false;
+        auto state_tangent_shards = shard_blocks(state_tangent_blocks, shard_size);
+        for (size_t i = 0; i < state_tangent_shards.size(); ++i)
+        {
+            files.push_back({ shard_filename("system_state_tangents", i, state_tangent_shards.size()), include + state_tangent_shards[i] + "\n" });
+        }
+    }
+
+    if (jacobian_pattern)
+    {
+        std::vector<std::string> pattern_blocks;
+        phase("generate_function_pattern", [&]() {
+            for (auto& f : system.function_definitions)
+            {
+                if (f.is_state_dependent(system))
+                    pattern_blocks.push_back(generate_function_pattern(system, f));
+            }
+        });
+        phase("generate_summation_pattern", [&]() {
+            for (auto& summation : system.summation_definitions)
+            {
+                pattern_blocks.push_back(generate_summation_pattern(system, summation));
+            }
+        });
+        auto pattern_shards = shard_blocks(pattern_blocks, shard_size);
+        for (size_t i = 0; i < pattern_shards.size(); ++i)
+        {
+            files.push_back({ shard_filename("system_patterns", i, pattern_shards.size()), include + pattern_shards[i] + "\n" });
+        }
+        files.push_back({ "system_jacobian_pattern.cpp", include + emit("generate_jacobian_pattern", [&]() { return generate_jacobian_pattern(system); }) });
+    }
+
+    if (adjoint)
+    {
+        std::vector<std::string> adjoint_blocks;
+        phase("generate_function_adjoint", [&]() {
+            for (auto& f : system.function_definitions)
+            {
+                if (!f.is_constant(system))
+                    adjoint_blocks.push_back(generate_function_adjoint(system, f));
+            }
+        });
+        phase("generate_summation_adjoint", [&]() {
+            for (auto& summation : system.summation_definitions)
+            {
+                adjoint_blocks.push_back(generate_summation_adjoint(system, summation));
+            }
+        });
+        auto adjoint_shards = shard_blocks(adjoint_blocks, shard_size);
+        for (size_t i = 0; i < adjoint_shards.size(); ++i)
+        {
+            files.push_back({ shard_filename("system_adjoints", i, adjoint_shards.size()), include + adjoint_shards[i] + "\n" });
+        }
+    }
+
+    std::stringstream output;
+    output << include
+           << emit("generate_csv_getters", [&]() { return generate_csv_getters(system); })
+           << emit("generate_initial_state_setter", [&]() { return generate_initial_state_setter(system); })
+           << (has_absolute_tolerances(system) ? emit("generate_absolute_tolerance_setter", [&]() { return generate_absolute_tolerance_setter(system); }) : "")
+           << (scaling ? emit("generate_state_scale_setter", [&]() { return generate_state_scale_setter(system); }) : "")
+           << (sensitivities ? emit("generate_initial_tangent_setter", [&]() { return generate_initial_state_setter(system, DerivativeMode::TANGENT); }) : "")
+           << (roots ? emit("generate_root_function", [&]() { return generate_root_function(system); }) : "")
+           << "\n";
+    files.push_back({ "system_output.cpp", output.str() });
+
+    phase("generate_derivative", [&]() { generate_derivative_function(system, "derivative", DerivativeMode::VALUE, shard_size, include, header, files); });
+    if (imex)
+    {
+        phase("generate_explicit_derivative", [&]() { generate_derivative_function(system, "explicit_derivative", DerivativeMode::EXPLICIT, shard_size, include, header, files); });
+        phase("generate_implicit_derivative", [&]() { generate_derivative_function(system, "implicit_derivative", DerivativeMode::IMPLICIT, shard_size, include, header, files); });
+    }
+    if (multirate)
+    {
+        phase("generate_fast_derivative", [&]() { generate_derivative_function(system, "fast_derivative", DerivativeMode::FAST, shard_size, include, header, files); });
+        phase("generate_slow_derivative", [&]() { generate_derivative_function(system, "slow_derivative", DerivativeMode::SLOW, shard_size, include, header, files); });
+    }
+
+    // The sensitivity RHS is sharded like the derivative, CVODES calls it once per parameter
+    if (sensitivities)
+    {
+        std::vector<std::string> sensitivity_blocks;
+        phase("generate_sensitivity_blocks", [&]() { sensitivity_blocks = generate_derivative_blocks(system, DerivativeMode::TANGENT); });
+        auto sensitivity_shards = shard_blocks(sensitivity_blocks, shard_size);
+        std::stringstream sensitivity;
+        sensitivity << include
+                    << "\nvoid sensitivity_derivative(int parameter, double* values, double* tangents, double* tangent_derivatives) {\n";
+        for (size_t i = 0; i < sensitivity_shards.size(); ++i)
+        {
+            header << "\nvoid sensitivity_chunk_" << i << "(int parameter, double* values, double* tangents, double* tangent_derivatives);";
+            sensitivity << "    sensitivity_chunk_" << i << "(parameter, values, tangents, tangent_derivatives);\n";
+
+            std::stringstream chunk;
+            chunk << include
+                  << "\nvoid sensitivity_chunk_" << i << "(int parameter, double* values, double* tangents, double* tangent_derivatives) {\n"
+                  << sensitivity_shards[i]
+                  << "}\n";
+            files.push_back({ "system_sensitivity_chunk_" + std::to_string(i) + ".cpp", chunk.str() });
+        }
+        sensitivity << "}\n";
+        files.push_back({ "system_sensitivity.cpp", sensitivity.str() });
+    }
+
+    // The Jacobian times the direction in tangents, called once per Krylov iteration
+    if (jacobian_times)
+    {
+        system.state_tangents = true;
+        std::vector<std::string> jacobian_blocks;
+        phase("generate_jacobian_times_blocks", [&]() { jacobian_blocks = generate_derivative_blocks(system, DerivativeMode::TANGENT); });
+        system.state_tangents = false;
+        auto jacobian_shards = shard_blocks(jacobian_blocks, shard_size);
+        std::stringstream jacobian;
+        jacobian << include
+                 << "\nvoid jacobian_times(double* values, double* tangents, double* tangent_derivatives) {\n";
+        for (size_t i = 0; i < jacobian_shards.size(); ++i)
+        {
+            header << "\nvoid jacobian_times_chunk_" << i << "(double* values, double* tangents, double* tangent_derivatives);";
+            jacobian << "    jacobian_times_chunk_" << i << "(values, tangents, tangent_derivatives);\n";
+
+            std::stringstream chunk;
+            chunk << include
+                  << "\nvoid jacobian_times_chunk_" << i << "(double* values, double* tangents, double* tangent_derivatives) {\n"
+                  << jacobian_shards[i]
+                  << "}\n";
+            files.push_back({ "system_jacobian_times_chunk_" + std::to_string(i) + ".cpp", chunk.str() });
+        }
+        jacobian << "}\n";
+        files.push_back({ "system_jacobian_times.cpp", jacobian.str() });
+    }
+
+    // The adjoint chunks accumulate into shared arrays, seeds[] starts as lambda and loses the list entries
+    // an override has consumed before the list loops run
+    if (adjoint)
+    {
+        std::vector<std::string> adjoint_derivative_blocks;
+        phase("generate_adjoint_blocks", [&]() { adjoint_derivative_blocks = generate_derivative_blocks(system, DerivativeMode::ADJOINT); });
+        auto adjoint_shards = shard_blocks(adjoint_derivative_blocks, shard_size);
+        std::stringstream adjoint_derivative;
+        adjoint_derivative << include
+                           << emit("generate_objective_adjoint", [&]() { return generate_objective_adjoint(system); })
+                           << emit("generate_initial_adjoint_setter", [&]() { return generate_initial_state_setter(system, DerivativeMode::ADJOINT); })
+                           << emit("generate_constant_propagation", [&]() { return generate_constant_propagation(system); })
+                           << "\n\nvoid adjoint_derivative(double* values, double* lambda, double* state_adjoint, double* constant_adjoint) {\n"
+                           << "    thread_local std::vector<double> seeds_buffer(STATE_SIZE);\n"
+                           << "    double* seeds = seeds_buffer.data();\n"
+                           << "    std::copy(lambda, lambda + STATE_SIZE, seeds);\n"
+                           << "    std::fill(state_adjoint, state_adjoint + STATE_SIZE, 0.0);\n"
+                           << "    std::fill(constant_adjoint, constant_adjoint + NUM_ADJOINT_CONSTANTS, 0.0);\n";
+        for (size_t i = 0; i < adjoint_shards.size(); ++i)
+        {
+            header << "\nvoid adjoint_chunk_" << i << "(double* values, double* seeds, double* state_adjoint, double* constant_adjoint);";
+            adjoint_derivative << "    adjoint_chunk_" << i << "(values, seeds, state_adjoint, constant_adjoint);\n";
+
+            std::stringstream chunk;
+            chunk << include
+                  << "\nvoid adjoint_chunk_" << i << "(double* values, double* seeds, double* state_adjoint, double* constant_adjoint) {\n"
+                  << adjoint_shards[i]
+                  << "}\n";
+            files.push_back({ "system_adjoint_chunk_" + std::to_string(i) + ".cpp", chunk.str() });
+        }
+        adjoint_derivative << "}\n";
+        files.push_back({ "system_adjoint.cpp", adjoint_derivative.str() });
+    }
+
+    files.push_back({ "system_model.cpp", emit("generate_model_interface", [&]() { return generate_model_interface(system); }) });
+
+    if (system.use_profiler)
+    {
+        files.push_back({ "system_profile.cpp", include + emit("generate_profiler_report", [&]() { return generate_profiler_report(system); }) + "\n" });
+    }
+
+    header << "\n";
+    files.insert(files.begin(), { "system.h", header.str() });
+
+    return files;
+}
+
+bool write_sources(std::string directory, std::vector<GeneratedFile> &files)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error)
+    {
+        std::cerr << "Error: Failed to create " << directory << ": " << error.message() << "\n";
+        return false;
+    }
+
+    // Remove shards left over from a bigger system, the solver target picks up every generated .cpp
+    for (auto& entry : fs::directory_iterator(directory, error))
+    {
+        auto filename = entry.path().filename().string();
+        if (entry.path().extension() != ".cpp" || filename.rfind("system", 0) != 0)
+            continue;
+
+        bool still_generated = false;
+        for (auto& file : files)
+        {
+            if (file.filename == filename) still_generated = true;
+        }
+        if (!still_generated) fs::remove(entry.path(), error);
+    }
+
+    // Unchanged files are left alone so the build only recompiles shards which actually changed
+    for (auto& file : files)
+    {
+        auto path = fs::path(directory) / file.filename;
+
+        std::ifstream existing_file(path, std::ios::in);
+        std::stringstream existing;
+        existing << existing_file.rdbuf();
+        existing_file.close();
+        if (existing.str() == file.contents)
+            continue;
+
+        std::ofstream out(path, std::ios::out);
+        out << file.contents;
+        if (!out)
+        {
+            std::cerr << "Error: Failed to write " << path.string() << "\n";
+            return false;
+        }
+    }
+    return true;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -9,22 +11,83 @@
 #include "expression.h"
 #include "parse.h"
 
+struct GeneratedFile
+{
+    std::string filename;
+    std::string contents;
+};
+
+// What the derivative and initial state emitters generate: the values themselves, their forward derivative along
+// a parameter (sensitivity.h), their reverse derivative (adjoint.h), one half of an IMEX split (imex.h) or one
+// partition of a multirate split (multirate.h)
+enum class DerivativeMode
+{
+    VALUE,
+    TANGENT,
+    ADJOINT,
+    EXPLICIT,
+    IMPLICIT,
+    FAST,
+    SLOW
+};
+
+const size_t DEFAULT_SHARD_SIZE = 32768; // Rough number of bytes of code per generated translation unit
+
 std::string generate_state_indices(SystemDeclarations &system);
+std::string generate_state_index_declarations(SystemDeclarations &system);
 std::string generate_index_range(SystemDeclarations &system, Symbol state_symbol);
 
 std::string generate_csv_getters(SystemDeclarations &system);
 std::string generate_csv_list(SystemDeclarations &system, Symbol state_symbol);
 
+bool has_roots(SystemDeclarations &system);
+std::string generate_root_function(SystemDeclarations &system);
+
 std::string generate_meta(SystemDeclarations& system);
+std::string generate_meta_declarations(SystemDeclarations& system);
+
+std::string generate_profile_scope(SystemDeclarations &system, std::string label, size_t num_tabs);
+std::string generate_profiler_runtime(SystemDeclarations &system);
+std::string generate_profiler_report(SystemDeclarations &system);
 
+void find_constexpr_constants(SystemDeclarations &system);
+std::string generate_range_constants(SystemDeclarations &system);
 std::string generate_constant_definitions(SystemDeclarations &system);
+std::string generate_constant_declarations(SystemDeclarations &system);
 std::string generate_function_declarations(SystemDeclarations &system);
+std::string generate_function_definition(SystemDeclarations &system, Function &f);
 std::string generate_function_definitions(SystemDeclarations &system);
+bool has_function_tables(SystemDeclarations &system);
+std::string generate_function_table_runtime(SystemDeclarations &system);
+std::string generate_function_table_declarations(SystemDeclarations &system);
+std::string generate_function_tables(SystemDeclarations &system);
+std::string generate_summation_declarations(SystemDeclarations &system);
+std::string generate_summation_definition(SystemDeclarations& system, Summation &summation);
 std::string generate_summation_definitions(SystemDeclarations& system);
 
-std::string generate_setter_list(SystemDeclarations &system, InitialState &initial_state);
-std::string generate_initial_state_setter(SystemDeclarations &system);
+// Emits the range loops around one list entry, the entry is generated with the loop indices bound
+std::string generate_list_loops(SystemDeclarations &system, Symbol &symbol, size_t nesting_level, std::function<std::string(std::string)> generate_body);
+std::string generate_setter_list(SystemDeclarations &system, InitialState &initial_state, DerivativeMode mode = DerivativeMode::VALUE);
+std::string generate_initial_state_setter(SystemDeclarations &system, DerivativeMode mode = DerivativeMode::VALUE);
+// Sets values[] for the states, lists and list entries of <state> = <value> tags the way initial states are set, the
+// overrides of list entries last
+std::string generate_state_assignments(SystemDeclarations &system, std::vector<InitialState> &assignments, std::string tag);
+bool has_absolute_tolerances(SystemDeclarations &system);
+std::string generate_absolute_tolerance_setter(SystemDeclarations &system);
 
+// Locals evaluated before a loop, holding the subexpressions of its body which don't read the index variables bound
+// in bound_parameters. The body's generate() reads them until loop_invariants is cleared
+std::string generate_loop_invariants(SystemDeclarations &system, Expression &body, std::string indentation);
+std::string generate_entry(SystemDeclarations &system, DerivativeMode mode, std::string indentation, std::string array, std::string index, Expression &rhs);
 std::string generate_derivative(SystemDeclarations &system);
+std::vector<std::string> generate_derivative_blocks(SystemDeclarations &system, DerivativeMode mode = DerivativeMode::VALUE);
 std::string generate_derivative_definitions(SystemDeclarations &system);
-std::string generate_derivative_list(SystemDeclarations &system, StateVariable &state_variable);
\ No newline at end of file
+std::string generate_derivative_list(SystemDeclarations &system, StateVariable &state_variable, DerivativeMode mode = DerivativeMode::VALUE);
+
+std::string generate_model_interface(SystemDeclarations &system);
+// Receives the name of every phase of generate_sources, checks and emitters, with a function running it, so the
+// generator benchmark can time them the way generate_sources runs them
+using PhaseHook = std::function<void(const std::string &name, const std::function<void()> &run)>;
+std::vector<GeneratedFile> generate_sources(SystemDeclarations &system, size_t shard_size = DEFAULT_SHARD_SIZE, const PhaseHook &phase_hook = nullptr);
+// Creates the directory if needed, false after printing an error
+bool write_sources(std::string directory, std::vector<GeneratedFile> &files);
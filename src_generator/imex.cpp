@@ -0,0 +1,92 @@
+#include "imex.h"
+
+#include <sstream>
+
+#include "sensitivity.h"
+
+bool has_imex(SystemDeclarations &system)
+{
+    return system.use_imex;
+}
+
+bool check_imex(SystemDeclarations &system)
+{
+    if (!system.use_imex)
+        return false;
+
+    // Functions and summations are shared by both halves, so they can't be split
+    bool misplaced = false;
+    for (auto& f : system.function_definitions)
+    {
+        for (auto& definition : f.definitions)
+        {
+            if (definition.expression && definition.expression->has_explicit_terms())
+                misplaced = true;
+        }
+    }
+    for (auto& summation : system.summation_definitions)
+    {
+        if (summation.summand && summation.summand->has_explicit_terms())
+            misplaced = true;
+    }
+    for (auto& initial_state : system.initial_states)
+    {
+        if (initial_state.rhs && initial_state.rhs->has_explicit_terms())
+            misplaced = true;
+    }
+    for (auto& output : system.additional_outputs)
+    {
+        if (output.rhs->has_explicit_terms())
+            misplaced = true;
+    }
+    if (misplaced)
+    {
+        std::cerr << "Error: EXPLICIT() can only be used in d/dt equations.\n";
+        return false;
+    }
+    return true;
+}
+
+std::string generate_imex_declarations()
+{
+    return "\nvoid explicit_derivative(double t, double* values, double* derivatives);"
+           "\nvoid implicit_derivative(double t, double* values, double* derivatives);";
+}
+
+std::string Expression::generate_explicit(SystemDeclarations&)
+{
+    if (has_explicit_terms())
+        std::cerr << "Error: EXPLICIT() terms must be added to or subtracted from the rest of the equation.\n";
+    return "0";
+}
+
+std::string NegateExpression::generate_explicit(SystemDeclarations& system)
+{
+    auto terms = negated_expression->generate_explicit(system);
+    return terms == "0" ? "0" : "-(" + terms + ")";
+}
+
+std::string AddExpression::generate_explicit(SystemDeclarations& system)
+{
+    return tangent_sum(lhs->generate_explicit(system), "+", rhs->generate_explicit(system));
+}
+
+std::string SubtractExpression::generate_explicit(SystemDeclarations& system)
+{
+    return tangent_sum(lhs->generate_explicit(system), "-", rhs->generate_explicit(system));
+}
+
+std::string ExplicitExpression::generate_explicit(SystemDeclarations& system)
+{
+    return term->generate(system);
+}
+
+// The implicit half is generated with the explicit terms left out
+std::string ExplicitExpression::generate(SystemDeclarations& system)
+{
+    std::string hoisted;
+    if (read_loop_invariant(system, this, hoisted))
+        return hoisted;
+
+    return system.omit_explicit_terms ? "0" : term->generate(system);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include "expression.h"
+#include "parse.h"
+
+// Implicit-explicit split for ARKStep, chosen with @INTEGRATOR arkode-imex. Terms of a d/dt equation wrapped in
+// EXPLICIT() make up the explicit derivative, everything else the implicit one, so together they sum to the
+// derivative. Only the implicit half goes through Newton iterations and linear solves. EXPLICIT() terms have to be
+// added to or subtracted from the rest of their equation, and outside of the split they're just their value.
+
+bool has_imex(SystemDeclarations &system);
+// Prints an error when the split can't be honoured
+bool check_imex(SystemDeclarations &system);
+
+std::string generate_imex_declarations();
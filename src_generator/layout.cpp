@@ -0,0 +1,196 @@
+#include "layout.h"
+
+#include <sstream>
+
+ListLayout get_list_layout(SystemDeclarations &system, std::string list)
+{
+    auto layout = system.list_layouts.find(list);
+    return layout == system.list_layouts.end() ? ListLayout() : layout->second;
+}
+
+// Range symbols of the catch-all definition of a list, empty when there's no such list
+std::vector<std::string> get_list_ranges(SystemDeclarations &system, std::string list)
+{
+    for (auto& state_variable : system.state_variables)
+    {
+        std::vector<std::string> ranges;
+        for (auto& p : state_variable.symbol.parameters)
+        {
+            if (p.type == ParameterType::VARIABLE && system.ranges.count(p.symbol.value()))
+                ranges.push_back(p.symbol.value());
+        }
+        if (state_variable.symbol.name == list && !ranges.empty() && ranges.size() == state_variable.symbol.parameters.size())
+            return ranges;
+    }
+    return {};
+}
+
+bool check_layouts(SystemDeclarations &system)
+{
+    bool valid = true;
+    for (auto& [list, layout] : system.list_layouts)
+    {
+        auto ranges = get_list_ranges(system, list);
+        if (ranges.empty())
+        {
+            std::cerr << "Error: @LAYOUT names " << list << ", which isn't a list with a catch-all definition.\n";
+            valid = false;
+            continue;
+        }
+        for (auto& member : layout.group)
+        {
+            auto& member_layout = system.list_layouts[member];
+            if (get_list_ranges(system, member) != ranges)
+            {
+                std::cerr << "Error: @LAYOUT groups " << list << " with " << member << ", which doesn't have the same ranges.\n";
+                valid = false;
+            }
+            else if (member_layout.kind != layout.kind || member_layout.group != layout.group || member_layout.tile_size != layout.tile_size
+                     || member_layout.row_major != layout.row_major)
+            {
+                std::cerr << "Error: " << list << " and " << member << " are grouped by @LAYOUT but don't share the same layout.\n";
+                valid = false;
+            }
+        }
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Error: Ignoring @LAYOUT, every list is stored separately.\n";
+        system.list_layouts.clear();
+    }
+    return valid;
+}
+
+std::string generate_group_indices(SystemDeclarations &system, std::string list, std::string size)
+{
+    auto layout = get_list_layout(system, list);
+    if (list != layout.group.front())
+        return "";
+
+    std::stringstream str;
+    std::string first = "INDEX_" + list;
+    size_t num_lists = layout.group.size();
+    for (size_t position = 0; position < num_lists; ++position)
+    {
+        str << "\n" << system.index_type() << " INDEX_" << layout.group[position] << "_START = ";
+        if (position == 0)
+            str << system.next_index;
+        else if (layout.kind == LayoutKind::INTERLEAVED)
+            str << first << "_START + " << position;
+        else
+            str << first << "_START + tiled_index(0, " << first << "_SIZE, " << position << ", " << num_lists << ", " << layout.tile_size << ")";
+        str << ";";
+        str << "\n" << system.index_type() << " INDEX_" << layout.group[position] << "_SIZE = " << size << ";";
+    }
+    system.next_index = first + "_START + " + std::to_string(num_lists) + " * " + first + "_SIZE";
+
+    return str.str();
+}
+
+std::string generate_list_index(SystemDeclarations &system, std::string list, std::string entry)
+{
+    auto layout = get_list_layout(system, list);
+    size_t num_lists = layout.group.size();
+    switch (layout.kind)
+    {
+        case LayoutKind::INTERLEAVED:
+            return "INDEX_" + list + "_START + " + std::to_string(num_lists) + " * (" + entry + ")";
+        case LayoutKind::TILED:
+            for (size_t position = 0; position < num_lists; ++position)
+            {
+                if (layout.group[position] != list)
+                    continue;
+                return "INDEX_" + layout.group.front() + "_START + tiled_index(" + entry + ", INDEX_" + list + "_SIZE, "
+                       + std::to_string(position) + ", " + std::to_string(num_lists) + ", " + std::to_string(layout.tile_size) + ")";
+            }
+            break;
+        default:
+            break;
+    }
+    return "INDEX_" + list + "_START + " + entry;
+}
+
+std::string generate_state_index(SystemDeclarations &system, Symbol &symbol)
+{
+    if (symbol.parameters.empty())
+        return "INDEX_" + symbol.to_string();
+
+    return generate_list_index(system, symbol.to_string(), generate_parameters_index(system, symbol));
+}
+
+bool has_tiled_layouts(SystemDeclarations &system)
+{
+    for (auto& [list, layout] : system.list_layouts)
+    {
+        if (layout.kind == LayoutKind::TILED)
+            return true;
+    }
+    return false;
+}
+
+std::string generate_layout_runtime(SystemDeclarations &system)
+{
+    if (!has_tiled_layouts(system))
+        return "";
+
+    // Entries past the last full tile are stored one list after the other
+    return "\n"
+           "\n// Offset of an entry of the position-th of a group of tiled lists from the group's first entry"
+           "\nconstexpr size_t tiled_index(size_t entry, size_t size, size_t position, size_t num_lists, size_t tile_size)"
+           "\n{"
+           "\n\tsize_t full = size / tile_size * tile_size;"
+           "\n\tif (entry < full) return entry / tile_size * tile_size * num_lists + position * tile_size + entry % tile_size;"
+           "\n\treturn full * num_lists + position * (size - full) + entry - full;"
+           "\n}";
+}
+
+std::string generate_state_view(SystemDeclarations &system)
+{
+    std::stringstream str;
+    str << "\n"
+        << "\n// Named access to a state vector, or to its derivative, with the layout above. Only wraps the pointer"
+        << "\ntemplate <typename Real>"
+        << "\nstruct StateView"
+        << "\n{"
+        << "\n\tReal* values;"
+        << "\n"
+        << "\n\texplicit StateView(Real* values) : values(values) {}"
+        << "\n";
+    for (auto& state_variable : system.state_variables)
+    {
+        auto& symbol = state_variable.symbol;
+        std::string name = symbol.to_string();
+        system.bound_parameters.clear();
+        if (symbol.parameters.empty())
+        {
+            str << "\n\tReal& " << name << "() const { return values[INDEX_" << name << "]; }";
+            continue;
+        }
+
+        std::string parameters;
+        for (auto& p : symbol.parameters)
+        {
+            if (p.type != ParameterType::VARIABLE || !system.ranges.count(p.symbol.value()))
+            {
+                parameters.clear();
+                break;
+            }
+            parameters += (parameters.empty() ? "" : ", ") + std::string("size_t ") + p.symbol.value();
+            system.bound_parameters[p.symbol.value()] = true;
+        }
+        if (parameters.empty()) // Overrides share the catch-all's accessor
+            continue;
+
+        str << "\n\tReal& " << name << "(" << parameters << ") const { return values[" << generate_state_index(system, symbol) << "]; }";
+        // A separate list is one block of INDEX_<list>_SIZE entries
+        if (get_list_layout(system, name).kind == LayoutKind::SEPARATE)
+        {
+            str << "\n\tReal* " << name << "_data() const { return values + INDEX_" << name << "_START; }";
+        }
+    }
+    system.bound_parameters.clear();
+    str << "\n};";
+
+    return str.str();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "expression.h"
+#include "parse.h"
+
+// Placement of list entries in the state vector, chosen with @LAYOUT. A list fills its own block with its first
+// index varying fastest unless told otherwise. Interleaved lists store entry n of every list of their group next to
+// each other, tiled lists do the same a tile of entries at a time, and row_major makes the last index vary fastest.
+// Every index into the state is generated through generate_state_index or generate_list_index so they all agree
+
+ListLayout get_list_layout(SystemDeclarations &system, std::string list);
+// Prints an error and falls back to separate lists when a @LAYOUT group isn't made of lists over the same ranges
+bool check_layouts(SystemDeclarations &system);
+
+// START and SIZE constants of every list of a group, emitted when its first list is reached
+std::string generate_group_indices(SystemDeclarations &system, std::string list, std::string size);
+// Index into the state of the entry of a list at the given offset from its first entry, as generate_parameters_index counts it
+std::string generate_list_index(SystemDeclarations &system, std::string list, std::string entry);
+// Index into the state of a scalar state, or of a list entry with every index bound or given
+std::string generate_state_index(SystemDeclarations &system, Symbol &symbol);
+
+bool has_tiled_layouts(SystemDeclarations &system);
+std::string generate_layout_runtime(SystemDeclarations &system);
+// StateView<Real> in system.h, accessors named after the states for code written against a generated model
+std::string generate_state_view(SystemDeclarations &system);
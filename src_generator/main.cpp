@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "parse.h"
 #include "generator.h"
 
@@ -5,26 +7,28 @@ int main(int argc, char **argv)
 {
     std::cerr << "Generating...\n";
 
-    std::string filename = (argc < 2) ? "system.txt" : argv[1];
+    std::string filename = "system.txt";
+    size_t shard_size = DEFAULT_SHARD_SIZE;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--shard-size=", 13) == 0)
+        {
+            shard_size = std::stoul(argv[i] + 13);
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+
     std::ifstream system_src_file(filename, std::ios::in);
     SystemDeclarations system;
     read_system(system, system_src_file);
     system_src_file.close();
 
-    std::ofstream outmodule("../generated/system.h", std::ios::out);
-    outmodule << "#include <cmath>"
-              << "\n#include <nvector/nvector_serial.h>"
-              << "\n#include <sstream>"
-              << generate_meta(system)
-              << generate_constant_definitions(system) 
-              << generate_state_indices(system)
-              << "\nconst size_t STATE_SIZE =" << system.next_index << ";"
-              << generate_function_declarations(system)
-              << generate_summation_definitions(system)
-              << generate_function_definitions(system)
-              << generate_csv_getters(system)
-              << generate_initial_state_setter(system)
-              << generate_derivative(system);
+    auto files = generate_sources(system, shard_size);
+    if (!write_sources("../generated", files))
+        return 1;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,149 @@
+#include "multirate.h"
+
+#include <sstream>
+
+#include "generator.h"
+#include "layout.h"
+
+bool has_multirate(SystemDeclarations &system)
+{
+    return !system.fast_states.empty();
+}
+
+bool check_multirate(SystemDeclarations &system)
+{
+    if (system.fast_states.empty())
+        return false;
+
+    if (system.use_imex)
+    {
+        std::cerr << "Error: @FAST can't be combined with @INTEGRATOR arkode-imex.\n";
+        return false;
+    }
+    for (auto& fast_state : system.fast_states)
+    {
+        auto state_variable = system.find_state_variable(Symbol(fast_state.name));
+        if (state_variable == nullptr)
+        {
+            std::cerr << "Error: @FAST names " << fast_state.name << ", which isn't a state.\n";
+            return false;
+        }
+        auto& parameters = state_variable->symbol.parameters;
+        if (!parameters.empty() && parameters[0].type != ParameterType::VARIABLE)
+        {
+            std::cerr << "Error: @FAST needs a catch-all definition of " << fast_state.name << ".\n";
+            return false;
+        }
+        if (fast_state.start && parameters.size() != 1)
+        {
+            std::cerr << "Error: @FAST can only give index ranges of lists with one index, " << fast_state.name << " has " << parameters.size() << ".\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string generate_multirate_declarations()
+{
+    return "\nvoid fast_derivative(double t, double* values, double* derivatives);"
+           "\nvoid slow_derivative(double t, double* values, double* derivatives);";
+}
+
+// The list overrides of a fast state, guarded by its range when only part of the list is fast
+std::vector<std::string> generate_fast_overrides(SystemDeclarations &system, FastState &fast_state, std::string start, std::string end)
+{
+    std::vector<std::string> overrides;
+    for (auto& state_variable : system.state_variables)
+    {
+        if (state_variable.symbol.name != fast_state.name || !state_variable.symbol.is_list()
+            || state_variable.symbol.parameters[0].type != ParameterType::EXPRESSION)
+            continue;
+
+        system.bound_parameters.clear();
+        std::string override_index = state_variable.symbol.parameters[0].expression->generate(system);
+        std::string index = generate_list_index(system, state_variable.symbol.to_string(), "(size_t)(" + override_index + " - 1)");
+        if (!fast_state.start)
+        {
+            overrides.push_back(generate_entry(system, DerivativeMode::FAST, "    ", "derivatives", index, *state_variable.rhs));
+            continue;
+        }
+        overrides.push_back("    if (" + override_index + " >= " + start + " && " + override_index + " <= " + end + ")\n    {\n"
+                            + generate_entry(system, DerivativeMode::FAST, "        ", "derivatives", index, *state_variable.rhs)
+                            + "    }\n");
+    }
+    return overrides;
+}
+
+std::vector<std::string> generate_fast_derivative_blocks(SystemDeclarations &system)
+{
+    std::vector<std::string> blocks;
+    blocks.push_back("    std::fill(derivatives, derivatives + STATE_SIZE, 0);\n");
+
+    for (auto& fast_state : system.fast_states)
+    {
+        auto& state_variable = *system.find_state_variable(Symbol(fast_state.name));
+        auto& symbol = state_variable.symbol;
+        system.bound_parameters.clear();
+        if (!symbol.is_list())
+        {
+            blocks.push_back(generate_entry(system, DerivativeMode::FAST, "    ", "derivatives", "INDEX_" + symbol.to_string(), *state_variable.rhs));
+            continue;
+        }
+        if (!fast_state.start)
+        {
+            blocks.push_back(generate_derivative_list(system, state_variable, DerivativeMode::FAST));
+            auto overrides = generate_fast_overrides(system, fast_state, "", "");
+            blocks.insert(blocks.end(), overrides.begin(), overrides.end());
+            continue;
+        }
+
+        // Only the part of the list's range inside the fast range is evaluated
+        std::string start = fast_state.start->generate(system);
+        std::string end = fast_state.end->generate(system);
+        auto range_symbol = symbol.parameters[0].symbol.value();
+        std::stringstream str;
+        system.bound_parameters[range_symbol] = true;
+        str << "\n" << generate_loop_invariants(system, *state_variable.rhs, "    ")
+            << "    for (size_t " << range_symbol << " = std::max<size_t>(" << generate_range_start(system, range_symbol) << ", " << start << "); "
+            << range_symbol << " <= std::min<size_t>(" << generate_range_end(system, range_symbol) << ", " << end << "); ++" << range_symbol << ")\n"
+            << "    {\n";
+        std::string index = generate_state_index(system, symbol);
+        str << generate_entry(system, DerivativeMode::FAST, "        ", "derivatives", index, *state_variable.rhs)
+            << "    }\n";
+        system.loop_invariants.clear();
+        blocks.push_back(str.str());
+
+        auto overrides = generate_fast_overrides(system, fast_state, start, end);
+        blocks.insert(blocks.end(), overrides.begin(), overrides.end());
+    }
+
+    return blocks;
+}
+
+std::string generate_fast_state_mask(SystemDeclarations &system)
+{
+    std::stringstream str;
+    str << "\n";
+    for (auto& fast_state : system.fast_states)
+    {
+        auto& symbol = system.find_state_variable(Symbol(fast_state.name))->symbol;
+        system.bound_parameters.clear();
+        if (!symbol.is_list())
+        {
+            str << "    derivatives[INDEX_" << symbol.to_string() << "] = 0;\n";
+        }
+        else if (!fast_state.start)
+        {
+            str << "    for (size_t i = 0; i < INDEX_" << symbol.to_string() << "_SIZE; ++i)\n"
+                << "        derivatives[" << generate_list_index(system, symbol.to_string(), "i") << "] = 0;\n";
+        }
+        else
+        {
+            auto range_symbol = symbol.parameters[0].symbol.value();
+            str << "    for (size_t i = std::max<size_t>(" << generate_range_start(system, range_symbol) << ", " << fast_state.start->generate(system) << "); "
+                << "i <= std::min<size_t>(" << generate_range_end(system, range_symbol) << ", " << fast_state.end->generate(system) << "); ++i)\n"
+                << "        derivatives[" << generate_list_index(system, symbol.to_string(), "i - 1") << "] = 0;\n";
+        }
+    }
+    return str.str();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "expression.h"
+#include "parse.h"
+
+// Multirate split for MRIStep, chosen by listing the fast states with @FAST. The fast derivative only evaluates the
+// equations of those states and leaves 0 for every other one, the slow derivative is the whole derivative with the
+// fast entries zeroed, so the two add up to the derivative and the slow equations run once per slow stage
+
+bool has_multirate(SystemDeclarations &system);
+// Prints an error when a @FAST entry doesn't name a state or a range of a list with one index
+bool check_multirate(SystemDeclarations &system);
+
+std::string generate_multirate_declarations();
+std::vector<std::string> generate_fast_derivative_blocks(SystemDeclarations &system);
+// Zeroes the fast entries, appended to the slow derivative
+std::string generate_fast_state_mask(SystemDeclarations &system);
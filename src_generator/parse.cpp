@@ -190,8 +190,7 @@ std::shared_ptr<Expression> parse_sum(SystemDeclarations &system, std::vector<To
 
     Symbol summation_symbol("__summation_" + std::to_string(Summation::next_id++));
     summation_symbol.type = SymbolType::SUMMATION;
-    system.summation_definitions.push_back(
-        Summation{summation_symbol, index_symbol.value(), summand_expression, range.value()});
+    system.add_summation(Summation{summation_symbol, index_symbol.value(), summand_expression, range.value()});
 
     return std::make_shared<SymbolExpression>(summation_symbol);
 }
@@ -280,6 +279,16 @@ std::shared_ptr<Expression> parse_expression(SystemDeclarations &system, std::ve
             expression = std::make_shared<ExpExpression>(unary_expr);
         }
             continue;
+        case TokenType::EXPLICIT:
+        {
+            auto unary_expr = parse_unary_expression(system, tokens);
+            if (!unary_expr)
+            {
+                std::cerr << "Error: EXPLICIT doesn't have a valid expression.\n";
+            }
+            expression = std::make_shared<ExplicitExpression>(unary_expr);
+        }
+            continue;
         case TokenType::SUM:
             expression = parse_sum(system, tokens);
             continue;
@@ -308,13 +317,10 @@ std::vector<Parameter> parse_parameters(SystemDeclarations &system, std::vector<
         {
             parameter.type = ParameterType::VARIABLE;
             parameter.symbol = parameter_tokens[0].symbol.value().name;
-            for (auto d : system.function_definitions)
+            if (system.find_function_definition(parameter_tokens[0].symbol.value()) != nullptr)
             {
-                if (d.symbol.name == parameter_tokens[0].symbol.value().name)
-                {
-                    parameter.type = ParameterType::EXPRESSION;
-                    parameter.expression = std::make_shared<SymbolExpression>(parameter.symbol.value());
-                }
+                parameter.type = ParameterType::EXPRESSION;
+                parameter.expression = std::make_shared<SymbolExpression>(parameter.symbol.value());
             }
             parameters.push_back(parameter);
         }
@@ -353,7 +359,7 @@ void parse_state_definition(SystemDeclarations &system, std::vector<Token> token
         return;
     }
 
-    system.state_variables.push_back(StateVariable(symbol, std::move(rhs)));
+    system.add_state_variable(StateVariable(symbol, std::move(rhs)));
 }
 
 void parse_initial_value(SystemDeclarations &system, std::vector<Token> tokens)
@@ -394,8 +400,7 @@ void parse_symbol_declaration(SystemDeclarations &system, std::vector<Token> tok
         auto function = system.find_function_definition(symbol);
         if (function == nullptr)
         {
-            system.function_definitions.push_back(Function(symbol));
-            function = system.find_function_definition(symbol);
+            function = &system.add_function(symbol);
         }
 
         function->definitions.push_back(FunctionDefinition{symbol.parameters, expression});
@@ -417,7 +422,7 @@ void parse_output_value(SystemDeclarations &system, std::vector<Token> tokens)
     system.additional_outputs.push_back(ExpressionOutput{symbol, expression});
 }
 
-void parse_valued_tag(std::string& tag_lvalue, SystemDeclarations system, std::vector<Token> tokens)
+void parse_valued_tag(std::string& tag_lvalue, SystemDeclarations& system, std::vector<Token> tokens)
 {
     Token tag_token = tokens.front();
     tokens.erase(tokens.begin());
@@ -425,14 +430,258 @@ void parse_valued_tag(std::string& tag_lvalue, SystemDeclarations system, std::v
     if (!expr)
     {
         std::cerr << "Error: Failed to parse " << tag_token.to_string() << " tag.\n";
+        return;
     }
     tag_lvalue = expr->generate(system);
+    system.tag_expressions[tag_token.type] = expr;
+}
+
+bool is_state_assignment(std::vector<Token>& tokens)
+{
+    return std::any_of(tokens.begin(), tokens.end(), [](const Token& token) { return token.type == TokenType::ASSIGN; });
+}
+
+// <tag> <state> = <value> for a single state, a whole list or one entry of a list
+void parse_state_assignment(std::vector<InitialState>& assignments, std::string description, SystemDeclarations& system, std::vector<Token> tokens)
+{
+    tokens.erase(tokens.begin());                 // Remove the tag
+    Symbol symbol = parse_symbol(system, tokens); // Grab and remove the symbol
+    tokens.erase(tokens.begin());                 // Remove "="
+
+    std::shared_ptr<Expression> expression = parse_expression(system, tokens);
+    if (!expression)
+    {
+        std::cerr << "Error: Malformed expression for " << description << " of " << symbol.name << "\n";
+        return;
+    }
+    assignments.push_back(InitialState{symbol, expression});
+}
+
+// A value for every state, or a state assignment
+void parse_absolute_tolerance_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    if (is_state_assignment(tokens))
+        parse_state_assignment(system.absolute_tolerances, "absolute tolerance", system, tokens);
+    else
+        parse_valued_tag(system.abstol, system, tokens);
+}
+
+// auto, or a state assignment. The state is divided by its scale, so a literal one has to be positive, computed
+// ones are checked when get_state_scale runs
+void parse_scale_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    if (is_state_assignment(tokens))
+    {
+        size_t num_scales = system.state_scales.size();
+        parse_state_assignment(system.state_scales, "scale", system, tokens);
+        if (system.state_scales.size() == num_scales)
+            return;
+
+        auto& scale = system.state_scales.back();
+        auto literal = dynamic_cast<ConstantExpression*>(scale.rhs.get());
+        if ((literal && literal->value <= 0) || dynamic_cast<NegateExpression*>(scale.rhs.get()))
+        {
+            std::cerr << "Error: @SCALE of " << scale.symbol.name << " must be positive.\n";
+            system.state_scales.pop_back();
+        }
+    }
+    else if (tokens.size() == 2 && tokens[1].type == TokenType::SYMBOL && tokens[1].symbol && tokens[1].symbol->name == "auto")
+        system.use_auto_scale = true;
+    else
+        std::cerr << "Error: @SCALE must be followed by auto or <state> = <value>.\n";
+}
+
+void parse_precision_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    std::string precision = tokens.size() == 2 && tokens[1].symbol ? tokens[1].symbol->name : "";
+    if (precision == "double")
+        system.precision = Precision::DOUBLE;
+    else if (precision == "mixed")
+        system.precision = Precision::MIXED;
+    else if (precision == "single")
+        system.precision = Precision::SINGLE;
+    else
+        std::cerr << "Error: @PRECISION must be followed by double, mixed or single.\n";
+}
+
+// Integrator names contain dashes, which tokenize as subtractions
+// A number of steps, or adaptive to let the solver lengthen the intervals between setups while Newton converges well
+void parse_jacobian_reuse_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    if (tokens.size() == 2 && tokens[1].type == TokenType::SYMBOL && tokens[1].symbol && tokens[1].symbol->name == "adaptive")
+    {
+        system.use_adaptive_reuse = true;
+        return;
+    }
+    parse_valued_tag(system.jacobian_reuse, system, tokens);
+}
+
+void parse_integrator_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    std::string integrator;
+    for (size_t i = 1; i < tokens.size(); ++i)
+    {
+        if (tokens[i].type == TokenType::SYMBOL && tokens[i].symbol)
+            integrator += tokens[i].symbol->name;
+        else if (tokens[i].type == TokenType::SUBTRACT || tokens[i].type == TokenType::NEGATE)
+            integrator += "-";
+    }
+    if (integrator == "cvodes")
+        system.use_imex = false;
+    else if (integrator == "arkode-imex")
+        system.use_imex = true;
+    else
+        std::cerr << "Error: @INTEGRATOR must be followed by cvodes or arkode-imex.\n";
+}
+
+// A comma separated list of states, lists can be followed by a single index or a range in brackets
+void parse_fast_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    tokens.erase(tokens.begin());
+    while (!tokens.empty())
+    {
+        if (tokens[0].type != TokenType::SYMBOL || !tokens[0].symbol)
+        {
+            std::cerr << "Error: @FAST must be followed by a comma separated list of states.\n";
+            return;
+        }
+        tokens.push_back(Token { TokenType::COMMA, std::nullopt, std::nullopt }); // Keeps parse_symbol from reading past the end
+        Symbol symbol = parse_symbol(system, tokens);
+        if (symbol.type == SymbolType::UNRESOLVED)
+        {
+            std::cerr << "Error: Missing ] after @FAST " << symbol.name << ".\n";
+            return;
+        }
+        tokens.pop_back();
+
+        FastState fast_state{ symbol.name, nullptr, nullptr };
+        if (symbol.parameters.size() > 1)
+        {
+            std::cerr << "Error: @FAST can only give index ranges of lists with one index, list all of " << symbol.name << " instead.\n";
+            return;
+        }
+        if (symbol.parameters.size() == 1 && symbol.parameters[0].type == ParameterType::EXPRESSION)
+        {
+            auto& index = symbol.parameters[0].expression;
+            if (auto range_expression = dynamic_cast<RangeExpression*>(index.get()))
+            {
+                fast_state.start = range_expression->range.start;
+                fast_state.end = range_expression->range.end;
+            }
+            else
+            {
+                fast_state.start = index;
+                fast_state.end = index;
+            }
+        }
+        system.fast_states.push_back(fast_state);
+
+        if (!tokens.empty() && tokens[0].type == TokenType::COMMA)
+            tokens.erase(tokens.begin());
+    }
+}
+
+// @LAYOUT <separate | interleaved | tiled <size> | row_major | column_major> <list>, <list>, ...
+void parse_layout_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    if (tokens.size() < 3 || tokens[1].type != TokenType::SYMBOL || !tokens[1].symbol)
+    {
+        std::cerr << "Error: @LAYOUT must be followed by a layout and a comma separated list of lists.\n";
+        return;
+    }
+    std::string kind = tokens[1].symbol->name;
+    size_t first_list = 2;
+    size_t tile_size = 1;
+    if (kind == "tiled")
+    {
+        if (tokens[2].type != TokenType::CONSTANT || tokens[2].value.value() < 1)
+        {
+            std::cerr << "Error: @LAYOUT tiled must be followed by a tile size.\n";
+            return;
+        }
+        tile_size = (size_t)tokens[2].value.value();
+        first_list = 3;
+    }
+    else if (kind != "separate" && kind != "interleaved" && kind != "row_major" && kind != "column_major")
+    {
+        std::cerr << "Error: Unknown layout " << kind << ", expected separate, interleaved, tiled, row_major or column_major.\n";
+        return;
+    }
+
+    std::vector<std::string> lists;
+    for (size_t i = first_list; i < tokens.size(); ++i)
+    {
+        if (tokens[i].type == TokenType::SYMBOL && tokens[i].symbol && (i == first_list || tokens[i - 1].type == TokenType::COMMA))
+        {
+            lists.push_back(tokens[i].symbol->name);
+        }
+        else if (tokens[i].type != TokenType::COMMA)
+        {
+            std::cerr << "Error: @LAYOUT " << kind << " must be followed by a comma separated list of lists.\n";
+            return;
+        }
+    }
+
+    // The order of the indices and the grouping of lists are set independently
+    for (auto& list : lists)
+    {
+        auto& layout = system.list_layouts[list];
+        if (kind == "row_major" || kind == "column_major")
+        {
+            layout.row_major = kind == "row_major";
+            continue;
+        }
+        layout.kind = kind == "interleaved" ? LayoutKind::INTERLEAVED : kind == "tiled" ? LayoutKind::TILED : LayoutKind::SEPARATE;
+        layout.group = kind == "separate" ? std::vector<std::string>() : lists;
+        layout.tile_size = tile_size;
+    }
+}
+
+void parse_sensitivity_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    for (size_t i = 1; i < tokens.size(); ++i)
+    {
+        if (tokens[i].type == TokenType::SYMBOL && tokens[i].symbol && (i == 1 || tokens[i - 1].type == TokenType::COMMA))
+        {
+            system.sensitivity_parameters.push_back(tokens[i].symbol->name);
+        }
+        else if (tokens[i].type != TokenType::COMMA)
+        {
+            std::cerr << "Error: @SENSITIVITY must be followed by a comma separated list of constants.\n";
+            return;
+        }
+    }
+}
+
+void parse_adjoint_tag(SystemDeclarations& system, std::vector<Token> tokens)
+{
+    if (tokens.size() == 2 && tokens[1].type == TokenType::SYMBOL && tokens[1].symbol)
+        system.adjoint_objective = tokens[1].symbol->name;
+    else
+        std::cerr << "Error: @ADJOINT must be followed by the label of an OUTPUT.\n";
+}
+
+// Roots have no label in the source, they're numbered per tag in the order they're declared
+void parse_root_tag(std::vector<ExpressionOutput>& conditions, std::string name, SystemDeclarations& system, std::vector<Token> tokens)
+{
+    Symbol label(name + "_" + std::to_string(conditions.size() + 1));
+    tokens.erase(tokens.begin());
+    std::shared_ptr<Expression> expression = parse_expression(system, tokens);
+    if (!expression)
+    {
+        std::cerr << "Error: Malformed expression for root " << label.name << "\n";
+        return;
+    }
+    conditions.push_back(ExpressionOutput{label, expression});
 }
 
 void parse_declaration(SystemDeclarations &system, std::string line)
 {
-    std::vector<Token> tokens = tokenize(line);
+    parse_declaration(system, tokenize(line));
+}
 
+void parse_declaration(SystemDeclarations &system, std::vector<Token> tokens)
+{
     if (tokens.size() == 0)
         return;
 
@@ -460,7 +709,7 @@ void parse_declaration(SystemDeclarations &system, std::string line)
         parse_valued_tag(system.reltol, system, tokens);
         break;
     case TokenType::TAG_ABSTOL:
-        parse_valued_tag(system.abstol, system, tokens);
+        parse_absolute_tolerance_tag(system, tokens);
         break;
     case TokenType::TAG_MAX_NUM_STEPS:
         parse_valued_tag(system.max_num_steps, system, tokens);
@@ -477,6 +726,66 @@ void parse_declaration(SystemDeclarations &system, std::string line)
     case TokenType::TAG_DIRECT_SOLVER:
         system.use_direct_solver = true;
         break;
+    case TokenType::TAG_PROFILE:
+        system.use_profiler = true;
+        break;
+    case TokenType::TAG_STEADY_STATE:
+        system.use_steady_state_solver = true;
+        break;
+    case TokenType::TAG_PARALLEL:
+        system.use_parallel = true;
+        break;
+    case TokenType::TAG_INTEGRATOR:
+        parse_integrator_tag(system, tokens);
+        break;
+    case TokenType::TAG_FAST:
+        parse_fast_tag(system, tokens);
+        break;
+    case TokenType::TAG_SLOW_STEP_SIZE:
+        parse_valued_tag(system.slow_step_size, system, tokens);
+        break;
+    case TokenType::TAG_LAYOUT:
+        parse_layout_tag(system, tokens);
+        break;
+    case TokenType::TAG_SCALE:
+        parse_scale_tag(system, tokens);
+        break;
+    case TokenType::TAG_JAC_REUSE:
+        parse_jacobian_reuse_tag(system, tokens);
+        break;
+    case TokenType::TAG_LSETUP_FREQ:
+        parse_valued_tag(system.linear_setup_frequency, system, tokens);
+        break;
+    case TokenType::TAG_DELTA_GAMMA_MAX:
+        parse_valued_tag(system.delta_gamma_max, system, tokens);
+        break;
+    case TokenType::TAG_MAX_NONLINEAR_ITERS:
+        parse_valued_tag(system.max_nonlinear_iterations, system, tokens);
+        break;
+    case TokenType::TAG_MAX_ORDER:
+        parse_valued_tag(system.max_order, system, tokens);
+        break;
+    case TokenType::TAG_PRECISION:
+        parse_precision_tag(system, tokens);
+        break;
+    case TokenType::TAG_SENSITIVITY:
+        parse_sensitivity_tag(system, tokens);
+        break;
+    case TokenType::TAG_ADJOINT:
+        parse_adjoint_tag(system, tokens);
+        break;
+    case TokenType::TAG_STOP_WHEN:
+        parse_root_tag(system.stop_conditions, "stop_when", system, tokens);
+        break;
+    case TokenType::TAG_EVENT:
+        parse_root_tag(system.event_conditions, "event", system, tokens);
+        break;
+    case TokenType::TAG_STOP_AT_STEADY_STATE:
+        parse_valued_tag(system.steady_state_tolerance, system, tokens);
+        break;
+    case TokenType::EXPLICIT:
+        std::cerr << "Error: EXPLICIT() marks terms of a d/dt equation, it can't start a declaration.\n";
+        break;
     }
 }
 
@@ -485,17 +794,20 @@ std::vector<std::string> collect_lines(std::ifstream& stream)
     std::vector<std::string> lines;
     std::string line;
 
+    static const std::regex continuation("^[ \\t]");
+    static const std::regex comment("(.*)#.*");
+
     std::string chunk;
     while (getline(stream, chunk))
     {
-        if (std::regex_search(chunk, std::regex("^[ \\t]")))
+        if (std::regex_search(chunk, continuation))
         {
             line += chunk;
             continue;
         }
 
         std::smatch matches;
-        if (std::regex_search(chunk, matches, std::regex("(.*)#.*")))
+        if (std::regex_search(chunk, matches, comment))
         {
             lines.push_back(line);
             line = "";
@@ -6,6 +6,7 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 
 #include "expression.h"
@@ -41,21 +42,79 @@ struct Summation
     static unsigned int next_id;
 };
 
+// A state given to the fast partition by @FAST. Lists of one index can give a range of it, start and end are null
+// when the whole state is fast
+struct FastState
+{
+    std::string name;
+    std::shared_ptr<Expression> start;
+    std::shared_ptr<Expression> end;
+};
+
+// Placement of a list's entries in the state vector, chosen with @LAYOUT, see layout.h
+enum class LayoutKind
+{
+    SEPARATE,    // The list fills its own block
+    INTERLEAVED, // Entry n of every list in the group, then entry n + 1, ...
+    TILED        // tile_size entries of every list in the group, then the next tile_size, ...
+};
+
+struct ListLayout
+{
+    LayoutKind kind = LayoutKind::SEPARATE;
+    bool row_major = false; // The last index of a multi-index list varies fastest instead of the first
+    std::vector<std::string> group; // Lists stored together, in @LAYOUT order. All have the same ranges
+    size_t tile_size = 1;
+};
+
+// Floating point types of the generated code. Mixed computes the derivative in float on the solver's double
+// state, single also hands the generated code a float copy of the state
+enum class Precision
+{
+    DOUBLE,
+    MIXED,
+    SINGLE
+};
+
 struct SystemDeclarations
 {
     std::vector<StateVariable> state_variables; // Represents the state, which may or may not include lists
     std::vector<InitialState> initial_states;
+    std::vector<InitialState> absolute_tolerances; // @ABSOLUTE_TOLERANCE <state> = <value>, set like initial states
+    std::vector<InitialState> state_scales; // @SCALE <state> = <value>, see scaling.h
     std::vector<ExpressionOutput> additional_outputs;
     std::vector<Function> function_definitions;
     std::vector<Summation> summation_definitions;
 
     std::unordered_map<std::string, Range> ranges; // The ranges that have been defined
-    std::map<std::string, bool> bound_parameters;
+    std::map<std::string, bool> bound_parameters; // True for size_t index variables, false for function parameters
 
     std::string next_index = "0";
+    std::unordered_set<std::string> constexpr_constants; // Constants defined in the header, see find_constexpr_constants
+    bool constexpr_indices = false; // Every list range is constexpr, so the state indices are defined in the header too
 
     bool use_cuda = false;
     bool use_direct_solver = false;
+    bool use_profiler = false;
+    bool use_steady_state_solver = false;
+    bool use_parallel = false; // @PARALLEL, the stages of the derivative run as OpenMP tasks, see schedule.h
+    bool use_imex = false; // @INTEGRATOR arkode-imex, see imex.h
+    bool use_auto_scale = false; // @SCALE auto
+    bool use_adaptive_reuse = false; // @JAC_REUSE adaptive, the solver stretches the reuse intervals as it goes
+    bool omit_explicit_terms = false; // Set while the implicit half of the split is generated
+    std::unordered_map<std::string, ListLayout> list_layouts; // @LAYOUT, lists without an entry are separate, first index fastest
+    std::vector<FastState> fast_states; // @FAST, integrated with MRIStep when not empty, see multirate.h
+    Precision precision = Precision::DOUBLE;
+    std::vector<std::string> sensitivity_parameters; // Constants named by @SENSITIVITY, in order
+    bool state_tangents = false; // Set while tangents along the state alone are generated, see has_jacobian_times
+    std::string adjoint_objective; // OUTPUT label named by @ADJOINT, empty without the tag
+    size_t adjoint_temporaries = 0; // Names the locals of generated adjoint code, see adjoint.h
+    std::unordered_map<const Expression*, std::string> loop_invariants; // Hoisted out of the loop being generated
+    std::unordered_map<std::string, std::string> intermediates; // Read instead of evaluated in the derivative, see schedule.h
+    size_t loop_invariant_locals = 0; // Names the locals loop invariants are hoisted into, see generate_loop_invariants
+    std::vector<ExpressionOutput> stop_conditions; // @STOP_WHEN, the solve ends when one crosses zero
+    std::vector<ExpressionOutput> event_conditions; // @EVENT, zero crossings are only recorded
+    std::vector<std::string> profile_labels; // One entry per profiled region, in emission order
     std::string end_time = "1e2";
     std::string sample_interval = "1e1";
     std::string reltol = "1e-6";
@@ -64,6 +123,25 @@ struct SystemDeclarations
     std::string max_step_size = "1e5";
     std::string min_step_size = "1e-30";
     std::string init_step_size = "1e-10";
+    std::string steady_state_tolerance = "0"; // Disabled unless @STOP_AT_STEADY_STATE is given
+    std::string slow_step_size = "0"; // The solver picks a hundredth of the sample interval unless it's given
+    // Newton controls, 0 keeps the integrator's default
+    std::string jacobian_reuse = "0"; // Steps between Jacobian evaluations
+    std::string linear_setup_frequency = "0"; // Steps between linear solver setups
+    std::string delta_gamma_max = "0"; // Relative change of gamma forcing a setup
+    std::string max_nonlinear_iterations = "0";
+    std::string max_order = "0"; // BDF order, CVODES only
+    std::map<TokenType, std::shared_ptr<Expression>> tag_expressions; // Parsed values of the tags above which were given
+
+    // Name lookups for the declarations above, kept in sync by the add_* functions so that
+    // resolving a symbol doesn't scan every declaration in big systems
+    std::unordered_map<std::string, size_t> function_indices;
+    std::unordered_map<std::string, size_t> state_variable_indices; // The catch-all definition if there is one
+    std::unordered_map<std::string, size_t> summation_indices;
+
+    std::string real_type() { return precision == Precision::DOUBLE ? "double" : "float"; }
+    std::string state_type() { return precision == Precision::SINGLE ? "float" : "double"; }
+    std::string index_type() { return constexpr_indices ? "constexpr size_t" : "const size_t"; }
 
     SymbolType resolve_symbol_type(Symbol symbol) {
         if (bound_parameters.count(symbol.name)) return SymbolType::PARAMETER;
@@ -72,19 +150,12 @@ struct SystemDeclarations
             return SymbolType::FUNCTION;
         }
 
-        // std::map could probably be better than std::vector
-        for (size_t i = 0; i < state_variables.size(); ++i)
-        {
-            if (state_variables[i].symbol == symbol) {
-                return SymbolType::STATE;
-            }
+        if (find_state_variable(symbol) != nullptr) {
+            return SymbolType::STATE;
         }
 
-        for (size_t i = 0; i < summation_definitions.size(); ++i)
-        {
-            if (summation_definitions[i].symbol == symbol) {
-                return SymbolType::SUMMATION;
-            }
+        if (find_summation(symbol) != nullptr) {
+            return SymbolType::SUMMATION;
         }
 
         std::cerr << "Error: Undefined symbol " << symbol.name << std::endl;
@@ -93,12 +164,50 @@ struct SystemDeclarations
 
     Function* find_function_definition(Symbol symbol)
     {
-        for (auto& f : function_definitions)
+        auto it = function_indices.find(symbol.name);
+        return it == function_indices.end() ? nullptr : &function_definitions[it->second];
+    }
+
+    StateVariable* find_state_variable(Symbol symbol)
+    {
+        auto it = state_variable_indices.find(symbol.name);
+        return it == state_variable_indices.end() ? nullptr : &state_variables[it->second];
+    }
+
+    Summation* find_summation(Symbol symbol)
+    {
+        auto it = summation_indices.find(symbol.name);
+        return it == summation_indices.end() ? nullptr : &summation_definitions[it->second];
+    }
+
+    Function& add_function(Symbol symbol)
+    {
+        function_indices[symbol.name] = function_definitions.size();
+        function_definitions.push_back(Function(symbol));
+        return function_definitions.back();
+    }
+
+    void add_state_variable(StateVariable state_variable)
+    {
+        bool is_catchall = true;
+        for (auto& p : state_variable.symbol.parameters)
         {
-            if (f.symbol == symbol) return &f;
+            if (p.type != ParameterType::VARIABLE) is_catchall = false;
         }
 
-        return nullptr;
+        auto existing = find_state_variable(state_variable.symbol);
+        if (existing == nullptr || (is_catchall && existing->symbol.parameters.size() > 0 
+            && existing->symbol.parameters[0].type != ParameterType::VARIABLE))
+        {
+            state_variable_indices[state_variable.symbol.name] = state_variables.size();
+        }
+        state_variables.push_back(state_variable);
+    }
+
+    void add_summation(Summation summation)
+    {
+        summation_indices[summation.symbol.name] = summation_definitions.size();
+        summation_definitions.push_back(summation);
     }
 };
 
@@ -107,4 +216,6 @@ void parse_state_definition(SystemDeclarations& system, std::vector<Token> token
 void parse_symbol_declaration(SystemDeclarations& system, std::vector<Token> tokens);
 void parse_initial_value(SystemDeclarations& system, std::vector<Token> tokens);
 void parse_declaration(SystemDeclarations& system, std::string line);
+void parse_declaration(SystemDeclarations& system, std::vector<Token> tokens);
+std::vector<std::string> collect_lines(std::ifstream& stream);
 void read_system(SystemDeclarations& system, std::ifstream& stream);
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "pattern.h"
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "adjoint.h"
+#include "generator.h"
+#include "layout.h"
+
+bool has_jacobian_pattern(SystemDeclarations &system)
+{
+    return system.use_direct_solver;
+}
+
+// Statements adding the state entries an expression reads to the pattern's current row
+static std::string generate_dependencies(SystemDeclarations &system, Expression &expression, std::string indentation)
+{
+    std::vector<Symbol*> symbols;
+    expression.find_symbols(symbols);
+
+    std::vector<std::string> statements;
+    for (auto symbol : symbols)
+    {
+        std::string statement;
+        switch (system.resolve_symbol_type(*symbol))
+        {
+            case SymbolType::STATE:
+                statement = "pattern.add(row, " + (symbol->parameters.empty() ? "INDEX_" + symbol->to_string() : generate_state_index(system, *symbol)) + ");";
+                break;
+            case SymbolType::FUNCTION:
+                {
+                // A function which doesn't read the state only passes on its arguments, which are among the symbols
+                auto function = system.find_function_definition(*symbol);
+                if (function == nullptr || !function->is_state_dependent(system))
+                    break;
+
+                statement = symbol->to_string() + "_pattern(";
+                for (auto& parameter : symbol->parameters)
+                {
+                    statement += generate_parameter_value(system, parameter) + ", ";
+                }
+                statement += "row, pattern);";
+                }
+                break;
+            case SymbolType::SUMMATION:
+                statement = symbol->to_string() + "_pattern(row, pattern);";
+                break;
+            default:
+                break;
+        }
+        if (!statement.empty() && std::find(statements.begin(), statements.end(), statement) == statements.end())
+            statements.push_back(statement);
+    }
+
+    std::string str;
+    for (auto& statement : statements)
+    {
+        str += indentation + statement + "\n";
+    }
+    return str;
+}
+
+std::string generate_jacobian_pattern_runtime(SystemDeclarations &system)
+{
+    if (!has_jacobian_pattern(system))
+        return "";
+
+    return "\n"
+           "\nstruct JacobianPattern"
+           "\n{"
+           "\n\tsize_t* rows; // Null while the pairs are only counted"
+           "\n\tsize_t* columns;"
+           "\n\tsize_t size = 0;"
+           "\n"
+           "\n\tvoid add(size_t row, size_t column)"
+           "\n\t{"
+           "\n\t\tif (rows) { rows[size] = row; columns[size] = column; }"
+           "\n\t\t++size;"
+           "\n\t}"
+           "\n};\n";
+}
+
+static std::string generate_function_pattern_signature(Function &f)
+{
+    std::string signature = "void " + f.symbol.to_string() + "_pattern(";
+    for (auto& p : f.get_catchall_definition().parameters)
+    {
+        signature += "double " + p.symbol.value_or("ERROR") + ", ";
+    }
+    return signature + "size_t row, JacobianPattern& pattern)";
+}
+
+std::string generate_jacobian_pattern_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n";
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_state_dependent(system))
+            str << "\n" << generate_function_pattern_signature(f) << ";";
+    }
+    for (auto& summation : system.summation_definitions)
+    {
+        str << "\nvoid " << summation.symbol.to_string() << "_pattern(size_t row, JacobianPattern& pattern);";
+    }
+    str << "\nsize_t jacobian_pattern(size_t* rows, size_t* columns);";
+
+    return str.str();
+}
+
+std::string generate_function_pattern(SystemDeclarations &system, Function &f)
+{
+    std::stringstream str;
+
+    if (f.definitions.size() == 0)
+        return "";
+
+    auto main_definition = f.get_catchall_definition();
+
+    system.bound_parameters.clear();
+    for (auto& p : main_definition.parameters)
+    {
+        if (p.type == ParameterType::VARIABLE)
+            system.bound_parameters[p.symbol.value()] = false;
+    }
+
+    // The constrained definitions keep recursive functions from recursing forever, like they do in the function
+    str << "\n\n" << generate_function_pattern_signature(f) << "\n{\n";
+    for (auto definition : f.definitions)
+    {
+        if (definition.is_catchall())
+            continue;
+
+        str << "\tif (" << definition.get_parameter_constraints(system, main_definition) << ") {\n"
+            << generate_dependencies(system, *definition.expression, "\t\t")
+            << "\t\treturn;\n"
+            << "\t}\n";
+    }
+    str << generate_dependencies(system, *main_definition.expression, "\t")
+        << "}";
+
+    return str.str();
+}
+
+std::string generate_summation_pattern(SystemDeclarations &system, Summation &summation)
+{
+    std::stringstream str;
+
+    system.bound_parameters.clear();
+    system.bound_parameters[summation.index.name] = true;
+    str << "\n\nvoid " << summation.symbol.to_string() << "_pattern(size_t row, JacobianPattern& pattern) {"
+        << "\n\tfor (size_t " << summation.index.to_string() << " = " << summation.range.start->generate(system) << "; "
+        << summation.index.to_string() << " < " << summation.range.end->generate(system) << "; "
+        << summation.index.to_string() << "++) {\n"
+        << generate_dependencies(system, *summation.summand, "\t\t")
+        << "\t}"
+        << "\n}";
+    system.bound_parameters.clear();
+
+    return str.str();
+}
+
+std::string generate_jacobian_pattern(SystemDeclarations &system)
+{
+    std::stringstream str;
+    auto &state_variables = system.state_variables;
+
+    // Entries an override replaces are skipped in their list's loop
+    std::unordered_map<std::string, std::vector<std::string>> overridden;
+    for (auto& state_variable : state_variables)
+    {
+        auto& symbol = state_variable.symbol;
+        if (symbol.is_list() && symbol.parameters[0].type == ParameterType::EXPRESSION)
+        {
+            system.bound_parameters.clear();
+            overridden[symbol.name].push_back("(size_t)(" + symbol.parameters[0].expression->generate(system) + ")");
+        }
+    }
+
+    str << "\n\nsize_t jacobian_pattern(size_t* rows, size_t* columns) {"
+        << "\n    JacobianPattern pattern { rows, columns };"
+        << "\n    size_t row;\n";
+    for (auto& state_variable : state_variables)
+    {
+        auto& symbol = state_variable.symbol;
+        system.bound_parameters.clear();
+        if (!symbol.is_list() || symbol.parameters[0].type == ParameterType::EXPRESSION)
+        {
+            auto dependencies = generate_dependencies(system, *state_variable.rhs, "    ");
+            if (dependencies.empty())
+                continue;
+
+            std::string index = !symbol.is_list() ? "INDEX_" + symbol.to_string()
+                : generate_list_index(system, symbol.to_string(), "(size_t)(" + symbol.parameters[0].expression->generate(system) + " - 1)");
+            str << "    row = " << index << ";\n"
+                << dependencies;
+        }
+        else
+        {
+            bool reads_state = false;
+            auto loops = generate_list_loops(system, symbol, 1, [&](std::string indentation) {
+                auto dependencies = generate_dependencies(system, *state_variable.rhs, indentation);
+                reads_state = !dependencies.empty();
+                std::string body = indentation + "row = " + generate_state_index(system, symbol) + ";\n" + dependencies;
+                auto overrides = overridden.find(symbol.name);
+                if (overrides == overridden.end())
+                    return body;
+
+                std::string condition;
+                for (auto& index : overrides->second)
+                {
+                    condition += (condition.empty() ? "" : " && ") + symbol.parameters[0].symbol.value() + " != " + index;
+                }
+                return indentation + "if (" + condition + ")\n" + indentation + "{\n"
+                       + indent_statements(body, "\t") + indentation + "}\n";
+            });
+            if (reads_state)
+                str << loops;
+        }
+    }
+    str << "    return pattern.size;\n"
+        << "}\n";
+    system.bound_parameters.clear();
+
+    return str.str();
+}
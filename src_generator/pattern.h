@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#include "expression.h"
+#include "parse.h"
+
+// Structure of the Jacobian, for the dense linear solver. jacobian_pattern() lists a (row, column) pair for every
+// state entry a derivative entry reads, directly, through the functions and summations it calls or through the
+// arguments it passes them. Pairs may repeat. Constants and functions of the index alone add none, and list entries
+// an override replaces only get the override's. The solver colors the columns so that one derivative call
+// perturbs a whole group of them, see src_solver/coloring.h
+
+bool has_jacobian_pattern(SystemDeclarations &system);
+
+// struct JacobianPattern, which the generated pattern functions fill, in system.h
+std::string generate_jacobian_pattern_runtime(SystemDeclarations &system);
+std::string generate_jacobian_pattern_declarations(SystemDeclarations &system);
+std::string generate_function_pattern(SystemDeclarations &system, Function &f);
+std::string generate_summation_pattern(SystemDeclarations &system, Summation &summation);
+std::string generate_jacobian_pattern(SystemDeclarations &system);
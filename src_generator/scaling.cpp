@@ -0,0 +1,133 @@
+#include "scaling.h"
+
+#include <sstream>
+
+#include "adjoint.h"
+#include "generator.h"
+#include "layout.h"
+#include "sensitivity.h"
+
+bool has_state_scaling(SystemDeclarations &system)
+{
+    return (system.use_auto_scale || !system.state_scales.empty()) && !has_sensitivities(system) && !has_adjoint(system);
+}
+
+bool check_state_scaling(SystemDeclarations &system)
+{
+    if (!system.use_auto_scale && system.state_scales.empty())
+        return false;
+
+    if (has_sensitivities(system) || has_adjoint(system))
+    {
+        std::cerr << "Warning: Sensitivities and adjoints are computed for the unscaled state, ignoring @SCALE.\n";
+        return false;
+    }
+    return true;
+}
+
+std::string generate_state_scale_declarations()
+{
+    return "\nvoid get_state_scale(double* values);";
+}
+
+// Every entry of a list gets the largest magnitude of the list's initial values, a scalar its own. States starting
+// at 0 keep a factor of 1
+static std::string generate_automatic_scale(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "    std::vector<double> initial(STATE_SIZE);\n"
+        << "    get_initial_state(initial.data());\n";
+    for (auto& state_variable : system.state_variables)
+    {
+        auto& symbol = state_variable.symbol;
+        system.bound_parameters.clear();
+        if (!symbol.is_list())
+        {
+            std::string index = "INDEX_" + symbol.to_string();
+            str << "    values[" << index << "] = initial[" << index << "] != 0 ? std::fabs(initial[" << index << "]) : 1;\n";
+            continue;
+        }
+        if (symbol.parameters[0].type == ParameterType::EXPRESSION)
+            continue;
+
+        str << "    {\n"
+            << "        double largest = 0;\n"
+            << generate_list_loops(system, symbol, 2, [&](std::string indentation) {
+                   std::string index = generate_state_index(system, symbol);
+                   return indentation + "if (std::fabs(initial[" + index + "]) > largest) largest = std::fabs(initial[" + index + "]);\n";
+               })
+            << generate_list_loops(system, symbol, 2, [&](std::string indentation) {
+                   return indentation + "values[" + generate_state_index(system, symbol) + "] = largest > 0 ? largest : 1;\n";
+               })
+            << "    }\n";
+    }
+    system.bound_parameters.clear();
+
+    return str.str();
+}
+
+std::string generate_state_scale_setter(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n\nvoid get_state_scale(double* values) {\n"
+        << "    for (size_t i = 0; i < STATE_SIZE; ++i) values[i] = 1;\n"
+        << (system.use_auto_scale ? generate_automatic_scale(system) : "")
+        << generate_state_assignments(system, system.state_scales, "@SCALE")
+        << "    for (size_t i = 0; i < STATE_SIZE; ++i) if (!(values[i] > 0 && std::isfinite(values[i]))) values[i] = 1;\n"
+        << "}";
+
+    return str.str();
+}
+
+std::string generate_scaled_model_runtime(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\nstatic double state_scale[STATE_SIZE];"
+        << "\n"
+        << "\nstatic double* unscale(const double* scaled) {"
+        << "\n\tthread_local std::vector<double> values(STATE_SIZE);"
+        << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) values[i] = scaled[i] * state_scale[i];"
+        << "\n\treturn values.data();"
+        << "\n}"
+        << "\n"
+        << "\ntemplate <void (*f)(double, double*, double*)>"
+        << "\nstatic void scaled_derivative(double t, double* scaled, double* derivatives) {"
+        << "\n\tf(t, unscale(scaled), derivatives);"
+        << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) derivatives[i] /= state_scale[i];"
+        << "\n}"
+        << "\n"
+        << "\ntemplate <void (*f)(double, double*, double*)>"
+        << "\nstatic void scaled_roots(double t, double* scaled, double* g) { f(t, unscale(scaled), g); }"
+        << "\n"
+        << "\nstatic void scaled_get_initial_state(double* scaled) {"
+        << "\n\tget_initial_state(scaled);"
+        << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) scaled[i] /= state_scale[i];"
+        << "\n}"
+        << "\n"
+        << "\nstatic void scaled_get_absolute_tolerances(double* tolerances) {";
+    if (has_absolute_tolerances(system))
+        str << "\n\tget_absolute_tolerances(tolerances);";
+    else
+        str << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) tolerances[i] = absolute_tolerance;";
+    str << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) tolerances[i] /= state_scale[i];"
+        << "\n}"
+        << "\n"
+        << "\nstatic const char* scaled_get_csv_line(double* scaled) { return model_get_csv_line(unscale(scaled)); }"
+        << "\n";
+    if (has_jacobian_times(system))
+    {
+        // The Jacobian of the scaled system is the Jacobian between the scaled direction and the scaled product
+        str << "\nstatic void scaled_jacobian_times(double t, double* scaled, double* v, double* Jv) {"
+            << "\n\tthread_local std::vector<double> direction(STATE_SIZE);"
+            << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) direction[i] = v[i] * state_scale[i];"
+            << "\n\tjacobian_times(unscale(scaled), direction.data(), Jv);"
+            << "\n\tfor (size_t i = 0; i < STATE_SIZE; ++i) Jv[i] /= state_scale[i];"
+            << "\n}"
+            << "\n";
+    }
+
+    return str.str();
+}
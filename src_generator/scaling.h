@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "expression.h"
+#include "parse.h"
+
+// State scaling, asked for with @SCALE. The solver integrates values / state_scale instead of the values: the
+// entries of the Model in system_model.cpp multiply the state by state_scale before calling the generated code and
+// divide what comes back, so derivatives, Jacobian products, roots and absolute tolerances are all in scaled units
+// while the equations, initial states and the CSV keep the model's own. @SCALE <state> = <value> gives the factor of
+// a state, a list or a list entry, @SCALE auto takes the largest magnitude of each list's initial values for the
+// states without one. Tolerances are divided by the scale too, so the accuracy asked for doesn't change
+
+bool has_state_scaling(SystemDeclarations &system);
+// Warns and leaves the state unscaled with @SENSITIVITY or @ADJOINT, whose output is in terms of the state
+bool check_state_scaling(SystemDeclarations &system);
+
+std::string generate_state_scale_declarations();
+// get_state_scale, one factor per state entry. A factor which comes out zero, negative or not finite is replaced by 1
+std::string generate_state_scale_setter(SystemDeclarations &system);
+// The scaling wrappers around the Model's entries, in system_model.cpp
+std::string generate_scaled_model_runtime(SystemDeclarations &system);
@@ -0,0 +1,192 @@
+#include "schedule.h"
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_set>
+
+#include "generator.h"
+
+const size_t NOT_AN_INTERMEDIATE = -1;
+
+// Summations over the same index and range of the same summand compute the same value
+static std::string get_summation_key(SystemDeclarations &system, Summation &summation)
+{
+    system.bound_parameters.clear();
+    system.bound_parameters[summation.index.name] = true;
+    std::string key = summation.index.name + " " + summation.range.start->generate(system) + " "
+                      + summation.range.end->generate(system) + " " + summation.summand->generate(system);
+    system.bound_parameters.clear();
+    return key;
+}
+
+struct IntermediateGraph
+{
+    SystemDeclarations &system;
+    std::vector<Intermediate> intermediates; // Every intermediate after the ones it reads
+    std::unordered_map<std::string, size_t> indices; // Function or summation name to its intermediate
+    std::unordered_map<std::string, size_t> summation_keys;
+    std::unordered_set<std::string> visiting;
+
+    IntermediateGraph(SystemDeclarations &system)
+        : system(system)
+    {}
+
+    // First stage in which every intermediate the expression reads is known, adding them to the graph
+    size_t find_stage(Expression &expression)
+    {
+        std::vector<Symbol*> symbols;
+        expression.find_symbols(symbols);
+
+        size_t stage = 0;
+        for (auto symbol : symbols)
+        {
+            size_t intermediate = add(*symbol);
+            if (intermediate != NOT_AN_INTERMEDIATE)
+                stage = std::max(stage, intermediates[intermediate].stage + 1);
+        }
+        return stage;
+    }
+
+    size_t add(Symbol &symbol)
+    {
+        auto found = indices.find(symbol.name);
+        if (found != indices.end())
+            return found->second;
+
+        // Summations are called as a whole, whatever their summand reads is evaluated by the call
+        if (auto summation = system.find_summation(symbol))
+        {
+            std::string key = get_summation_key(system, *summation);
+            auto shared = summation_keys.find(key);
+            if (shared != summation_keys.end())
+            {
+                intermediates[shared->second].summations.push_back(symbol.name);
+                return indices[symbol.name] = shared->second;
+            }
+            intermediates.push_back({ symbol.name, { symbol.name }, 0 });
+            return indices[symbol.name] = summation_keys[key] = intermediates.size() - 1;
+        }
+
+        // Functions with parameters stay calls, their bodies can't read intermediates
+        auto function = system.find_function_definition(symbol);
+        if (!function || !function->symbol.parameters.empty() || !function->is_state_dependent(system) || visiting.count(symbol.name))
+            return NOT_AN_INTERMEDIATE;
+
+        visiting.insert(symbol.name);
+        size_t stage = find_stage(*function->get_catchall_definition().expression);
+        visiting.erase(symbol.name);
+        intermediates.push_back({ symbol.name, {}, stage });
+        return indices[symbol.name] = intermediates.size() - 1;
+    }
+};
+
+static void sort_by_stage(std::vector<Intermediate> &intermediates)
+{
+    std::stable_sort(intermediates.begin(), intermediates.end(), [](const Intermediate &a, const Intermediate &b) {
+        return a.stage < b.stage;
+    });
+}
+
+std::vector<Intermediate> find_intermediates(SystemDeclarations &system)
+{
+    IntermediateGraph graph(system);
+    for (auto &state_variable : system.state_variables)
+    {
+        graph.find_stage(*state_variable.rhs);
+    }
+    sort_by_stage(graph.intermediates);
+    return graph.intermediates;
+}
+
+bool check_parallel(SystemDeclarations &system)
+{
+    if (!system.use_parallel)
+        return false;
+
+    if (system.use_profiler)
+    {
+        std::cerr << "Warning: @PROFILE counters aren't thread safe, ignoring @PARALLEL.\n";
+        system.use_parallel = false;
+        return false;
+    }
+    return true;
+}
+
+std::string generate_intermediate_indices(SystemDeclarations &system)
+{
+    auto intermediates = find_intermediates(system);
+    if (intermediates.empty())
+        return "";
+
+    std::stringstream str;
+    str << "\n";
+    for (size_t i = 0; i < intermediates.size(); ++i)
+    {
+        str << "\nconstexpr size_t INTERMEDIATE_" << intermediates[i].name << " = " << i << ";";
+    }
+    str << "\nconstexpr size_t NUM_INTERMEDIATES = " << intermediates.size() << ";";
+
+    return str.str();
+}
+
+std::vector<std::vector<std::string>> generate_derivative_stages(SystemDeclarations &system)
+{
+    auto &state_variables = system.state_variables;
+    IntermediateGraph graph(system);
+    std::vector<size_t> equation_stages;
+    std::unordered_map<std::string, size_t> list_stages;
+    for (auto &state_variable : state_variables)
+    {
+        equation_stages.push_back(graph.find_stage(*state_variable.rhs));
+        if (state_variable.symbol.is_list() && state_variable.symbol.parameters[0].type == ParameterType::VARIABLE)
+            list_stages[state_variable.symbol.name] = equation_stages.back();
+    }
+    auto intermediates = graph.intermediates;
+    sort_by_stage(intermediates);
+
+    std::vector<std::vector<std::string>> stages;
+    auto add_block = [&](size_t stage, std::string block) {
+        if (stages.size() <= stage)
+            stages.resize(stage + 1);
+        stages[stage].push_back(block);
+    };
+
+    for (auto &intermediate : intermediates)
+    {
+        std::string value = "intermediates[INTERMEDIATE_" + intermediate.name + "]";
+        system.intermediates[intermediate.name] = value;
+        for (auto &summation : intermediate.summations)
+        {
+            system.intermediates[summation] = value;
+        }
+    }
+    for (auto &intermediate : intermediates)
+    {
+        system.bound_parameters.clear();
+        std::string value = intermediate.name + "(values)";
+        if (intermediate.summations.empty())
+            value = system.find_function_definition(Symbol(intermediate.name))->get_catchall_definition().expression->generate(system);
+        add_block(intermediate.stage, "    intermediates[INTERMEDIATE_" + intermediate.name + "] = " + value + ";\n");
+    }
+
+    // generate_derivative_blocks keeps declaration order, the equations first and then the overrides. An override
+    // replaces an entry its list's loop wrote, so it runs in a later stage
+    auto blocks = generate_derivative_blocks(system);
+    size_t block = 0;
+    for (size_t i = 0; i < state_variables.size(); ++i)
+    {
+        if (!state_variables[i].symbol.is_list() || state_variables[i].symbol.parameters[0].type == ParameterType::VARIABLE)
+            add_block(equation_stages[i], blocks[block++]);
+    }
+    for (size_t i = 0; i < state_variables.size(); ++i)
+    {
+        auto &symbol = state_variables[i].symbol;
+        if (symbol.is_list() && symbol.parameters[0].type == ParameterType::EXPRESSION)
+            add_block(std::max(equation_stages[i], list_stages[symbol.name] + 1), blocks[block++]);
+    }
+    if (block < blocks.size()) // The separator left when there are no overrides
+        add_block(stages.empty() ? 0 : stages.size() - 1, blocks[block]);
+
+    system.intermediates.clear();
+    return stages;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "expression.h"
+#include "parse.h"
+
+// Evaluation order of derivative(), from the dependency graph of its equations. Summations and state-dependent
+// functions without parameters which the equations read are intermediates, evaluated once per call into
+// intermediates[] and read from there, summations with the same definition sharing one entry. Every intermediate or
+// equation lands in the stage after the last intermediate it reads, list overrides after their list, so the blocks
+// of a stage are independent: reductions, then the scalar coefficients built on them, then the equations. With
+// @PARALLEL the chunks of a stage run as OpenMP tasks
+
+struct Intermediate
+{
+    std::string name; // Of the function, or of the first summation with this definition
+    std::vector<std::string> summations; // Every summation sharing the entry, empty for a function
+    size_t stage = 0;
+};
+
+std::vector<Intermediate> find_intermediates(SystemDeclarations &system);
+// Prints a warning and runs the derivative sequentially when @PARALLEL can't be honoured
+bool check_parallel(SystemDeclarations &system);
+
+// INTERMEDIATE_ indices into intermediates[] and NUM_INTERMEDIATES, in system.h
+std::string generate_intermediate_indices(SystemDeclarations &system);
+// The blocks of derivative(), stage by stage
+std::vector<std::vector<std::string>> generate_derivative_stages(SystemDeclarations &system);
@@ -0,0 +1,411 @@
+#include "sensitivity.h"
+
+#include <sstream>
+
+#include "layout.h"
+
+bool has_sensitivities(SystemDeclarations &system)
+{
+    if (system.sensitivity_parameters.empty() || system.precision != Precision::DOUBLE)
+        return false;
+
+    for (auto& name : system.sensitivity_parameters)
+    {
+        auto f = system.find_function_definition(Symbol(name));
+        if (f == nullptr || !f->is_constant(system))
+            return false;
+    }
+    return true;
+}
+
+bool check_sensitivities(SystemDeclarations &system)
+{
+    if (system.sensitivity_parameters.empty())
+        return false;
+
+    if (system.precision != Precision::DOUBLE)
+    {
+        std::cerr << "Error: @SENSITIVITY needs @PRECISION double.\n";
+        return false;
+    }
+
+    for (auto& name : system.sensitivity_parameters)
+    {
+        auto f = system.find_function_definition(Symbol(name));
+        if (f == nullptr || !f->is_constant(system))
+        {
+            std::cerr << "Error: Sensitivity parameter " << name << " must be a constant.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool has_jacobian_times(SystemDeclarations &system)
+{
+    return !system.use_direct_solver && system.precision == Precision::DOUBLE;
+}
+
+// Tangents along the state alone have their own functions, without the parameter
+static std::string tangent_name(SystemDeclarations &system, std::string name)
+{
+    return name + (system.state_tangents ? "_state_tangent" : "_tangent");
+}
+
+static std::string tangent_arguments(SystemDeclarations &system)
+{
+    return system.state_tangents ? "values, tangents" : "values, tangents, parameter";
+}
+
+// Tangents are simplified while they're built, "0" marks a term which doesn't depend on the state or the parameter
+std::string tangent_sum(std::string a, std::string op, std::string b)
+{
+    if (b == "0") return a;
+    if (a == "0") return op == "+" ? b : "-(" + b + ")";
+    return "((" + a + ") " + op + " (" + b + "))";
+}
+
+std::string tangent_scale(std::string tangent, std::string factor)
+{
+    if (tangent == "0") return "0";
+    return "((" + factor + ") * (" + tangent + "))";
+}
+
+std::string generate_parameter_tangent(SystemDeclarations& system, Parameter& parameter)
+{
+    switch (parameter.type)
+    {
+        case ParameterType::VARIABLE:
+            {
+            // Index variables are integers, function parameters carry their tangent in d_<name>
+            auto bound = system.bound_parameters.find(parameter.symbol.value_or(""));
+            if (bound == system.bound_parameters.end() || bound->second)
+                return "0";
+            return "d_" + parameter.symbol.value();
+            }
+        case ParameterType::EXPRESSION:
+            return parameter.expression->generate_tangent(system);
+    }
+    return "0";
+}
+
+std::string ConstantExpression::generate_tangent(SystemDeclarations&)
+{
+    return "0";
+}
+
+std::string SymbolExpression::generate_tangent(SystemDeclarations& system)
+{
+    std::stringstream str;
+
+    SymbolType type = system.resolve_symbol_type(symbol);
+    switch (type)
+    {
+        case SymbolType::STATE:
+            if (symbol.parameters.size() > 0)
+            {
+                str << "tangents[" << generate_state_index(system, symbol) << "]";
+                return str.str();
+            }
+            return "tangents[INDEX_" + symbol.to_string() + "]";
+        case SymbolType::PARAMETER:
+            return system.bound_parameters.count(symbol.name) && !system.bound_parameters[symbol.name] ? "d_" + symbol.to_string() : "0";
+        case SymbolType::FUNCTION:
+            if (auto function = system.find_function_definition(symbol))
+            {
+                if (function->is_constant(system))
+                {
+                    return system.state_tangents ? "0" : symbol.to_string() + "_tangent[parameter]";
+                }
+
+                // Along the state alone, a function which doesn't read it only moves with its arguments
+                bool vanishes = system.state_tangents && !function->is_state_dependent(system);
+                str << tangent_name(system, symbol.to_string()) << "(";
+                for (auto& parameter : symbol.parameters)
+                {
+                    auto tangent = generate_parameter_tangent(system, parameter);
+                    vanishes = vanishes && tangent == "0";
+                    str << generate_parameter_value(system, parameter) << ", " << tangent << ", ";
+                }
+                str << tangent_arguments(system) << ")";
+                return vanishes ? "0" : str.str();
+            }
+            return "0";
+        case SymbolType::SUMMATION:
+            return tangent_name(system, symbol.to_string()) + "(" + tangent_arguments(system) + ")";
+        case SymbolType::UNRESOLVED:
+            std::cerr << "Error: Unknown symbol " << symbol.to_string() << " in the tangent of an equation.\n";
+            return "0";
+    }
+
+    return "0";
+}
+
+std::string NegateExpression::generate_tangent(SystemDeclarations& system)
+{
+    auto tangent = negated_expression->generate_tangent(system);
+    return tangent == "0" ? "0" : "-(" + tangent + ")";
+}
+
+std::string AddExpression::generate_tangent(SystemDeclarations& system)
+{
+    return tangent_sum(lhs->generate_tangent(system), "+", rhs->generate_tangent(system));
+}
+
+std::string SubtractExpression::generate_tangent(SystemDeclarations& system)
+{
+    return tangent_sum(lhs->generate_tangent(system), "-", rhs->generate_tangent(system));
+}
+
+std::string MultiplyExpression::generate_tangent(SystemDeclarations& system)
+{
+    return tangent_sum(tangent_scale(lhs->generate_tangent(system), rhs->generate(system)), "+",
+                       tangent_scale(rhs->generate_tangent(system), lhs->generate(system)));
+}
+
+std::string DivideExpression::generate_tangent(SystemDeclarations& system)
+{
+    auto lhs_tangent = lhs->generate_tangent(system);
+    auto rhs_tangent = rhs->generate_tangent(system);
+    auto denominator = rhs->generate(system);
+
+    std::string numerator_term = lhs_tangent == "0" ? "0" : "((" + lhs_tangent + ") / (" + denominator + "))";
+    std::string denominator_term = rhs_tangent == "0" ? "0"
+        : "((" + lhs->generate(system) + ") * (" + rhs_tangent + ") / ((" + denominator + ") * (" + denominator + ")))";
+    return tangent_sum(numerator_term, "-", denominator_term);
+}
+
+std::string ExponentExpression::generate_tangent(SystemDeclarations& system)
+{
+    auto base_tangent = base->generate_tangent(system);
+    auto exp_tangent = exp->generate_tangent(system);
+    if (base_tangent == "0" && exp_tangent == "0")
+        return "0";
+
+    return "pow_tangent(" + base->generate(system) + ", " + exp->generate(system) + ", " + base_tangent + ", " + exp_tangent + ")";
+}
+
+std::string SqrtExpression::generate_tangent(SystemDeclarations& system)
+{
+    auto tangent = base->generate_tangent(system);
+    if (tangent == "0")
+        return "0";
+
+    return "((" + tangent + ") / (2 * std::sqrt(" + base->generate(system) + ")))";
+}
+
+std::string ExpExpression::generate_tangent(SystemDeclarations& system)
+{
+    return tangent_scale(exp->generate_tangent(system), "std::exp(" + exp->generate(system) + ")");
+}
+
+std::string ExplicitExpression::generate_tangent(SystemDeclarations& system)
+{
+    return term->generate_tangent(system);
+}
+
+std::string RangeExpression::generate_tangent(SystemDeclarations&)
+{
+    std::cerr << "Error: Range expression must be either standalone or used for a summation.\n";
+    return "0";
+}
+
+std::string generate_sensitivity_runtime(SystemDeclarations &system)
+{
+    if (!has_sensitivities(system) && !has_jacobian_times(system))
+        return "";
+
+    std::stringstream str;
+
+    // The log term is skipped for constant exponents, it's NaN for the negative bases they allow
+    str << "\n"
+        << "\ninline double pow_tangent(double base, double exp, double base_tangent, double exp_tangent)"
+        << "\n{"
+        << "\n\tdouble tangent = base_tangent != 0.0 ? exp * std::pow(base, exp - 1) * base_tangent : 0.0;"
+        << "\n\tif (exp_tangent != 0.0) tangent += std::pow(base, exp) * std::log(base) * exp_tangent;"
+        << "\n\treturn tangent;"
+        << "\n}"
+        << "\n";
+
+    return str.str();
+}
+
+std::string generate_tangent_signature(SystemDeclarations &system, Function &f)
+{
+    std::stringstream str;
+
+    str << "double " << tangent_name(system, f.symbol.to_string()) << "(";
+    for (auto& p : f.get_catchall_definition().parameters)
+    {
+        str << "double " << p.symbol.value_or("ERROR") << ", double d_" << p.symbol.value_or("ERROR") << ", ";
+    }
+    str << (system.state_tangents ? "double* values, double* tangents)" : "double* values, double* tangents, int parameter)");
+
+    return str.str();
+}
+
+static std::string generate_summation_tangent_signature(SystemDeclarations &system, Summation &summation)
+{
+    return "double " + tangent_name(system, summation.symbol.to_string())
+           + (system.state_tangents ? "(double* values, double* tangents)" : "(double* values, double* tangents, int parameter)");
+}
+
+std::string generate_sensitivity_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    str << "\n"
+        << "\nextern const size_t NUM_SENSITIVITIES;"
+        << "\nextern const char* const SENSITIVITY_NAMES[];";
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_constant(system))
+            str << "\nextern double " << f.symbol.to_string() << "_tangent[];";
+        else
+            str << "\n" << generate_tangent_signature(system, f) << ";";
+    }
+    for (auto& summation : system.summation_definitions)
+    {
+        str << "\n" << generate_summation_tangent_signature(system, summation) << ";";
+    }
+    str << "\nvoid get_initial_sensitivity(int parameter, double* values, double* tangents);"
+        << "\nvoid sensitivity_derivative(int parameter, double* values, double* tangents, double* tangent_derivatives);";
+
+    return str.str();
+}
+
+// Constants are initialized in declaration order in this translation unit, their tangents follow the same order.
+// Sensitivity parameters are the independent variables, so their tangent is a unit vector whatever they're set to
+std::string generate_constant_tangents(SystemDeclarations &system)
+{
+    std::stringstream str;
+    size_t num_sensitivities = system.sensitivity_parameters.size();
+
+    str << "\nconst size_t NUM_SENSITIVITIES = " << num_sensitivities << ";";
+    str << "\nconst char* const SENSITIVITY_NAMES[] = {";
+    for (size_t i = 0; i < num_sensitivities; ++i)
+    {
+        str << (i != 0 ? ", " : " ") << "\"" << system.sensitivity_parameters[i] << "\"";
+    }
+    str << " };\n";
+
+    for (auto &f : system.function_definitions)
+    {
+        if (f.is_constant(system))
+            str << "\ndouble " << f.symbol.to_string() << "_tangent[" << num_sensitivities << "];";
+    }
+
+    system.bound_parameters.clear();
+    str << "\n\nstatic bool constant_tangents_initialized = []()"
+        << "\n{"
+        << "\n\tdouble* values = nullptr;"
+        << "\n\tdouble* tangents = nullptr;"
+        << "\n\tfor (int parameter = 0; parameter < " << num_sensitivities << "; ++parameter)"
+        << "\n\t{";
+    for (auto &f : system.function_definitions)
+    {
+        if (!f.is_constant(system) || f.definitions.size() != 1)
+            continue;
+
+        str << "\n\t\t" << f.symbol.to_string() << "_tangent[parameter] = ";
+        bool seeded = false;
+        for (size_t i = 0; i < num_sensitivities; ++i)
+        {
+            if (system.sensitivity_parameters[i] == f.symbol.name)
+            {
+                str << "parameter == " << i << " ? 1.0 : 0.0;";
+                seeded = true;
+            }
+        }
+        if (!seeded)
+            str << f.definitions[0].expression->generate_tangent(system) << ";";
+    }
+    str << "\n\t}"
+        << "\n\treturn true;"
+        << "\n}();\n";
+
+    return str.str();
+}
+
+std::string generate_function_tangent(SystemDeclarations &system, Function &f)
+{
+    std::stringstream str;
+
+    if (f.definitions.size() == 0)
+        return "";
+
+    auto main_definition = f.get_catchall_definition();
+
+    system.bound_parameters.clear();
+    for (auto& p : main_definition.parameters)
+    {
+        if (p.type == ParameterType::VARIABLE)
+            system.bound_parameters[p.symbol.value()] = false;
+    }
+
+    str << "\n\n" << generate_tangent_signature(system, f) << "\n{";
+    // Along the state alone, a function which doesn't read it is mostly called with index arguments, whose tangent
+    // is 0, and skips evaluating its body's derivative
+    if (system.state_tangents && !f.is_state_dependent(system) && !main_definition.parameters.empty())
+    {
+        std::string condition;
+        for (auto& p : main_definition.parameters)
+        {
+            condition += (condition.empty() ? "" : " && ") + std::string("d_") + p.symbol.value_or("ERROR") + " == 0";
+        }
+        str << "\n\tif (" << condition << ") return 0;";
+    }
+    for (auto definition : f.definitions)
+    {
+        if (definition.is_catchall())
+            continue;
+
+        str << "\n\tif (" << definition.get_parameter_constraints(system, main_definition) << ") {"
+            << "\n\t\t return " << definition.expression->generate_tangent(system) << ";"
+            << "\n\t}";
+    }
+    str << "\n\treturn " << main_definition.expression->generate_tangent(system) << ";\n"
+        << "}";
+
+    return str.str();
+}
+
+std::string generate_summation_tangent(SystemDeclarations &system, Summation &summation)
+{
+    std::stringstream str;
+
+    system.bound_parameters[summation.index.name] = true;
+    str << "\n\n" << generate_summation_tangent_signature(system, summation) << " {"
+        << "\n\tdouble sum = 0.0;"
+        << "\n\tfor (size_t " << summation.index.to_string() << " = " << summation.range.start->generate(system) << "; "
+        << summation.index.to_string() << " < " << summation.range.end->generate(system) << "; "
+        << summation.index.to_string() << "++) {"
+        << "\n\t\tsum += " << summation.summand->generate_tangent(system) << ";"
+        << "\n\t}"
+        << "\n\treturn sum;"
+        << "\n}";
+    system.bound_parameters.erase(summation.index.name);
+
+    return str.str();
+}
+
+std::string generate_jacobian_times_declarations(SystemDeclarations &system)
+{
+    std::stringstream str;
+
+    system.state_tangents = true;
+    str << "\n";
+    for (auto &f : system.function_definitions)
+    {
+        if (!f.is_constant(system))
+            str << "\n" << generate_tangent_signature(system, f) << ";";
+    }
+    for (auto& summation : system.summation_definitions)
+    {
+        str << "\n" << generate_summation_tangent_signature(system, summation) << ";";
+    }
+    str << "\nvoid jacobian_times(double* values, double* tangents, double* tangent_derivatives);";
+    system.state_tangents = false;
+
+    return str.str();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "expression.h"
+#include "parse.h"
+
+// Forward sensitivities for the constants named by @SENSITIVITY. Every expression generates its tangent: the
+// derivative along the state direction in `tangents` plus the constant numbered `parameter`. Applied to the
+// whole system that is the sensitivity RHS CVODES integrates once per parameter. Functions, summations and
+// constants get tangent counterparts (`f_tangent`, `X_tangent[parameter]`) which the tangent code calls.
+
+// The same tangents with every constant held fixed give the product of the Jacobian with the direction in
+// `tangents`, which CVODES' and KINSOL's Krylov solvers ask for instead of taking difference quotients of the
+// derivative. jacobian_times calls the `f_state_tangent` counterparts, which have no parameter.
+
+bool has_sensitivities(SystemDeclarations &system);
+// Only the iterative linear solvers use jacobian_times
+bool has_jacobian_times(SystemDeclarations &system);
+// Prints an error when @SENSITIVITY can't be honoured
+bool check_sensitivities(SystemDeclarations &system);
+
+std::string generate_sensitivity_runtime(SystemDeclarations &system);
+std::string generate_sensitivity_declarations(SystemDeclarations &system);
+std::string generate_constant_tangents(SystemDeclarations &system);
+std::string generate_function_tangent(SystemDeclarations &system, Function &f);
+std::string generate_summation_tangent(SystemDeclarations &system, Summation &summation);
+std::string generate_jacobian_times_declarations(SystemDeclarations &system);
+// a op b, where "0" stands for a term which is known to vanish
+std::string tangent_sum(std::string a, std::string op, std::string b);
@@ -1,3 +1,5 @@
+#include <unordered_map>
+
 #include "tokenize.h"
 #include "expression.h"
 
@@ -28,10 +30,30 @@ std::string get_token_type_string(TokenType type)
         case TokenType::NEGATE: return "NEGATE";
         case TokenType::SQRT: return "SQRT";
         case TokenType::EXP: return "EXP";
+        case TokenType::EXPLICIT: return "EXPLICIT";
         case TokenType::SUM: return "SUM";
         case TokenType::ASSIGN: return "ASSIGN";
         case TokenType::COMMA: return "COMMA";
         case TokenType::TAG_CUDA: return "TAG_CUDA";
+        case TokenType::TAG_PROFILE: return "TAG_PROFILE";
+        case TokenType::TAG_PRECISION: return "TAG_PRECISION";
+        case TokenType::TAG_SENSITIVITY: return "TAG_SENSITIVITY";
+        case TokenType::TAG_ADJOINT: return "TAG_ADJOINT";
+        case TokenType::TAG_STOP_WHEN: return "TAG_STOP_WHEN";
+        case TokenType::TAG_EVENT: return "TAG_EVENT";
+        case TokenType::TAG_STOP_AT_STEADY_STATE: return "TAG_STOP_AT_STEADY_STATE";
+        case TokenType::TAG_STEADY_STATE: return "TAG_STEADY_STATE";
+        case TokenType::TAG_INTEGRATOR: return "TAG_INTEGRATOR";
+        case TokenType::TAG_FAST: return "TAG_FAST";
+        case TokenType::TAG_SLOW_STEP_SIZE: return "TAG_SLOW_STEP_SIZE";
+        case TokenType::TAG_LAYOUT: return "TAG_LAYOUT";
+        case TokenType::TAG_PARALLEL: return "TAG_PARALLEL";
+        case TokenType::TAG_JAC_REUSE: return "TAG_JAC_REUSE";
+        case TokenType::TAG_LSETUP_FREQ: return "TAG_LSETUP_FREQ";
+        case TokenType::TAG_DELTA_GAMMA_MAX: return "TAG_DELTA_GAMMA_MAX";
+        case TokenType::TAG_MAX_NONLINEAR_ITERS: return "TAG_MAX_NONLINEAR_ITERS";
+        case TokenType::TAG_MAX_ORDER: return "TAG_MAX_ORDER";
+        case TokenType::TAG_SCALE: return "TAG_SCALE";
         default: return "UNKNOWN";
     }
 }
@@ -65,6 +87,21 @@ std::vector<Parameter> get_indices(std::string indexList)
     return indices;
 }
 
+// Patterns are compiled once per call site and only tried at the start of the line, constructing a
+// std::regex for every check used to dominate generation time for large systems.
+bool match_prefix(const std::string& line, std::smatch& matches, const char* pattern)
+{
+    static std::unordered_map<const char*, std::regex> compiled_patterns;
+
+    auto it = compiled_patterns.find(pattern);
+    if (it == compiled_patterns.end())
+    {
+        it = compiled_patterns.emplace(pattern, std::regex(pattern)).first;
+    }
+
+    return std::regex_search(line, matches, it->second, std::regex_constants::match_continuous);
+}
+
 std::vector<Token> tokenize(std::string line) 
 {
     std::vector<Token> tokens;
@@ -72,93 +109,204 @@ std::vector<Token> tokenize(std::string line)
 
     while (line.size() > 0) {
         
-        if (std::regex_search(line, matches, std::regex("^#"))) {
+        if (match_prefix(line, matches, "^#")) {
             break;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@DIRECT_LINEAR_SOLVER"))) {
+        if (match_prefix(line, matches, "^@DIRECT_LINEAR_SOLVER")) {
             tokens.push_back(Token { TokenType::TAG_DIRECT_SOLVER });
             break;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@CUDA"))) {
+        if (match_prefix(line, matches, "^@CUDA")) {
             tokens.push_back(Token { TokenType::TAG_CUDA });
             break;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@END_TIME"))) {
+        if (match_prefix(line, matches, "^@PROFILE")) {
+            tokens.push_back(Token { TokenType::TAG_PROFILE });
+            break;
+        }
+        
+        if (match_prefix(line, matches, "^@PARALLEL")) {
+            tokens.push_back(Token { TokenType::TAG_PARALLEL });
+            break;
+        }
+        
+        if (match_prefix(line, matches, "^@STEADY_STATE")) {
+            tokens.push_back(Token { TokenType::TAG_STEADY_STATE });
+            break;
+        }
+        
+        if (match_prefix(line, matches, "^@INTEGRATOR")) {
+            tokens.push_back(Token { TokenType::TAG_INTEGRATOR });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@FAST")) {
+            tokens.push_back(Token { TokenType::TAG_FAST });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@SLOW_STEP_SIZE")) {
+            tokens.push_back(Token { TokenType::TAG_SLOW_STEP_SIZE });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@JAC_REUSE")) {
+            tokens.push_back(Token { TokenType::TAG_JAC_REUSE });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@LSETUP_FREQ")) {
+            tokens.push_back(Token { TokenType::TAG_LSETUP_FREQ });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@DELTA_GAMMA_MAX")) {
+            tokens.push_back(Token { TokenType::TAG_DELTA_GAMMA_MAX });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@MAX_NONLINEAR_ITERS")) {
+            tokens.push_back(Token { TokenType::TAG_MAX_NONLINEAR_ITERS });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@MAX_ORDER")) {
+            tokens.push_back(Token { TokenType::TAG_MAX_ORDER });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@SCALE")) {
+            tokens.push_back(Token { TokenType::TAG_SCALE });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@LAYOUT")) {
+            tokens.push_back(Token { TokenType::TAG_LAYOUT });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@PRECISION")) {
+            tokens.push_back(Token { TokenType::TAG_PRECISION });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@SENSITIVITY")) {
+            tokens.push_back(Token { TokenType::TAG_SENSITIVITY });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@ADJOINT")) {
+            tokens.push_back(Token { TokenType::TAG_ADJOINT });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@STOP_WHEN")) {
+            tokens.push_back(Token { TokenType::TAG_STOP_WHEN });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@STOP_AT_STEADY_STATE")) {
+            tokens.push_back(Token { TokenType::TAG_STOP_AT_STEADY_STATE });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@EVENT")) {
+            tokens.push_back(Token { TokenType::TAG_EVENT });
+            line = line.substr(matches[0].str().size());
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^@END_TIME")) {
             tokens.push_back(Token { TokenType::TAG_END_TIME });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@SAMPLE_INTERVAL"))) {
+        if (match_prefix(line, matches, "^@SAMPLE_INTERVAL")) {
             tokens.push_back(Token { TokenType::TAG_SAMPLE_INTERVAL });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@MAXIMUM_STEP_SIZE"))) {
+        if (match_prefix(line, matches, "^@MAXIMUM_STEP_SIZE")) {
             tokens.push_back(Token { TokenType::TAG_MAX_STEP_SIZE });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@MINIMUM_STEP_SIZE"))) {
+        if (match_prefix(line, matches, "^@MINIMUM_STEP_SIZE")) {
             tokens.push_back(Token { TokenType::TAG_MIN_STEP_SIZE });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@MAXIMUM_NUM_STEPS"))) {
+        if (match_prefix(line, matches, "^@MAXIMUM_NUM_STEPS")) {
             tokens.push_back(Token { TokenType::TAG_MAX_NUM_STEPS });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@INITIAL_STEP_SIZE"))) {
+        if (match_prefix(line, matches, "^@INITIAL_STEP_SIZE")) {
             tokens.push_back(Token { TokenType::TAG_INIT_STEP });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@RELATIVE_TOLERANCE"))) {
+        if (match_prefix(line, matches, "^@RELATIVE_TOLERANCE")) {
             tokens.push_back(Token { TokenType::TAG_RELTOL });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^@ABSOLUTE_TOLERANCE"))) {
+        if (match_prefix(line, matches, "^@ABSOLUTE_TOLERANCE")) {
             tokens.push_back(Token { TokenType::TAG_ABSTOL });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^d/dt"))) {
+        if (match_prefix(line, matches, "^d/dt")) {
             tokens.push_back(Token { TokenType::DERIVATIVE });
             line = line.substr(matches[0].str().size());
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^="))) {
+        if (match_prefix(line, matches, "^=")) {
             tokens.push_back(Token { TokenType::ASSIGN });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^,"))) {
+        if (match_prefix(line, matches, "^,")) {
             tokens.push_back(Token { TokenType::COMMA });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\+"))) {
+        if (match_prefix(line, matches, "^\\+")) {
             tokens.push_back(Token { TokenType::ADD });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\-"))) {
+        if (match_prefix(line, matches, "^\\-")) {
             if (tokens.size() > 0 && (tokens.back().type == TokenType::CONSTANT 
                 || tokens.back().type == TokenType::SYMBOL || tokens.back().type == TokenType::RPAREN || tokens.back().type == TokenType::RBRACKET))
             {
@@ -172,91 +320,97 @@ std::vector<Token> tokenize(std::string line)
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\*"))) {
+        if (match_prefix(line, matches, "^\\*")) {
             tokens.push_back(Token { TokenType::MULTIPLY });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^/"))) {
+        if (match_prefix(line, matches, "^/")) {
             tokens.push_back(Token { TokenType::DIVIDE });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\^"))) {
+        if (match_prefix(line, matches, "^\\^")) {
             tokens.push_back(Token { TokenType::EXPONENT });
             line = line.substr(1);
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^OUTPUT"))) {
+        if (match_prefix(line, matches, "^OUTPUT")) {
             tokens.push_back(Token { TokenType::OUTPUT });
             line = line.substr(6);
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^INITIAL"))) {
+        if (match_prefix(line, matches, "^INITIAL")) {
             tokens.push_back(Token { TokenType::INITIAL });
             line = line.substr(7);
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^SQRT"))) {
+        if (match_prefix(line, matches, "^SQRT")) {
             tokens.push_back(Token { TokenType::SQRT });
             line = line.substr(4);
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^EXP"))) {
+        if (match_prefix(line, matches, "^EXPLICIT")) {
+            tokens.push_back(Token { TokenType::EXPLICIT });
+            line = line.substr(8);
+            continue;
+        }
+        
+        if (match_prefix(line, matches, "^EXP")) {
             tokens.push_back(Token { TokenType::EXP });
             line = line.substr(3);
             continue;
         }
         
-        if (std::regex_search(line, matches, std::regex("^SUM"))) {
+        if (match_prefix(line, matches, "^SUM")) {
             tokens.push_back(Token { TokenType::SUM });
             line = line.substr(3);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\("))) {
+        if (match_prefix(line, matches, "^\\(")) {
             tokens.push_back(Token { TokenType::LPAREN });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\)"))) {
+        if (match_prefix(line, matches, "^\\)")) {
             tokens.push_back(Token { TokenType::RPAREN });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\["))) {
+        if (match_prefix(line, matches, "^\\[")) {
             tokens.push_back(Token { TokenType::LBRACKET });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\]"))) {
+        if (match_prefix(line, matches, "^\\]")) {
             tokens.push_back(Token { TokenType::RBRACKET });
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^([A-Za-z_][A-Za-z_0-9]*)"))) {
+        if (match_prefix(line, matches, "^([A-Za-z_][A-Za-z_0-9]*)")) {
             tokens.push_back(Token { TokenType::SYMBOL, Symbol(matches[0]) });
             line = line.substr(matches[0].str().size());
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^\\.\\."))) {
+        if (match_prefix(line, matches, "^\\.\\.")) {
             tokens.push_back(Token { TokenType::RANGE } );
             line = line.substr(1);
             continue;
         }
 
-        if (std::regex_search(line, matches, std::regex("^([0-9]+\\.?[0-9]*)"))) {
+        if (match_prefix(line, matches, "^([0-9]+\\.?[0-9]*)")) {
             tokens.push_back(Token { TokenType::CONSTANT, std::nullopt, std::atof(matches[1].str().c_str()) } );
             line = line.substr(matches[1].str().size());
             continue;
@@ -92,6 +92,7 @@ enum class TokenType {
     NEGATE,
     SQRT,
     EXP,
+    EXPLICIT,
     SUM,
     ASSIGN,
     COMMA,
@@ -104,7 +105,26 @@ enum class TokenType {
     TAG_RELTOL,
     TAG_ABSTOL,
     TAG_DIRECT_SOLVER,
-    TAG_CUDA
+    TAG_CUDA,
+    TAG_PROFILE,
+    TAG_PRECISION,
+    TAG_SENSITIVITY,
+    TAG_ADJOINT,
+    TAG_STOP_WHEN,
+    TAG_EVENT,
+    TAG_STOP_AT_STEADY_STATE,
+    TAG_STEADY_STATE,
+    TAG_INTEGRATOR,
+    TAG_FAST,
+    TAG_SLOW_STEP_SIZE,
+    TAG_LAYOUT,
+    TAG_PARALLEL,
+    TAG_JAC_REUSE,
+    TAG_LSETUP_FREQ,
+    TAG_DELTA_GAMMA_MAX,
+    TAG_MAX_NONLINEAR_ITERS,
+    TAG_MAX_ORDER,
+    TAG_SCALE
 };
 
 std::string get_token_type_string(TokenType type);
@@ -0,0 +1,82 @@
+#include "coloring.h"
+
+#include <algorithm>
+
+JacobianColoring color_jacobian(const Model* model)
+{
+    if (!model->jacobian_pattern)
+        return JacobianColoring();
+
+    size_t size = model->jacobian_pattern(nullptr, nullptr);
+    std::vector<size_t> rows(size), columns(size);
+    model->jacobian_pattern(rows.data(), columns.data());
+    return color_jacobian(model->state_size, rows, columns);
+}
+
+JacobianColoring color_jacobian(size_t state_size, const std::vector<size_t>& rows, const std::vector<size_t>& columns)
+{
+    // Both orientations of the pattern without repeats. A list equation can read past the end of the state at an
+    // entry which no override replaces, that column doesn't exist
+    std::vector<std::vector<size_t>> row_columns(state_size), column_rows(state_size);
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (rows[i] < state_size && columns[i] < state_size)
+            row_columns[rows[i]].push_back(columns[i]);
+    }
+    for (size_t row = 0; row < state_size; ++row)
+    {
+        auto& read = row_columns[row];
+        std::sort(read.begin(), read.end());
+        read.erase(std::unique(read.begin(), read.end()), read.end());
+        for (auto column : read)
+        {
+            column_rows[column].push_back(row);
+        }
+    }
+
+    // Every column takes the smallest color which no earlier column sharing a row with it has
+    JacobianColoring coloring;
+    std::vector<size_t> colors(state_size);
+    std::vector<size_t> forbidden(state_size, state_size); // Column for which the color was last ruled out
+    for (size_t column = 0; column < state_size; ++column)
+    {
+        for (auto row : column_rows[column])
+        {
+            for (auto neighbour : row_columns[row])
+            {
+                if (neighbour < column)
+                    forbidden[colors[neighbour]] = column;
+            }
+        }
+        size_t color = 0;
+        while (color < coloring.num_colors && forbidden[color] == column)
+            ++color;
+        colors[column] = color;
+        coloring.num_colors = std::max(coloring.num_colors, color + 1);
+    }
+
+    coloring.color_starts.assign(coloring.num_colors + 1, 0);
+    for (size_t column = 0; column < state_size; ++column)
+    {
+        coloring.color_starts[colors[column] + 1] += 1;
+    }
+    for (size_t color = 0; color < coloring.num_colors; ++color)
+    {
+        coloring.color_starts[color + 1] += coloring.color_starts[color];
+    }
+    coloring.color_columns.resize(state_size);
+    std::vector<size_t> next(coloring.color_starts.begin(), coloring.color_starts.end() - (coloring.num_colors > 0 ? 1 : 0));
+    for (size_t column = 0; column < state_size; ++column)
+    {
+        coloring.color_columns[next[colors[column]]++] = column;
+    }
+
+    coloring.row_starts.push_back(0);
+    for (size_t column = 0; column < state_size; ++column)
+    {
+        coloring.rows.insert(coloring.rows.end(), column_rows[column].begin(), column_rows[column].end());
+        coloring.row_starts.push_back(coloring.rows.size());
+    }
+
+    return coloring;
+}
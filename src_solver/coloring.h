@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "model.h"
+
+// Compressed finite differences for the dense Jacobian (Curtis, Powell and Reid). Columns which no row reads together
+// share a color, so one derivative call perturbing every column of a color gives all of their entries. The colors
+// come from a greedy distance-2 coloring of the pattern the model declares, taking the columns in order
+struct JacobianColoring
+{
+    size_t num_colors = 0;
+    // The columns of color c are color_columns[color_starts[c] .. color_starts[c + 1])
+    std::vector<size_t> color_starts;
+    std::vector<size_t> color_columns;
+    // The rows reading column j are rows[row_starts[j] .. row_starts[j + 1])
+    std::vector<size_t> row_starts;
+    std::vector<size_t> rows;
+};
+
+// No colors when the model doesn't declare its pattern
+JacobianColoring color_jacobian(const Model* model);
+JacobianColoring color_jacobian(size_t state_size, const std::vector<size_t>& rows, const std::vector<size_t>& columns);
@@ -0,0 +1,534 @@
+#include "interpreter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <utility>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(INTERPRETER_NO_COMPUTED_GOTO)
+#define INTERPRETER_COMPUTED_GOTO
+#endif
+
+Interpreter::Interpreter(BytecodeProgram program)
+    : program(std::move(program)), constants(this->program.num_constants, 0.0), outputs(this->program.output_labels.size() + this->program.root_labels.size(), 0.0),
+      registers(std::max<size_t>(this->program.num_registers, 1) * TILE_SIZE, 0.0)
+{
+    // Setup only computes constants, which the list sizes of the other blocks depend on
+    run(prepare(this->program.setup), nullptr, nullptr);
+
+    state_size = (size_t)constants[this->program.state_size_slot];
+    initial_state_blocks = prepare(this->program.initial_state);
+    absolute_tolerance_blocks = prepare(this->program.absolute_tolerances);
+    state_scale_blocks = prepare(this->program.state_scales);
+    derivative_blocks = prepare(this->program.derivative);
+    output_blocks = prepare(this->program.outputs);
+    root_blocks = prepare(this->program.roots);
+
+    for (auto& label : this->program.labels)
+    {
+        for_each_label_entry(label, [&](const std::vector<size_t>&, size_t index) { state_csv_order.push_back(index); });
+    }
+}
+
+std::vector<Interpreter::PreparedBlock> Interpreter::prepare(const std::vector<BytecodeBlock>& blocks)
+{
+    std::vector<PreparedBlock> prepared;
+    for (auto& block : blocks)
+    {
+        PreparedBlock prepared_block = { block.begin, 1, {} };
+        for (auto range : block.dimensions)
+        {
+            double size = constants[program.ranges[range].size_slot];
+            Dimension dimension;
+            dimension.start = (size_t)constants[program.ranges[range].start_slot];
+            dimension.size = size > 0.0 ? (size_t)size : 0;
+            dimension.stride = prepared_block.lanes;
+            prepared_block.lanes *= dimension.size;
+            prepared_block.dimensions.push_back(dimension);
+        }
+        prepared.push_back(prepared_block);
+    }
+    return prepared;
+}
+
+void Interpreter::run(const std::vector<PreparedBlock>& blocks, const double* in, double* out)
+{
+    for (auto& block : blocks)
+    {
+        run_block(block, in, out);
+    }
+}
+
+#define REGISTER(index) (r + (size_t)(index) * TILE_SIZE)
+#define LANES() ((pc->flags & VARYING_DST) ? width : 1)
+#define STRIDE(bit) ((pc->flags & (bit)) ? 1 : 0)
+
+#define UNARY(expression) \
+    { \
+        double* d = REGISTER(pc->dst); \
+        const double* A = REGISTER(pc->a); \
+        size_t sa = STRIDE(VARYING_A), n = LANES(); \
+        for (size_t k = 0; k < n; ++k) \
+        { \
+            double a = A[k * sa]; \
+            d[k] = (expression); \
+        } \
+        ++pc; \
+        DISPATCH(); \
+    }
+
+#define BINARY(expression) \
+    { \
+        double* d = REGISTER(pc->dst); \
+        const double* A = REGISTER(pc->a); \
+        const double* B = REGISTER(pc->b); \
+        size_t sa = STRIDE(VARYING_A), sb = STRIDE(VARYING_B), n = LANES(); \
+        for (size_t k = 0; k < n; ++k) \
+        { \
+            double a = A[k * sa], b = B[k * sb]; \
+            d[k] = (expression); \
+        } \
+        ++pc; \
+        DISPATCH(); \
+    }
+
+#ifdef INTERPRETER_COMPUTED_GOTO
+#define DISPATCH() goto *dispatch_table[(size_t)pc->opcode]
+#define CASE(name) op_##name:
+#define LABEL_ADDRESS(name) &&op_##name,
+#else
+#define DISPATCH() goto dispatch
+#define CASE(name) case Opcode::name:
+#endif
+
+void Interpreter::run_block(const PreparedBlock& block, const double* in, double* out)
+{
+#ifdef INTERPRETER_COMPUTED_GOTO
+    static void* dispatch_table[] = { BYTECODE_OPCODES(LABEL_ADDRESS) };
+#endif
+    const Instruction* instructions = program.instructions.data();
+    double* r = registers.data();
+
+    for (size_t tile = 0; tile < block.lanes; tile += TILE_SIZE)
+    {
+        size_t width = std::min(TILE_SIZE, block.lanes - tile);
+        const Instruction* pc = instructions + block.begin;
+
+        DISPATCH();
+#ifndef INTERPRETER_COMPUTED_GOTO
+    dispatch:
+        switch (pc->opcode)
+        {
+#endif
+        CASE(END)
+            goto next_tile;
+        CASE(CONSTANT)
+            REGISTER(pc->dst)[0] = pc->immediate;
+            ++pc;
+            DISPATCH();
+        CASE(LOAD_CONSTANT)
+            REGISTER(pc->dst)[0] = constants[pc->a];
+            ++pc;
+            DISPATCH();
+        CASE(STORE_CONSTANT)
+            constants[pc->dst] = REGISTER(pc->a)[0];
+            ++pc;
+            DISPATCH();
+        CASE(LANE_INDEX)
+            {
+            double* d = REGISTER(pc->dst);
+            auto& dimension = block.dimensions[pc->a];
+            for (size_t k = 0; k < width; ++k)
+            {
+                d[k] = (double)(dimension.start + ((tile + k) / dimension.stride) % dimension.size);
+            }
+            ++pc;
+            DISPATCH();
+            }
+        CASE(LOAD_STATE)
+            {
+            double* d = REGISTER(pc->dst);
+            const double* A = REGISTER(pc->a);
+            size_t sa = STRIDE(VARYING_A), n = LANES();
+            for (size_t k = 0; k < n; ++k)
+            {
+                double index = A[k * sa];
+                d[k] = (index >= 0.0 && index < state_size) ? in[(size_t)index] : 0.0;
+            }
+            ++pc;
+            DISPATCH();
+            }
+        CASE(STORE)
+            {
+            const double* A = REGISTER(pc->a);
+            const double* B = REGISTER(pc->b);
+            size_t sa = STRIDE(VARYING_A), sb = STRIDE(VARYING_B), n = LANES();
+            for (size_t k = 0; k < n; ++k)
+            {
+                double index = A[k * sa];
+                if (index >= 0.0 && index < state_size) out[(size_t)index] = B[k * sb];
+            }
+            ++pc;
+            DISPATCH();
+            }
+        CASE(STORE_OUTPUT)
+            outputs[pc->dst] = REGISTER(pc->a)[0];
+            ++pc;
+            DISPATCH();
+        CASE(COPY)
+            UNARY(a)
+        CASE(NEGATE)
+            UNARY(-a)
+        CASE(ADD)
+            BINARY(a + b)
+        CASE(SUBTRACT)
+            BINARY(a - b)
+        CASE(MULTIPLY)
+            BINARY(a * b)
+        CASE(DIVIDE)
+            BINARY(a / b)
+        CASE(POW)
+            BINARY(std::pow(a, b))
+        CASE(SQRT)
+            UNARY(std::sqrt(a))
+        CASE(EXP)
+            UNARY(std::exp(a))
+        CASE(INTEGER_DIVIDE)
+            BINARY(std::trunc(a / b))
+        CASE(WRAP_UNSIGNED)
+            UNARY(a < 0.0 ? a + 18446744073709551616.0 : a)
+        CASE(EQUAL)
+            BINARY(a == b ? 1.0 : 0.0)
+        CASE(SELECT)
+            {
+            double* d = REGISTER(pc->dst);
+            const double* A = REGISTER(pc->a);
+            const double* B = REGISTER(pc->b);
+            const double* C = REGISTER(pc->c);
+            size_t sa = STRIDE(VARYING_A), sb = STRIDE(VARYING_B), sc = STRIDE(VARYING_C), n = LANES();
+            for (size_t k = 0; k < n; ++k)
+            {
+                d[k] = A[k * sa] != 0.0 ? B[k * sb] : C[k * sc];
+            }
+            ++pc;
+            DISPATCH();
+            }
+        CASE(JUMP)
+            pc = instructions + pc->c;
+            DISPATCH();
+        CASE(JUMP_IF_GREATER_EQUAL)
+            pc = REGISTER(pc->a)[0] >= REGISTER(pc->b)[0] ? instructions + pc->c : pc + 1;
+            DISPATCH();
+#ifndef INTERPRETER_COMPUTED_GOTO
+        }
+#endif
+    next_tile:;
+    }
+}
+
+void Interpreter::get_initial_state(double* values)
+{
+    run(initial_state_blocks, values, values);
+}
+
+void Interpreter::get_absolute_tolerances(double* tolerances)
+{
+    std::fill(tolerances, tolerances + state_size, constants[program.absolute_tolerance_slot]);
+    run(absolute_tolerance_blocks, tolerances, tolerances);
+}
+
+// Like get_state_scale of the compiled backend: with @SCALE auto every entry of a list gets the largest magnitude of
+// the list's initial values, then the given factors apply, and factors which aren't positive and finite become 1
+void Interpreter::get_state_scale(double* scales)
+{
+    std::fill(scales, scales + state_size, 1.0);
+    if (program.use_auto_scale)
+    {
+        std::vector<double> initial(state_size);
+        get_initial_state(initial.data());
+        for (auto& label : program.labels)
+        {
+            double largest = 0;
+            for_each_label_entry(label, [&](const std::vector<size_t>&, size_t index) { largest = std::max(largest, std::fabs(initial[index])); });
+            for_each_label_entry(label, [&](const std::vector<size_t>&, size_t index) { scales[index] = largest > 0 ? largest : 1; });
+        }
+    }
+    run(state_scale_blocks, scales, scales);
+    for (size_t i = 0; i < state_size; ++i)
+    {
+        if (!(scales[i] > 0 && std::isfinite(scales[i])))
+            scales[i] = 1;
+    }
+}
+
+void Interpreter::derivative(const double* values, double* derivatives)
+{
+    run(derivative_blocks, values, derivatives);
+}
+
+// Root values are stored behind the outputs
+void Interpreter::roots(const double* values, double* g)
+{
+    run(root_blocks, values, nullptr);
+    std::copy(outputs.begin() + program.output_labels.size(), outputs.end(), g);
+}
+
+// Visits the entries of a list label in csv order, the last index fastest, with their index into the state,
+// where the first index varies fastest
+template <typename Visit>
+void Interpreter::for_each_label_entry(const BytecodeLabel& label, Visit visit)
+{
+    std::vector<size_t> starts, ends, strides, indices;
+    size_t count = 1;
+    for (auto range : label.dimensions)
+    {
+        starts.push_back((size_t)constants[program.ranges[range].start_slot]);
+        ends.push_back(starts.back() + (size_t)constants[program.ranges[range].size_slot]);
+        indices.push_back(starts.back());
+        strides.push_back(count);
+        count *= ends.back() - starts.back();
+    }
+    size_t offset = (size_t)constants[label.offset_slot];
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = offset;
+        for (size_t d = 0; d < indices.size(); ++d)
+        {
+            index += (indices[d] - starts[d]) * strides[d];
+        }
+        visit(indices, index);
+
+        for (size_t d = indices.size(); d-- > 0;)
+        {
+            if (++indices[d] < ends[d]) break;
+            indices[d] = starts[d];
+        }
+    }
+}
+
+const size_t* Interpreter::get_state_csv_order()
+{
+    return state_csv_order.data();
+}
+
+// Same text as the compiled get_state_csv_label, lists are labelled with their first index outermost
+std::string Interpreter::get_state_csv_label()
+{
+    std::stringstream str;
+    str << "t (seconds)";
+    for (auto& label : program.labels)
+    {
+        if (label.dimensions.size() == 0)
+        {
+            str << ", " << label.name;
+            continue;
+        }
+
+        for_each_label_entry(label, [&](const std::vector<size_t>& indices, size_t) {
+            str << ", " << label.name << "[";
+            for (size_t d = 0; d < indices.size(); ++d)
+            {
+                str << (d != 0 ? " " : "") << indices[d];
+            }
+            str << "]";
+        });
+    }
+    for (auto& label : program.output_labels)
+    {
+        str << ", " << label;
+    }
+    return str.str();
+}
+
+std::string Interpreter::get_csv_line(const double* values)
+{
+    std::stringstream str;
+    for (size_t i = 0; i < state_size; ++i)
+    {
+        str << ", " << values[state_csv_order[i]];
+    }
+    run(output_blocks, values, nullptr);
+    for (size_t i = 0; i < program.output_labels.size(); ++i)
+    {
+        str << ", " << outputs[i];
+    }
+    return str.str();
+}
+
+// The Model interface has no context pointer, the solver only ever runs one model at a time
+static std::unique_ptr<Interpreter> interpreter;
+static Model interpreted_model;
+
+// With @SCALE the solver sees the state divided by these factors, as in the compiled system_model.cpp. Empty otherwise
+static std::vector<double> interpreted_scale;
+
+static const double* unscale(const double* values)
+{
+    if (interpreted_scale.empty())
+        return values;
+    thread_local std::vector<double> unscaled;
+    unscaled.resize(interpreted_scale.size());
+    for (size_t i = 0; i < unscaled.size(); ++i)
+    {
+        unscaled[i] = values[i] * interpreted_scale[i];
+    }
+    return unscaled.data();
+}
+
+static void divide_by_scale(double* values)
+{
+    for (size_t i = 0; i < interpreted_scale.size(); ++i)
+    {
+        values[i] /= interpreted_scale[i];
+    }
+}
+
+static void interpreted_get_initial_state(double* values)
+{
+    interpreter->get_initial_state(values);
+    divide_by_scale(values);
+}
+
+static void interpreted_get_absolute_tolerances(double* tolerances)
+{
+    interpreter->get_absolute_tolerances(tolerances);
+    divide_by_scale(tolerances);
+}
+
+static void interpreted_derivative(double /*t*/, double* values, double* derivatives)
+{
+    interpreter->derivative(unscale(values), derivatives);
+    divide_by_scale(derivatives);
+}
+
+static void interpreted_roots(double /*t*/, double* values, double* g) { interpreter->roots(unscale(values), g); }
+static std::vector<const char*> interpreted_root_labels;
+
+static const char* interpreted_get_state_csv_label()
+{
+    static std::string label;
+    label = interpreter->get_state_csv_label();
+    return label.c_str();
+}
+
+static const size_t* interpreted_get_state_csv_order() { return interpreter->get_state_csv_order(); }
+
+static const char* interpreted_get_csv_line(double* values)
+{
+    thread_local std::string line;
+    line = interpreter->get_csv_line(unscale(values));
+    return line.c_str();
+}
+
+const Model* load_interpreted_model(std::string model_filename)
+{
+    std::ifstream system_src_file(model_filename, std::ios::in);
+    if (!system_src_file)
+    {
+        std::cerr << "Error: Failed to open model " << model_filename << "\n";
+        return nullptr;
+    }
+    SystemDeclarations system;
+    read_system(system, system_src_file);
+    if (!system.sensitivity_parameters.empty())
+    {
+        std::cerr << "Warning: The interpreter doesn't compute sensitivities, ignoring @SENSITIVITY.\n";
+    }
+    if (!system.adjoint_objective.empty())
+    {
+        std::cerr << "Warning: The interpreter doesn't compute adjoints, ignoring @ADJOINT.\n";
+    }
+    if (system.use_imex)
+    {
+        std::cerr << "Warning: The interpreter always integrates with CVODES, ignoring @INTEGRATOR arkode-imex.\n";
+    }
+    if (!system.fast_states.empty())
+    {
+        std::cerr << "Warning: The interpreter always integrates with CVODES, ignoring @FAST.\n";
+    }
+    if (!system.list_layouts.empty())
+    {
+        std::cerr << "Warning: The interpreter stores every list separately, ignoring @LAYOUT.\n";
+    }
+
+    auto lowered = lower_system(system);
+    if (!lowered.recursive_functions.empty())
+    {
+        for (auto& name : lowered.recursive_functions)
+        {
+            std::cerr << "Error: " << name << " is recursive, which the interpreter can't evaluate. Drop --backend=interpreter to compile the model.\n";
+        }
+        return nullptr;
+    }
+
+    interpreter = std::make_unique<Interpreter>(std::move(lowered));
+    auto& constants = interpreter->constants;
+    auto& program = interpreter->program;
+
+    interpreted_model.abi_version = MODEL_ABI_VERSION;
+    interpreted_model.state_size = interpreter->state_size;
+    interpreted_model.end_time = constants[program.end_time_slot];
+    interpreted_model.sample_interval = constants[program.sample_interval_slot];
+    interpreted_model.absolute_tolerance = constants[program.absolute_tolerance_slot];
+    interpreted_model.relative_tolerance = constants[program.relative_tolerance_slot];
+    // The compiled model stores the initial step size as a size_t, truncate the same way so both backends agree
+    interpreted_model.initial_step_size = (double)(size_t)constants[program.initial_step_size_slot];
+    interpreted_model.maximum_step_size = constants[program.maximum_step_size_slot];
+    interpreted_model.minimum_step_size = constants[program.minimum_step_size_slot];
+    interpreted_model.maximum_num_steps = constants[program.maximum_num_steps_slot];
+    interpreted_model.use_direct_solver = program.use_direct_solver;
+    interpreted_model.get_initial_state = interpreted_get_initial_state;
+    interpreted_scale.clear();
+    if (system.use_auto_scale || !system.state_scales.empty())
+    {
+        interpreted_scale.resize(interpreter->state_size);
+        interpreter->get_state_scale(interpreted_scale.data());
+    }
+    bool absolute_tolerances = !system.absolute_tolerances.empty() || !interpreted_scale.empty();
+    interpreted_model.get_absolute_tolerances = absolute_tolerances ? interpreted_get_absolute_tolerances : nullptr;
+    interpreted_model.derivative = interpreted_derivative;
+    interpreted_model.get_state_csv_label = interpreted_get_state_csv_label;
+    interpreted_model.get_csv_line = interpreted_get_csv_line;
+    interpreted_model.get_state_csv_order = interpreted_get_state_csv_order;
+    interpreted_model.jacobian_times = nullptr;
+    interpreted_model.jacobian_pattern = nullptr;
+    interpreted_model.num_sensitivities = 0;
+    interpreted_model.sensitivity_names = nullptr;
+    interpreted_model.get_initial_sensitivity = nullptr;
+    interpreted_model.sensitivity_derivative = nullptr;
+    interpreted_model.adjoint_objective = nullptr;
+    interpreted_model.num_adjoint_constants = 0;
+    interpreted_model.adjoint_constant_names = nullptr;
+    interpreted_model.objective_adjoint = nullptr;
+    interpreted_model.initial_state_adjoint = nullptr;
+    interpreted_model.adjoint_derivative = nullptr;
+    interpreted_model.propagate_constant_adjoint = nullptr;
+
+    interpreted_root_labels.clear();
+    for (auto& label : program.root_labels)
+    {
+        interpreted_root_labels.push_back(label.c_str());
+    }
+    interpreted_model.num_roots = program.root_labels.size();
+    interpreted_model.num_stop_roots = program.num_stop_roots;
+    interpreted_model.root_labels = interpreted_root_labels.data();
+    interpreted_model.roots = program.root_labels.empty() ? nullptr : interpreted_roots;
+    interpreted_model.steady_state_tolerance = constants[program.steady_state_tolerance_slot];
+    interpreted_model.use_steady_state_solver = program.use_steady_state_solver;
+    interpreted_model.explicit_derivative = nullptr;
+    interpreted_model.implicit_derivative = nullptr;
+    interpreted_model.fast_derivative = nullptr;
+    interpreted_model.slow_derivative = nullptr;
+    interpreted_model.slow_step_size = 0;
+    interpreted_model.jacobian_reuse = constants[program.jacobian_reuse_slot];
+    interpreted_model.linear_setup_frequency = constants[program.linear_setup_frequency_slot];
+    interpreted_model.delta_gamma_max = constants[program.delta_gamma_max_slot];
+    interpreted_model.maximum_nonlinear_iterations = constants[program.maximum_nonlinear_iterations_slot];
+    interpreted_model.maximum_order = constants[program.maximum_order_slot];
+    interpreted_model.use_adaptive_reuse = program.use_adaptive_reuse;
+
+    return &interpreted_model;
+}
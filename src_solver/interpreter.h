@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../src_generator/bytecode.h"
+#include "model.h"
+
+// Runs the bytecode produced by lower_system. List blocks are evaluated a tile of lanes at a time.
+class Interpreter
+{
+public:
+    static constexpr size_t TILE_SIZE = 128;
+
+    Interpreter(BytecodeProgram program);
+
+    void get_initial_state(double* values);
+    void get_absolute_tolerances(double* tolerances); // The global tolerance where no state has its own
+    void get_state_scale(double* scales); // Factors the solver divides the state by, 1 without @SCALE
+    void derivative(const double* values, double* derivatives);
+    void roots(const double* values, double* g);
+    std::string get_state_csv_label();
+    std::string get_csv_line(const double* values);
+    const size_t* get_state_csv_order();
+
+    BytecodeProgram program;
+    std::vector<double> constants;
+    std::vector<double> outputs;
+    size_t state_size = 0;
+    std::vector<size_t> state_csv_order; // State index of every csv column
+
+private:
+    struct Dimension
+    {
+        size_t start;
+        size_t size;
+        size_t stride;
+    };
+
+    struct PreparedBlock
+    {
+        size_t begin;
+        size_t lanes;
+        std::vector<Dimension> dimensions;
+    };
+
+    std::vector<PreparedBlock> prepare(const std::vector<BytecodeBlock>& blocks);
+    void run(const std::vector<PreparedBlock>& blocks, const double* in, double* out);
+    void run_block(const PreparedBlock& block, const double* in, double* out);
+    template <typename Visit>
+    void for_each_label_entry(const BytecodeLabel& label, Visit visit);
+
+    std::vector<double> registers;
+    std::vector<PreparedBlock> initial_state_blocks;
+    std::vector<PreparedBlock> absolute_tolerance_blocks;
+    std::vector<PreparedBlock> state_scale_blocks;
+    std::vector<PreparedBlock> derivative_blocks;
+    std::vector<PreparedBlock> output_blocks;
+    std::vector<PreparedBlock> root_blocks;
+};
+
+// Parses the model file and returns a Model backed by the interpreter, or null after printing an error
+const Model* load_interpreted_model(std::string model_filename);
@@ -0,0 +1,117 @@
+#include "jit.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "../src_generator/parse.h"
+#include "../src_generator/generator.h"
+
+namespace fs = std::filesystem;
+
+// FNV-1a, unlike std::hash it's guaranteed to give the same value across runs and standard libraries
+static void hash_bytes(uint64_t& hash, const std::string& bytes)
+{
+    for (unsigned char c : bytes)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+}
+
+ModelCompiler::ModelCompiler()
+{
+    cache_directory = (fs::temp_directory_path() / "solver_models").string();
+}
+
+const Model* ModelCompiler::load(std::string model_filename)
+{
+    std::ifstream system_src_file(model_filename, std::ios::in);
+    if (!system_src_file)
+    {
+        std::cerr << "Error: Failed to open model " << model_filename << "\n";
+        return nullptr;
+    }
+    SystemDeclarations system;
+    read_system(system, system_src_file);
+    auto files = generate_sources(system);
+    std::string model_flags = flags + (system.use_parallel ? " -fopenmp" : "");
+
+    // The compiler and ABI are part of the key, so a changed toolchain or solver never picks up a stale object
+    uint64_t hash = 14695981039346656037ull;
+    hash_bytes(hash, compiler + " " + model_flags + " " + std::to_string(MODEL_ABI_VERSION));
+    for (auto& file : files)
+    {
+        hash_bytes(hash, file.filename);
+        hash_bytes(hash, file.contents);
+    }
+    std::stringstream key;
+    key << std::hex << hash;
+
+    fs::path model_directory = fs::path(cache_directory) / key.str();
+    fs::path library = model_directory / "model.so";
+    if (!fs::exists(library))
+    {
+        std::error_code error;
+        fs::create_directories(model_directory, error);
+        if (error)
+        {
+            std::cerr << "Error: Failed to create model cache " << model_directory << ": " << error.message() << "\n";
+            return nullptr;
+        }
+        if (!write_sources(model_directory.string(), files))
+            return nullptr;
+
+        // Compiled under a temporary name and renamed, so a concurrent or interrupted run never loads half an object
+        fs::path partial_library = model_directory / ("model.so." + std::to_string(getpid()));
+        fs::path log = model_directory / "compile.log";
+        std::stringstream command;
+        command << "\"" << compiler << "\" " << model_flags << " -I\"" << include_directory << "\" -I\"" << model_directory.string() << "\"";
+        for (auto& file : files)
+        {
+            if (fs::path(file.filename).extension() == ".cpp")
+                command << " \"" << (model_directory / file.filename).string() << "\"";
+        }
+        command << " -o \"" << partial_library.string() << "\" > \"" << log.string() << "\" 2>&1";
+
+        if (verbose) std::cerr << "Compiling model: " << command.str() << "\n";
+        if (std::system(command.str().c_str()) != 0)
+        {
+            std::cerr << "Error: Failed to compile model " << model_filename << ", see " << log << "\n";
+            return nullptr;
+        }
+        fs::rename(partial_library, library);
+    }
+    else if (verbose)
+    {
+        std::cerr << "Using cached model " << library << "\n";
+    }
+
+    // The handle stays open for the rest of the run since the solver calls into the model until it exits
+    void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        std::cerr << "Error: Failed to load model " << library << ": " << dlerror() << "\n";
+        return nullptr;
+    }
+    auto get_model_function = (GetModelFunction)dlsym(handle, "get_model");
+    if (!get_model_function)
+    {
+        std::cerr << "Error: " << library << " has no get_model()\n";
+        return nullptr;
+    }
+    const Model* model = get_model_function();
+    if (model->abi_version != MODEL_ABI_VERSION)
+    {
+        std::cerr << "Error: " << library << " was built for model ABI " << model->abi_version
+                  << ", the solver expects " << MODEL_ABI_VERSION << "\n";
+        return nullptr;
+    }
+
+    return model;
+}
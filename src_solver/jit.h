@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+#include "model.h"
+
+struct ModelCompiler
+{
+    std::string cache_directory; // Every compiled model lives in a subfolder named after the hash of its sources
+    std::string compiler = MODEL_COMPILER;
+    std::string flags = "-std=c++17 -O2 -fPIC -shared -fvisibility=hidden -Wl,-Bsymbolic";
+    std::string include_directory = MODEL_INCLUDE_DIR;
+    bool verbose = false;
+
+    ModelCompiler();
+
+    // Generates, compiles (unless an identical model is cached) and loads the model described in the file.
+    // Returns null after printing an error if any of these steps fail.
+    const Model* load(std::string model_filename);
+};
@@ -1,41 +1,638 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
 
+#include <arkode/arkode_arkstep.h>
+#include <arkode/arkode_mristep.h>
 #include <cvodes/cvodes.h>
 #include <nvector/nvector_serial.h>
 #include <sunlinsol/sunlinsol_dense.h>
 #include <sunlinsol/sunlinsol_spgmr.h>
-#include <sunmatrix/sunmatrix_dense.h> 
+#include <sunmatrix/sunmatrix_dense.h>
 
-#include "../generated/system.h"
+#include "coloring.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "model.h"
+#include "stats.h"
+#include "steady_state.h"
+
+SolverStats stats;
+const Model* model;
+// CVODES unless the model splits its derivative, see create_integrator
+Integrator integrator = Integrator::CVODES;
+// MRIStep's inner integrator of the fast partition, and the same wrapped as an inner stepper
+void* fast_memory_block = nullptr;
+MRIStepInnerStepper fast_stepper = nullptr;
+// Column groups of the dense Jacobian, when the model declares its pattern, and the CVODES integrator
+// colored_jacobian reads the step size and error weights from
+JacobianColoring jacobian_coloring;
+void* coloring_memory_block = nullptr;
+
+// CVODES' own intervals between linear solver setups and Jacobian evaluations, @JAC_REUSE adaptive starts from them
+// unless they're given. It stretches them up to MAX_REUSE_GROWTH times while Newton takes at most
+// GOOD_NEWTON_ITERATIONS per step
+const long DEFAULT_LINEAR_SETUP_FREQUENCY = 20;
+const long DEFAULT_JACOBIAN_REUSE = 51;
+const long MAX_REUSE_GROWTH = 16;
+const long GOOD_NEWTON_ITERATIONS = 2;
+
+struct AdaptiveReuse
+{
+    long initial_setup_frequency = DEFAULT_LINEAR_SETUP_FREQUENCY;
+    long initial_jacobian_reuse = DEFAULT_JACOBIAN_REUSE;
+    long setup_frequency = DEFAULT_LINEAR_SETUP_FREQUENCY;
+    long jacobian_reuse = DEFAULT_JACOBIAN_REUSE;
+    long steps = 0;
+    long nonlinear_iters = 0;
+    long nonlinear_conv_fails = 0;
+};
+AdaptiveReuse adaptive_reuse;
+
+// Forward steps between the checkpoints CVODES keeps for the backward adjoint solve
+const long ADJOINT_CHECKPOINT_STEPS = 100;
+// Receives the half of adjoint_derivative an adjoint callback doesn't need
+std::vector<double> adjoint_state_scratch, adjoint_constant_scratch;
 
 void handleError(int sunerr)
 {
     if (sunerr) std::cout << SUNGetErrMsg(sunerr) << "\n";
 }
 
+int timed_derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::derivative));
+    model->derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot));
+    return 0;
+}
+
+int timed_explicit_derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::explicit_derivative));
+    model->explicit_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot));
+    return 0;
+}
+
+int timed_implicit_derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::derivative));
+    model->implicit_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot));
+    return 0;
+}
+
+int timed_fast_derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::fast_derivative));
+    model->fast_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot));
+    return 0;
+}
+
+int timed_slow_derivative(sunrealtype t, N_Vector y, N_Vector ydot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::derivative));
+    model->slow_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot));
+    return 0;
+}
+
+int timed_roots(sunrealtype t, N_Vector y, sunrealtype* g, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::roots));
+    model->roots(t, N_VGetArrayPointer(y), g);
+    return 0;
+}
+
+// ARKODE's return codes match CVODES' for everything the solver checks (success, root return, errors below 0)
+int integrate(void* integrator_memory_block, double t_out, N_Vector state, double* t)
+{
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            return ARKStepEvolve(integrator_memory_block, t_out, state, t, ARK_NORMAL);
+        case Integrator::MRISTEP:
+            return MRIStepEvolve(integrator_memory_block, t_out, state, t, ARK_NORMAL);
+        default:
+            return CVode(integrator_memory_block, t_out, state, t, CV_NORMAL);
+    }
+}
+
+int init_roots(void* integrator_memory_block, int num_roots)
+{
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            return ARKStepRootInit(integrator_memory_block, num_roots, timed_roots);
+        case Integrator::MRISTEP:
+            return MRIStepRootInit(integrator_memory_block, num_roots, timed_roots);
+        default:
+            return CVodeRootInit(integrator_memory_block, num_roots, timed_roots);
+    }
+}
+
+int get_root_info(void* integrator_memory_block, int* root_info)
+{
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            return ARKStepGetRootInfo(integrator_memory_block, root_info);
+        case Integrator::MRISTEP:
+            return MRIStepGetRootInfo(integrator_memory_block, root_info);
+        default:
+            return CVodeGetRootInfo(integrator_memory_block, root_info);
+    }
+}
+
+// The derivative is read off the integrator's interpolant rather than evaluated, and weighed like its error test
+bool is_steady_state(void* integrator_memory_block, double t, N_Vector derivative, N_Vector weights)
+{
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            if (ARKStepGetDky(integrator_memory_block, t, 1, derivative) != ARK_SUCCESS) return false;
+            if (ARKStepGetErrWeights(integrator_memory_block, weights) != ARK_SUCCESS) return false;
+            break;
+        case Integrator::MRISTEP:
+            if (MRIStepGetDky(integrator_memory_block, t, 1, derivative) != ARK_SUCCESS) return false;
+            if (MRIStepGetErrWeights(integrator_memory_block, weights) != ARK_SUCCESS) return false;
+            break;
+        default:
+            if (CVodeGetDky(integrator_memory_block, t, 1, derivative) != CV_SUCCESS) return false;
+            if (CVodeGetErrWeights(integrator_memory_block, weights) != CV_SUCCESS) return false;
+            break;
+    }
+    return N_VWrmsNorm(derivative, weights) < model->steady_state_tolerance;
+}
+
+// Called after every sample interval with @JAC_REUSE adaptive. An interval where Newton converged quickly without a
+// failure doubles the reuse intervals, a convergence failure sends them back to where they started
+void adapt_reuse(void* cvodes_memory_block)
+{
+    if (!model->use_adaptive_reuse || integrator != Integrator::CVODES) return;
+
+    long steps, nonlinear_iters, nonlinear_conv_fails;
+    CVodeGetNumSteps(cvodes_memory_block, &steps);
+    CVodeGetNumNonlinSolvIters(cvodes_memory_block, &nonlinear_iters);
+    CVodeGetNumNonlinSolvConvFails(cvodes_memory_block, &nonlinear_conv_fails);
+    long interval_steps = steps - adaptive_reuse.steps;
+    long interval_iters = nonlinear_iters - adaptive_reuse.nonlinear_iters;
+    long interval_fails = nonlinear_conv_fails - adaptive_reuse.nonlinear_conv_fails;
+    adaptive_reuse.steps = steps;
+    adaptive_reuse.nonlinear_iters = nonlinear_iters;
+    adaptive_reuse.nonlinear_conv_fails = nonlinear_conv_fails;
+
+    long setup_frequency = adaptive_reuse.setup_frequency, jacobian_reuse = adaptive_reuse.jacobian_reuse;
+    if (interval_fails > 0)
+    {
+        setup_frequency = adaptive_reuse.initial_setup_frequency;
+        jacobian_reuse = adaptive_reuse.initial_jacobian_reuse;
+    }
+    else if (interval_steps > 0 && interval_iters <= GOOD_NEWTON_ITERATIONS * interval_steps)
+    {
+        setup_frequency = std::min(2 * setup_frequency, MAX_REUSE_GROWTH * adaptive_reuse.initial_setup_frequency);
+        jacobian_reuse = std::min(2 * jacobian_reuse, MAX_REUSE_GROWTH * adaptive_reuse.initial_jacobian_reuse);
+    }
+
+    if (setup_frequency != adaptive_reuse.setup_frequency)
+        handleError( CVodeSetLSetupFrequency(cvodes_memory_block, setup_frequency) );
+    if (jacobian_reuse != adaptive_reuse.jacobian_reuse)
+        handleError( CVodeSetJacEvalFrequency(cvodes_memory_block, jacobian_reuse) );
+    adaptive_reuse.setup_frequency = setup_frequency;
+    adaptive_reuse.jacobian_reuse = jacobian_reuse;
+}
+
+// Newton's method is tried on the initial state first. When it fails the system is integrated over horizons growing
+// tenfold, the end of each being a better guess to try again from, until Newton converges or the end time is reached
+// (pseudo-transient continuation)
+void run_to_steady_state(void* integrator_memory_block, N_Vector state, SUNContext sun_context, std::ostream& events)
+{
+    double t = 0;
+    double horizon = model->sample_interval;
+    bool converged = solve_newton_steady_state(model, state, sun_context, stats.timer(&SolverTimers::derivative));
+    while (!converged && t < model->end_time)
+    {
+        int sunerr = integrate(integrator_memory_block, std::min(t + horizon, model->end_time), state, &t);
+        stats.record_sample(t, integrator_memory_block);
+        adapt_reuse(integrator_memory_block);
+        if (sunerr < 0)
+        {
+            stats.error_flag = sunerr;
+            return;
+        }
+        horizon *= 10;
+        converged = solve_newton_steady_state(model, state, sun_context, stats.timer(&SolverTimers::derivative));
+    }
+    if (!converged)
+    {
+        std::cerr << "Error: No steady state found by t = " << t << "\n";
+        return;
+    }
+
+    events << t << ", steady_state\n";
+    ScopedTimer timer(stats.timer(&SolverTimers::output));
+    std::cout << t << model->get_csv_line(N_VGetArrayPointer(state)) << "\n";
+}
+
+int timed_sensitivity_derivative(int num_sensitivities, sunrealtype t, N_Vector y, N_Vector ydot, int parameter, N_Vector yS, N_Vector ySdot,
+                                 void *user_data, N_Vector tmp1, N_Vector tmp2)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::sensitivity));
+    model->sensitivity_derivative(parameter, t, N_VGetArrayPointer(y), N_VGetArrayPointer(yS), N_VGetArrayPointer(ySdot));
+    return 0;
+}
+
+// The backward problem is lambda' = -J^T lambda, and the quadrature of -lambda^T df/dc integrated from the end time
+// back to 0 is the part of the gradient accumulated along the trajectory
+int timed_adjoint_derivative(sunrealtype t, N_Vector y, N_Vector lambda, N_Vector lambda_dot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::adjoint));
+    model->adjoint_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(lambda), N_VGetArrayPointer(lambda_dot), adjoint_constant_scratch.data());
+    N_VScale(-1.0, lambda_dot, lambda_dot);
+    return 0;
+}
+
+int timed_adjoint_quadrature(sunrealtype t, N_Vector y, N_Vector lambda, N_Vector quadrature_dot, void *user_data)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::adjoint));
+    model->adjoint_derivative(t, N_VGetArrayPointer(y), N_VGetArrayPointer(lambda), adjoint_state_scratch.data(), N_VGetArrayPointer(quadrature_dot));
+    N_VScale(-1.0, quadrature_dot, quadrature_dot);
+    return 0;
+}
+
+// Integrates the adjoint back from the end of the forward run and writes the objective's gradient with respect to
+// every constant. The forward run must have gone through CVodeF so the checkpoints exist
+void solve_adjoint(void* cvodes_memory_block, N_Vector state, double final_time, SUNContext sun_context, std::ostream& out)
+{
+    size_t state_size = model->state_size;
+    size_t num_constants = model->num_adjoint_constants;
+    adjoint_state_scratch.assign(state_size, 0.0);
+    adjoint_constant_scratch.assign(num_constants, 0.0);
+
+    std::vector<double> gradient(num_constants, 0.0);
+    N_Vector lambda = N_VNew_Serial(state_size, sun_context);
+    N_VConst(0.0, lambda);
+    model->objective_adjoint(N_VGetArrayPointer(state), N_VGetArrayPointer(lambda), gradient.data());
+
+    int which;
+    SUNMatrix A = NULL;
+    SUNLinearSolver linear_solver;
+    handleError( CVodeCreateB(cvodes_memory_block, CV_BDF, &which) );
+    handleError( CVodeInitB(cvodes_memory_block, which, timed_adjoint_derivative, final_time, lambda) );
+    handleError( CVodeSStolerancesB(cvodes_memory_block, which, model->relative_tolerance, model->absolute_tolerance) );
+    if (model->use_direct_solver)
+    {
+        A = SUNDenseMatrix(state_size, state_size, sun_context);
+        linear_solver = SUNLinSol_Dense(lambda, A, sun_context);
+    }
+    else
+    {
+        linear_solver = SUNLinSol_SPGMR(lambda, SUN_PREC_NONE, 0, sun_context);
+    }
+    handleError( CVodeSetLinearSolverB(cvodes_memory_block, which, linear_solver, A) );
+    CVodeSetMaxNumStepsB(cvodes_memory_block, which, model->maximum_num_steps);
+
+    N_Vector quadrature = N_VNew_Serial(num_constants, sun_context);
+    N_VConst(0.0, quadrature);
+    handleError( CVodeQuadInitB(cvodes_memory_block, which, timed_adjoint_quadrature, quadrature) );
+    handleError( CVodeQuadSStolerancesB(cvodes_memory_block, which, model->relative_tolerance, model->absolute_tolerance) );
+    handleError( CVodeSetQuadErrConB(cvodes_memory_block, which, SUNTRUE) );
+
+    sunrealtype t;
+    handleError( CVodeB(cvodes_memory_block, 0.0, CV_NORMAL) );
+    handleError( CVodeGetB(cvodes_memory_block, which, &t, lambda) );
+    handleError( CVodeGetQuadB(cvodes_memory_block, which, &t, quadrature) );
+
+    // The initial state depends on constants too, lambda at 0 weighs that in
+    std::vector<double> initial_state(state_size);
+    model->get_initial_state(initial_state.data());
+    model->initial_state_adjoint(N_VGetArrayPointer(lambda), initial_state.data(), adjoint_state_scratch.data(), gradient.data());
+    double* quadrature_values = N_VGetArrayPointer(quadrature);
+    for (size_t i = 0; i < num_constants; ++i)
+    {
+        gradient[i] += quadrature_values[i];
+    }
+    model->propagate_constant_adjoint(gradient.data());
+
+    out << "constant, d(" << model->adjoint_objective << ")/d(constant)\n";
+    for (size_t i = 0; i < num_constants; ++i)
+    {
+        out << model->adjoint_constant_names[i] << ", " << gradient[i] << "\n";
+    }
+
+    N_VDestroy_Serial(quadrature);
+    N_VDestroy_Serial(lambda);
+    if (A) SUNMatDestroy(A);
+    SUNLinSolFree(linear_solver);
+}
+
+// Splits the CSV header into the state labels, dropping the time column and the additional outputs
+std::vector<std::string> get_state_labels(std::string header, size_t state_size)
+{
+    std::vector<std::string> labels;
+    size_t start = header.find(", ");
+    while (start != std::string::npos && labels.size() < state_size)
+    {
+        size_t end = header.find(", ", start + 2);
+        labels.push_back(header.substr(start + 2, end == std::string::npos ? std::string::npos : end - start - 2));
+        start = end;
+    }
+    return labels;
+}
+
 int p_solve(sunrealtype t, N_Vector y, N_Vector fy, N_Vector r, N_Vector z, sunrealtype gamma, sunrealtype delta, int lr, void *user_data)
 {
+    ScopedTimer timer(stats.timer(&SolverTimers::preconditioner));
+    return 0;
+}
+
+// The model's exact product replaces CVODES' difference quotient, which costs a derivative call per Krylov iteration
+int timed_jacobian_times(N_Vector v, N_Vector Jv, sunrealtype t, N_Vector y, N_Vector fy, void *user_data, N_Vector tmp)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::jacobian_times));
+    model->jacobian_times(t, N_VGetArrayPointer(y), N_VGetArrayPointer(v), N_VGetArrayPointer(Jv));
+    return 0;
+}
+
+// CVODES' dense difference quotient with the columns of a color perturbed together, so a Jacobian costs one derivative
+// call per color instead of one per state. Increments follow CVODES (cvLsDenseDQJac)
+int colored_jacobian(sunrealtype t, N_Vector y, N_Vector fy, SUNMatrix J, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3)
+{
+    sunrealtype h;
+    CVodeGetCurrentStep(coloring_memory_block, &h);
+    CVodeGetErrWeights(coloring_memory_block, tmp1);
+
+    size_t state_size = model->state_size;
+    double* y_data = N_VGetArrayPointer(y);
+    double* fy_data = N_VGetArrayPointer(fy);
+    double* weights = N_VGetArrayPointer(tmp1);
+    double* perturbed = N_VGetArrayPointer(tmp2);
+    double* increments = N_VGetArrayPointer(tmp3);
+
+    double epsilon = std::numeric_limits<double>::epsilon();
+    double fnorm = N_VWrmsNorm(fy, tmp1);
+    double minimum_increment = fnorm != 0 ? 1000 * std::abs(h) * epsilon * state_size * fnorm : 1.0;
+    for (size_t column = 0; column < state_size; ++column)
+    {
+        increments[column] = std::max(std::sqrt(epsilon) * std::abs(y_data[column]), minimum_increment / weights[column]);
+    }
+
+    // The weights aren't needed anymore, so tmp1 keeps the entries being perturbed. They are written back rather
+    // than subtracting the increment, which wouldn't restore them exactly, and the quotients divide by the step
+    // the rounded sum actually took
+    double* saved = weights;
+    SUNMatZero(J);
+    for (size_t color = 0; color < jacobian_coloring.num_colors; ++color)
+    {
+        size_t start = jacobian_coloring.color_starts[color], end = jacobian_coloring.color_starts[color + 1];
+        for (size_t k = start; k < end; ++k)
+        {
+            size_t column = jacobian_coloring.color_columns[k];
+            saved[column] = y_data[column];
+            y_data[column] = saved[column] + increments[column];
+            increments[column] = y_data[column] - saved[column];
+        }
+        timed_derivative(t, y, tmp2, nullptr);
+        for (size_t k = start; k < end; ++k)
+        {
+            size_t column = jacobian_coloring.color_columns[k];
+            y_data[column] = saved[column];
+            for (size_t i = jacobian_coloring.row_starts[column]; i < jacobian_coloring.row_starts[column + 1]; ++i)
+            {
+                size_t row = jacobian_coloring.rows[i];
+                SM_ELEMENT_D(J, row, column) = (perturbed[row] - fy_data[row]) / increments[column];
+            }
+        }
+    }
     return 0;
 }
 
-int main()
+// CVODES has no hooks around the linear solver, so its setup and solve ops are swapped
+// for timed versions which forward to the originals.
+SUNErrCode (*untimed_linear_setup)(SUNLinearSolver, SUNMatrix);
+int (*untimed_linear_solve)(SUNLinearSolver, SUNMatrix, N_Vector, N_Vector, sunrealtype);
+
+SUNErrCode timed_linear_setup(SUNLinearSolver linear_solver, SUNMatrix A)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::linear_setup));
+    return untimed_linear_setup(linear_solver, A);
+}
+
+int timed_linear_solve(SUNLinearSolver linear_solver, SUNMatrix A, N_Vector x, N_Vector b, sunrealtype tol)
+{
+    ScopedTimer timer(stats.timer(&SolverTimers::linear_solve));
+    return untimed_linear_solve(linear_solver, A, x, b, tol);
+}
+
+void time_linear_solver(SUNLinearSolver linear_solver)
+{
+    untimed_linear_setup = linear_solver->ops->setup;
+    untimed_linear_solve = linear_solver->ops->solve;
+    if (untimed_linear_setup) linear_solver->ops->setup = timed_linear_setup;
+    if (untimed_linear_solve) linear_solver->ops->solve = timed_linear_solve;
+}
+
+// @ABSOLUTE_TOLERANCE per state, null when one value applies to every state. The integrators keep their own copy
+N_Vector create_absolute_tolerances(N_Vector state)
+{
+    if (!model->get_absolute_tolerances) return nullptr;
+
+    N_Vector absolute_tolerances = N_VClone(state);
+    model->get_absolute_tolerances(N_VGetArrayPointer(absolute_tolerances));
+    return absolute_tolerances;
+}
+
+// CVODES' BDF integrates the whole derivative unless the model splits it. With @INTEGRATOR arkode-imex ARKStep only
+// iterates on the implicit half, the EXPLICIT() terms are evaluated once per stage. With @FAST MRIStep takes fixed
+// implicit steps on the slow partition and an inner explicit ARKStep resolves the fast one in between
+void* create_integrator(N_Vector state, SUNLinearSolver linear_solver, SUNMatrix A, SUNContext sun_context)
 {
+    void* integrator_memory_block;
+    N_Vector absolute_tolerances = create_absolute_tolerances(state);
+    if (model->implicit_derivative)
+    {
+        integrator = Integrator::ARKSTEP;
+        integrator_memory_block = ARKStepCreate(timed_explicit_derivative, timed_implicit_derivative, 0, state, sun_context);
+        if (absolute_tolerances) handleError( ARKStepSVtolerances(integrator_memory_block, model->relative_tolerance, absolute_tolerances) );
+        else handleError( ARKStepSStolerances(integrator_memory_block, model->relative_tolerance, model->absolute_tolerance) );
+        ARKStepSetMaxNumSteps(integrator_memory_block, model->maximum_num_steps);
+        ARKStepSetMinStep(integrator_memory_block, model->minimum_step_size);
+        ARKStepSetMaxStep(integrator_memory_block, model->maximum_step_size);
+        ARKStepSetInitStep(integrator_memory_block, model->initial_step_size);
+        handleError( ARKStepSetLinearSolver(integrator_memory_block, linear_solver, A) );
+        if (model->jacobian_reuse > 0) handleError( ARKStepSetJacEvalFrequency(integrator_memory_block, (long)model->jacobian_reuse) );
+        if (model->linear_setup_frequency > 0) handleError( ARKStepSetLSetupFrequency(integrator_memory_block, (int)model->linear_setup_frequency) );
+        if (model->delta_gamma_max > 0) handleError( ARKStepSetDeltaGammaMax(integrator_memory_block, model->delta_gamma_max) );
+        if (model->maximum_nonlinear_iterations > 0) handleError( ARKStepSetMaxNonlinIters(integrator_memory_block, (int)model->maximum_nonlinear_iterations) );
+
+        if (!model->use_direct_solver) handleError( ARKStepSetPreconditioner(integrator_memory_block, NULL, p_solve) );
+    }
+    else if (model->fast_derivative)
+    {
+        integrator = Integrator::MRISTEP;
+        fast_memory_block = ARKStepCreate(timed_fast_derivative, NULL, 0, state, sun_context);
+        if (absolute_tolerances) handleError( ARKStepSVtolerances(fast_memory_block, model->relative_tolerance, absolute_tolerances) );
+        else handleError( ARKStepSStolerances(fast_memory_block, model->relative_tolerance, model->absolute_tolerance) );
+        ARKStepSetMaxNumSteps(fast_memory_block, model->maximum_num_steps);
+        handleError( ARKStepCreateMRIStepInnerStepper(fast_memory_block, &fast_stepper) );
+
+        double slow_step_size = model->slow_step_size > 0 ? model->slow_step_size : model->sample_interval / 100;
+        integrator_memory_block = MRIStepCreate(NULL, timed_slow_derivative, 0, state, fast_stepper, sun_context);
+        if (absolute_tolerances) handleError( MRIStepSVtolerances(integrator_memory_block, model->relative_tolerance, absolute_tolerances) );
+        else handleError( MRIStepSStolerances(integrator_memory_block, model->relative_tolerance, model->absolute_tolerance) );
+        handleError( MRIStepSetFixedStep(integrator_memory_block, slow_step_size) );
+        MRIStepSetMaxNumSteps(integrator_memory_block, model->maximum_num_steps);
+        handleError( MRIStepSetLinearSolver(integrator_memory_block, linear_solver, A) );
+        if (model->jacobian_reuse > 0) handleError( MRIStepSetJacEvalFrequency(integrator_memory_block, (long)model->jacobian_reuse) );
+        if (model->linear_setup_frequency > 0) handleError( MRIStepSetLSetupFrequency(integrator_memory_block, (int)model->linear_setup_frequency) );
+        if (model->delta_gamma_max > 0) handleError( MRIStepSetDeltaGammaMax(integrator_memory_block, model->delta_gamma_max) );
+        if (model->maximum_nonlinear_iterations > 0) handleError( MRIStepSetMaxNonlinIters(integrator_memory_block, (int)model->maximum_nonlinear_iterations) );
+
+        if (!model->use_direct_solver) handleError( MRIStepSetPreconditioner(integrator_memory_block, NULL, p_solve) );
+        stats.fast_memory_block = fast_memory_block;
+    }
+    else
+    {
+        integrator_memory_block = CVodeCreate(CV_BDF, sun_context);
+        handleError( CVodeInit(integrator_memory_block, timed_derivative, 0, state) );
+        if (absolute_tolerances) handleError( CVodeSVtolerances(integrator_memory_block, model->relative_tolerance, absolute_tolerances) );
+        else handleError( CVodeSStolerances(integrator_memory_block, model->relative_tolerance, model->absolute_tolerance) );
+        CVodeSetMaxNumSteps(integrator_memory_block, model->maximum_num_steps);
+        CVodeSetMinStep(integrator_memory_block, model->minimum_step_size);
+        CVodeSetMaxStep(integrator_memory_block, model->maximum_step_size);
+        CVodeSetInitStep(integrator_memory_block, model->initial_step_size);
+        handleError( CVodeSetLinearSolver(integrator_memory_block, linear_solver, A) );
+        if (model->jacobian_reuse > 0) handleError( CVodeSetJacEvalFrequency(integrator_memory_block, (long)model->jacobian_reuse) );
+        if (model->linear_setup_frequency > 0) handleError( CVodeSetLSetupFrequency(integrator_memory_block, (long)model->linear_setup_frequency) );
+        if (model->delta_gamma_max > 0) handleError( CVodeSetDeltaGammaMaxLSetup(integrator_memory_block, model->delta_gamma_max) );
+        if (model->maximum_nonlinear_iterations > 0) handleError( CVodeSetMaxNonlinIters(integrator_memory_block, (int)model->maximum_nonlinear_iterations) );
+        if (model->maximum_order > 0) handleError( CVodeSetMaxOrd(integrator_memory_block, (int)model->maximum_order) );
+        if (model->use_adaptive_reuse)
+        {
+            adaptive_reuse = AdaptiveReuse();
+            if (model->linear_setup_frequency > 0) adaptive_reuse.initial_setup_frequency = (long)model->linear_setup_frequency;
+            if (model->jacobian_reuse > 0) adaptive_reuse.initial_jacobian_reuse = (long)model->jacobian_reuse;
+            adaptive_reuse.setup_frequency = adaptive_reuse.initial_setup_frequency;
+            adaptive_reuse.jacobian_reuse = adaptive_reuse.initial_jacobian_reuse;
+        }
+
+        if (!model->use_direct_solver) handleError( CVodeSetPreconditioner(integrator_memory_block, NULL, p_solve) );
+        if (!model->use_direct_solver && model->jacobian_times) handleError( CVodeSetJacTimes(integrator_memory_block, NULL, timed_jacobian_times) );
+        if (model->use_direct_solver)
+        {
+            // A row reading every column leaves nothing to share, CVODES' own quotient is as cheap then
+            jacobian_coloring = color_jacobian(model);
+            stats.jacobian_colors = jacobian_coloring.num_colors;
+            if (jacobian_coloring.num_colors > 0 && jacobian_coloring.num_colors < model->state_size)
+            {
+                coloring_memory_block = integrator_memory_block;
+                handleError( CVodeSetJacFn(integrator_memory_block, colored_jacobian) );
+            }
+        }
+    }
+    if (absolute_tolerances) N_VDestroy(absolute_tolerances);
+    stats.integrator = integrator;
+    return integrator_memory_block;
+}
+
+void free_integrator(void* integrator_memory_block)
+{
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            ARKStepFree(&integrator_memory_block);
+            break;
+        case Integrator::MRISTEP:
+            MRIStepFree(&integrator_memory_block);
+            MRIStepInnerStepper_Free(&fast_stepper);
+            ARKStepFree(&fast_memory_block);
+            break;
+        default:
+            CVodeFree(&integrator_memory_block);
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string stats_filename = "";
+    std::string model_filename = "";
+    std::string gradient_filename = "";
+    std::string events_filename = "";
+    bool interpret = false;
+    ModelCompiler model_compiler;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--stats") == 0)
+        {
+            stats.enabled = true;
+        }
+        else if (std::strncmp(argv[i], "--stats=", 8) == 0)
+        {
+            stats.enabled = true;
+            stats_filename = argv[i] + 8;
+        }
+        else if (std::strncmp(argv[i], "--gradient=", 11) == 0)
+        {
+            gradient_filename = argv[i] + 11;
+        }
+        else if (std::strncmp(argv[i], "--events=", 9) == 0)
+        {
+            events_filename = argv[i] + 9;
+        }
+        else if (std::strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+        {
+            model_filename = argv[++i];
+        }
+        else if (std::strncmp(argv[i], "--model-cache=", 14) == 0)
+        {
+            model_compiler.cache_directory = argv[i] + 14;
+        }
+        else if (std::strcmp(argv[i], "--backend=interpreter") == 0)
+        {
+            interpret = true;
+        }
+        else if (std::strcmp(argv[i], "--backend=compiled") == 0)
+        {
+            interpret = false;
+        }
+        else if (std::strcmp(argv[i], "--verbose") == 0)
+        {
+            model_compiler.verbose = true;
+        }
+        else
+        {
+            std::cerr << "Usage: solver [--stats | --stats=<file>] [--gradient=<file>] [--events=<file>] [--model <system file> [--backend=compiled|interpreter] [--model-cache=<dir>] [--verbose]]\n";
+            return 1;
+        }
+    }
+
+    // Without --model the solver runs the system that was generated into generated/ when it was built
+    if (model_filename.empty())
+    {
+        model = get_model();
+    }
+    else
+    {
+        model = interpret ? load_interpreted_model(model_filename) : model_compiler.load(model_filename);
+    }
+    if (!model) return 1;
+
     SUNContext sun_context;
     N_Vector state;
     SUNMatrix A;
     SUNLinearSolver linear_solver;
-    void* cvodes_memory_block;
-    size_t state_size = STATE_SIZE;
+    void* integrator_memory_block;
+    size_t state_size = model->state_size;
 
     handleError( SUNContext_Create(SUN_COMM_NULL, &sun_context) );
 
     state = N_VNew_Serial(state_size, sun_context);
-    get_initial_state(state);
-    
-    cvodes_memory_block = CVodeCreate(CV_BDF, sun_context);
-    handleError( CVodeInit(cvodes_memory_block, derivative, 0, state) );
-    handleError( CVodeSStolerances(cvodes_memory_block, relative_tolerance, absolute_tolerance) );
-    if (use_direct_solver)
+    model->get_initial_state(N_VGetArrayPointer(state));
+
+    if (model->use_direct_solver)
     {
         A = SUNDenseMatrix(state_size, state_size, sun_context);
         linear_solver = SUNLinSol_Dense(state, A, sun_context);
@@ -44,28 +641,173 @@ int main()
     {
         linear_solver = SUNLinSol_SPGMR(state, SUN_PREC_NONE, 0, sun_context);
     }
-    CVodeSetMaxNumSteps(cvodes_memory_block, maximum_num_steps);
-    CVodeSetMinStep(cvodes_memory_block, minimum_step_size);
-    CVodeSetMaxStep(cvodes_memory_block, maximum_step_size);
-    CVodeSetInitStep(cvodes_memory_block, initial_step_size);
-    handleError( CVodeSetLinearSolver(cvodes_memory_block, linear_solver, use_direct_solver ? A : NULL) );
-    
-    if (!use_direct_solver) handleError( CVodeSetPreconditioner(cvodes_memory_block, NULL, p_solve) );
+    if (stats.enabled) time_linear_solver(linear_solver);
+    integrator_memory_block = create_integrator(state, linear_solver, model->use_direct_solver ? A : NULL, sun_context);
 
-    std::cout << get_state_csv_label() << std::endl;
-    for (double t = 0; t <= end_time;)
+    // The steady state solve produces a single row, there's no trajectory to differentiate
+    bool steady_state = model->use_steady_state_solver;
+    if (steady_state && (model->num_sensitivities > 0 || model->adjoint_derivative))
+    {
+        std::cerr << "Warning: The steady state solve ignores @SENSITIVITY and @ADJOINT.\n";
+    }
+    // Sensitivities and checkpointing are CVODES features
+    bool cvodes = integrator == Integrator::CVODES;
+    if (!cvodes && !steady_state && (model->num_sensitivities > 0 || model->adjoint_derivative))
     {
-        int sunerr = CVode(cvodes_memory_block, t + sample_interval, state, &t, CV_NORMAL);
-        if (sunerr) break;
-        std::cout << t;
-        std::cout << get_csv_line(state) << "\n";
+        std::cerr << "Warning: ARKODE integration (@INTEGRATOR arkode-imex, @FAST) ignores @SENSITIVITY and @ADJOINT.\n";
     }
+    bool forward_only = steady_state || !cvodes;
 
+    // Forward sensitivities are integrated alongside the state, one vector per @SENSITIVITY parameter
+    int num_sensitivities = forward_only ? 0 : (int)model->num_sensitivities;
+    N_Vector* sensitivities = nullptr;
+    if (num_sensitivities > 0)
+    {
+        sensitivities = N_VCloneVectorArray(num_sensitivities, state);
+        for (int i = 0; i < num_sensitivities; ++i)
+        {
+            N_VConst(0.0, sensitivities[i]);
+            model->get_initial_sensitivity(i, N_VGetArrayPointer(state), N_VGetArrayPointer(sensitivities[i]));
+        }
+        handleError( CVodeSensInit1(integrator_memory_block, num_sensitivities, CV_STAGGERED, timed_sensitivity_derivative, sensitivities) );
+        handleError( CVodeSensEEtolerances(integrator_memory_block) );
+        handleError( CVodeSetSensErrCon(integrator_memory_block, SUNTRUE) );
+    }
+
+    // The adjoint needs the forward run checkpointed, which only CVodeF does
+    bool adjoint = !forward_only && model->adjoint_derivative != nullptr;
+    if (adjoint) handleError( CVodeAdjInit(integrator_memory_block, ADJOINT_CHECKPOINT_STEPS, CV_HERMITE) );
+
+    std::cout << model->get_state_csv_label();
+    if (num_sensitivities > 0)
+    {
+        auto labels = get_state_labels(model->get_state_csv_label(), state_size);
+        for (int i = 0; i < num_sensitivities; ++i)
+        {
+            for (auto& label : labels)
+            {
+                std::cout << ", d(" << label << ")/d(" << model->sensitivity_names[i] << ")";
+            }
+        }
+    }
+    std::cout << std::endl;
+    // Stop conditions, events and the steady state check are reported as they happen
+    int num_roots = (int)model->num_roots;
+    std::vector<int> root_info(num_roots);
+    if (num_roots > 0) handleError( init_roots(integrator_memory_block, num_roots) );
+    bool steady_state_check = model->steady_state_tolerance > 0;
+    N_Vector steady_state_derivative = steady_state_check ? N_VClone(state) : nullptr;
+    N_Vector steady_state_weights = steady_state_check ? N_VClone(state) : nullptr;
+    std::ofstream events_file;
+    if (!events_filename.empty()) events_file.open(events_filename, std::ios::out);
+    std::ostream& events = events_filename.empty() ? std::cerr : events_file;
+    if (num_roots > 0 || steady_state_check || steady_state) events << "t, event\n";
+
+    double final_time = 0;
+    if (steady_state)
+    {
+        run_to_steady_state(integrator_memory_block, state, sun_context, events);
+    }
+    else
+    {
+        double next_sample = model->sample_interval;
+        for (double t = 0; t <= model->end_time;)
+        {
+            int num_checkpoints;
+            int sunerr = adjoint ? CVodeF(integrator_memory_block, next_sample, state, &t, CV_NORMAL, &num_checkpoints)
+                                 : integrate(integrator_memory_block, next_sample, state, &t);
+            final_time = t;
+            if (sunerr < 0)
+            {
+                stats.error_flag = sunerr;
+                stats.record_sample(t, integrator_memory_block);
+                break;
+            }
+
+            // An event alone doesn't produce a row, the solve carries on towards the same sample
+            bool stop = false;
+            if (sunerr == CV_ROOT_RETURN)
+            {
+                get_root_info(integrator_memory_block, root_info.data());
+                for (int i = 0; i < num_roots; ++i)
+                {
+                    if (!root_info[i]) continue;
+
+                    events << t << ", " << model->root_labels[i] << "\n";
+                    if (i < (int)model->num_stop_roots) stop = true;
+                }
+                if (!stop) continue;
+            }
+            else if (steady_state_check && is_steady_state(integrator_memory_block, t, steady_state_derivative, steady_state_weights))
+            {
+                events << t << ", steady_state\n";
+                stop = true;
+            }
+            next_sample = t + model->sample_interval;
+
+            {
+                ScopedTimer timer(stats.timer(&SolverTimers::output));
+                std::cout << t;
+                std::cout << model->get_csv_line(N_VGetArrayPointer(state));
+                if (num_sensitivities > 0)
+                {
+                    sunrealtype sensitivity_time;
+                    CVodeGetSens(integrator_memory_block, &sensitivity_time, sensitivities);
+                    const size_t* order = model->get_state_csv_order();
+                    for (int i = 0; i < num_sensitivities; ++i)
+                    {
+                        double* values = N_VGetArrayPointer(sensitivities[i]);
+                        for (size_t j = 0; j < state_size; ++j)
+                        {
+                            std::cout << ", " << values[order[j]];
+                        }
+                    }
+                }
+                std::cout << "\n";
+            }
+            stats.record_sample(t, integrator_memory_block);
+            adapt_reuse(integrator_memory_block);
+            if (stop) break;
+        }
+    }
+
+    if (adjoint && !stats.error_flag)
+    {
+        if (gradient_filename.empty())
+        {
+            solve_adjoint(integrator_memory_block, state, final_time, sun_context, std::cerr);
+        }
+        else
+        {
+            std::ofstream gradient_file(gradient_filename, std::ios::out);
+            solve_adjoint(integrator_memory_block, state, final_time, sun_context, gradient_file);
+        }
+    }
+
+    if (stats.enabled)
+    {
+        if (stats_filename.empty())
+        {
+            stats.write_json(std::cerr);
+        }
+        else
+        {
+            std::ofstream stats_file(stats_filename, std::ios::out);
+            stats.write_json(stats_file);
+        }
+    }
+
+    if (num_sensitivities > 0) N_VDestroyVectorArray(sensitivities, num_sensitivities);
+    if (steady_state_check)
+    {
+        N_VDestroy(steady_state_derivative);
+        N_VDestroy(steady_state_weights);
+    }
     N_VDestroy_Serial(state);
-    if (use_direct_solver) SUNMatDestroy(A);
+    if (model->use_direct_solver) SUNMatDestroy(A);
     SUNLinSolFree(linear_solver);
-    CVodeFree(&cvodes_memory_block);
+    free_integrator(integrator_memory_block);
     SUNContext_Free(&sun_context);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+
+// Everything the solver needs from a generated model. The generated system_model.cpp fills this in and exports
+// it through get_model() with C linkage, so the same struct describes a model linked into the solver and one
+// loaded from a shared object at runtime. Bump MODEL_ABI_VERSION whenever the layout changes.
+#define MODEL_ABI_VERSION 12
+
+#if defined(_WIN32)
+#define MODEL_EXPORT __declspec(dllexport)
+#else
+#define MODEL_EXPORT __attribute__((visibility("default")))
+#endif
+
+extern "C" {
+
+struct Model
+{
+    unsigned int abi_version;
+    size_t state_size;
+
+    double end_time;
+    double sample_interval;
+    double absolute_tolerance;
+    double relative_tolerance;
+    double initial_step_size;
+    double maximum_step_size;
+    double minimum_step_size;
+    double maximum_num_steps;
+    bool use_direct_solver;
+
+    void (*get_initial_state)(double* values);
+    // Absolute tolerance of every state entry, from @ABSOLUTE_TOLERANCE <state> = <value> and absolute_tolerance for
+    // the states without one. Null when absolute_tolerance applies to every state
+    void (*get_absolute_tolerances)(double* tolerances);
+    void (*derivative)(double t, double* values, double* derivatives);
+    const char* (*get_state_csv_label)();
+    const char* (*get_csv_line)(double* values);
+    // Index into the state of each state column of the csv, which follows the label rather than the @LAYOUT
+    const size_t* (*get_state_csv_order)();
+    // Jv = J v, the Jacobian of the derivative at values times v, for the Krylov solvers. Null when the model uses
+    // the dense solver, the solver then approximates it by difference quotients
+    void (*jacobian_times)(double t, double* values, double* v, double* Jv);
+    // Structural nonzeros of the Jacobian for the dense solver, as possibly repeated (row, column) pairs. Returns their
+    // number and only counts them when the arrays are null. Null without @DIRECT_LINEAR_SOLVER
+    size_t (*jacobian_pattern)(size_t* rows, size_t* columns);
+
+    // Forward sensitivities along the constants named by @SENSITIVITY, empty and null without the tag.
+    // tangents holds the sensitivity of the state to one parameter, tangent_derivatives receives its derivative
+    size_t num_sensitivities;
+    const char* const* sensitivity_names;
+    void (*get_initial_sensitivity)(int parameter, double* values, double* tangents);
+    void (*sensitivity_derivative)(int parameter, double t, double* values, double* tangents, double* tangent_derivatives);
+
+    // Gradient of the OUTPUT named by @ADJOINT at the end time with respect to every constant, null without the tag.
+    // The functions add lambda (or the objective's seed) times the derivatives they stand for to state_adjoint and
+    // constant_adjoint, propagate_constant_adjoint then folds each constant's share into the ones it's defined from
+    const char* adjoint_objective;
+    size_t num_adjoint_constants;
+    const char* const* adjoint_constant_names;
+    void (*objective_adjoint)(double* values, double* state_adjoint, double* constant_adjoint);
+    void (*initial_state_adjoint)(double* lambda, double* values, double* state_adjoint, double* constant_adjoint);
+    void (*adjoint_derivative)(double t, double* values, double* lambda, double* state_adjoint, double* constant_adjoint);
+    void (*propagate_constant_adjoint)(double* constant_adjoint);
+
+    // Root functions for CVodeRootInit, the first num_stop_roots come from @STOP_WHEN and end the solve when they
+    // cross zero, the rest come from @EVENT and are only recorded. A positive steady_state_tolerance also ends the
+    // solve once the weighted RMS norm of the derivative drops below it
+    size_t num_roots;
+    size_t num_stop_roots;
+    const char* const* root_labels;
+    void (*roots)(double t, double* values, double* g);
+    double steady_state_tolerance;
+
+    // @STEADY_STATE, solve derivative = 0 with Newton's method instead of integrating to the end time
+    bool use_steady_state_solver;
+
+    // @INTEGRATOR arkode-imex, the two halves of the derivative for ARKStep, null to integrate with CVODES.
+    // The implicit half is the one solved with Newton's method
+    void (*explicit_derivative)(double t, double* values, double* derivatives);
+    void (*implicit_derivative)(double t, double* values, double* derivatives);
+
+    // @FAST, the two partitions of the derivative for MRIStep, null to integrate with a single rate. Each leaves 0
+    // in the other's entries. The slow partition is integrated with a fixed step, 0 leaves it to the solver
+    void (*fast_derivative)(double t, double* values, double* derivatives);
+    void (*slow_derivative)(double t, double* values, double* derivatives);
+    double slow_step_size;
+
+    // Newton and linear solver controls, 0 keeps the integrator's default. Steps between Jacobian evaluations
+    // (@JAC_REUSE) and linear solver setups (@LSETUP_FREQ), the relative change of gamma forcing a setup
+    // (@DELTA_GAMMA_MAX), Newton iterations per step (@MAX_NONLINEAR_ITERS) and the highest BDF order (@MAX_ORDER).
+    // With use_adaptive_reuse (@JAC_REUSE adaptive) the solver lengthens the reuse intervals while Newton converges
+    double jacobian_reuse;
+    double linear_setup_frequency;
+    double delta_gamma_max;
+    double maximum_nonlinear_iterations;
+    double maximum_order;
+    bool use_adaptive_reuse;
+};
+
+typedef const Model* (*GetModelFunction)();
+
+// The model generated into generated/ and linked into the solver
+const Model* get_model();
+
+}
@@ -0,0 +1,180 @@
+#include "stats.h"
+
+#include <arkode/arkode_arkstep.h>
+#include <arkode/arkode_mristep.h>
+#include <cvodes/cvodes.h>
+
+void SolverCounters::query(void* cvodes_memory_block)
+{
+    // The linear solver getters fail harmlessly for counters the attached solver doesn't track
+    CVodeGetNumSteps(cvodes_memory_block, &steps);
+    CVodeGetNumRhsEvals(cvodes_memory_block, &rhs_evals);
+    CVodeGetNumLinSolvSetups(cvodes_memory_block, &linear_setups);
+    CVodeGetNumErrTestFails(cvodes_memory_block, &error_test_fails);
+    CVodeGetNumNonlinSolvIters(cvodes_memory_block, &nonlinear_iters);
+    CVodeGetNumNonlinSolvConvFails(cvodes_memory_block, &nonlinear_conv_fails);
+    CVodeGetNumJacEvals(cvodes_memory_block, &jac_evals);
+    CVodeGetNumLinRhsEvals(cvodes_memory_block, &linear_rhs_evals);
+    CVodeGetNumLinIters(cvodes_memory_block, &linear_iters);
+    CVodeGetNumLinConvFails(cvodes_memory_block, &linear_conv_fails);
+    CVodeGetNumPrecEvals(cvodes_memory_block, &prec_evals);
+    CVodeGetNumPrecSolves(cvodes_memory_block, &prec_solves);
+    CVodeGetNumJtimesEvals(cvodes_memory_block, &jtimes_evals);
+    CVodeGetSensNumRhsEvals(cvodes_memory_block, &sensitivity_rhs_evals);
+    CVodeGetNumGEvals(cvodes_memory_block, &root_evals);
+    CVodeGetLastStep(cvodes_memory_block, &last_step);
+    CVodeGetLastOrder(cvodes_memory_block, &last_order);
+}
+
+void SolverCounters::query_arkstep(void* arkstep_memory_block)
+{
+    ARKStepGetNumSteps(arkstep_memory_block, &steps);
+    ARKStepGetNumRhsEvals(arkstep_memory_block, &explicit_rhs_evals, &rhs_evals);
+    ARKStepGetNumLinSolvSetups(arkstep_memory_block, &linear_setups);
+    ARKStepGetNumErrTestFails(arkstep_memory_block, &error_test_fails);
+    ARKStepGetNumNonlinSolvIters(arkstep_memory_block, &nonlinear_iters);
+    ARKStepGetNumNonlinSolvConvFails(arkstep_memory_block, &nonlinear_conv_fails);
+    ARKStepGetNumJacEvals(arkstep_memory_block, &jac_evals);
+    ARKStepGetNumLinRhsEvals(arkstep_memory_block, &linear_rhs_evals);
+    ARKStepGetNumLinIters(arkstep_memory_block, &linear_iters);
+    ARKStepGetNumLinConvFails(arkstep_memory_block, &linear_conv_fails);
+    ARKStepGetNumPrecEvals(arkstep_memory_block, &prec_evals);
+    ARKStepGetNumPrecSolves(arkstep_memory_block, &prec_solves);
+    ARKStepGetNumGEvals(arkstep_memory_block, &root_evals);
+    ARKStepGetLastStep(arkstep_memory_block, &last_step);
+}
+
+void SolverCounters::query_mristep(void* mristep_memory_block, void* fast_memory_block)
+{
+    long unused_rhs_evals;
+    MRIStepGetNumSteps(mristep_memory_block, &steps);
+    MRIStepGetNumRhsEvals(mristep_memory_block, &explicit_rhs_evals, &rhs_evals);
+    MRIStepGetNumLinSolvSetups(mristep_memory_block, &linear_setups);
+    MRIStepGetNumNonlinSolvIters(mristep_memory_block, &nonlinear_iters);
+    MRIStepGetNumNonlinSolvConvFails(mristep_memory_block, &nonlinear_conv_fails);
+    MRIStepGetNumJacEvals(mristep_memory_block, &jac_evals);
+    MRIStepGetNumLinRhsEvals(mristep_memory_block, &linear_rhs_evals);
+    MRIStepGetNumLinIters(mristep_memory_block, &linear_iters);
+    MRIStepGetNumLinConvFails(mristep_memory_block, &linear_conv_fails);
+    MRIStepGetNumPrecEvals(mristep_memory_block, &prec_evals);
+    MRIStepGetNumPrecSolves(mristep_memory_block, &prec_solves);
+    MRIStepGetNumGEvals(mristep_memory_block, &root_evals);
+    MRIStepGetLastStep(mristep_memory_block, &last_step);
+    ARKStepGetNumSteps(fast_memory_block, &fast_steps);
+    ARKStepGetNumRhsEvals(fast_memory_block, &fast_rhs_evals, &unused_rhs_evals);
+    ARKStepGetNumErrTestFails(fast_memory_block, &error_test_fails);
+}
+
+void SolverStats::record_sample(double t, void* memory_block)
+{
+    if (!enabled) return;
+
+    SolverSample sample;
+    sample.t = t;
+    switch (integrator)
+    {
+        case Integrator::ARKSTEP:
+            sample.counters.query_arkstep(memory_block);
+            break;
+        case Integrator::MRISTEP:
+            sample.counters.query_mristep(memory_block, fast_memory_block);
+            break;
+        default:
+            sample.counters.query(memory_block);
+            break;
+    }
+    sample.timers = timers;
+    samples.push_back(sample);
+}
+
+void write_counters_json(std::ostream& out, const SolverCounters& counters, const SolverCounters& previous)
+{
+    out << "{\"steps\": " << counters.steps - previous.steps
+        << ", \"rhs_evals\": " << counters.rhs_evals - previous.rhs_evals
+        << ", \"explicit_rhs_evals\": " << counters.explicit_rhs_evals - previous.explicit_rhs_evals
+        << ", \"fast_steps\": " << counters.fast_steps - previous.fast_steps
+        << ", \"fast_rhs_evals\": " << counters.fast_rhs_evals - previous.fast_rhs_evals
+        << ", \"linear_setups\": " << counters.linear_setups - previous.linear_setups
+        << ", \"error_test_fails\": " << counters.error_test_fails - previous.error_test_fails
+        << ", \"nonlinear_iters\": " << counters.nonlinear_iters - previous.nonlinear_iters
+        << ", \"nonlinear_conv_fails\": " << counters.nonlinear_conv_fails - previous.nonlinear_conv_fails
+        << ", \"jac_evals\": " << counters.jac_evals - previous.jac_evals
+        << ", \"linear_rhs_evals\": " << counters.linear_rhs_evals - previous.linear_rhs_evals
+        << ", \"linear_iters\": " << counters.linear_iters - previous.linear_iters
+        << ", \"linear_conv_fails\": " << counters.linear_conv_fails - previous.linear_conv_fails
+        << ", \"prec_evals\": " << counters.prec_evals - previous.prec_evals
+        << ", \"prec_solves\": " << counters.prec_solves - previous.prec_solves
+        << ", \"jtimes_evals\": " << counters.jtimes_evals - previous.jtimes_evals
+        << ", \"sensitivity_rhs_evals\": " << counters.sensitivity_rhs_evals - previous.sensitivity_rhs_evals
+        << ", \"root_evals\": " << counters.root_evals - previous.root_evals
+        << ", \"last_step\": " << counters.last_step
+        << ", \"last_order\": " << counters.last_order
+        << "}";
+}
+
+void write_timer_json(std::ostream& out, const char* name, const HotPathTimer& timer, const HotPathTimer& previous)
+{
+    out << "\"" << name << "\": {\"calls\": " << timer.calls - previous.calls
+        << ", \"seconds\": " << timer.seconds - previous.seconds << "}";
+}
+
+void write_timers_json(std::ostream& out, const SolverTimers& timers, const SolverTimers& previous)
+{
+    out << "{";
+    write_timer_json(out, "derivative", timers.derivative, previous.derivative);
+    out << ", ";
+    write_timer_json(out, "explicit_derivative", timers.explicit_derivative, previous.explicit_derivative);
+    out << ", ";
+    write_timer_json(out, "fast_derivative", timers.fast_derivative, previous.fast_derivative);
+    out << ", ";
+    write_timer_json(out, "jacobian_times", timers.jacobian_times, previous.jacobian_times);
+    out << ", ";
+    write_timer_json(out, "sensitivity", timers.sensitivity, previous.sensitivity);
+    out << ", ";
+    write_timer_json(out, "adjoint", timers.adjoint, previous.adjoint);
+    out << ", ";
+    write_timer_json(out, "roots", timers.roots, previous.roots);
+    out << ", ";
+    write_timer_json(out, "linear_setup", timers.linear_setup, previous.linear_setup);
+    out << ", ";
+    write_timer_json(out, "linear_solve", timers.linear_solve, previous.linear_solve);
+    out << ", ";
+    write_timer_json(out, "preconditioner", timers.preconditioner, previous.preconditioner);
+    out << ", ";
+    write_timer_json(out, "output", timers.output, previous.output);
+    out << "}";
+}
+
+void SolverStats::write_json(std::ostream& out)
+{
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start;
+
+    // Samples report the work done since the previous sample, totals are cumulative
+    out << "{\n  \"samples\": [";
+    SolverCounters previous_counters;
+    SolverTimers previous_timers;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        out << (i != 0 ? "," : "") << "\n    {\"t\": " << samples[i].t << ", \"counters\": ";
+        write_counters_json(out, samples[i].counters, previous_counters);
+        out << ", \"timers\": ";
+        write_timers_json(out, samples[i].timers, previous_timers);
+        out << "}";
+
+        previous_counters = samples[i].counters;
+        previous_timers = samples[i].timers;
+    }
+    out << "\n  ],";
+
+    SolverCounters totals = samples.empty() ? SolverCounters() : samples.back().counters;
+    out << "\n  \"totals\": {\"counters\": ";
+    write_counters_json(out, totals, SolverCounters());
+    out << ", \"timers\": ";
+    write_timers_json(out, timers, SolverTimers());
+    out << "},";
+
+    out << "\n  \"jacobian_colors\": " << jacobian_colors << ",";
+    out << "\n  \"wall_seconds\": " << wall_time.count() << ",";
+    out << "\n  \"error_flag\": " << error_flag;
+    out << "\n}\n";
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct HotPathTimer
+{
+    long calls = 0;
+    double seconds = 0.0;
+};
+
+// Adds the lifetime of the scope to a timer. A null timer skips the clock reads entirely,
+// so wrapped callbacks cost nothing extra when --stats isn't given.
+class ScopedTimer
+{
+public:
+    ScopedTimer(HotPathTimer* timer)
+        : timer(timer)
+    {
+        if (timer) start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer()
+    {
+        if (!timer) return;
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        timer->calls += 1;
+        timer->seconds += elapsed.count();
+    }
+
+private:
+    HotPathTimer* timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+// The SUNDIALS integrator whose memory blocks are handed to SolverStats
+enum class Integrator
+{
+    CVODES,
+    ARKSTEP, // @INTEGRATOR arkode-imex
+    MRISTEP  // @FAST
+};
+
+struct SolverCounters
+{
+    long steps = 0;
+    long rhs_evals = 0;
+    long explicit_rhs_evals = 0;
+    long fast_steps = 0;
+    long fast_rhs_evals = 0;
+    long linear_setups = 0;
+    long error_test_fails = 0;
+    long nonlinear_iters = 0;
+    long nonlinear_conv_fails = 0;
+    long jac_evals = 0;
+    long linear_rhs_evals = 0;
+    long linear_iters = 0;
+    long linear_conv_fails = 0;
+    long prec_evals = 0;
+    long prec_solves = 0;
+    long jtimes_evals = 0;
+    long sensitivity_rhs_evals = 0;
+    long root_evals = 0;
+    double last_step = 0.0;
+    int last_order = 0;
+
+    void query(void* cvodes_memory_block);
+    // ARKODE counts its implicit derivative calls as rhs_evals, it has no variable order
+    void query_arkstep(void* arkstep_memory_block);
+    // The steps and derivative calls of the inner fast integrator are counted separately
+    void query_mristep(void* mristep_memory_block, void* fast_memory_block);
+};
+
+struct SolverTimers
+{
+    HotPathTimer derivative;
+    HotPathTimer explicit_derivative;
+    HotPathTimer fast_derivative;
+    HotPathTimer jacobian_times;
+    HotPathTimer sensitivity;
+    HotPathTimer adjoint;
+    HotPathTimer roots;
+    HotPathTimer linear_setup;
+    HotPathTimer linear_solve;
+    HotPathTimer preconditioner;
+    HotPathTimer output;
+};
+
+struct SolverSample
+{
+    double t;
+    SolverCounters counters;
+    SolverTimers timers;
+};
+
+struct SolverStats
+{
+    bool enabled = false;
+    SolverTimers timers;
+    std::vector<SolverSample> samples;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int error_flag = 0;
+    Integrator integrator = Integrator::CVODES;
+    void* fast_memory_block = nullptr; // MRIStep's inner ARKStep
+    size_t jacobian_colors = 0; // Derivative calls per compressed Jacobian, 0 without a pattern
+
+    HotPathTimer* timer(HotPathTimer SolverTimers::* member)
+    {
+        return enabled ? &(timers.*member) : nullptr;
+    }
+
+    void record_sample(double t, void* memory_block);
+    void write_json(std::ostream& out);
+};
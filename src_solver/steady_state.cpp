@@ -0,0 +1,135 @@
+#include "steady_state.h"
+
+#include <cmath>
+#include <vector>
+
+#include <kinsol/kinsol.h>
+#include <sunlinsol/sunlinsol_dense.h>
+#include <sunlinsol/sunlinsol_spgmr.h>
+#include <sunmatrix/sunmatrix_dense.h>
+
+struct NewtonProblem
+{
+    const Model* model;
+    std::vector<double> guess;
+    std::vector<bool> frozen;
+    HotPathTimer* derivative_timer;
+};
+
+static int steady_state_residual(N_Vector u, N_Vector f, void* user_data)
+{
+    auto problem = (NewtonProblem*)user_data;
+    double* values = N_VGetArrayPointer(u);
+    double* residuals = N_VGetArrayPointer(f);
+    {
+        ScopedTimer timer(problem->derivative_timer);
+        problem->model->derivative(0, values, residuals);
+    }
+    for (size_t i = 0; i < problem->guess.size(); ++i)
+    {
+        if (problem->frozen[i]) residuals[i] = values[i] - problem->guess[i];
+    }
+    return 0;
+}
+
+// The residual of a held state is its distance to the guess, so its row of the Jacobian is the identity
+static int steady_state_jacobian_times(N_Vector v, N_Vector Jv, N_Vector u, sunbooleantype* new_u, void* user_data)
+{
+    auto problem = (NewtonProblem*)user_data;
+    double* directions = N_VGetArrayPointer(v);
+    double* products = N_VGetArrayPointer(Jv);
+    problem->model->jacobian_times(0, N_VGetArrayPointer(u), directions, products);
+    for (size_t i = 0; i < problem->guess.size(); ++i)
+    {
+        if (problem->frozen[i]) products[i] = directions[i];
+    }
+    return 0;
+}
+
+// A row of the derivative which doesn't move under two perturbations of every entry is taken as state independent
+static std::vector<bool> find_frozen_states(const Model* model, std::vector<double> guess, double absolute_tolerance)
+{
+    size_t state_size = guess.size();
+    std::vector<double> derivative(state_size), perturbed(state_size), perturbed_derivative(state_size);
+    std::vector<bool> frozen(state_size, true);
+    model->derivative(0, guess.data(), derivative.data());
+    for (int probe = 1; probe <= 2; ++probe)
+    {
+        for (size_t i = 0; i < state_size; ++i)
+        {
+            perturbed[i] = guess[i] + 1e-4 * std::sin(probe * (i + 1.0)) * (std::fabs(guess[i]) + absolute_tolerance);
+        }
+        model->derivative(0, perturbed.data(), perturbed_derivative.data());
+        for (size_t i = 0; i < state_size; ++i)
+        {
+            if (perturbed_derivative[i] != derivative[i]) frozen[i] = false;
+        }
+    }
+    return frozen;
+}
+
+bool solve_newton_steady_state(const Model* model, N_Vector state, SUNContext sun_context, HotPathTimer* derivative_timer)
+{
+    size_t state_size = model->state_size;
+    double tolerance = model->steady_state_tolerance > 0 ? model->steady_state_tolerance : DEFAULT_STEADY_STATE_TOLERANCE;
+    double* values = N_VGetArrayPointer(state);
+
+    NewtonProblem problem;
+    problem.model = model;
+    problem.guess.assign(values, values + state_size);
+    problem.frozen = find_frozen_states(model, problem.guess, model->absolute_tolerance);
+    problem.derivative_timer = derivative_timer;
+
+    N_Vector solution = N_VClone(state);
+    N_Vector scale = N_VClone(state);
+    N_Vector residual = N_VClone(state);
+    N_VScale(1.0, state, solution);
+    double* weights = N_VGetArrayPointer(scale);
+    std::vector<double> absolute_tolerances(state_size, model->absolute_tolerance);
+    if (model->get_absolute_tolerances) model->get_absolute_tolerances(absolute_tolerances.data());
+    for (size_t i = 0; i < state_size; ++i)
+    {
+        weights[i] = 1.0 / (model->relative_tolerance * std::fabs(values[i]) + absolute_tolerances[i]);
+    }
+
+    // Newton with a line search, the matrix is set up again on every iteration unless @JAC_REUSE spaces the setups
+    SUNMatrix A = NULL;
+    SUNLinearSolver linear_solver;
+    void* kinsol_memory_block = KINCreate(sun_context);
+    KINInit(kinsol_memory_block, steady_state_residual, solution);
+    KINSetUserData(kinsol_memory_block, &problem);
+    if (model->use_direct_solver)
+    {
+        A = SUNDenseMatrix(state_size, state_size, sun_context);
+        linear_solver = SUNLinSol_Dense(solution, A, sun_context);
+    }
+    else
+    {
+        linear_solver = SUNLinSol_SPGMR(solution, SUN_PREC_NONE, 0, sun_context);
+    }
+    KINSetLinearSolver(kinsol_memory_block, linear_solver, A);
+    if (!model->use_direct_solver && model->jacobian_times) KINSetJacTimesVecFn(kinsol_memory_block, steady_state_jacobian_times);
+    KINSetMaxSetupCalls(kinsol_memory_block, model->jacobian_reuse > 0 ? (long)model->jacobian_reuse : 1);
+    KINSetFuncNormTol(kinsol_memory_block, tolerance);
+    bool converged = KINSol(kinsol_memory_block, solution, KIN_LINESEARCH, scale, scale) >= 0;
+
+    // KINSOL also returns when its steps stall, and a held state only converges if its derivative is really 0
+    if (converged)
+    {
+        model->derivative(0, N_VGetArrayPointer(solution), N_VGetArrayPointer(residual));
+        double* residuals = N_VGetArrayPointer(residual);
+        for (size_t i = 0; i < state_size; ++i)
+        {
+            if (std::fabs(residuals[i]) * weights[i] > tolerance) converged = false;
+        }
+    }
+    if (converged) N_VScale(1.0, solution, state);
+
+    KINFree(&kinsol_memory_block);
+    SUNLinSolFree(linear_solver);
+    if (A) SUNMatDestroy(A);
+    N_VDestroy(residual);
+    N_VDestroy(scale);
+    N_VDestroy(solution);
+    return converged;
+}
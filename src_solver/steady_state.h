@@ -0,0 +1,14 @@
+#pragma once
+
+#include <nvector/nvector_serial.h>
+
+#include "model.h"
+#include "stats.h"
+
+// Residual norm a steady state has to reach when the model doesn't set @STOP_AT_STEADY_STATE
+const double DEFAULT_STEADY_STATE_TOLERANCE = 1e-6;
+
+// Solves derivative(state) = 0 with KINSOL's Newton iteration starting from state, which is only overwritten when it
+// converges. Residuals are weighted like CVODES' error test. A state whose derivative doesn't depend on the state
+// (d/dt X = 0) is held at its value in the guess, which keeps the Newton matrix nonsingular
+bool solve_newton_steady_state(const Model* model, N_Vector state, SUNContext sun_context, HotPathTimer* derivative_timer);
@@ -1,10 +1,65 @@
+#include <algorithm>
 #include <string>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
 
 #include <gtest/gtest.h>
 
 #include "../src_generator/tokenize.h"
 #include "../src_generator/parse.h"
+#include "../src_generator/generator.h"
+#include "../src_generator/bytecode.h"
+#include "../src_generator/sensitivity.h"
+#include "../src_generator/adjoint.h"
+#include "../src_generator/imex.h"
+#include "../src_generator/multirate.h"
+#include "../src_generator/layout.h"
+#include "../src_generator/schedule.h"
+#include "../src_generator/pattern.h"
+#include "../src_generator/scaling.h"
+#include "../src_solver/coloring.h"
+#include "../src_solver/interpreter.h"
+#include "../src_solver/jit.h"
+
+// Generated files by name
+std::map<std::string, std::string> file_contents(const std::vector<GeneratedFile>& files)
+{
+    std::map<std::string, std::string> contents;
+    for (auto& file : files)
+    {
+        contents[file.filename] = file.contents;
+    }
+    return contents;
+}
+
+// Writes a model file for the loaders of `solver --model`
+std::string write_model(const std::string& name, const std::string& source)
+{
+    std::string filename = (std::filesystem::temp_directory_path() / ("test_model_" + name + ".txt")).string();
+    std::ofstream(filename) << source;
+    return filename;
+}
+
+// Compiles a model the way `solver --model` does, for checks on the numbers the generated code computes
+const Model* compile_model(const std::string& name, const std::string& source)
+{
+    ModelCompiler compiler;
+    return compiler.load(write_model(name, source));
+}
+
+// Nonlinear in the state through products, a division, EXP, a function and a summation, with a list override
+const std::string NONLINEAR_MODEL =
+    "n = 1 .. 5\n"
+    "k = 2\n"
+    "rate(m) = k * m\n"
+    "total = SUM(i = 1 .. 5, C[i] * C[i])\n"
+    "d/dt A = -k * A * A + total\n"
+    "d/dt C[n] = rate(n) * C[n + 1] * A - C[n] * C[n] / (1 + A) + EXP(-A)\n"
+    "d/dt C[5] = -A * C[5]\n"
+    "INITIAL A = 0.5\n"
+    "INITIAL C[n] = 0.1 * n\n";
 
 
 TEST(Tokenize, DerivativeTokens) 
@@ -402,4 +457,914 @@ TEST(Generate, StateDefinition)
     
     EXPECT_TRUE(system.state_variables.size() == 1);
     ASSERT_EQ(system.state_variables[0].rhs->generate(system), "((1) - (values[INDEX_C_START + ((n) - 1)]))");
-}
\ No newline at end of file
+}
+
+TEST(Parse, TagProfile)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@PROFILE");
+
+    EXPECT_TRUE(system.use_profiler);
+}
+
+TEST(Parse, TagSteadyState)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@STOP_AT_STEADY_STATE 10^-4");
+    EXPECT_FALSE(system.use_steady_state_solver);
+
+    parse_declaration(system, "@STEADY_STATE");
+    EXPECT_TRUE(system.use_steady_state_solver);
+    EXPECT_EQ(system.steady_state_tolerance, "std::pow(10, -(4))");
+}
+
+TEST(Parse, TagNewtonControls)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@JAC_REUSE 100");
+    parse_declaration(system, "@LSETUP_FREQ 40");
+    parse_declaration(system, "@DELTA_GAMMA_MAX 0.5");
+    parse_declaration(system, "@MAX_NONLINEAR_ITERS 5");
+    parse_declaration(system, "@MAX_ORDER 2");
+    EXPECT_EQ(system.jacobian_reuse, "100");
+    EXPECT_EQ(system.linear_setup_frequency, "40");
+    EXPECT_EQ(system.max_nonlinear_iterations, "5");
+    EXPECT_EQ(system.max_order, "2");
+    EXPECT_FALSE(system.use_adaptive_reuse);
+    EXPECT_NE(generate_meta(system).find("const double maximum_order = 2;"), std::string::npos);
+
+    // adaptive keeps the last number of steps as the starting point
+    parse_declaration(system, "@JAC_REUSE adaptive");
+    EXPECT_TRUE(system.use_adaptive_reuse);
+    EXPECT_EQ(system.jacobian_reuse, "100");
+}
+
+TEST(Generate, AbsoluteTolerances)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = -C[n]");
+    parse_declaration(system, "d/dt Rho = 0");
+    parse_declaration(system, "@ABSOLUTE_TOLERANCE 10");
+    EXPECT_FALSE(has_absolute_tolerances(system));
+
+    parse_declaration(system, "@ABSOLUTE_TOLERANCE C[n] = 10^-20 * n");
+    parse_declaration(system, "@ABSOLUTE_TOLERANCE C[1] = 1");
+    parse_declaration(system, "@ABSOLUTE_TOLERANCE Rho = 10^8");
+    ASSERT_TRUE(has_absolute_tolerances(system));
+    EXPECT_EQ(system.abstol, "10");
+
+    // Everything starts at the global tolerance, the list entry's override comes after the list
+    std::string setter = generate_absolute_tolerance_setter(system);
+    EXPECT_NE(setter.find("values[i] = absolute_tolerance;"), std::string::npos);
+    EXPECT_NE(setter.find("values[INDEX_C_START + ((n) - 1)] = ((std::pow(10, -(20))) * (n));"), std::string::npos);
+    EXPECT_NE(setter.find("values[INDEX_Rho] = std::pow(10, 8);"), std::string::npos);
+    EXPECT_GT(setter.find("values[INDEX_C_START + (size_t)(1 - 1)] = 1;"), setter.find("values[INDEX_Rho]"));
+}
+
+TEST(Generate, StateScaling)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = -C[n]");
+    parse_declaration(system, "d/dt Rho = 0");
+    parse_declaration(system, "INITIAL C[n] = 10^5 * n");
+    parse_declaration(system, "INITIAL Rho = 0");
+    EXPECT_FALSE(has_state_scaling(system));
+
+    parse_declaration(system, "@SCALE auto");
+    parse_declaration(system, "@SCALE Rho = 10^10");
+    ASSERT_TRUE(has_state_scaling(system));
+
+    // A given scale replaces the estimate from the initial state
+    std::string setter = generate_state_scale_setter(system);
+    EXPECT_NE(setter.find("if (std::fabs(initial[INDEX_C_START + ((n) - 1)]) > largest)"), std::string::npos);
+    EXPECT_GT(setter.find("values[INDEX_Rho] = std::pow(10, 10);"), setter.find("values[INDEX_Rho] = initial[INDEX_Rho]"));
+    EXPECT_NE(setter.find("if (!(values[i] > 0 && std::isfinite(values[i]))) values[i] = 1;"), std::string::npos);
+
+    // The state is divided by its scale
+    parse_declaration(system, "@SCALE C[2] = 0");
+    parse_declaration(system, "@SCALE C[3] = -10^5");
+    EXPECT_EQ(system.state_scales.size(), 1);
+
+    // Every entry of the Model works on the scaled state, tolerances included
+    auto contents = file_contents(generate_sources(system));
+    auto& model = contents["system_model.cpp"];
+    EXPECT_NE(model.find("get_state_scale(state_scale);"), std::string::npos);
+    EXPECT_NE(model.find("\t\tscaled_get_initial_state,\n\t\tscaled_get_absolute_tolerances,\n\t\tscaled_derivative<model_derivative>,"), std::string::npos);
+    EXPECT_NE(model.find("scaled_jacobian_times,"), std::string::npos);
+
+    parse_declaration(system, "k = 2");
+    parse_declaration(system, "@SENSITIVITY k");
+    EXPECT_FALSE(has_state_scaling(system));
+}
+
+TEST(Generate, ProfileScopes)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@PROFILE");
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = k(n) * C[n]");
+    parse_declaration(system, "k(n) = 2 * n");
+
+    std::string functions = generate_function_definitions(system);
+    std::string derivative = generate_derivative(system);
+
+    ASSERT_EQ(system.profile_labels.size(), 3);
+    EXPECT_EQ(system.profile_labels[0], "k");
+    EXPECT_EQ(system.profile_labels[1], "derivative");
+    EXPECT_EQ(system.profile_labels[2], "d/dt C[n]");
+    EXPECT_NE(functions.find("ProfileScope __profile(profile_table[0]);"), std::string::npos);
+    EXPECT_NE(generate_profiler_report(system).find("{\"d/dt C[n]\", 0, 0}"), std::string::npos);
+}
+
+TEST(Generate, NoProfileScopesWithoutTag)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = k(n) * C[n]");
+    parse_declaration(system, "k(n) = 2 * n");
+
+    EXPECT_EQ(generate_function_definitions(system).find("ProfileScope"), std::string::npos);
+    EXPECT_EQ(generate_derivative(system).find("ProfileScope"), std::string::npos);
+    EXPECT_EQ(generate_profiler_runtime(system), "");
+    EXPECT_EQ(generate_profiler_report(system), "");
+}
+
+TEST(Parse, StateLookupPrefersCatchall)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[1] = 0.0");
+    parse_declaration(system, "d/dt C[n] = C[n]");
+
+    ASSERT_EQ(system.state_variables.size(), 2);
+    auto state_variable = system.find_state_variable(Symbol("C"));
+    ASSERT_NE(state_variable, nullptr);
+    EXPECT_EQ(state_variable->symbol.parameters[0].type, ParameterType::VARIABLE);
+    EXPECT_EQ(system.resolve_symbol_type(Symbol("C")), SymbolType::STATE);
+}
+
+TEST(Generate, ShardedSources)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt A = f(A) - A");
+    parse_declaration(system, "d/dt B = g(B) - B");
+    parse_declaration(system, "d/dt C[n] = n * C[n]");
+    parse_declaration(system, "f(x) = 2 * x");
+    parse_declaration(system, "g(x) = 3 * x");
+
+    auto files = generate_sources(system, 1);
+
+    auto contents = file_contents(files);
+    ASSERT_EQ(files[0].filename, "system.h");
+    EXPECT_NE(contents["system.h"].find("constexpr size_t INDEX_C_START = INDEX_B + 1;"), std::string::npos);
+    EXPECT_NE(contents["system.h"].find("void derivative_chunk_2(double* values, double* derivatives);"), std::string::npos);
+    EXPECT_EQ(contents.count("system_functions_0.cpp"), 1);
+    EXPECT_EQ(contents.count("system_functions_1.cpp"), 1);
+    EXPECT_NE(contents["system.h"].find("constexpr size_t STATE_SIZE ="), std::string::npos);
+    EXPECT_NE(contents["system_derivative.cpp"].find("derivative_chunk_2(values, derivatives);"), std::string::npos);
+    EXPECT_NE(contents["system_derivative_chunk_2.cpp"].find("for (size_t n = RANGE_n_START; n <= RANGE_n_END; ++n)"), std::string::npos);
+    EXPECT_NE(contents["system_model.cpp"].find("extern \"C\" MODEL_EXPORT const Model* get_model()"), std::string::npos);
+    EXPECT_EQ(contents["system.h"].find("N_Vector"), std::string::npos);
+}
+
+TEST(Generate, ConstexprRanges)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "N = 4");
+    parse_declaration(system, "M = 2 * N - 1");
+    parse_declaration(system, "E = EXP(1)");
+    parse_declaration(system, "n = 1 .. M");
+    parse_declaration(system, "m = 1 .. E");
+    parse_declaration(system, "d/dt C[n] = C[n]");
+    find_constexpr_constants(system);
+
+    // Constants of literals and constexpr constants are folded, the range over them gets constexpr bounds
+    std::string declarations = generate_constant_declarations(system);
+    EXPECT_NE(declarations.find("constexpr double M = ((((2) * (N))) - (1));"), std::string::npos);
+    EXPECT_NE(declarations.find("extern double E;"), std::string::npos);
+    EXPECT_EQ(generate_constant_definitions(system).find(" N = "), std::string::npos);
+    EXPECT_NE(generate_range_constants(system).find("constexpr size_t RANGE_n_END = M;"), std::string::npos);
+    EXPECT_EQ(generate_range_constants(system).find("RANGE_m"), std::string::npos);
+    EXPECT_TRUE(system.constexpr_indices);
+    EXPECT_NE(generate_state_indices(system).find("constexpr size_t INDEX_C_SIZE = RANGE_n_SIZE;"), std::string::npos);
+
+    // A list over a range known only at runtime keeps every index a runtime constant
+    parse_declaration(system, "d/dt D[m] = D[m]");
+    find_constexpr_constants(system);
+    EXPECT_FALSE(system.constexpr_indices);
+    EXPECT_EQ(generate_range_size(system, "m"), "(E - 1 + 1)");
+}
+
+TEST(Generate, FunctionTables)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "d/dt C[n] = a(n + 1) * C[n + 1] - b(n) * C[n] + f(n)");
+    parse_declaration(system, "a(n) = EXP(-n) + r(n)");
+    parse_declaration(system, "r(n) = SQRT(n)");
+    parse_declaration(system, "b(n) = a(n) * C[1]");
+    parse_declaration(system, "f(1) = 1");
+    parse_declaration(system, "f(n) = 2 * f(n - 1)");
+
+    std::string blocks;
+    for (auto& block : generate_derivative_blocks(system))
+    {
+        blocks += block;
+    }
+    EXPECT_NE(blocks.find("a_table[(((n) + (1)))]"), std::string::npos);
+    EXPECT_NE(blocks.find("b((n), values)"), std::string::npos);
+    EXPECT_NE(blocks.find("f((n))"), std::string::npos); // Recursive, never tabulated
+
+    // Function parameters are doubles, so calls inside function bodies take the checked lookup
+    EXPECT_NE(generate_function_definitions(system).find("r_table((n))"), std::string::npos);
+    EXPECT_NE(generate_function_tables(system).find("FunctionTable<a> a_table(FUNCTION_TABLE_FIRST, FUNCTION_TABLE_LAST);"), std::string::npos);
+    EXPECT_EQ(generate_function_tables(system).find("b_table"), std::string::npos);
+}
+
+TEST(Generate, MixedPrecision)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@PRECISION mixed");
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "d/dt C[n] = k(n) * C[n] * 0.5 + C[1] / 2");
+    parse_declaration(system, "k(n) = SQRT(n) * C[1]");
+    ASSERT_EQ(system.precision, Precision::MIXED);
+
+    std::string blocks;
+    for (auto& block : generate_derivative_blocks(system))
+    {
+        blocks += block;
+    }
+    EXPECT_NE(blocks.find("((float)values[INDEX_C_START + ((n) - 1)])"), std::string::npos);
+    EXPECT_NE(blocks.find("0.5f"), std::string::npos);
+    EXPECT_NE(blocks.find("/ (2)"), std::string::npos); // Whole numbers stay int literals
+    EXPECT_NE(generate_function_definitions(system).find("float k(float n, double* values)"), std::string::npos);
+    EXPECT_NE(generate_function_definitions(system).find("std::sqrt((float)(n))"), std::string::npos);
+}
+
+TEST(Generate, SensitivityTangents)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@SENSITIVITY k");
+    parse_declaration(system, "k = 2");
+    parse_declaration(system, "d/dt X = -k * X");
+    parse_declaration(system, "INITIAL X = k");
+    ASSERT_TRUE(has_sensitivities(system));
+
+    std::string blocks;
+    for (auto& block : generate_derivative_blocks(system, DerivativeMode::TANGENT))
+    {
+        blocks += block;
+    }
+    EXPECT_NE(blocks.find("tangent_derivatives[INDEX_X] = -(((((values[INDEX_X]) * (k_tangent[parameter]))) + (((k) * (tangents[INDEX_X])))))"), std::string::npos);
+    EXPECT_NE(generate_initial_state_setter(system, DerivativeMode::TANGENT).find("tangents[INDEX_X] = k_tangent[parameter];"), std::string::npos);
+    EXPECT_NE(generate_constant_tangents(system).find("k_tangent[parameter] = parameter == 0 ? 1.0 : 0.0;"), std::string::npos);
+
+    parse_declaration(system, "@PRECISION mixed");
+    EXPECT_FALSE(has_sensitivities(system));
+}
+
+TEST(Generate, JacobianTimes)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "k = 2");
+    parse_declaration(system, "rate(m) = k * m");
+    parse_declaration(system, "square(x) = x * x");
+    parse_declaration(system, "d/dt A = k * square(2 * A)");
+    parse_declaration(system, "d/dt C[n] = rate(n) * C[n]");
+    ASSERT_TRUE(has_jacobian_times(system));
+
+    auto contents = file_contents(generate_sources(system));
+    auto& product = contents["system_jacobian_times_chunk_0.cpp"];
+    EXPECT_NE(product.find("tangent_derivatives[INDEX_A] = ((k) * (square_state_tangent((((2) * (values[INDEX_A]))), ((2) * (tangents[INDEX_A])), values, tangents)))"), std::string::npos);
+    EXPECT_NE(product.find("tangent_derivatives[INDEX_C_START + ((n) - 1)] = ((rate_table[(n)]) * (tangents[INDEX_C_START + ((n) - 1)]))"), std::string::npos);
+    EXPECT_EQ(product.find("k_tangent"), std::string::npos);
+    EXPECT_NE(contents["system_state_tangents.cpp"].find("if (d_m == 0) return 0;"), std::string::npos);
+    EXPECT_NE(contents["system_model.cpp"].find("model_jacobian_times,"), std::string::npos);
+
+    parse_declaration(system, "@DIRECT_LINEAR_SOLVER");
+    EXPECT_FALSE(has_jacobian_times(system));
+}
+
+TEST(Generate, AdjointTransposedProducts)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@ADJOINT final");
+    parse_declaration(system, "k = 2");
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = -k * C[n]");
+    parse_declaration(system, "d/dt C[1] = k");
+    parse_declaration(system, "OUTPUT final C[2] * C[3]");
+    ASSERT_TRUE(has_adjoint(system));
+
+    // The override runs first and consumes its seed, so the list loop skips that entry
+    auto blocks = generate_derivative_blocks(system, DerivativeMode::ADJOINT);
+    ASSERT_EQ(blocks.size(), 2);
+    EXPECT_NE(blocks[0].find("constant_adjoint[ADJOINT_k] += seeds[INDEX_C_START + (size_t)(1 - 1)];"), std::string::npos);
+    EXPECT_NE(blocks[0].find("seeds[INDEX_C_START + (size_t)(1 - 1)] = 0.0;"), std::string::npos);
+    EXPECT_NE(blocks[1].find("if (seeds[INDEX_C_START + ((n) - 1)] != 0.0)"), std::string::npos);
+    EXPECT_NE(blocks[1].find("state_adjoint[INDEX_C_START + ((n) - 1)] += adjoint_0 * (k);"), std::string::npos);
+    EXPECT_NE(generate_objective_adjoint(system).find("state_adjoint[INDEX_C_START + ((2) - 1)] += adjoint_0 * (values[INDEX_C_START + ((3) - 1)]);"), std::string::npos);
+
+    parse_declaration(system, "@ADJOINT missing");
+    EXPECT_FALSE(has_adjoint(system));
+}
+
+TEST(Generate, RootFunctions)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@EVENT X - 2");
+    parse_declaration(system, "@STOP_WHEN X - 3");
+    parse_declaration(system, "d/dt X = 1");
+    ASSERT_TRUE(has_roots(system));
+
+    // Stop conditions come first whatever order they're declared in
+    auto roots = generate_root_function(system);
+    EXPECT_NE(roots.find("const size_t NUM_STOP_ROOTS = 1;"), std::string::npos);
+    EXPECT_NE(roots.find("const char* const ROOT_LABELS[] = { \"stop_when_1\", \"event_1\" };"), std::string::npos);
+    EXPECT_NE(roots.find("g[0] = ((values[INDEX_X]) - (3));"), std::string::npos);
+    EXPECT_NE(roots.find("g[1] = ((values[INDEX_X]) - (2));"), std::string::npos);
+
+    // The interpreter stores root values behind the outputs, which the csv line must not print
+    parse_declaration(system, "INITIAL X = 0.5");
+    parse_declaration(system, "OUTPUT twice 2 * X");
+    Interpreter interpreter(lower_system(system));
+    std::vector<double> values(1), g(2);
+    interpreter.get_initial_state(values.data());
+    interpreter.roots(values.data(), g.data());
+    EXPECT_EQ(g, std::vector<double>({ -2.5, -1.5 }));
+    EXPECT_EQ(interpreter.get_csv_line(values.data()), ", 0.5, 1");
+}
+
+TEST(Generate, ImexSplit)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@INTEGRATOR arkode-imex");
+    parse_declaration(system, "d/dt X = -(5 * X) - EXPLICIT(2 * Y)");
+    parse_declaration(system, "d/dt Y = X");
+    ASSERT_TRUE(check_imex(system));
+
+    // Each half keeps the sign its terms have in the equation and they sum back to the derivative
+    auto explicit_blocks = generate_derivative_blocks(system, DerivativeMode::EXPLICIT);
+    auto implicit_blocks = generate_derivative_blocks(system, DerivativeMode::IMPLICIT);
+    ASSERT_GE(explicit_blocks.size(), 2);
+    ASSERT_GE(implicit_blocks.size(), 2);
+    EXPECT_NE(explicit_blocks[0].find("derivatives[INDEX_X] = -(((2) * (values[INDEX_Y])));"), std::string::npos);
+    EXPECT_NE(explicit_blocks[1].find("derivatives[INDEX_Y] = 0;"), std::string::npos);
+    EXPECT_NE(implicit_blocks[0].find("derivatives[INDEX_X] = ((-(((5) * (values[INDEX_X])))) - (0));"), std::string::npos);
+    EXPECT_NE(implicit_blocks[1].find("derivatives[INDEX_Y] = values[INDEX_X];"), std::string::npos);
+    EXPECT_NE(generate_derivative_blocks(system)[0].find("(2) * (values[INDEX_Y])"), std::string::npos);
+
+    // Outputs are evaluated whole, so they can't be split
+    parse_declaration(system, "OUTPUT split EXPLICIT(X)");
+    EXPECT_FALSE(check_imex(system));
+}
+
+TEST(Generate, MultirateSplit)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@FAST C[1 .. 2], X");
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "d/dt C[n] = -C[n]");
+    parse_declaration(system, "d/dt C[1] = X");
+    parse_declaration(system, "d/dt X = 2");
+    ASSERT_EQ(system.fast_states.size(), 2);
+    ASSERT_TRUE(check_multirate(system));
+
+    // The fast derivative only runs the fast part of the list, and the override when its index is in range
+    std::string fast;
+    for (auto& block : generate_derivative_blocks(system, DerivativeMode::FAST)) fast += block;
+    EXPECT_NE(fast.find("std::fill(derivatives, derivatives + STATE_SIZE, 0);"), std::string::npos);
+    EXPECT_NE(fast.find("for (size_t n = std::max<size_t>(RANGE_n_START, 1); n <= std::min<size_t>(RANGE_n_END, 2); ++n)"), std::string::npos);
+    EXPECT_NE(fast.find("if (1 >= 1 && 1 <= 2)"), std::string::npos);
+    EXPECT_NE(fast.find("derivatives[INDEX_X] = 2;"), std::string::npos);
+
+    // The slow derivative is the whole derivative with the fast entries zeroed last
+    std::string slow;
+    for (auto& block : generate_derivative_blocks(system, DerivativeMode::SLOW)) slow += block;
+    EXPECT_LT(slow.find("derivatives[INDEX_C_START + (size_t)(1 - 1)] = values[INDEX_X];"), slow.find("derivatives[INDEX_X] = 0;"));
+    EXPECT_NE(slow.find("derivatives[INDEX_C_START + i - 1] = 0;"), std::string::npos);
+
+    parse_declaration(system, "@FAST Y");
+    EXPECT_FALSE(check_multirate(system));
+}
+
+TEST(Generate, ListLayouts)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@LAYOUT interleaved A, B");
+    parse_declaration(system, "@LAYOUT row_major W");
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "m = 1 .. 3");
+    parse_declaration(system, "k = 1 .. 2");
+    parse_declaration(system, "d/dt A[n] = B[n] - A[n]");
+    parse_declaration(system, "d/dt B[n] = A[n]");
+    parse_declaration(system, "d/dt V[n, m, k] = V[n, m, k]");
+    parse_declaration(system, "d/dt W[n, m] = W[n, m]");
+    ASSERT_TRUE(check_layouts(system));
+
+    // Interleaved lists share one block, the lists after it start behind the whole group
+    std::string indices = generate_state_indices(system);
+    EXPECT_NE(indices.find("const size_t INDEX_B_START = INDEX_A_START + 1;"), std::string::npos);
+    EXPECT_NE(indices.find("const size_t INDEX_V_START = INDEX_A_START + 2 * INDEX_A_SIZE;"), std::string::npos);
+    system.bound_parameters = { { "n", true }, { "m", true }, { "k", true } };
+    EXPECT_EQ(system.state_variables[1].rhs->generate(system), "values[INDEX_A_START + 2 * (((n) - 1))]");
+
+    // Every index steps over all the entries of the faster ones, the last index is the fastest in row major order
+    EXPECT_EQ(system.state_variables[2].rhs->generate(system),
+              "values[INDEX_V_START + ((n) - 1) + RANGE_n_SIZE * (((m) - 1)) + RANGE_n_SIZE * RANGE_m_SIZE * (((k) - 1))]");
+    EXPECT_EQ(system.state_variables[3].rhs->generate(system), "values[INDEX_W_START + ((m) - 1) + RANGE_m_SIZE * (((n) - 1))]");
+
+    // The csv keeps its order whatever the layout
+    std::string csv = generate_csv_getters(system);
+    EXPECT_NE(csv.find("order.push_back(INDEX_B_START + 2 * (((n) - 1)));"), std::string::npos);
+    EXPECT_NE(csv.find("str << \", \" << values[order[i]];"), std::string::npos);
+
+    // Tiled lists index through the runtime, grouping lists over different ranges falls back to separate lists
+    parse_declaration(system, "@LAYOUT tiled 2 A, B");
+    EXPECT_NE(generate_layout_runtime(system).find("constexpr size_t tiled_index("), std::string::npos);
+    EXPECT_EQ(generate_list_index(system, "B", "i"), "INDEX_A_START + tiled_index(i, INDEX_B_SIZE, 1, 2, 2)");
+    parse_declaration(system, "@LAYOUT interleaved A, W");
+    EXPECT_FALSE(check_layouts(system));
+    EXPECT_EQ(generate_list_index(system, "A", "i"), "INDEX_A_START + i");
+}
+
+TEST(Generate, StateView)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@LAYOUT interleaved A, B");
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "m = 1 .. 3");
+    parse_declaration(system, "d/dt A[n] = -A[n]");
+    parse_declaration(system, "d/dt A[1] = 0");
+    parse_declaration(system, "d/dt B[n] = A[n]");
+    parse_declaration(system, "d/dt T[n, m] = T[n, m]");
+    parse_declaration(system, "d/dt X = 1");
+
+    // Accessors index like the generated code, separate lists also hand out their block
+    std::string view = generate_state_view(system);
+    EXPECT_NE(view.find("Real& A(size_t n) const { return values[INDEX_A_START + 2 * (((n) - 1))]; }"), std::string::npos);
+    EXPECT_EQ(view.find("A_data()"), std::string::npos);
+    EXPECT_NE(view.find("Real& T(size_t n, size_t m) const { return values[INDEX_T_START + ((n) - 1) + RANGE_n_SIZE * (((m) - 1))]; }"), std::string::npos);
+    EXPECT_NE(view.find("Real* T_data() const { return values + INDEX_T_START; }"), std::string::npos);
+    EXPECT_NE(view.find("Real& X() const { return values[INDEX_X]; }"), std::string::npos);
+    EXPECT_EQ(view.find("Real& A(", view.find("Real& A(") + 1), std::string::npos);
+}
+
+TEST(Generate, LoopInvariants)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "total = SUM(i = 1 .. 4, C[i] * X)");
+    parse_declaration(system, "rate = 2 * X");
+    parse_declaration(system, "d/dt C[n] = -rate * total * C[n] + X * n + X * total");
+    parse_declaration(system, "d/dt X = 0");
+
+    // Calls and state reads which don't read n are evaluated once, before the loop
+    std::string list = generate_derivative_list(system, system.state_variables[0]);
+    size_t loop = list.find("for (size_t n");
+    ASSERT_NE(loop, std::string::npos);
+    EXPECT_LT(list.find(" = ((rate(values)) * (total(values)));"), loop);
+    EXPECT_LT(list.find(" = values[INDEX_X];"), loop);
+    EXPECT_EQ(list.find("(values)", loop), std::string::npos);
+    EXPECT_EQ(list.find("values[INDEX_X]", loop), std::string::npos);
+    EXPECT_NE(list.find("* (n)", loop), std::string::npos);
+
+    // The summand's invariant reads leave the summation's loop too
+    std::string summation = generate_summation_definition(system, system.summation_definitions[0]);
+    EXPECT_LT(summation.find(" = values[INDEX_X];"), summation.find("for (size_t i"));
+
+    // Sensitivities differentiate every term in place
+    std::string tangent = generate_derivative_list(system, system.state_variables[0], DerivativeMode::TANGENT);
+    EXPECT_EQ(tangent.find("invariant_"), std::string::npos);
+}
+
+TEST(Generate, DerivativeStages)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "total = SUM(i = 1 .. 4, C[i])");
+    parse_declaration(system, "mean = SUM(i = 1 .. 4, C[i]) / 4");
+    parse_declaration(system, "d/dt C[n] = mean - C[n]");
+    parse_declaration(system, "d/dt C[1] = total");
+    parse_declaration(system, "d/dt X = 1");
+
+    // The two summations share an entry, the functions reading it come a stage later
+    auto intermediates = find_intermediates(system);
+    ASSERT_EQ(intermediates.size(), 3);
+    EXPECT_EQ(intermediates[0].summations.size(), 2);
+    EXPECT_EQ(intermediates[0].stage, 0);
+    EXPECT_EQ(intermediates[2].name, "total");
+    EXPECT_EQ(intermediates[2].stage, 1);
+
+    // Reductions, coefficients, the equations reading them and the override replacing a list entry
+    auto stages = generate_derivative_stages(system);
+    ASSERT_EQ(stages.size(), 4);
+    EXPECT_EQ(stages[0][0], "    intermediates[INTERMEDIATE_" + intermediates[0].name + "] = " + intermediates[0].name + "(values);\n");
+    EXPECT_EQ(stages[0][1], "    derivatives[INDEX_X] = 1;\n");
+    EXPECT_NE(stages[1][0].find("intermediates[INTERMEDIATE_mean] = ((intermediates[INTERMEDIATE_"), std::string::npos);
+    EXPECT_NE(stages[2][0].find("const double invariant_"), std::string::npos);
+    EXPECT_EQ(stages[3][0], "\n    derivatives[INDEX_C_START + (size_t)(1 - 1)] = intermediates[INTERMEDIATE_total];\n");
+    EXPECT_TRUE(system.intermediates.empty());
+
+    // Each block of a stage is a task, the stages wait for each other
+    system.use_parallel = true;
+    auto contents = file_contents(generate_sources(system));
+    EXPECT_NE(contents["system.h"].find("constexpr size_t NUM_INTERMEDIATES = 3;"), std::string::npos);
+    EXPECT_NE(contents["system_derivative.cpp"].find("double intermediates[NUM_INTERMEDIATES];"), std::string::npos);
+    EXPECT_NE(contents["system_derivative.cpp"].find("derivative_chunk_3(values, derivatives, intermediates);\n        #pragma omp taskwait"), std::string::npos);
+    EXPECT_NE(contents["system_derivative_chunk_0.cpp"].find("    #pragma omp task\n    {\n        intermediates["), std::string::npos);
+}
+
+TEST(Generate, JacobianPattern)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "@DIRECT_LINEAR_SOLVER");
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "k = 2");
+    parse_declaration(system, "total = SUM(m = 1 .. 3, C[m])");
+    parse_declaration(system, "d/dt C[n] = k * (C[n + 1] - C[n]) - total");
+    parse_declaration(system, "d/dt C[3] = -C[3]");
+    parse_declaration(system, "d/dt A = k");
+    ASSERT_TRUE(has_jacobian_pattern(system));
+
+    // The override's entry is skipped by its list's loop, and A reads no state at all
+    std::string pattern = generate_jacobian_pattern(system);
+    EXPECT_NE(pattern.find("if (n != (size_t)(3))"), std::string::npos);
+    EXPECT_NE(pattern.find("pattern.add(row, INDEX_C_START + ((((n) + (1))) - 1));"), std::string::npos);
+    EXPECT_NE(pattern.find("total_pattern(row, pattern);"), std::string::npos);
+    EXPECT_NE(pattern.find("row = INDEX_C_START + (size_t)(3 - 1);\n    pattern.add(row, INDEX_C_START + ((3) - 1));"), std::string::npos);
+    EXPECT_EQ(pattern.find("INDEX_A"), std::string::npos);
+    EXPECT_NE(generate_summation_pattern(system, system.summation_definitions[0]).find("pattern.add(row, INDEX_C_START + ((m) - 1));"), std::string::npos);
+
+    system.use_direct_solver = false;
+    EXPECT_FALSE(has_jacobian_pattern(system));
+}
+
+TEST(Coloring, TridiagonalNeedsThreeColors)
+{
+    std::vector<size_t> rows, columns;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        for (size_t j = (i > 0 ? i - 1 : 0); j <= i + 1; ++j)
+        {
+            // The last row reads past the end of the state, that pair is dropped
+            rows.push_back(i);
+            columns.push_back(j);
+        }
+    }
+
+    auto coloring = color_jacobian(10, rows, columns);
+    ASSERT_EQ(coloring.num_colors, 3);
+    EXPECT_EQ(coloring.color_starts, std::vector<size_t>({0, 4, 7, 10}));
+    EXPECT_EQ(coloring.color_columns, std::vector<size_t>({0, 3, 6, 9, 1, 4, 7, 2, 5, 8}));
+    EXPECT_EQ(coloring.row_starts[1] - coloring.row_starts[0], 2);
+    EXPECT_EQ(coloring.row_starts[10] - coloring.row_starts[9], 2);
+
+    // A row reading everything leaves every column its own color
+    for (size_t j = 0; j < 10; ++j)
+    {
+        rows.push_back(0);
+        columns.push_back(j);
+    }
+    EXPECT_EQ(color_jacobian(10, rows, columns).num_colors, 10);
+}
+
+TEST(Model, JacobianTimesMatchesDifferenceQuotients)
+{
+    auto model = compile_model("jacobian_times", NONLINEAR_MODEL);
+    ASSERT_NE(model, nullptr);
+    ASSERT_NE(model->jacobian_times, nullptr);
+
+    size_t size = model->state_size;
+    std::vector<double> values(size), direction(size), product(size), plus(size), minus(size), forward(size), backward(size);
+    model->get_initial_state(values.data());
+    for (size_t i = 0; i < size; ++i)
+    {
+        direction[i] = 1.0 - 0.3 * i;
+    }
+    model->jacobian_times(0.0, values.data(), direction.data(), product.data());
+
+    // Central differences of the plain derivative along the direction
+    double h = 1e-6;
+    for (size_t i = 0; i < size; ++i)
+    {
+        plus[i] = values[i] + h * direction[i];
+        minus[i] = values[i] - h * direction[i];
+    }
+    model->derivative(0.0, plus.data(), forward.data());
+    model->derivative(0.0, minus.data(), backward.data());
+    for (size_t i = 0; i < size; ++i)
+    {
+        EXPECT_NEAR(product[i], (forward[i] - backward[i]) / (2 * h), 1e-7 * (1 + std::fabs(product[i]))) << "entry " << i;
+    }
+}
+
+TEST(Model, ScaledModelMatchesPlainDerivative)
+{
+    auto plain = compile_model("unscaled", NONLINEAR_MODEL);
+    auto scaled = compile_model("scaled", "@SCALE auto\n@SCALE A = 10^3\n" + NONLINEAR_MODEL);
+    ASSERT_NE(plain, nullptr);
+    ASSERT_NE(scaled, nullptr);
+    ASSERT_EQ(plain->state_size, scaled->state_size);
+
+    // Every initial value is nonzero, so the scales can be read off the initial states
+    size_t size = plain->state_size;
+    std::vector<double> values(size), scaled_values(size), scales(size);
+    plain->get_initial_state(values.data());
+    scaled->get_initial_state(scaled_values.data());
+    for (size_t i = 0; i < size; ++i)
+    {
+        scales[i] = values[i] / scaled_values[i];
+    }
+    EXPECT_DOUBLE_EQ(scales[0], 1000.0);
+
+    std::vector<double> derivatives(size), scaled_derivatives(size), direction(size), scaled_direction(size), product(size), scaled_product(size);
+    plain->derivative(0.0, values.data(), derivatives.data());
+    scaled->derivative(0.0, scaled_values.data(), scaled_derivatives.data());
+    for (size_t i = 0; i < size; ++i)
+    {
+        direction[i] = 1.0 + i;
+        scaled_direction[i] = direction[i] / scales[i];
+    }
+    plain->jacobian_times(0.0, values.data(), direction.data(), product.data());
+    scaled->jacobian_times(0.0, scaled_values.data(), scaled_direction.data(), scaled_product.data());
+    for (size_t i = 0; i < size; ++i)
+    {
+        EXPECT_NEAR(scaled_derivatives[i] * scales[i], derivatives[i], 1e-12 * (1 + std::fabs(derivatives[i]))) << "entry " << i;
+        EXPECT_NEAR(scaled_product[i] * scales[i], product[i], 1e-12 * (1 + std::fabs(product[i]))) << "entry " << i;
+    }
+}
+
+TEST(Model, ColoredDifferenceQuotientsMatchPlainDerivative)
+{
+    auto model = compile_model("pattern",
+        "@DIRECT_LINEAR_SOLVER\n"
+        "n = 1 .. 8\n"
+        "k = 2\n"
+        "total = SUM(m = 1 .. 3, C[m])\n"
+        "d/dt C[n] = k * (C[n + 1] - C[n]) * C[n] - total * A\n"
+        "d/dt C[8] = -C[8]\n"
+        "d/dt A = -A * A\n"
+        "INITIAL C[n] = 0.1 * n\n"
+        "INITIAL A = 1.5\n");
+    ASSERT_NE(model, nullptr);
+    auto coloring = color_jacobian(model);
+    size_t size = model->state_size;
+    ASSERT_GT(coloring.num_colors, 0);
+    EXPECT_LT(coloring.num_colors, size);
+
+    std::vector<double> values(size), derivatives(size), perturbed(size), increments(size);
+    model->get_initial_state(values.data());
+    model->derivative(0.0, values.data(), derivatives.data());
+    for (size_t j = 0; j < size; ++j)
+    {
+        increments[j] = 1e-7 * (1 + std::fabs(values[j]));
+    }
+
+    // One column at a time, every entry which changes has to be in the pattern
+    std::vector<std::vector<double>> jacobian(size, std::vector<double>(size));
+    for (size_t j = 0; j < size; ++j)
+    {
+        values[j] += increments[j];
+        model->derivative(0.0, values.data(), perturbed.data());
+        values[j] -= increments[j];
+        for (size_t i = 0; i < size; ++i)
+        {
+            jacobian[i][j] = (perturbed[i] - derivatives[i]) / increments[j];
+            auto begin = coloring.rows.begin() + coloring.row_starts[j], end = coloring.rows.begin() + coloring.row_starts[j + 1];
+            if (jacobian[i][j] != 0)
+                EXPECT_NE(std::find(begin, end, i), end) << "row " << i << ", column " << j;
+        }
+    }
+
+    // The columns of a color perturbed together give the same quotients
+    for (size_t color = 0; color < coloring.num_colors; ++color)
+    {
+        for (size_t k = coloring.color_starts[color]; k < coloring.color_starts[color + 1]; ++k)
+            values[coloring.color_columns[k]] += increments[coloring.color_columns[k]];
+        model->derivative(0.0, values.data(), perturbed.data());
+        for (size_t k = coloring.color_starts[color]; k < coloring.color_starts[color + 1]; ++k)
+        {
+            size_t j = coloring.color_columns[k];
+            values[j] -= increments[j];
+            for (size_t r = coloring.row_starts[j]; r < coloring.row_starts[j + 1]; ++r)
+            {
+                size_t i = coloring.rows[r];
+                EXPECT_DOUBLE_EQ((perturbed[i] - derivatives[i]) / increments[j], jacobian[i][j]) << "row " << i << ", column " << j;
+            }
+        }
+    }
+}
+
+TEST(Model, LayoutsMatchPlainDerivative)
+{
+    std::string source =
+        "n = 1 .. 4\n"
+        "d/dt A[n] = B[n] * A[n] - A[n + 1]\n"
+        "d/dt A[4] = -A[4]\n"
+        "d/dt B[n] = -A[n] * B[n] + n\n"
+        "INITIAL A[n] = n\n"
+        "INITIAL B[n] = 1.0 / n\n";
+    auto plain = compile_model("plain_layout", source);
+    auto interleaved = compile_model("interleaved_layout", "@LAYOUT interleaved A, B\n" + source);
+    ASSERT_NE(plain, nullptr);
+    ASSERT_NE(interleaved, nullptr);
+
+    // The csv columns name the same entries whatever the layout
+    size_t size = plain->state_size;
+    auto plain_order = plain->get_state_csv_order();
+    auto interleaved_order = interleaved->get_state_csv_order();
+    std::vector<double> values(size), interleaved_values(size), derivatives(size), interleaved_derivatives(size);
+    plain->get_initial_state(values.data());
+    interleaved->get_initial_state(interleaved_values.data());
+    plain->derivative(0.0, values.data(), derivatives.data());
+    interleaved->derivative(0.0, interleaved_values.data(), interleaved_derivatives.data());
+    EXPECT_NE(std::vector<size_t>(plain_order, plain_order + size), std::vector<size_t>(interleaved_order, interleaved_order + size));
+    for (size_t k = 0; k < size; ++k)
+    {
+        EXPECT_EQ(interleaved_values[interleaved_order[k]], values[plain_order[k]]) << "column " << k;
+        EXPECT_EQ(interleaved_derivatives[interleaved_order[k]], derivatives[plain_order[k]]) << "column " << k;
+    }
+}
+
+TEST(Bytecode, ListsMatchCompiledIntegerSemantics)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 3");
+    parse_declaration(system, "d/dt C[n] = 3.0 * n + C[n]");
+    parse_declaration(system, "INITIAL C[n] = n / 2");
+
+    Interpreter interpreter(lower_system(system));
+    ASSERT_EQ(interpreter.state_size, 3);
+
+    std::vector<double> values(3), derivatives(3);
+    interpreter.get_initial_state(values.data());
+    EXPECT_EQ(values, std::vector<double>({ 0.0, 1.0, 1.0 }));
+
+    interpreter.derivative(values.data(), derivatives.data());
+    EXPECT_EQ(derivatives, std::vector<double>({ 3.0, 7.0, 10.0 }));
+    EXPECT_EQ(interpreter.get_state_csv_label(), "t (seconds), C[1], C[2], C[3]");
+}
+
+TEST(Bytecode, CsvFollowsLabels)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 2");
+    parse_declaration(system, "m = 1 .. 3");
+    parse_declaration(system, "d/dt T[n, m] = 0");
+    parse_declaration(system, "INITIAL T[n, m] = 10 * n + m");
+
+    // The state has the first index fastest, the labels the last
+    Interpreter interpreter(lower_system(system));
+    std::vector<double> values(6);
+    interpreter.get_initial_state(values.data());
+    EXPECT_EQ(values, std::vector<double>({ 11.0, 21.0, 12.0, 22.0, 13.0, 23.0 }));
+    EXPECT_EQ(interpreter.get_state_csv_label(), "t (seconds), T[1 1], T[1 2], T[1 3], T[2 1], T[2 2], T[2 3]");
+    EXPECT_EQ(interpreter.get_csv_line(values.data()), ", 11, 12, 13, 21, 22, 23");
+}
+
+TEST(Bytecode, FunctionsSummationsAndOverrides)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 4");
+    parse_declaration(system, "RATE = 0.5");
+    parse_declaration(system, "g(x) = RATE * x");
+    parse_declaration(system, "g(2) = 10");
+    parse_declaration(system, "total = SUM(i = 1 .. 4, A[i])");
+    parse_declaration(system, "d/dt X = total");
+    parse_declaration(system, "INITIAL X = 0");
+    parse_declaration(system, "d/dt A[n] = g(n)");
+    parse_declaration(system, "d/dt A[4] = X");
+    parse_declaration(system, "INITIAL A[n] = 1.0");
+
+    Interpreter interpreter(lower_system(system));
+    ASSERT_EQ(interpreter.state_size, 5);
+
+    std::vector<double> values(5), derivatives(5);
+    interpreter.get_initial_state(values.data());
+    values[0] = 7.0;
+    interpreter.derivative(values.data(), derivatives.data());
+
+    // SUM ranges exclude their end, like the compiled summations
+    EXPECT_EQ(derivatives[0], 3.0);
+    EXPECT_EQ(derivatives, std::vector<double>({ 3.0, 0.5, 10.0, 1.5, 7.0 }));
+}
+
+TEST(Bytecode, AbsoluteTolerances)
+{
+    std::vector<std::string> lines = {
+        "@ABSOLUTE_TOLERANCE 10^-3",
+        "@ABSOLUTE_TOLERANCE C[n] = n * 10^-6",
+        "@ABSOLUTE_TOLERANCE C[2] = 1",
+        "n = 1 .. 3",
+        "d/dt C[n] = -n * C[n]",
+        "INITIAL C[n] = 10 * n",
+        "d/dt X = C[1]",
+        "INITIAL X = 0",
+    };
+    SystemDeclarations system;
+    std::string source;
+    for (auto& line : lines)
+    {
+        parse_declaration(system, line);
+        source += line + "\n";
+    }
+
+    // States without their own tolerance keep the global one, list overrides win over the list
+    Interpreter interpreter(lower_system(system));
+    ASSERT_EQ(interpreter.state_size, 4);
+    std::vector<double> tolerances(4);
+    interpreter.get_absolute_tolerances(tolerances.data());
+    EXPECT_DOUBLE_EQ(tolerances[0], 1e-6);
+    EXPECT_DOUBLE_EQ(tolerances[1], 1.0);
+    EXPECT_DOUBLE_EQ(tolerances[2], 3e-6);
+    EXPECT_DOUBLE_EQ(tolerances[3], 1e-3);
+
+    auto model = load_interpreted_model(write_model("interpreted_tolerances", source));
+    ASSERT_NE(model, nullptr);
+    ASSERT_NE(model->get_absolute_tolerances, nullptr);
+    std::vector<double> model_tolerances(4);
+    model->get_absolute_tolerances(model_tolerances.data());
+    EXPECT_EQ(model_tolerances, tolerances);
+}
+
+TEST(Bytecode, StateScales)
+{
+    std::vector<std::string> lines = {
+        "@ABSOLUTE_TOLERANCE 10^-3",
+        "@SCALE auto",
+        "@SCALE X = 10^3",
+        "n = 1 .. 3",
+        "d/dt C[n] = -n * C[n]",
+        "INITIAL C[n] = 10 * n",
+        "d/dt X = C[1]",
+        "INITIAL X = 0",
+    };
+    SystemDeclarations system;
+    std::string source;
+    for (auto& line : lines)
+    {
+        parse_declaration(system, line);
+        source += line + "\n";
+    }
+
+    // A list gets its largest initial value, X starts at 0 but has its own factor
+    Interpreter interpreter(lower_system(system));
+    ASSERT_EQ(interpreter.state_size, 4);
+    std::vector<double> scales(4);
+    interpreter.get_state_scale(scales.data());
+    EXPECT_EQ(scales, std::vector<double>({ 30.0, 30.0, 30.0, 1000.0 }));
+
+    // The model hands the solver the scaled state, tolerances and derivative, and writes the CSV unscaled
+    auto model = load_interpreted_model(write_model("interpreted_scales", source));
+    ASSERT_NE(model, nullptr);
+    ASSERT_NE(model->get_absolute_tolerances, nullptr);
+    std::vector<double> values(4), derivatives(4), tolerances(4);
+    model->get_initial_state(values.data());
+    model->derivative(0.0, values.data(), derivatives.data());
+    model->get_absolute_tolerances(tolerances.data());
+    std::vector<double> unscaled_derivatives = { -10.0, -40.0, -90.0, 10.0 };
+    for (size_t i = 0; i < 4; ++i)
+    {
+        EXPECT_DOUBLE_EQ(derivatives[i] * scales[i], unscaled_derivatives[i]) << "entry " << i;
+        EXPECT_DOUBLE_EQ(tolerances[i] * scales[i], 1e-3) << "entry " << i;
+    }
+    EXPECT_DOUBLE_EQ(values[2], 1.0);
+    EXPECT_EQ(std::string(model->get_csv_line(values.data())), ", 10, 20, 30, 0");
+}
+
+TEST(Bytecode, RecursiveFunctionsAreRefused)
+{
+    SystemDeclarations system;
+    parse_declaration(system, "n = 1 .. 100");
+    parse_declaration(system, "f(1) = 1");
+    parse_declaration(system, "f(n) = 2 * f(n - 1)");
+    parse_declaration(system, "h(x) = f(x) + 1");
+    parse_declaration(system, "d/dt C[n] = h(n) * C[n]");
+
+    // Inlining would never reach a base case, deep or shallow, so the function is reported once instead
+    auto program = lower_system(system);
+    EXPECT_EQ(program.recursive_functions, std::vector<std::string>({ "f" }));
+
+    // A function calling another one is inlined as usual
+    SystemDeclarations plain;
+    parse_declaration(plain, "n = 1 .. 3");
+    parse_declaration(plain, "g(x) = 2 * x");
+    parse_declaration(plain, "h(x) = g(x) + 1");
+    parse_declaration(plain, "d/dt C[n] = h(n) * C[n]");
+    parse_declaration(plain, "INITIAL C[n] = 2");
+    auto lowered = lower_system(plain);
+    EXPECT_TRUE(lowered.recursive_functions.empty());
+
+    Interpreter interpreter(std::move(lowered));
+    ASSERT_EQ(interpreter.state_size, 3);
+    std::vector<double> values(3), derivatives(3);
+    interpreter.get_initial_state(values.data());
+    interpreter.derivative(values.data(), derivatives.data());
+    EXPECT_EQ(derivatives, std::vector<double>({ 6.0, 10.0, 14.0 }));
+}